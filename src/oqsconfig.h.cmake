@@ -126,6 +126,8 @@
 #cmakedefine OQS_ENABLE_LIBJADE_KEM_kyber_768_avx2 1
 ///// OQS_COPY_FROM_LIBJADE_FRAGMENT_ADD_ALG_ENABLE_DEFINES_END
 
+#cmakedefine OQS_ENABLE_SIG_DILITHIUM_SPECULATIVE_SIGNING 1
+
 #cmakedefine OQS_ENABLE_SIG_STFL_XMSS 1
 #cmakedefine OQS_ENABLE_SIG_STFL_xmss_sha256_h10 1
 #cmakedefine OQS_ENABLE_SIG_STFL_xmss_sha256_h16 1
@@ -28,6 +28,12 @@ int crypto_sign_verify(const uint8_t *sig, size_t siglen,
                        const uint8_t *m, size_t mlen,
                        const uint8_t *pk);
 
+#define crypto_sign_verify_batch DILITHIUM_NAMESPACE(verify_batch)
+int crypto_sign_verify_batch(int *results, size_t count,
+                             const uint8_t *const *sigs, const size_t *siglens,
+                             const uint8_t *const *ms, const size_t *mlens,
+                             const uint8_t *pk);
+
 #define crypto_sign_open DILITHIUM_NAMESPACE(open)
 int crypto_sign_open(uint8_t *m, size_t *mlen,
                      const uint8_t *sm, size_t smlen,
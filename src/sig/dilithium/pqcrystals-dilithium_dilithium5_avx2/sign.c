@@ -12,6 +12,15 @@
 #ifdef DILITHIUM_USE_AES
 #include "aes256ctr.h"
 #endif
+#include <oqs/common.h>
+
+#if defined(OQS_ENABLE_SIG_DILITHIUM_SPECULATIVE_SIGNING) && defined(OQS_USE_PTHREADS)
+#include <limits.h>
+#include <pthread.h>
+#include "../sign_lanes.h"
+/* Signing attempts are evaluated on several lanes when cores allow */
+#define SIGN_SPECULATIVE
+#endif
 
 #ifndef DILITHIUM_USE_AES
 static inline void polyvec_matrix_expand_row(polyvecl **row, polyvecl buf[2], const uint8_t rho[SEEDBYTES], unsigned int i) {
@@ -175,28 +184,35 @@ int crypto_sign_keypair(uint8_t *pk, uint8_t *sk) {
   return 0;
 }
 
+/* Signing state shared by all rejection-sampling attempts of one signature. */
+typedef struct {
+  const uint8_t *mu;
+  const uint8_t *rhoprime;
+  const polyvecl *mat;
+  const polyvecl *s1;
+  const polyveck *s2;
+  const polyveck *t0;
+} sign_state;
+
 /*************************************************
-* Name:        crypto_sign_signature
+* Name:        sign_attempt
 *
-* Description: Computes signature.
+* Description: Runs one rejection-sampling attempt of crypto_sign_signature.
 *
 * Arguments:   - uint8_t *sig: pointer to output signature (of length CRYPTO_BYTES)
-*              - size_t *siglen: pointer to output length of signature
-*              - uint8_t *m: pointer to message to be signed
-*              - size_t mlen: length of message
-*              - uint8_t *sk: pointer to bit-packed secret key
+*              - const sign_state *st: pointer to expanded key and message state
+*              - unsigned int attempt: index of the attempt; y uses nonces
+*                                      L*attempt to L*attempt + L - 1
 *
-* Returns 0 (success)
+* Returns 0 if the attempt produced a signature and -1 if it was rejected
 **************************************************/
-int crypto_sign_signature(uint8_t *sig, size_t *siglen, const uint8_t *m, size_t mlen, const uint8_t *sk) {
+static int sign_attempt(uint8_t *sig, const sign_state *st, unsigned int attempt) {
   unsigned int i, n, pos;
-  uint8_t seedbuf[3*SEEDBYTES + 2*CRHBYTES];
-  uint8_t *rho, *tr, *key, *mu, *rhoprime;
   uint8_t hintbuf[N];
   uint8_t *hint = sig + SEEDBYTES + L*POLYZ_PACKEDBYTES;
-  uint64_t nonce = 0;
-  polyvecl mat[K], s1, z;
-  polyveck t0, s2, w1;
+  uint64_t nonce = (uint64_t)L*attempt;
+  polyvecl z;
+  polyveck w1;
   poly c, tmp;
   union {
     polyvecl y;
@@ -204,60 +220,28 @@ int crypto_sign_signature(uint8_t *sig, size_t *siglen, const uint8_t *m, size_t
   } tmpv;
   shake256incctx state;
 
-  rho = seedbuf;
-  tr = rho + SEEDBYTES;
-  key = tr + SEEDBYTES;
-  mu = key + SEEDBYTES;
-  rhoprime = mu + CRHBYTES;
-  unpack_sk(rho, tr, key, &t0, &s1, &s2, sk);
-
-  /* Compute CRH(tr, msg) */
-  shake256_inc_init(&state);
-  shake256_inc_absorb(&state, tr, SEEDBYTES);
-  shake256_inc_absorb(&state, m, mlen);
-  shake256_inc_finalize(&state);
-  shake256_inc_squeeze(mu, CRHBYTES, &state);
-
-#ifdef DILITHIUM_RANDOMIZED_SIGNING
-  randombytes(rhoprime, CRHBYTES);
-#else
-  shake256(rhoprime, CRHBYTES, key, SEEDBYTES + CRHBYTES);
-#endif
-
-  /* Expand matrix and transform vectors */
-  polyvec_matrix_expand(mat, rho);
-  polyvecl_ntt(&s1);
-  polyveck_ntt(&s2);
-  polyveck_ntt(&t0);
-
-#ifdef DILITHIUM_USE_AES
-  aes256ctr_ctx aesctx;
-  aes256ctr_init_u64(&aesctx, rhoprime, 0);
-#endif
-
-rej:
   /* Sample intermediate vector y */
 #ifdef DILITHIUM_USE_AES
+  aes256ctr_ctx aesctx;
+  aes256ctr_init_u64(&aesctx, st->rhoprime, 0);
   for(i = 0; i < L; ++i) {
     aes256ctr_init_iv_u64(&aesctx, nonce);
     nonce++;
     poly_uniform_gamma1_preinit(&z.vec[i], &aesctx);
   }
+  aes256_ctx_release(&aesctx);
 #elif L == 4
   poly_uniform_gamma1_4x(&z.vec[0], &z.vec[1], &z.vec[2], &z.vec[3],
-                         rhoprime, nonce, nonce + 1, nonce + 2, nonce + 3);
-  nonce += 4;
+                         st->rhoprime, nonce, nonce + 1, nonce + 2, nonce + 3);
 #elif L == 5
   poly_uniform_gamma1_4x(&z.vec[0], &z.vec[1], &z.vec[2], &z.vec[3],
-                         rhoprime, nonce, nonce + 1, nonce + 2, nonce + 3);
-  poly_uniform_gamma1(&z.vec[4], rhoprime, nonce + 4);
-  nonce += 5;
+                         st->rhoprime, nonce, nonce + 1, nonce + 2, nonce + 3);
+  poly_uniform_gamma1(&z.vec[4], st->rhoprime, nonce + 4);
 #elif L == 7
   poly_uniform_gamma1_4x(&z.vec[0], &z.vec[1], &z.vec[2], &z.vec[3],
-                         rhoprime, nonce, nonce + 1, nonce + 2, nonce + 3);
+                         st->rhoprime, nonce, nonce + 1, nonce + 2, nonce + 3);
   poly_uniform_gamma1_4x(&z.vec[4], &z.vec[5], &z.vec[6], &tmp,
-                         rhoprime, nonce + 4, nonce + 5, nonce + 6, 0);
-  nonce += 7;
+                         st->rhoprime, nonce + 4, nonce + 5, nonce + 6, 0);
 #else
 #error
 #endif
@@ -265,7 +249,7 @@ rej:
   /* Matrix-vector product */
   tmpv.y = z;
   polyvecl_ntt(&tmpv.y);
-  polyvec_matrix_pointwise_montgomery(&w1, mat, &tmpv.y);
+  polyvec_matrix_pointwise_montgomery(&w1, st->mat, &tmpv.y);
   polyveck_invntt_tomont(&w1);
 
   /* Decompose w and call the random oracle */
@@ -273,22 +257,23 @@ rej:
   polyveck_decompose(&w1, &tmpv.w0, &w1);
   polyveck_pack_w1(sig, &w1);
 
-  shake256_inc_ctx_reset(&state);
-  shake256_inc_absorb(&state, mu, CRHBYTES);
+  shake256_inc_init(&state);
+  shake256_inc_absorb(&state, st->mu, CRHBYTES);
   shake256_inc_absorb(&state, sig, K*POLYW1_PACKEDBYTES);
   shake256_inc_finalize(&state);
   shake256_inc_squeeze(sig, SEEDBYTES, &state);
+  shake256_inc_ctx_release(&state);
   poly_challenge(&c, sig);
   poly_ntt(&c);
 
   /* Compute z, reject if it reveals secret */
   for(i = 0; i < L; i++) {
-    poly_pointwise_montgomery(&tmp, &c, &s1.vec[i]);
+    poly_pointwise_montgomery(&tmp, &c, &st->s1->vec[i]);
     poly_invntt_tomont(&tmp);
     poly_add(&z.vec[i], &z.vec[i], &tmp);
     poly_reduce(&z.vec[i]);
     if(poly_chknorm(&z.vec[i], GAMMA1 - BETA))
-      goto rej;
+      return -1;
   }
 
   /* Zero hint vector in signature */
@@ -298,38 +283,171 @@ rej:
   for(i = 0; i < K; i++) {
     /* Check that subtracting cs2 does not change high bits of w and low bits
      * do not reveal secret information */
-    poly_pointwise_montgomery(&tmp, &c, &s2.vec[i]);
+    poly_pointwise_montgomery(&tmp, &c, &st->s2->vec[i]);
     poly_invntt_tomont(&tmp);
     poly_sub(&tmpv.w0.vec[i], &tmpv.w0.vec[i], &tmp);
     poly_reduce(&tmpv.w0.vec[i]);
     if(poly_chknorm(&tmpv.w0.vec[i], GAMMA2 - BETA))
-      goto rej;
+      return -1;
 
     /* Compute hints */
-    poly_pointwise_montgomery(&tmp, &c, &t0.vec[i]);
+    poly_pointwise_montgomery(&tmp, &c, &st->t0->vec[i]);
     poly_invntt_tomont(&tmp);
     poly_reduce(&tmp);
     if(poly_chknorm(&tmp, GAMMA2))
-      goto rej;
+      return -1;
 
     poly_add(&tmpv.w0.vec[i], &tmpv.w0.vec[i], &tmp);
     n = poly_make_hint(hintbuf, &tmpv.w0.vec[i], &w1.vec[i]);
     if(pos + n > OMEGA)
-      goto rej;
+      return -1;
 
     /* Store hints in signature */
     memcpy(&hint[pos], hintbuf, n);
     hint[OMEGA + i] = pos = pos + n;
   }
 
-#ifdef DILITHIUM_USE_AES
-  aes256_ctx_release(&aesctx);
-#endif
-
-  shake256_inc_ctx_release(&state);
   /* Pack z into signature */
   for(i = 0; i < L; i++)
     polyz_pack(sig + SEEDBYTES + i*POLYZ_PACKEDBYTES, &z.vec[i]);
+  return 0;
+}
+
+#ifdef SIGN_SPECULATIVE
+/* Shared by the lanes of one signature; lane i keeps its accepted attempt in
+ * found[i] and sig[i] */
+typedef struct {
+  const sign_state *st;
+  pthread_mutex_t lock;
+  unsigned int accepted;
+  unsigned int found[OQS_SIG_DILITHIUM_MAX_SIGN_LANES];
+  uint8_t sig[OQS_SIG_DILITHIUM_MAX_SIGN_LANES][CRYPTO_BYTES];
+} sign_lanes;
+
+static void sign_lane_run(void *arg, unsigned int lane, unsigned int lanes)
+{
+  sign_lanes *sl = arg;
+  unsigned int attempt, accepted;
+
+  for(attempt = lane;; attempt += lanes) {
+    /* Attempts above the lowest accepted one can no longer win */
+    pthread_mutex_lock(&sl->lock);
+    accepted = sl->accepted;
+    pthread_mutex_unlock(&sl->lock);
+    if(attempt > accepted)
+      break;
+
+    if(sign_attempt(sl->sig[lane], sl->st, attempt) == 0) {
+      sl->found[lane] = attempt;
+      pthread_mutex_lock(&sl->lock);
+      if(attempt < sl->accepted)
+        sl->accepted = attempt;
+      pthread_mutex_unlock(&sl->lock);
+      break;
+    }
+  }
+}
+
+/*************************************************
+* Name:        sign_speculative
+*
+* Description: Evaluates one attempt per lane at a time on the shared lane
+*              workers and keeps the lowest accepted one. Every attempt below
+*              it has been evaluated and rejected, so the signature is the
+*              one the sequential loop would have produced.
+*
+* Arguments:   - uint8_t *sig:            pointer to output signature (of length CRYPTO_BYTES)
+*              - const sign_state *st:    pointer to expanded key and message state
+*
+* Returns 0 if the signature was written and -1 if there were no lanes to
+* run it on
+**************************************************/
+static int sign_speculative(uint8_t *sig, const sign_state *st)
+{
+  unsigned int i;
+  int ret;
+  sign_lanes sl;
+
+  if(pthread_mutex_init(&sl.lock, NULL) != 0)
+    return -1;
+  sl.st = st;
+  sl.accepted = UINT_MAX;
+  for(i = 0; i < OQS_SIG_DILITHIUM_MAX_SIGN_LANES; i++)
+    sl.found[i] = UINT_MAX;
+
+  ret = oqs_sig_dilithium_run_lanes(sign_lane_run, &sl);
+  pthread_mutex_destroy(&sl.lock);
+  if(ret == 0)
+    for(i = 0; i < OQS_SIG_DILITHIUM_MAX_SIGN_LANES; i++)
+      if(sl.found[i] == sl.accepted)
+        memcpy(sig, sl.sig[i], CRYPTO_BYTES);
+  OQS_MEM_cleanse(sl.sig, sizeof(sl.sig));
+  return ret;
+}
+#endif
+
+/*************************************************
+* Name:        crypto_sign_signature
+*
+* Description: Computes signature.
+*
+* Arguments:   - uint8_t *sig: pointer to output signature (of length CRYPTO_BYTES)
+*              - size_t *siglen: pointer to output length of signature
+*              - uint8_t *m: pointer to message to be signed
+*              - size_t mlen: length of message
+*              - uint8_t *sk: pointer to bit-packed secret key
+*
+* Returns 0 (success)
+**************************************************/
+int crypto_sign_signature(uint8_t *sig, size_t *siglen, const uint8_t *m, size_t mlen, const uint8_t *sk) {
+  uint8_t seedbuf[3*SEEDBYTES + 2*CRHBYTES];
+  uint8_t *rho, *tr, *key, *mu, *rhoprime;
+  polyvecl mat[K], s1;
+  polyveck t0, s2;
+  shake256incctx state;
+  sign_state st;
+  unsigned int attempt = 0;
+
+  rho = seedbuf;
+  tr = rho + SEEDBYTES;
+  key = tr + SEEDBYTES;
+  mu = key + SEEDBYTES;
+  rhoprime = mu + CRHBYTES;
+  unpack_sk(rho, tr, key, &t0, &s1, &s2, sk);
+
+  /* Compute CRH(tr, msg) */
+  shake256_inc_init(&state);
+  shake256_inc_absorb(&state, tr, SEEDBYTES);
+  shake256_inc_absorb(&state, m, mlen);
+  shake256_inc_finalize(&state);
+  shake256_inc_squeeze(mu, CRHBYTES, &state);
+  shake256_inc_ctx_release(&state);
+
+#ifdef DILITHIUM_RANDOMIZED_SIGNING
+  randombytes(rhoprime, CRHBYTES);
+#else
+  shake256(rhoprime, CRHBYTES, key, SEEDBYTES + CRHBYTES);
+#endif
+
+  /* Expand matrix and transform vectors */
+  polyvec_matrix_expand(mat, rho);
+  polyvecl_ntt(&s1);
+  polyveck_ntt(&s2);
+  polyveck_ntt(&t0);
+
+  st.mu = mu;
+  st.rhoprime = rhoprime;
+  st.mat = mat;
+  st.s1 = &s1;
+  st.s2 = &s2;
+  st.t0 = &t0;
+
+#ifdef SIGN_SPECULATIVE
+  /* Without a second lane the attempts run one after another */
+  if(sign_speculative(sig, &st) != 0)
+#endif
+    while(sign_attempt(sig, &st, attempt++))
+      ;
 
   *siglen = CRYPTO_BYTES;
   return 0;
@@ -491,6 +609,157 @@ int crypto_sign_verify(const uint8_t *sig, size_t siglen, const uint8_t *m, size
   return 0;
 }
 
+/* Public-key dependent part of verification, shared by a batch. */
+typedef struct {
+  uint8_t tr[SEEDBYTES];
+  polyvecl mat[K];
+  polyveck t1;
+} verify_key;
+
+/*************************************************
+* Name:        verify_key_init
+*
+* Description: Expands the whole matrix A and computes H(rho, t1) and
+*              NTT(2^d*t1) for a public key. crypto_sign_verify expands A
+*              row by row instead; a batch amortises the full expansion.
+*
+* Arguments:   - verify_key *vk: pointer to output expanded key
+*              - const uint8_t *pk: pointer to bit-packed public key
+**************************************************/
+static void verify_key_init(verify_key *vk, const uint8_t *pk) {
+  uint8_t rho[SEEDBYTES];
+
+  unpack_pk(rho, &vk->t1, pk);
+  shake256(vk->tr, SEEDBYTES, pk, CRYPTO_PUBLICKEYBYTES);
+  polyvec_matrix_expand(vk->mat, rho);
+  polyveck_shiftl(&vk->t1);
+  polyveck_ntt(&vk->t1);
+}
+
+/*************************************************
+* Name:        verify_with_key
+*
+* Description: Verifies signature against an expanded public key.
+*
+* Arguments:   - const uint8_t *sig: pointer to input signature
+*              - size_t siglen: length of signature
+*              - const uint8_t *m: pointer to message
+*              - size_t mlen: length of message
+*              - const verify_key *vk: pointer to expanded public key
+*
+* Returns 0 if signature could be verified correctly and -1 otherwise
+**************************************************/
+static int verify_with_key(const uint8_t *sig, size_t siglen, const uint8_t *m, size_t mlen, const verify_key *vk) {
+  unsigned int i, j, pos = 0;
+  /* polyw1_pack writes additional 14 bytes */
+  ALIGNED_UINT8(K*POLYW1_PACKEDBYTES+14) buf;
+  uint8_t mu[CRHBYTES];
+  const uint8_t *hint = sig + SEEDBYTES + L*POLYZ_PACKEDBYTES;
+  polyvecl z;
+  poly c, w1, h;
+  shake256incctx state;
+
+  if(siglen != CRYPTO_BYTES)
+    return -1;
+
+  /* Compute CRH(H(rho, t1), msg) */
+  shake256_inc_init(&state);
+  shake256_inc_absorb(&state, vk->tr, SEEDBYTES);
+  shake256_inc_absorb(&state, m, mlen);
+  shake256_inc_finalize(&state);
+  shake256_inc_squeeze(mu, CRHBYTES, &state);
+  shake256_inc_ctx_release(&state);
+
+  /* Expand challenge */
+  poly_challenge(&c, sig);
+  poly_ntt(&c);
+
+  /* Unpack z; shortness follows from unpacking */
+  for(i = 0; i < L; i++) {
+    polyz_unpack(&z.vec[i], sig + SEEDBYTES + i*POLYZ_PACKEDBYTES);
+    poly_ntt(&z.vec[i]);
+  }
+
+  for(i = 0; i < K; i++) {
+    /* Compute i-th row of Az - c2^Dt1 */
+    polyvecl_pointwise_acc_montgomery(&w1, &vk->mat[i], &z);
+
+    poly_pointwise_montgomery(&h, &c, &vk->t1.vec[i]);
+
+    poly_sub(&w1, &w1, &h);
+    poly_reduce(&w1);
+    poly_invntt_tomont(&w1);
+
+    /* Get hint polynomial and reconstruct w1 */
+    memset(h.vec, 0, sizeof(poly));
+    if(hint[OMEGA + i] < pos || hint[OMEGA + i] > OMEGA)
+      return -1;
+
+    for(j = pos; j < hint[OMEGA + i]; ++j) {
+      /* Coefficients are ordered for strong unforgeability */
+      if(j > pos && hint[j] <= hint[j-1])
+        return -1;
+      h.coeffs[hint[j]] = 1;
+    }
+    pos = hint[OMEGA + i];
+
+    poly_caddq(&w1);
+    poly_use_hint(&w1, &w1, &h);
+    polyw1_pack(buf.coeffs + i*POLYW1_PACKEDBYTES, &w1);
+  }
+
+  /* Extra indices are zero for strong unforgeability */
+  for(j = pos; j < OMEGA; ++j)
+    if(hint[j]) return -1;
+
+  /* Call random oracle and verify challenge */
+  shake256_inc_init(&state);
+  shake256_inc_absorb(&state, mu, CRHBYTES);
+  shake256_inc_absorb(&state, buf.coeffs, K*POLYW1_PACKEDBYTES);
+  shake256_inc_finalize(&state);
+  shake256_inc_squeeze(buf.coeffs, SEEDBYTES, &state);
+  shake256_inc_ctx_release(&state);
+  for(i = 0; i < SEEDBYTES; ++i)
+    if(buf.coeffs[i] != sig[i])
+      return -1;
+
+  return 0;
+}
+
+/*************************************************
+* Name:        crypto_sign_verify_batch
+*
+* Description: Verifies several signatures under the same public key,
+*              expanding the public key only once.
+*
+* Arguments:   - int *results: output array of count per-signature results,
+*                              0 for a valid signature and -1 otherwise
+*              - size_t count: number of signatures
+*              - const uint8_t *const *sigs: pointers to input signatures
+*              - const size_t *siglens: lengths of signatures
+*              - const uint8_t *const *ms: pointers to messages
+*              - const size_t *mlens: lengths of messages
+*              - const uint8_t *pk: pointer to bit-packed public key
+*
+* Returns 0 if all signatures could be verified correctly and -1 otherwise
+**************************************************/
+int crypto_sign_verify_batch(int *results, size_t count,
+                             const uint8_t *const *sigs, const size_t *siglens,
+                             const uint8_t *const *ms, const size_t *mlens,
+                             const uint8_t *pk) {
+  size_t i;
+  int ret = 0;
+  verify_key vk;
+
+  verify_key_init(&vk, pk);
+  for(i = 0; i < count; i++) {
+    results[i] = verify_with_key(sigs[i], siglens[i], ms[i], mlens[i], &vk);
+    if(results[i])
+      ret = -1;
+  }
+  return ret;
+}
+
 /*************************************************
 * Name:        crypto_sign_open
 *
@@ -7,6 +7,16 @@
 #include "randombytes.h"
 #include "symmetric.h"
 #include "fips202.h"
+#include <oqs/common.h>
+
+#if defined(OQS_ENABLE_SIG_DILITHIUM_SPECULATIVE_SIGNING) && defined(OQS_USE_PTHREADS)
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include "../sign_lanes.h"
+/* Signing attempts are evaluated on several lanes when cores allow */
+#define SIGN_SPECULATIVE
+#endif
 
 /*************************************************
 * Name:        crypto_sign_keypair
@@ -64,68 +74,42 @@ int crypto_sign_keypair(uint8_t *pk, uint8_t *sk) {
   return 0;
 }
 
+/* Signing state shared by all rejection-sampling attempts of one signature. */
+typedef struct {
+  const uint8_t *mu;
+  const uint8_t *rhoprime;
+  const polyvecl *mat;
+  const polyvecl *s1;
+  const polyveck *s2;
+  const polyveck *t0;
+} sign_state;
+
 /*************************************************
-* Name:        crypto_sign_signature
+* Name:        sign_attempt
 *
-* Description: Computes signature.
+* Description: Runs one rejection-sampling attempt of crypto_sign_signature.
 *
-* Arguments:   - uint8_t *sig:   pointer to output signature (of length CRYPTO_BYTES)
-*              - size_t *siglen: pointer to output length of signature
-*              - uint8_t *m:     pointer to message to be signed
-*              - size_t mlen:    length of message
-*              - uint8_t *sk:    pointer to bit-packed secret key
+* Arguments:   - uint8_t *sig:            pointer to output signature (of length CRYPTO_BYTES)
+*              - const sign_state *st:    pointer to expanded key and message state
+*              - unsigned int attempt:    index of the attempt; selects the nonce of y
 *
-* Returns 0 (success)
+* Returns 0 if the attempt produced a signature and -1 if it was rejected
 **************************************************/
-int crypto_sign_signature(uint8_t *sig,
-                          size_t *siglen,
-                          const uint8_t *m,
-                          size_t mlen,
-                          const uint8_t *sk)
+static int sign_attempt(uint8_t *sig, const sign_state *st, unsigned int attempt)
 {
   unsigned int n;
-  uint8_t seedbuf[3*SEEDBYTES + 2*CRHBYTES];
-  uint8_t *rho, *tr, *key, *mu, *rhoprime;
-  uint16_t nonce = 0;
-  polyvecl mat[K], s1, y, z;
-  polyveck t0, s2, w1, w0, h;
+  polyvecl y, z;
+  polyveck w1, w0, h;
   poly cp;
   shake256incctx state;
 
-  rho = seedbuf;
-  tr = rho + SEEDBYTES;
-  key = tr + SEEDBYTES;
-  mu = key + SEEDBYTES;
-  rhoprime = mu + CRHBYTES;
-  unpack_sk(rho, tr, key, &t0, &s1, &s2, sk);
-
-  /* Compute CRH(tr, msg) */
-  shake256_inc_init(&state);
-  shake256_inc_absorb(&state, tr, SEEDBYTES);
-  shake256_inc_absorb(&state, m, mlen);
-  shake256_inc_finalize(&state);
-  shake256_inc_squeeze(mu, CRHBYTES, &state);
-
-#ifdef DILITHIUM_RANDOMIZED_SIGNING
-  randombytes(rhoprime, CRHBYTES);
-#else
-  shake256(rhoprime, CRHBYTES, key, SEEDBYTES + CRHBYTES);
-#endif
-
-  /* Expand matrix and transform vectors */
-  polyvec_matrix_expand(mat, rho);
-  polyvecl_ntt(&s1);
-  polyveck_ntt(&s2);
-  polyveck_ntt(&t0);
-
-rej:
   /* Sample intermediate vector y */
-  polyvecl_uniform_gamma1(&y, rhoprime, nonce++);
+  polyvecl_uniform_gamma1(&y, st->rhoprime, (uint16_t)attempt);
 
   /* Matrix-vector multiplication */
   z = y;
   polyvecl_ntt(&z);
-  polyvec_matrix_pointwise_montgomery(&w1, mat, &z);
+  polyvec_matrix_pointwise_montgomery(&w1, st->mat, &z);
   polyveck_reduce(&w1);
   polyveck_invntt_tomont(&w1);
 
@@ -134,47 +118,190 @@ rej:
   polyveck_decompose(&w1, &w0, &w1);
   polyveck_pack_w1(sig, &w1);
 
-  shake256_inc_ctx_reset(&state);
-  shake256_inc_absorb(&state, mu, CRHBYTES);
+  shake256_inc_init(&state);
+  shake256_inc_absorb(&state, st->mu, CRHBYTES);
   shake256_inc_absorb(&state, sig, K*POLYW1_PACKEDBYTES);
   shake256_inc_finalize(&state);
   shake256_inc_squeeze(sig, SEEDBYTES, &state);
+  shake256_inc_ctx_release(&state);
   poly_challenge(&cp, sig);
   poly_ntt(&cp);
 
   /* Compute z, reject if it reveals secret */
-  polyvecl_pointwise_poly_montgomery(&z, &cp, &s1);
+  polyvecl_pointwise_poly_montgomery(&z, &cp, st->s1);
   polyvecl_invntt_tomont(&z);
   polyvecl_add(&z, &z, &y);
   polyvecl_reduce(&z);
   if(polyvecl_chknorm(&z, GAMMA1 - BETA))
-    goto rej;
+    return -1;
 
   /* Check that subtracting cs2 does not change high bits of w and low bits
    * do not reveal secret information */
-  polyveck_pointwise_poly_montgomery(&h, &cp, &s2);
+  polyveck_pointwise_poly_montgomery(&h, &cp, st->s2);
   polyveck_invntt_tomont(&h);
   polyveck_sub(&w0, &w0, &h);
   polyveck_reduce(&w0);
   if(polyveck_chknorm(&w0, GAMMA2 - BETA))
-    goto rej;
+    return -1;
 
   /* Compute hints for w1 */
-  polyveck_pointwise_poly_montgomery(&h, &cp, &t0);
+  polyveck_pointwise_poly_montgomery(&h, &cp, st->t0);
   polyveck_invntt_tomont(&h);
   polyveck_reduce(&h);
   if(polyveck_chknorm(&h, GAMMA2))
-    goto rej;
+    return -1;
 
   polyveck_add(&w0, &w0, &h);
   n = polyveck_make_hint(&h, &w0, &w1);
   if(n > OMEGA)
-    goto rej;
-
-  shake256_inc_ctx_release(&state);
+    return -1;
 
   /* Write signature */
   pack_sig(sig, sig, &z, &h);
+  return 0;
+}
+
+#ifdef SIGN_SPECULATIVE
+/* Shared by the lanes of one signature; lane i keeps its accepted attempt in
+ * found[i] and sig[i] */
+typedef struct {
+  const sign_state *st;
+  pthread_mutex_t lock;
+  unsigned int accepted;
+  unsigned int found[OQS_SIG_DILITHIUM_MAX_SIGN_LANES];
+  uint8_t sig[OQS_SIG_DILITHIUM_MAX_SIGN_LANES][CRYPTO_BYTES];
+} sign_lanes;
+
+static void sign_lane_run(void *arg, unsigned int lane, unsigned int lanes)
+{
+  sign_lanes *sl = arg;
+  unsigned int attempt, accepted;
+
+  for(attempt = lane;; attempt += lanes) {
+    /* Attempts above the lowest accepted one can no longer win */
+    pthread_mutex_lock(&sl->lock);
+    accepted = sl->accepted;
+    pthread_mutex_unlock(&sl->lock);
+    if(attempt > accepted)
+      break;
+
+    if(sign_attempt(sl->sig[lane], sl->st, attempt) == 0) {
+      sl->found[lane] = attempt;
+      pthread_mutex_lock(&sl->lock);
+      if(attempt < sl->accepted)
+        sl->accepted = attempt;
+      pthread_mutex_unlock(&sl->lock);
+      break;
+    }
+  }
+}
+
+/*************************************************
+* Name:        sign_speculative
+*
+* Description: Evaluates one attempt per lane at a time on the shared lane
+*              workers and keeps the lowest accepted one. Every attempt below
+*              it has been evaluated and rejected, so the signature is the
+*              one the sequential loop would have produced.
+*
+* Arguments:   - uint8_t *sig:            pointer to output signature (of length CRYPTO_BYTES)
+*              - const sign_state *st:    pointer to expanded key and message state
+*
+* Returns 0 if the signature was written and -1 if there were no lanes to
+* run it on
+**************************************************/
+static int sign_speculative(uint8_t *sig, const sign_state *st)
+{
+  unsigned int i;
+  int ret;
+  sign_lanes sl;
+
+  if(pthread_mutex_init(&sl.lock, NULL) != 0)
+    return -1;
+  sl.st = st;
+  sl.accepted = UINT_MAX;
+  for(i = 0; i < OQS_SIG_DILITHIUM_MAX_SIGN_LANES; i++)
+    sl.found[i] = UINT_MAX;
+
+  ret = oqs_sig_dilithium_run_lanes(sign_lane_run, &sl);
+  pthread_mutex_destroy(&sl.lock);
+  if(ret == 0)
+    for(i = 0; i < OQS_SIG_DILITHIUM_MAX_SIGN_LANES; i++)
+      if(sl.found[i] == sl.accepted)
+        memcpy(sig, sl.sig[i], CRYPTO_BYTES);
+  OQS_MEM_cleanse(sl.sig, sizeof(sl.sig));
+  return ret;
+}
+#endif
+
+/*************************************************
+* Name:        crypto_sign_signature
+*
+* Description: Computes signature.
+*
+* Arguments:   - uint8_t *sig:   pointer to output signature (of length CRYPTO_BYTES)
+*              - size_t *siglen: pointer to output length of signature
+*              - uint8_t *m:     pointer to message to be signed
+*              - size_t mlen:    length of message
+*              - uint8_t *sk:    pointer to bit-packed secret key
+*
+* Returns 0 (success)
+**************************************************/
+int crypto_sign_signature(uint8_t *sig,
+                          size_t *siglen,
+                          const uint8_t *m,
+                          size_t mlen,
+                          const uint8_t *sk)
+{
+  uint8_t seedbuf[3*SEEDBYTES + 2*CRHBYTES];
+  uint8_t *rho, *tr, *key, *mu, *rhoprime;
+  polyvecl mat[K], s1;
+  polyveck t0, s2;
+  shake256incctx state;
+  sign_state st;
+  unsigned int attempt = 0;
+
+  rho = seedbuf;
+  tr = rho + SEEDBYTES;
+  key = tr + SEEDBYTES;
+  mu = key + SEEDBYTES;
+  rhoprime = mu + CRHBYTES;
+  unpack_sk(rho, tr, key, &t0, &s1, &s2, sk);
+
+  /* Compute CRH(tr, msg) */
+  shake256_inc_init(&state);
+  shake256_inc_absorb(&state, tr, SEEDBYTES);
+  shake256_inc_absorb(&state, m, mlen);
+  shake256_inc_finalize(&state);
+  shake256_inc_squeeze(mu, CRHBYTES, &state);
+  shake256_inc_ctx_release(&state);
+
+#ifdef DILITHIUM_RANDOMIZED_SIGNING
+  randombytes(rhoprime, CRHBYTES);
+#else
+  shake256(rhoprime, CRHBYTES, key, SEEDBYTES + CRHBYTES);
+#endif
+
+  /* Expand matrix and transform vectors */
+  polyvec_matrix_expand(mat, rho);
+  polyvecl_ntt(&s1);
+  polyveck_ntt(&s2);
+  polyveck_ntt(&t0);
+
+  st.mu = mu;
+  st.rhoprime = rhoprime;
+  st.mat = mat;
+  st.s1 = &s1;
+  st.s2 = &s2;
+  st.t0 = &t0;
+
+#ifdef SIGN_SPECULATIVE
+  /* Without a second lane the attempts run one after another */
+  if(sign_speculative(sig, &st) != 0)
+#endif
+    while(sign_attempt(sig, &st, attempt++))
+      ;
+
   *siglen = CRYPTO_BYTES;
   return 0;
 }
@@ -210,64 +337,85 @@ int crypto_sign(uint8_t *sm,
   return 0;
 }
 
+/* Public-key dependent part of verification, shared by a batch. */
+typedef struct {
+  uint8_t tr[SEEDBYTES];
+  polyvecl mat[K];
+  polyveck t1;
+} verify_key;
+
 /*************************************************
-* Name:        crypto_sign_verify
+* Name:        verify_key_init
 *
-* Description: Verifies signature.
+* Description: Expands the matrix A and computes H(rho, t1) and NTT(2^d*t1)
+*              for a public key.
 *
-* Arguments:   - uint8_t *m: pointer to input signature
+* Arguments:   - verify_key *vk: pointer to output expanded key
+*              - const uint8_t *pk: pointer to bit-packed public key
+**************************************************/
+static void verify_key_init(verify_key *vk, const uint8_t *pk)
+{
+  uint8_t rho[SEEDBYTES];
+
+  unpack_pk(rho, &vk->t1, pk);
+  shake256(vk->tr, SEEDBYTES, pk, CRYPTO_PUBLICKEYBYTES);
+  polyvec_matrix_expand(vk->mat, rho);
+  polyveck_shiftl(&vk->t1);
+  polyveck_ntt(&vk->t1);
+}
+
+/*************************************************
+* Name:        verify_with_key
+*
+* Description: Verifies signature against an expanded public key.
+*
+* Arguments:   - const uint8_t *sig: pointer to input signature
 *              - size_t siglen: length of signature
 *              - const uint8_t *m: pointer to message
 *              - size_t mlen: length of message
-*              - const uint8_t *pk: pointer to bit-packed public key
+*              - const verify_key *vk: pointer to expanded public key
 *
 * Returns 0 if signature could be verified correctly and -1 otherwise
 **************************************************/
-int crypto_sign_verify(const uint8_t *sig,
-                       size_t siglen,
-                       const uint8_t *m,
-                       size_t mlen,
-                       const uint8_t *pk)
+static int verify_with_key(const uint8_t *sig,
+                           size_t siglen,
+                           const uint8_t *m,
+                           size_t mlen,
+                           const verify_key *vk)
 {
   unsigned int i;
   uint8_t buf[K*POLYW1_PACKEDBYTES];
-  uint8_t rho[SEEDBYTES];
   uint8_t mu[CRHBYTES];
   uint8_t c[SEEDBYTES];
   uint8_t c2[SEEDBYTES];
   poly cp;
-  polyvecl mat[K], z;
+  polyvecl z;
   polyveck t1, w1, h;
   shake256incctx state;
 
   if(siglen != CRYPTO_BYTES)
     return -1;
 
-  unpack_pk(rho, &t1, pk);
   if(unpack_sig(c, &z, &h, sig))
     return -1;
   if(polyvecl_chknorm(&z, GAMMA1 - BETA))
     return -1;
 
   /* Compute CRH(H(rho, t1), msg) */
-  shake256(mu, SEEDBYTES, pk, CRYPTO_PUBLICKEYBYTES);
   shake256_inc_init(&state);
-  shake256_inc_absorb(&state, mu, SEEDBYTES);
+  shake256_inc_absorb(&state, vk->tr, SEEDBYTES);
   shake256_inc_absorb(&state, m, mlen);
   shake256_inc_finalize(&state);
   shake256_inc_squeeze(mu, CRHBYTES, &state);
 
   /* Matrix-vector multiplication; compute Az - c2^dt1 */
   poly_challenge(&cp, c);
-  polyvec_matrix_expand(mat, rho);
 
   polyvecl_ntt(&z);
-  polyvec_matrix_pointwise_montgomery(&w1, mat, &z);
+  polyvec_matrix_pointwise_montgomery(&w1, vk->mat, &z);
 
   poly_ntt(&cp);
-  polyveck_shiftl(&t1);
-  polyveck_ntt(&t1);
-  polyveck_pointwise_poly_montgomery(&t1, &cp, &t1);
+  polyveck_pointwise_poly_montgomery(&t1, &cp, &vk->t1);
 
   polyveck_sub(&w1, &w1, &t1);
   polyveck_reduce(&w1);
@@ -292,6 +440,72 @@ int crypto_sign_verify(const uint8_t *sig,
   return 0;
 }
 
+/*************************************************
+* Name:        crypto_sign_verify
+*
+* Description: Verifies signature.
+*
+* Arguments:   - uint8_t *m: pointer to input signature
+*              - size_t siglen: length of signature
+*              - const uint8_t *m: pointer to message
+*              - size_t mlen: length of message
+*              - const uint8_t *pk: pointer to bit-packed public key
+*
+* Returns 0 if signature could be verified correctly and -1 otherwise
+**************************************************/
+int crypto_sign_verify(const uint8_t *sig,
+                       size_t siglen,
+                       const uint8_t *m,
+                       size_t mlen,
+                       const uint8_t *pk)
+{
+  verify_key vk;
+
+  if(siglen != CRYPTO_BYTES)
+    return -1;
+
+  verify_key_init(&vk, pk);
+  return verify_with_key(sig, siglen, m, mlen, &vk);
+}
+
+/*************************************************
+* Name:        crypto_sign_verify_batch
+*
+* Description: Verifies several signatures under the same public key,
+*              expanding the public key only once.
+*
+* Arguments:   - int *results: output array of count per-signature results,
+*                              0 for a valid signature and -1 otherwise
+*              - size_t count: number of signatures
+*              - const uint8_t *const *sigs: pointers to input signatures
+*              - const size_t *siglens: lengths of signatures
+*              - const uint8_t *const *ms: pointers to messages
+*              - const size_t *mlens: lengths of messages
+*              - const uint8_t *pk: pointer to bit-packed public key
+*
+* Returns 0 if all signatures could be verified correctly and -1 otherwise
+**************************************************/
+int crypto_sign_verify_batch(int *results,
+                             size_t count,
+                             const uint8_t *const *sigs,
+                             const size_t *siglens,
+                             const uint8_t *const *ms,
+                             const size_t *mlens,
+                             const uint8_t *pk)
+{
+  size_t i;
+  int ret = 0;
+  verify_key vk;
+
+  verify_key_init(&vk, pk);
+  for(i = 0; i < count; i++) {
+    results[i] = verify_with_key(sigs[i], siglens[i], ms[i], mlens[i], &vk);
+    if(results[i])
+      ret = -1;
+  }
+  return ret;
+}
+
 /*************************************************
 * Name:        crypto_sign_open
 *
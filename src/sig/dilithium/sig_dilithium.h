@@ -16,6 +16,7 @@ OQS_API OQS_STATUS OQS_SIG_dilithium_2_sign(uint8_t *signature, size_t *signatur
 OQS_API OQS_STATUS OQS_SIG_dilithium_2_verify(const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *public_key);
 OQS_API OQS_STATUS OQS_SIG_dilithium_2_sign_with_ctx_str(uint8_t *signature, size_t *signature_len, const uint8_t *message, size_t message_len, const uint8_t *ctx, size_t ctxlen, const uint8_t *secret_key);
 OQS_API OQS_STATUS OQS_SIG_dilithium_2_verify_with_ctx_str(const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *ctx, size_t ctxlen, const uint8_t *public_key);
+OQS_API OQS_STATUS OQS_SIG_dilithium_2_verify_batch(size_t count, const uint8_t *const *messages, const size_t *message_lens, const uint8_t *const *signatures, const size_t *signature_lens, const uint8_t *public_key, OQS_STATUS *results);
 #endif
 
 #if defined(OQS_ENABLE_SIG_dilithium_3)
@@ -29,6 +30,7 @@ OQS_API OQS_STATUS OQS_SIG_dilithium_3_sign(uint8_t *signature, size_t *signatur
 OQS_API OQS_STATUS OQS_SIG_dilithium_3_verify(const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *public_key);
 OQS_API OQS_STATUS OQS_SIG_dilithium_3_sign_with_ctx_str(uint8_t *signature, size_t *signature_len, const uint8_t *message, size_t message_len, const uint8_t *ctx, size_t ctxlen, const uint8_t *secret_key);
 OQS_API OQS_STATUS OQS_SIG_dilithium_3_verify_with_ctx_str(const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *ctx, size_t ctxlen, const uint8_t *public_key);
+OQS_API OQS_STATUS OQS_SIG_dilithium_3_verify_batch(size_t count, const uint8_t *const *messages, const size_t *message_lens, const uint8_t *const *signatures, const size_t *signature_lens, const uint8_t *public_key, OQS_STATUS *results);
 #endif
 
 #if defined(OQS_ENABLE_SIG_dilithium_5)
@@ -42,6 +44,15 @@ OQS_API OQS_STATUS OQS_SIG_dilithium_5_sign(uint8_t *signature, size_t *signatur
 OQS_API OQS_STATUS OQS_SIG_dilithium_5_verify(const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *public_key);
 OQS_API OQS_STATUS OQS_SIG_dilithium_5_sign_with_ctx_str(uint8_t *signature, size_t *signature_len, const uint8_t *message, size_t message_len, const uint8_t *ctx, size_t ctxlen, const uint8_t *secret_key);
 OQS_API OQS_STATUS OQS_SIG_dilithium_5_verify_with_ctx_str(const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *ctx, size_t ctxlen, const uint8_t *public_key);
+OQS_API OQS_STATUS OQS_SIG_dilithium_5_verify_batch(size_t count, const uint8_t *const *messages, const size_t *message_lens, const uint8_t *const *signatures, const size_t *signature_lens, const uint8_t *public_key, OQS_STATUS *results);
+#endif
+
+#if defined(OQS_ENABLE_SIG_DILITHIUM_SPECULATIVE_SIGNING) && defined(OQS_USE_PTHREADS)
+/* Lanes used by speculative signing: 0 (the default) picks one per online core,
+ * at most 4, and 1 signs sequentially. */
+OQS_API void OQS_SIG_dilithium_set_sign_lanes(unsigned int lanes);
+/* Lanes the next signature would use; 1 means the sequential loop. */
+OQS_API unsigned int OQS_SIG_dilithium_sign_lanes(void);
 #endif
 
 #endif
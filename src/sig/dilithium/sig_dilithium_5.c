@@ -27,6 +27,7 @@ OQS_SIG *OQS_SIG_dilithium_5_new(void) {
 	sig->verify = OQS_SIG_dilithium_5_verify;
 	sig->sign_with_ctx_str = OQS_SIG_dilithium_5_sign_with_ctx_str;
 	sig->verify_with_ctx_str = OQS_SIG_dilithium_5_verify_with_ctx_str;
+	sig->verify_batch = OQS_SIG_dilithium_5_verify_batch;
 
 	return sig;
 }
@@ -34,11 +35,13 @@ OQS_SIG *OQS_SIG_dilithium_5_new(void) {
 extern int pqcrystals_dilithium5_ref_keypair(uint8_t *pk, uint8_t *sk);
 extern int pqcrystals_dilithium5_ref_signature(uint8_t *sig, size_t *siglen, const uint8_t *m, size_t mlen, const uint8_t *sk);
 extern int pqcrystals_dilithium5_ref_verify(const uint8_t *sig, size_t siglen, const uint8_t *m, size_t mlen, const uint8_t *pk);
+extern int pqcrystals_dilithium5_ref_verify_batch(int *results, size_t count, const uint8_t *const *sigs, const size_t *siglens, const uint8_t *const *ms, const size_t *mlens, const uint8_t *pk);
 
 #if defined(OQS_ENABLE_SIG_dilithium_5_avx2)
 extern int pqcrystals_dilithium5_avx2_keypair(uint8_t *pk, uint8_t *sk);
 extern int pqcrystals_dilithium5_avx2_signature(uint8_t *sig, size_t *siglen, const uint8_t *m, size_t mlen, const uint8_t *sk);
 extern int pqcrystals_dilithium5_avx2_verify(const uint8_t *sig, size_t siglen, const uint8_t *m, size_t mlen, const uint8_t *pk);
+extern int pqcrystals_dilithium5_avx2_verify_batch(int *results, size_t count, const uint8_t *const *sigs, const size_t *siglens, const uint8_t *const *ms, const size_t *mlens, const uint8_t *pk);
 #endif
 
 #if defined(OQS_ENABLE_SIG_dilithium_5_aarch64)
@@ -125,6 +128,49 @@ OQS_API OQS_STATUS OQS_SIG_dilithium_5_verify(const uint8_t *message, size_t mes
 #endif
 }
 
+OQS_API OQS_STATUS OQS_SIG_dilithium_5_verify_batch(size_t count, const uint8_t *const *messages, const size_t *message_lens, const uint8_t *const *signatures, const size_t *signature_lens, const uint8_t *public_key, OQS_STATUS *results) {
+	OQS_STATUS ret = OQS_SUCCESS;
+	int *status = NULL;
+	size_t i;
+
+#if !defined(OQS_ENABLE_SIG_dilithium_5_aarch64)
+	status = OQS_MEM_malloc(count * sizeof(int));
+#endif
+	if (status == NULL) {
+		/* No batch entry point (aarch64) or no memory for one: verify one at a time. */
+		for (i = 0; i < count; i++) {
+			results[i] = OQS_SIG_dilithium_5_verify(messages[i], message_lens[i], signatures[i], signature_lens[i], public_key);
+			if (results[i] != OQS_SUCCESS) {
+				ret = OQS_ERROR;
+			}
+		}
+		return ret;
+	}
+
+#if defined(OQS_ENABLE_SIG_dilithium_5_avx2)
+#if defined(OQS_DIST_BUILD)
+	if (OQS_CPU_has_extension(OQS_CPU_EXT_AVX2) && OQS_CPU_has_extension(OQS_CPU_EXT_POPCNT)) {
+#endif /* OQS_DIST_BUILD */
+		pqcrystals_dilithium5_avx2_verify_batch(status, count, signatures, signature_lens, messages, message_lens, public_key);
+#if defined(OQS_DIST_BUILD)
+	} else {
+		pqcrystals_dilithium5_ref_verify_batch(status, count, signatures, signature_lens, messages, message_lens, public_key);
+	}
+#endif /* OQS_DIST_BUILD */
+#else
+	pqcrystals_dilithium5_ref_verify_batch(status, count, signatures, signature_lens, messages, message_lens, public_key);
+#endif
+
+	for (i = 0; i < count; i++) {
+		results[i] = (OQS_STATUS) status[i];
+		if (results[i] != OQS_SUCCESS) {
+			ret = OQS_ERROR;
+		}
+	}
+	OQS_MEM_insecure_free(status);
+	return ret;
+}
+
 OQS_API OQS_STATUS OQS_SIG_dilithium_5_sign_with_ctx_str(uint8_t *signature, size_t *signature_len, const uint8_t *message, size_t message_len, const uint8_t *ctx_str, size_t ctx_str_len, const uint8_t *secret_key) {
 	if (ctx_str == NULL && ctx_str_len == 0) {
 		return OQS_SIG_dilithium_5_sign(signature, signature_len, message, message_len, secret_key);
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <oqs/sig_dilithium.h>
+
+#include "sign_lanes.h"
+
+/* The lane workers are started on first use and then wait for work for the
+ * rest of the process, so a signature only pays for a wake-up and not for
+ * creating and joining threads. Lane 0 runs on the signing thread. */
+static pthread_mutex_t lanes_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lanes_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t lanes_done = PTHREAD_COND_INITIALIZER;
+static unsigned int lanes_requested; /* 0: one lane per online core */
+static long lanes_online;            /* online cores, looked up once */
+static unsigned int lanes_workers;   /* workers running lanes 1 .. lanes_workers */
+static int lanes_busy;               /* a signature holds the workers */
+static unsigned long lanes_job;      /* bumped for every signature */
+static unsigned long lanes_seen[OQS_SIG_DILITHIUM_MAX_SIGN_LANES];
+static unsigned int lanes_pending;   /* workers still running the current job */
+static oqs_sig_dilithium_lane_fn job_fn;
+static void *job_arg;
+static unsigned int job_lanes;
+
+static void *lane_worker(void *arg) {
+	unsigned int lane = (unsigned int)(uintptr_t)arg;
+	oqs_sig_dilithium_lane_fn fn;
+	void *fn_arg;
+	unsigned int lanes;
+
+	pthread_mutex_lock(&lanes_lock);
+	for (;;) {
+		while (lanes_seen[lane] == lanes_job) {
+			pthread_cond_wait(&lanes_start, &lanes_lock);
+		}
+		lanes_seen[lane] = lanes_job;
+		if (lane >= job_lanes) {
+			continue;
+		}
+		fn = job_fn;
+		fn_arg = job_arg;
+		lanes = job_lanes;
+		pthread_mutex_unlock(&lanes_lock);
+		fn(fn_arg, lane, lanes);
+		pthread_mutex_lock(&lanes_lock);
+		if (--lanes_pending == 0) {
+			pthread_cond_signal(&lanes_done);
+		}
+	}
+	return NULL;
+}
+
+/* Lanes a signature would use now; called with lanes_lock held */
+static unsigned int lanes_wanted(void) {
+	if (lanes_requested != 0) {
+		return lanes_requested;
+	}
+	if (lanes_online == 0) {
+		lanes_online = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (lanes_online < 2) {
+		return 1;
+	}
+	return lanes_online < OQS_SIG_DILITHIUM_MAX_SIGN_LANES ? (unsigned int)lanes_online : OQS_SIG_DILITHIUM_MAX_SIGN_LANES;
+}
+
+int oqs_sig_dilithium_run_lanes(oqs_sig_dilithium_lane_fn fn, void *arg) {
+	unsigned int lanes;
+	pthread_t thread;
+
+	pthread_mutex_lock(&lanes_lock);
+	lanes = lanes_wanted();
+	if (lanes < 2 || lanes_busy) {
+		pthread_mutex_unlock(&lanes_lock);
+		return -1;
+	}
+	while (lanes_workers + 1 < lanes) {
+		lanes_seen[lanes_workers + 1] = lanes_job;
+		if (pthread_create(&thread, NULL, lane_worker, (void *)(uintptr_t)(lanes_workers + 1)) != 0) {
+			break;
+		}
+		pthread_detach(thread);
+		lanes_workers++;
+	}
+	if (lanes > lanes_workers + 1) {
+		lanes = lanes_workers + 1;
+	}
+	if (lanes < 2) {
+		pthread_mutex_unlock(&lanes_lock);
+		return -1;
+	}
+
+	lanes_busy = 1;
+	job_fn = fn;
+	job_arg = arg;
+	job_lanes = lanes;
+	lanes_pending = lanes - 1;
+	lanes_job++;
+	pthread_cond_broadcast(&lanes_start);
+	pthread_mutex_unlock(&lanes_lock);
+
+	fn(arg, 0, lanes);
+
+	pthread_mutex_lock(&lanes_lock);
+	while (lanes_pending > 0) {
+		pthread_cond_wait(&lanes_done, &lanes_lock);
+	}
+	lanes_busy = 0;
+	pthread_mutex_unlock(&lanes_lock);
+	return 0;
+}
+
+OQS_API void OQS_SIG_dilithium_set_sign_lanes(unsigned int lanes) {
+	pthread_mutex_lock(&lanes_lock);
+	lanes_requested = lanes < OQS_SIG_DILITHIUM_MAX_SIGN_LANES ? lanes : OQS_SIG_DILITHIUM_MAX_SIGN_LANES;
+	pthread_mutex_unlock(&lanes_lock);
+}
+
+OQS_API unsigned int OQS_SIG_dilithium_sign_lanes(void) {
+	unsigned int lanes;
+
+	pthread_mutex_lock(&lanes_lock);
+	lanes = lanes_wanted();
+	pthread_mutex_unlock(&lanes_lock);
+	return lanes;
+}
@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef OQS_SIG_DILITHIUM_SIGN_LANES_H
+#define OQS_SIG_DILITHIUM_SIGN_LANES_H
+
+/* Upper bound on the number of signing attempts evaluated concurrently */
+#define OQS_SIG_DILITHIUM_MAX_SIGN_LANES 4
+
+/* Runs one lane of a signature; lane i of n runs attempts i, i + n, ... */
+typedef void (*oqs_sig_dilithium_lane_fn)(void *arg, unsigned int lane, unsigned int lanes);
+
+/* Runs fn on every lane, lane 0 on the calling thread and the others on the
+ * shared lane workers, and returns 0 once all of them are done. Returns -1
+ * without running fn when fewer than two lanes are available, i.e. a single
+ * online core or another signature already holding the workers; the caller
+ * then signs with the sequential loop. */
+int oqs_sig_dilithium_run_lanes(oqs_sig_dilithium_lane_fn fn, void *arg);
+
+#endif
@@ -2,8 +2,8 @@
 
 #include <assert.h>
 #include <stdlib.h>
-#if defined(_WIN32)
 #include <string.h>
+#if defined(_WIN32)
 #define strcasecmp _stricmp
 #else
 #include <strings.h>
@@ -11,6 +11,11 @@
 
 #include <oqs/oqs.h>
 
+#if defined(OQS_USE_PTHREADS)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 OQS_API const char *OQS_SIG_alg_identifier(size_t i) {
 	// EDIT-WHEN-ADDING-SIG
 	const char *a[OQS_SIG_algs_length] = {
@@ -142,6 +147,217 @@ OQS_API OQS_STATUS OQS_SIG_verify_with_ctx_str(const OQS_SIG *sig, const uint8_t
 	}
 }
 
+/* One signature of a verify_batch call, ordered by public key. */
+typedef struct {
+	const uint8_t *public_key;
+	size_t public_key_len;
+	uint64_t prefix;
+	size_t index;
+} verify_batch_entry;
+
+/* A run of signatures under one public key, verified by one thread. */
+typedef struct {
+	size_t begin;
+	size_t end;
+} verify_batch_unit;
+
+typedef struct {
+	const OQS_SIG *sig;
+	const verify_batch_entry *entries;
+	const uint8_t **messages;
+	size_t *message_lens;
+	const uint8_t **signatures;
+	size_t *signature_lens;
+	OQS_STATUS *results;
+	const verify_batch_unit *units;
+	size_t num_units;
+	size_t next_unit;
+#if defined(OQS_USE_PTHREADS)
+	pthread_mutex_t lock;
+#endif
+} verify_batch_state;
+
+static int verify_batch_entry_cmp(const void *a, const void *b) {
+	const verify_batch_entry *x = a;
+	const verify_batch_entry *y = b;
+	int c;
+
+	if (x->prefix != y->prefix) {
+		return x->prefix < y->prefix ? -1 : 1;
+	}
+	if (x->public_key != y->public_key) {
+		c = memcmp(x->public_key, y->public_key, x->public_key_len);
+		if (c != 0) {
+			return c;
+		}
+	}
+	return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+static void verify_batch_run_unit(verify_batch_state *state, const verify_batch_unit *unit) {
+	const OQS_SIG *sig = state->sig;
+	const uint8_t *public_key = state->entries[unit->begin].public_key;
+	size_t i;
+
+	if (sig->verify_batch != NULL) {
+		sig->verify_batch(unit->end - unit->begin, state->messages + unit->begin, state->message_lens + unit->begin,
+		                  state->signatures + unit->begin, state->signature_lens + unit->begin, public_key,
+		                  state->results + unit->begin);
+		return;
+	}
+	for (i = unit->begin; i < unit->end; i++) {
+		state->results[i] = sig->verify(state->messages[i], state->message_lens[i], state->signatures[i],
+		                                state->signature_lens[i], public_key);
+	}
+}
+
+static void *verify_batch_worker(void *arg) {
+	verify_batch_state *state = arg;
+	size_t unit;
+
+	for (;;) {
+#if defined(OQS_USE_PTHREADS)
+		pthread_mutex_lock(&state->lock);
+#endif
+		unit = state->next_unit++;
+#if defined(OQS_USE_PTHREADS)
+		pthread_mutex_unlock(&state->lock);
+#endif
+		if (unit >= state->num_units) {
+			return NULL;
+		}
+		verify_batch_run_unit(state, &state->units[unit]);
+	}
+}
+
+OQS_API OQS_STATUS OQS_SIG_verify_batch(const OQS_SIG *sig, size_t count,
+                                        const uint8_t *const *messages, const size_t *message_lens,
+                                        const uint8_t *const *signatures, const size_t *signature_lens,
+                                        const uint8_t *const *public_keys, OQS_STATUS *results, size_t num_threads) {
+	OQS_STATUS ret = OQS_SUCCESS;
+	verify_batch_state state;
+	verify_batch_entry *entries = NULL;
+	verify_batch_unit *units = NULL;
+	size_t i, j, max_unit, num_units = 0;
+
+	if (sig == NULL || sig->verify == NULL || results == NULL ||
+	        (count > 0 && (messages == NULL || message_lens == NULL || signatures == NULL ||
+	                       signature_lens == NULL || public_keys == NULL))) {
+		return OQS_ERROR;
+	}
+	if (count == 0) {
+		return OQS_SUCCESS;
+	}
+
+#if defined(OQS_USE_PTHREADS)
+	if (num_threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = online > 0 ? (size_t)online : 1;
+	}
+#else
+	num_threads = 1;
+#endif
+	if (num_threads > count) {
+		num_threads = count;
+	}
+
+	memset(&state, 0, sizeof(state));
+	entries = OQS_MEM_malloc(count * sizeof(verify_batch_entry));
+	units = OQS_MEM_malloc(count * sizeof(verify_batch_unit));
+	state.messages = OQS_MEM_malloc(count * sizeof(uint8_t *));
+	state.message_lens = OQS_MEM_malloc(count * sizeof(size_t));
+	state.signatures = OQS_MEM_malloc(count * sizeof(uint8_t *));
+	state.signature_lens = OQS_MEM_malloc(count * sizeof(size_t));
+	state.results = OQS_MEM_malloc(count * sizeof(OQS_STATUS));
+	if (entries == NULL || units == NULL || state.messages == NULL || state.message_lens == NULL ||
+	        state.signatures == NULL || state.signature_lens == NULL || state.results == NULL) {
+		ret = OQS_ERROR;
+		goto cleanup;
+	}
+
+	/* Group the signatures by public key so that each key is expanded once per unit. */
+	for (i = 0; i < count; i++) {
+		entries[i].public_key = public_keys[i];
+		entries[i].public_key_len = sig->length_public_key;
+		entries[i].prefix = 0;
+		for (j = 0; j < sizeof(uint64_t) && j < sig->length_public_key; j++) {
+			entries[i].prefix = (entries[i].prefix << 8) | public_keys[i][j];
+		}
+		entries[i].index = i;
+	}
+	qsort(entries, count, sizeof(verify_batch_entry), verify_batch_entry_cmp);
+	for (i = 0; i < count; i++) {
+		state.messages[i] = messages[entries[i].index];
+		state.message_lens[i] = message_lens[entries[i].index];
+		state.signatures[i] = signatures[entries[i].index];
+		state.signature_lens[i] = signature_lens[entries[i].index];
+	}
+
+	/* Split large groups so that a batch under a single key still spreads across the threads. */
+	max_unit = (count + 4 * num_threads - 1) / (4 * num_threads);
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count && j - i < max_unit; j++) {
+			if (entries[j].public_key != entries[i].public_key &&
+			        memcmp(entries[j].public_key, entries[i].public_key, sig->length_public_key) != 0) {
+				break;
+			}
+		}
+		units[num_units].begin = i;
+		units[num_units].end = j;
+		num_units++;
+	}
+
+	state.sig = sig;
+	state.entries = entries;
+	state.units = units;
+	state.num_units = num_units;
+	state.next_unit = 0;
+
+#if defined(OQS_USE_PTHREADS)
+	pthread_t *threads = OQS_MEM_malloc(num_threads * sizeof(pthread_t));
+	bool *started = OQS_MEM_calloc(num_threads, sizeof(bool));
+	if (threads == NULL || started == NULL || pthread_mutex_init(&state.lock, NULL) != 0) {
+		OQS_MEM_insecure_free(threads);
+		OQS_MEM_insecure_free(started);
+		ret = OQS_ERROR;
+		goto cleanup;
+	}
+	/* The calling thread works through the units alongside the pool; if no
+	 * thread can be started it simply does all of them. */
+	for (i = 1; i < num_threads; i++) {
+		started[i] = pthread_create(&threads[i], NULL, verify_batch_worker, &state) == 0;
+	}
+	verify_batch_worker(&state);
+	for (i = 1; i < num_threads; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+	pthread_mutex_destroy(&state.lock);
+	OQS_MEM_insecure_free(threads);
+	OQS_MEM_insecure_free(started);
+#else
+	verify_batch_worker(&state);
+#endif
+
+	for (i = 0; i < count; i++) {
+		results[entries[i].index] = state.results[i];
+		if (state.results[i] != OQS_SUCCESS) {
+			ret = OQS_ERROR;
+		}
+	}
+
+cleanup:
+	OQS_MEM_insecure_free(entries);
+	OQS_MEM_insecure_free(units);
+	OQS_MEM_insecure_free(state.messages);
+	OQS_MEM_insecure_free(state.message_lens);
+	OQS_MEM_insecure_free(state.signatures);
+	OQS_MEM_insecure_free(state.signature_lens);
+	OQS_MEM_insecure_free(state.results);
+	return ret;
+}
+
 OQS_API void OQS_SIG_free(OQS_SIG *sig) {
 	OQS_MEM_insecure_free(sig);
 }
@@ -180,6 +180,23 @@ extern "C" {
 		 */
 		OQS_STATUS(*verify_with_ctx_str)(const uint8_t* message, size_t message_len, const uint8_t* signature, size_t signature_len, const uint8_t* ctx_str, size_t ctx_str_len, const uint8_t* public_key);
 
+		/**
+		 * Verification of several signatures under one public key.
+		 *
+		 * Optional: `NULL` if the scheme has nothing to share between signatures, in which
+		 * case OQS_SIG_verify_batch calls `verify` once per signature.
+		 *
+		 * @param[in] count The number of signatures.
+		 * @param[in] messages The messages, one per signature.
+		 * @param[in] message_lens The lengths of the messages.
+		 * @param[in] signatures The signatures.
+		 * @param[in] signature_lens The lengths of the signatures.
+		 * @param[in] public_key The public key all signatures are verified against.
+		 * @param[out] results OQS_SUCCESS or OQS_ERROR for each signature.
+		 * @return OQS_SUCCESS if every signature verified, OQS_ERROR otherwise
+		 */
+		OQS_STATUS(*verify_batch)(size_t count, const uint8_t* const* messages, const size_t* message_lens, const uint8_t* const* signatures, const size_t* signature_lens, const uint8_t* public_key, OQS_STATUS* results);
+
 
 	} OQS_SIG;
 
@@ -272,6 +289,26 @@ extern "C" {
 	 */
 	OQS_API OQS_STATUS OQS_SIG_verify_with_ctx_str(const OQS_SIG* sig, const uint8_t* message, size_t message_len, const uint8_t* signature, size_t signature_len, const uint8_t* ctx_str, size_t ctx_str_len, const uint8_t* public_key);
 
+	/**
+	 * Verifies many signatures, each under its own public key, across `num_threads` threads.
+	 *
+	 * Signatures are grouped by public key so that a key shared by several signatures is
+	 * only expanded once per group (see the `verify_batch` member). One result is written
+	 * per signature, in the order of the inputs.
+	 *
+	 * @param[in] sig The OQS_SIG object representing the signature scheme.
+	 * @param[in] count The number of signatures.
+	 * @param[in] messages The messages, one per signature.
+	 * @param[in] message_lens The lengths of the messages.
+	 * @param[in] signatures The signatures.
+	 * @param[in] signature_lens The lengths of the signatures.
+	 * @param[in] public_keys The public key of each signature.
+	 * @param[out] results OQS_SUCCESS or OQS_ERROR for each signature.
+	 * @param[in] num_threads The number of threads to use; 0 uses one per online CPU. Ignored without pthreads.
+	 * @return OQS_SUCCESS if every signature verified, OQS_ERROR otherwise or if the batch could not be run
+	 */
+	OQS_API OQS_STATUS OQS_SIG_verify_batch(const OQS_SIG* sig, size_t count, const uint8_t* const* messages, const size_t* message_lens, const uint8_t* const* signatures, const size_t* signature_lens, const uint8_t* const* public_keys, OQS_STATUS* results, size_t num_threads);
+
 	/**
 	 * Frees an OQS_SIG object that was constructed by OQS_SIG_new.
 	 *
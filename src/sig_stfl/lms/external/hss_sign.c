@@ -594,12 +594,12 @@ bool hss_generate_signature(
     unsigned merkle_levels_below = 0;
     int switch_merkle = w->levels;
     struct merkle_level *tree;
-    for (i = w->levels-1; i>=1; i--, merkle_levels_below += tree->level) {
+    for (i = w->levels; i-- > 0; merkle_levels_below += tree->level) {
         tree = w->tree[i];
 
         if (0 == (cur_count & (((sequence_t)1 << (merkle_levels_below + tree->level))-1))) {
             /* We exhausted this tree */
-            if ((i-1) == 0) {
+            if (i == 0) {
                 /* We've run out of signatures; we've already caught this */
                 /* above; just make *sure* we've marked the key as */
                 /* unusable, and give up */
@@ -645,7 +645,7 @@ done_advancing:
         unsigned j;
 
         /* Rearrange the subtrees */
-        for (j=0; j<tree->sublevels; j++) {
+        for (j=0; j<tree_l->sublevels; j++) {
             /* Make the NEXT_TREE active; replace it with the current active */
             struct subtree *active = tree_l->subtree[j][NEXT_TREE];
             struct subtree *next = tree_l->subtree[j][ACTIVE_TREE];
@@ -661,28 +661,28 @@ done_advancing:
             next->stack = stack;
             if (j > 0) {
                 /* Also reset the building tree */
-                struct subtree *building = tree->subtree[j][BUILDING_TREE];
+                struct subtree *building = tree_l->subtree[j][BUILDING_TREE];
                 building->current_index = 0;
                 merkle_index_t size_subtree = (merkle_index_t)1 <<
-                                (tree->subtree_size + building->levels_below);
+                                (tree_l->subtree_size + building->levels_below);
                 building->left_leaf = size_subtree;
             }
         }
 
         /* Copy in the value of seed, I we'll use for the new tree */
-        memcpy( tree_l->seed, tree->seed_next, SEED_LEN );
-        memcpy( tree_l->I, tree->I_next, I_LEN );
+        memcpy( tree_l->seed, tree_l->seed_next, SEED_LEN );
+        memcpy( tree_l->I, tree_l->I_next, I_LEN );
 
         /* Compute the new next I, which is derived from either the parent's */
         /* I or the parent's I_next value */
         merkle_index_t index = parent->current_index;
         if (index == parent->max_index) {
-            hss_generate_child_seed_I_value(tree->seed_next, tree->I_next,
+            hss_generate_child_seed_I_value(tree_l->seed_next, tree_l->I_next,
                                        parent->seed_next, parent->I_next, 0,
                                        parent->lm_type,
                                        parent->lm_ots_type);
         } else {
-            hss_generate_child_seed_I_value( tree->seed_next, tree->I_next,
+            hss_generate_child_seed_I_value( tree_l->seed_next, tree_l->I_next,
                                        parent->seed, parent->I, index+1,
                                        parent->lm_type,
                                        parent->lm_ots_type);
@@ -62,7 +62,9 @@ static void OQS_SECRET_KEY_LMS_set_store_cb(OQS_SIG_STFL_SECRET_KEY *sk, secure_
         sig->sigs_remaining = OQS_SIG_STFL_lms_sigs_left; \
         sig->sigs_total = OQS_SIG_STFL_lms_sigs_total; \
         sig->keypair = OQS_SIG_STFL_alg_lms_##lms_variant##_keypair; \
-        sig->sign = OQS_SIG_STFL_alg_lms_sign;
+        sig->sign = OQS_SIG_STFL_alg_lms_sign; \
+        sig->sign_init = OQS_SIG_STFL_alg_lms_sign_init; \
+        sig->verify_init = OQS_SIG_STFL_alg_lms_verify_init;
 #else
 #define LMS_SIGGEN(lms_variant, LMS_VARIANT)
 #endif
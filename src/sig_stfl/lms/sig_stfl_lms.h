@@ -334,6 +334,10 @@ OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_sign(uint8_t *signature, size_t *signatu
 
 OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_verify(const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *public_key);
 
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_sign_init(OQS_SIG_STFL_INC_CTX *ctx, OQS_SIG_STFL_SECRET_KEY *secret_key);
+
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_verify_init(OQS_SIG_STFL_INC_CTX *ctx);
+
 // --------------------------------------------------------------------------------------------------------
 
 #endif /* OQS_SIG_STFL_LMS_H */
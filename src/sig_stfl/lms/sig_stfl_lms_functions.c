@@ -9,6 +9,8 @@
 #include "external/hss.h"
 #include "external/endian.h"
 #include "external/hss_internal.h"
+#include "external/hss_common.h"
+#include "external/lm_common.h"
 #include "sig_stfl_lms_wrap.h"
 
 #ifdef __GNUC__
@@ -50,8 +52,39 @@ typedef struct OQS_LMS_KEY_DATA {
 
 	/* app specific */
 	void *context;
+
+	/*
+	 * Working key, loaded from sec_key on the first signature and kept
+	 * until the key object is freed
+	 */
+	struct hss_working_key *working_key;
 } oqs_lms_key_data;
 
+#ifdef OQS_ALLOW_LMS_KEY_AND_SIG_GEN
+/*
+ * The working key holds the current signature and authentication path of
+ * every level and builds the next trees a little with each signature.
+ * Loading it regenerates all of that, so it is done once per key object
+ * rather than once per signature.
+ */
+static struct hss_working_key *oqs_lms_get_working_key(oqs_lms_key_data *key_data) {
+	if (key_data->working_key == NULL) {
+		key_data->working_key = hss_load_private_key(NULL, key_data->sec_key,
+		                        0,
+		                        NULL,
+		                        0,
+		                        0);
+	}
+	return key_data->working_key;
+}
+
+/* Drop a working key that failed to sign; the next call reloads it */
+static void oqs_lms_drop_working_key(oqs_lms_key_data *key_data) {
+	hss_free_working_key(key_data->working_key);
+	key_data->working_key = NULL;
+}
+#endif
+
 #ifndef OQS_ALLOW_LMS_KEY_AND_SIG_GEN
 OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_sign(UNUSED uint8_t *signature, UNUSED size_t *signature_length, UNUSED const uint8_t *message,
         UNUSED size_t message_len, UNUSED OQS_SIG_STFL_SECRET_KEY *secret_key) {
@@ -147,6 +180,240 @@ OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_verify(const uint8_t *message, size_t me
 	return OQS_SUCCESS;
 }
 
+/*
+ * Incremental signing and verification, built on the hss_sign_* and
+ * hss_validate_signature_* calls of the underlying library.
+ */
+typedef struct OQS_LMS_INC_DATA {
+
+	/* Working key of the secret key object, used by hss_sign_finalize */
+	const struct hss_working_key *working_key;
+
+	/* Incremental signing context */
+	struct hss_sign_inc sign_ctx;
+
+	/* Incremental validation context */
+	struct hss_validate_inc verify_ctx;
+
+	/* Set once final has run */
+	bool finished;
+} oqs_lms_inc_data;
+
+static OQS_STATUS oqs_lms_inc_update(OQS_SIG_STFL_INC_CTX *ctx, const uint8_t *message_chunk, size_t chunk_len) {
+	oqs_lms_inc_data *data = (oqs_lms_inc_data *)ctx->inc_data;
+	bool status;
+
+	if (data == NULL || data->finished) {
+		return OQS_ERROR;
+	}
+
+	if (ctx->is_signing) {
+		status = hss_sign_update(&data->sign_ctx, message_chunk, chunk_len);
+	} else {
+		status = hss_validate_signature_update(&data->verify_ctx, message_chunk, chunk_len);
+	}
+
+	return status ? OQS_SUCCESS : OQS_ERROR;
+}
+
+static OQS_STATUS oqs_lms_inc_final(OQS_SIG_STFL_INC_CTX *ctx) {
+	oqs_lms_inc_data *data = (oqs_lms_inc_data *)ctx->inc_data;
+	bool status;
+
+	if (data == NULL || data->finished) {
+		return OQS_ERROR;
+	}
+	data->finished = true;
+
+	if (ctx->is_signing) {
+		status = hss_sign_finalize(&data->sign_ctx, data->working_key, ctx->signature, 0);
+	} else {
+		status = hss_validate_signature_finalize(&data->verify_ctx, ctx->signature, 0);
+	}
+
+	return status ? OQS_SUCCESS : OQS_ERROR;
+}
+
+static void oqs_lms_inc_free(OQS_SIG_STFL_INC_CTX *ctx) {
+	oqs_lms_inc_data *data = (oqs_lms_inc_data *)ctx->inc_data;
+
+	if (data == NULL) {
+		return;
+	}
+
+	/* The running hash is only live between a successful init and final */
+	if (!data->finished) {
+		if (ctx->is_signing && data->sign_ctx.status == hss_error_none) {
+			OQS_SHA2_sha256_inc_ctx_release(&data->sign_ctx.hash_ctx.sha256);
+		} else if (!ctx->is_signing && data->verify_ctx.status == hss_error_none) {
+			OQS_SHA2_sha256_inc_ctx_release(&data->verify_ctx.hash_ctx.sha256);
+		}
+	}
+
+	OQS_MEM_secure_free(data, sizeof(oqs_lms_inc_data));
+	ctx->inc_data = NULL;
+}
+
+#ifndef OQS_ALLOW_LMS_KEY_AND_SIG_GEN
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_sign_init(UNUSED OQS_SIG_STFL_INC_CTX *ctx, UNUSED OQS_SIG_STFL_SECRET_KEY *secret_key) {
+	return OQS_ERROR;
+}
+#else
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_sign_init(OQS_SIG_STFL_INC_CTX *ctx, OQS_SIG_STFL_SECRET_KEY *secret_key) {
+	OQS_STATUS status = OQS_ERROR;
+	oqs_lms_key_data *lms_key_data = NULL;
+	oqs_lms_inc_data *data = NULL;
+	struct hss_working_key *working_key = NULL;
+	uint8_t *sk_key_buf = NULL;
+	size_t sk_key_buf_len = 0;
+	size_t sig_len;
+
+	if (ctx == NULL || ctx->signature == NULL || secret_key == NULL) {
+		return OQS_ERROR;
+	}
+
+	/* Lock secret to ensure OTS use */
+	if ((secret_key->lock_key) && (secret_key->mutex)) {
+		secret_key->lock_key(secret_key->mutex);
+	}
+
+	/*
+	 * Don't even attempt signing without a way to safe the updated private key
+	 */
+	if (secret_key->secure_store_scrt_key == NULL) {
+		fprintf(stderr, "No Secure-store set for secret key.\n.");
+		goto err;
+	}
+
+	lms_key_data = (oqs_lms_key_data *)secret_key->secret_key_data;
+	if (lms_key_data == NULL || lms_key_data->sec_key == NULL) {
+		goto err;
+	}
+
+	data = OQS_MEM_calloc(1, sizeof(oqs_lms_inc_data));
+	if (data == NULL) {
+		goto err;
+	}
+	data->sign_ctx.status = hss_error_ctx_uninitialized;
+	ctx->inc_data = data;
+	ctx->update = oqs_lms_inc_update;
+	ctx->final = oqs_lms_inc_final;
+	ctx->free_data = oqs_lms_inc_free;
+
+	working_key = oqs_lms_get_working_key(lms_key_data);
+	if (working_key == NULL) {
+		goto err;
+	}
+	data->working_key = working_key;
+
+	sig_len = hss_get_signature_len_from_working_key(working_key);
+	if (sig_len == 0 || sig_len > ctx->length_signature) {
+		goto err;
+	}
+	ctx->length_signature = sig_len;
+
+	/* Advances the key counter in sec_key and signs all but the bottom level */
+	if (!hss_sign_init(&data->sign_ctx, working_key,
+	                   NULL, lms_key_data->sec_key,
+	                   ctx->signature, sig_len,
+	                   0)) {
+		if (working_key->status != hss_error_none) {
+			oqs_lms_drop_working_key(lms_key_data);
+		}
+		goto err;
+	}
+
+	/*
+	 * serialize and securely store the updated private key
+	 * before any of the message is signed
+	 */
+	status = oqs_serialize_lms_key(&sk_key_buf, &sk_key_buf_len, secret_key);
+	if (status != OQS_SUCCESS) {
+		goto err;
+	}
+
+	status = secret_key->secure_store_scrt_key(sk_key_buf, sk_key_buf_len, secret_key->context);
+
+err:
+	OQS_MEM_secure_free(sk_key_buf, sk_key_buf_len);
+
+	/* Unlock secret to ensure OTS use */
+	if ((secret_key->unlock_key) && (secret_key->mutex)) {
+		secret_key->unlock_key(secret_key->mutex);
+	}
+	return status;
+}
+#endif
+
+/*
+ * The length of an HSS signature under public_key: the top level's parameter sets are in the public key, those of each
+ * level below in the public key signed by the level above it. 0 when the signature is too short to hold them or a
+ * parameter set is unknown.
+ */
+static size_t lms_expected_signature_len(const uint8_t *public_key, size_t public_key_len, const uint8_t *signature, size_t signature_len) {
+	param_set_t lm_type[MAX_HSS_LEVELS], lm_ots_type[MAX_HSS_LEVELS];
+	unsigned levels, i;
+	size_t offset = 4, level_len;
+
+	if (public_key_len < 12 || signature_len < 4) {
+		return 0;
+	}
+	levels = (unsigned)get_bigendian(public_key, 4);
+	if (levels < MIN_HSS_LEVELS || levels > MAX_HSS_LEVELS || get_bigendian(signature, 4) + 1 != levels) {
+		return 0;
+	}
+	lm_type[0] = (param_set_t)get_bigendian(public_key + 4, 4);
+	lm_ots_type[0] = (param_set_t)get_bigendian(public_key + 8, 4);
+	for (i = 1; i < levels; i++) {
+		level_len = lm_get_signature_len(lm_type[i - 1], lm_ots_type[i - 1]);
+		if (level_len == 0 || signature_len < offset + level_len + 8) {
+			return 0;
+		}
+		offset += level_len;
+		lm_type[i] = (param_set_t)get_bigendian(signature + offset, 4);
+		lm_ots_type[i] = (param_set_t)get_bigendian(signature + offset + 4, 4);
+		level_len = lm_get_public_key_len(lm_type[i]);
+		if (level_len == 0) {
+			return 0;
+		}
+		offset += level_len;
+	}
+	return hss_get_signature_len(levels, lm_type, lm_ots_type);
+}
+
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_lms_verify_init(OQS_SIG_STFL_INC_CTX *ctx) {
+	oqs_lms_inc_data *data = NULL;
+
+	if (ctx == NULL || ctx->signature == NULL || ctx->public_key == NULL) {
+		return OQS_ERROR;
+	}
+
+	/* hss_validate_signature_init reads the bottom level's signature without checking its length */
+	if (ctx->length_signature != lms_expected_signature_len(ctx->public_key, ctx->length_public_key, ctx->signature, ctx->length_signature)) {
+		return OQS_ERROR;
+	}
+
+	data = OQS_MEM_calloc(1, sizeof(oqs_lms_inc_data));
+	if (data == NULL) {
+		return OQS_ERROR;
+	}
+	data->verify_ctx.status = hss_error_ctx_uninitialized;
+	ctx->inc_data = data;
+	ctx->update = oqs_lms_inc_update;
+	ctx->final = oqs_lms_inc_final;
+	ctx->free_data = oqs_lms_inc_free;
+
+	if (!hss_validate_signature_init(&data->verify_ctx,
+	                                 (const unsigned char *)ctx->public_key,
+	                                 (const unsigned char *)ctx->signature,
+	                                 ctx->length_signature,
+	                                 0)) {
+		return OQS_ERROR;
+	}
+
+	return OQS_SUCCESS;
+}
+
 OQS_API OQS_STATUS OQS_SIG_STFL_lms_sigs_left(unsigned long long *remain, const OQS_SIG_STFL_SECRET_KEY *secret_key) {
 	OQS_STATUS status;
 	uint8_t *priv_key = NULL;
@@ -562,29 +829,20 @@ int oqs_sig_stfl_lms_sign(OQS_SIG_STFL_SECRET_KEY *sk,
 	} else {
 		return -1;
 	}
-	w = hss_load_private_key(NULL, priv_key,
-	                         0,
-	                         NULL,
-	                         0,
-	                         0);
+	w = oqs_lms_get_working_key(oqs_key_data);
 	if (!w) {
-		hss_free_working_key(w);
-		return 0;
+		return -1;
 	}
 
-	/* Now, go through the file list, and generate the signatures for each */
-
 	/* Look up the signature length */
 
 	sig_len = hss_get_signature_len_from_working_key(w);
 	if (sig_len == 0) {
-		hss_free_working_key(w);
-		return 0;
+		return -1;
 	}
 
 	sig = OQS_MEM_malloc(sig_len);
 	if (!sig) {
-		hss_free_working_key(w);
 		return -1;
 	}
 
@@ -608,7 +866,9 @@ int oqs_sig_stfl_lms_sign(OQS_SIG_STFL_SECRET_KEY *sk,
 	             0);
 
 	if (!status) {
-		hss_free_working_key(w);
+		if (w->status != hss_error_none) {
+			oqs_lms_drop_working_key(oqs_key_data);
+		}
 		OQS_MEM_insecure_free(sig);
 		return -1;
 	}
@@ -616,7 +876,6 @@ int oqs_sig_stfl_lms_sign(OQS_SIG_STFL_SECRET_KEY *sk,
 	*signature_len = sig_len;
 	memcpy(signature, sig, sig_len);
 	OQS_MEM_insecure_free(sig);
-	hss_free_working_key(w);
 
 	return 0;
 }
@@ -661,6 +920,9 @@ void oqs_secret_lms_key_free(OQS_SIG_STFL_SECRET_KEY *sk) {
 	if (sk->secret_key_data) {
 		oqs_lms_key_data *key_data = (oqs_lms_key_data *)sk->secret_key_data;
 		if (key_data) {
+			hss_free_working_key(key_data->working_key);
+			key_data->working_key = NULL;
+
 			OQS_MEM_secure_free(key_data->sec_key, key_data->len_sec_key);
 			key_data->sec_key = NULL;
 
@@ -768,6 +1030,7 @@ OQS_STATUS oqs_deserialize_lms_key(OQS_SIG_STFL_SECRET_KEY *sk, const uint8_t *s
 	}
 
 	memcpy(lms_sk, sk_buf, lms_sk_len);
+	lms_key_data->working_key = NULL;
 	lms_key_data->sec_key = lms_sk;
 	lms_key_data->len_sec_key = lms_sk_len;
 	lms_key_data->context = context;
@@ -2,8 +2,8 @@
 
 #include <assert.h>
 #include <stdlib.h>
-#if defined(_WIN32)
 #include <string.h>
+#if defined(_WIN32)
 #define strcasecmp _stricmp
 #else
 #include <strings.h>
@@ -11,6 +11,11 @@
 
 #include <oqs/oqs.h>
 
+#if defined(OQS_USE_PTHREADS)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #ifdef OQS_ENABLE_SIG_STFL_XMSS
 #include <oqs/sig_stfl_xmss.h>
 #endif // OQS_ENABLE_SIG_STFL_XMSS
@@ -1037,6 +1042,229 @@ OQS_API OQS_STATUS OQS_SIG_STFL_verify(const OQS_SIG_STFL *sig, const uint8_t *m
 	}
 }
 
+/* A contiguous slice of a verify_batch call, handled by one thread. */
+typedef struct {
+	const OQS_SIG_STFL *sig;
+	const uint8_t *const *messages;
+	const size_t *message_lens;
+	const uint8_t *const *signatures;
+	const size_t *signature_lens;
+	const uint8_t *public_key;
+	OQS_STATUS *results;
+	size_t begin;
+	size_t end;
+} verify_batch_job;
+
+static void verify_batch_range(const verify_batch_job *job) {
+	for (size_t i = job->begin; i < job->end; i++) {
+		job->results[i] = OQS_SIG_STFL_verify(job->sig, job->messages[i], job->message_lens[i],
+		                                      job->signatures[i], job->signature_lens[i], job->public_key);
+	}
+}
+
+#if defined(OQS_USE_PTHREADS)
+static void *verify_batch_worker(void *arg) {
+	verify_batch_range((const verify_batch_job *)arg);
+	return NULL;
+}
+#endif
+
+OQS_API OQS_STATUS OQS_SIG_STFL_verify_batch(const OQS_SIG_STFL *sig, size_t count,
+        const uint8_t *const *messages, const size_t *message_lens,
+        const uint8_t *const *signatures, const size_t *signature_lens,
+        const uint8_t *public_key, OQS_STATUS *results, size_t num_threads) {
+	OQS_STATUS ret = OQS_SUCCESS;
+	verify_batch_job *jobs = NULL;
+	size_t i;
+
+	if (sig == NULL || sig->verify == NULL || results == NULL || public_key == NULL ||
+	        (count > 0 && (messages == NULL || message_lens == NULL || signatures == NULL || signature_lens == NULL))) {
+		return OQS_ERROR;
+	}
+	if (count == 0) {
+		return OQS_SUCCESS;
+	}
+
+#if defined(OQS_USE_PTHREADS)
+	if (num_threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = online > 0 ? (size_t)online : 1;
+	}
+#else
+	num_threads = 1;
+#endif
+	if (num_threads > count) {
+		num_threads = count;
+	}
+
+	jobs = OQS_MEM_malloc(num_threads * sizeof(verify_batch_job));
+	if (jobs == NULL) {
+		return OQS_ERROR;
+	}
+	for (i = 0; i < num_threads; i++) {
+		jobs[i].sig = sig;
+		jobs[i].messages = messages;
+		jobs[i].message_lens = message_lens;
+		jobs[i].signatures = signatures;
+		jobs[i].signature_lens = signature_lens;
+		jobs[i].public_key = public_key;
+		jobs[i].results = results;
+		jobs[i].begin = count * i / num_threads;
+		jobs[i].end = count * (i + 1) / num_threads;
+	}
+
+#if defined(OQS_USE_PTHREADS)
+	pthread_t *threads = NULL;
+	bool *started = NULL;
+	if (num_threads > 1) {
+		threads = OQS_MEM_malloc(num_threads * sizeof(pthread_t));
+		started = OQS_MEM_calloc(num_threads, sizeof(bool));
+		if (threads == NULL || started == NULL) {
+			OQS_MEM_insecure_free(threads);
+			OQS_MEM_insecure_free(started);
+			OQS_MEM_insecure_free(jobs);
+			return OQS_ERROR;
+		}
+		/* The calling thread takes the first slice itself. */
+		for (i = 1; i < num_threads; i++) {
+			started[i] = pthread_create(&threads[i], NULL, verify_batch_worker, &jobs[i]) == 0;
+		}
+	}
+	verify_batch_range(&jobs[0]);
+	for (i = 1; i < num_threads; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		} else {
+			/* Out of threads: verify the slice here instead. */
+			verify_batch_range(&jobs[i]);
+		}
+	}
+	OQS_MEM_insecure_free(threads);
+	OQS_MEM_insecure_free(started);
+#else
+	verify_batch_range(&jobs[0]);
+#endif
+
+	for (i = 0; i < count; i++) {
+		if (results[i] != OQS_SUCCESS) {
+			ret = OQS_ERROR;
+		}
+	}
+	OQS_MEM_insecure_free(jobs);
+	return ret;
+}
+
+OQS_API OQS_SIG_STFL_INC_CTX *OQS_SIG_STFL_sign_init(const OQS_SIG_STFL *sig, OQS_SIG_STFL_SECRET_KEY *secret_key) {
+#ifndef OQS_ALLOW_STFL_KEY_AND_SIG_GEN
+	(void)sig;
+	(void)secret_key;
+	return NULL;
+#else
+	OQS_SIG_STFL_INC_CTX *ctx = NULL;
+
+	if (sig == NULL || sig->sign_init == NULL || secret_key == NULL) {
+		return NULL;
+	}
+
+	ctx = OQS_MEM_calloc(1, sizeof(OQS_SIG_STFL_INC_CTX));
+	if (ctx == NULL) {
+		return NULL;
+	}
+	ctx->is_signing = true;
+	ctx->length_signature = sig->length_signature;
+	ctx->signature = OQS_MEM_malloc(ctx->length_signature);
+	if (ctx->signature == NULL || sig->sign_init(ctx, secret_key) != OQS_SUCCESS) {
+		OQS_SIG_STFL_INC_CTX_free(ctx);
+		return NULL;
+	}
+	return ctx;
+#endif
+}
+
+OQS_API OQS_STATUS OQS_SIG_STFL_sign_update(OQS_SIG_STFL_INC_CTX *ctx, const uint8_t *message_chunk, size_t chunk_len) {
+	if (ctx == NULL || !ctx->is_signing || ctx->update == NULL || (message_chunk == NULL && chunk_len != 0)) {
+		return OQS_ERROR;
+	}
+	return ctx->update(ctx, message_chunk, chunk_len);
+}
+
+OQS_API OQS_STATUS OQS_SIG_STFL_sign_final(OQS_SIG_STFL_INC_CTX *ctx, uint8_t *signature, size_t *signature_len) {
+	if (ctx == NULL || !ctx->is_signing || ctx->final == NULL || signature == NULL || signature_len == NULL) {
+		return OQS_ERROR;
+	}
+	if (ctx->final(ctx) != OQS_SUCCESS) {
+		*signature_len = 0;
+		return OQS_ERROR;
+	}
+	memcpy(signature, ctx->signature, ctx->length_signature);
+	*signature_len = ctx->length_signature;
+	return OQS_SUCCESS;
+}
+
+OQS_API OQS_SIG_STFL_INC_CTX *OQS_SIG_STFL_verify_init(const OQS_SIG_STFL *sig, const uint8_t *signature, size_t signature_len, const uint8_t *public_key) {
+#ifndef OQS_ALLOW_STFL_KEY_AND_SIG_GEN
+	(void)sig;
+	(void)signature;
+	(void)signature_len;
+	(void)public_key;
+	return NULL;
+#else
+	OQS_SIG_STFL_INC_CTX *ctx = NULL;
+
+	if (sig == NULL || sig->verify_init == NULL || signature == NULL || signature_len == 0 || public_key == NULL) {
+		return NULL;
+	}
+
+	ctx = OQS_MEM_calloc(1, sizeof(OQS_SIG_STFL_INC_CTX));
+	if (ctx == NULL) {
+		return NULL;
+	}
+	ctx->is_signing = false;
+	ctx->length_signature = signature_len;
+	ctx->signature = OQS_MEM_malloc(signature_len);
+	ctx->length_public_key = sig->length_public_key;
+	ctx->public_key = OQS_MEM_malloc(sig->length_public_key);
+	if (ctx->signature == NULL || ctx->public_key == NULL) {
+		OQS_SIG_STFL_INC_CTX_free(ctx);
+		return NULL;
+	}
+	memcpy(ctx->signature, signature, signature_len);
+	memcpy(ctx->public_key, public_key, sig->length_public_key);
+
+	if (sig->verify_init(ctx) != OQS_SUCCESS) {
+		OQS_SIG_STFL_INC_CTX_free(ctx);
+		return NULL;
+	}
+	return ctx;
+#endif
+}
+
+OQS_API OQS_STATUS OQS_SIG_STFL_verify_update(OQS_SIG_STFL_INC_CTX *ctx, const uint8_t *message_chunk, size_t chunk_len) {
+	if (ctx == NULL || ctx->is_signing || ctx->update == NULL || (message_chunk == NULL && chunk_len != 0)) {
+		return OQS_ERROR;
+	}
+	return ctx->update(ctx, message_chunk, chunk_len);
+}
+
+OQS_API OQS_STATUS OQS_SIG_STFL_verify_final(OQS_SIG_STFL_INC_CTX *ctx) {
+	if (ctx == NULL || ctx->is_signing || ctx->final == NULL) {
+		return OQS_ERROR;
+	}
+	return ctx->final(ctx);
+}
+
+OQS_API void OQS_SIG_STFL_INC_CTX_free(OQS_SIG_STFL_INC_CTX *ctx) {
+	if (ctx == NULL) {
+		return;
+	}
+	if (ctx->free_data != NULL) {
+		ctx->free_data(ctx);
+	}
+	OQS_MEM_secure_free(ctx->signature, ctx->length_signature);
+	OQS_MEM_insecure_free(ctx->public_key);
+	OQS_MEM_insecure_free(ctx);
+}
+
 OQS_API OQS_STATUS OQS_SIG_STFL_sigs_remaining(const OQS_SIG_STFL *sig, unsigned long long *remain, const OQS_SIG_STFL_SECRET_KEY *secret_key) {
 #ifndef OQS_ALLOW_STFL_KEY_AND_SIG_GEN
 	(void)sig;
@@ -159,6 +159,58 @@ typedef OQS_STATUS (*lock_key)(void *mutex);
  */
 typedef OQS_STATUS (*unlock_key)(void *mutex);
 
+/**
+ * Context of a signature that is generated or verified incrementally, with the message
+ * supplied in pieces. Created by `OQS_SIG_STFL_sign_init` or `OQS_SIG_STFL_verify_init`
+ * and released with `OQS_SIG_STFL_INC_CTX_free`.
+ *
+ * The buffers are owned by the context; the function pointers are set by the scheme.
+ */
+typedef struct OQS_SIG_STFL_INC_CTX {
+
+	/** Whether this context produces (true) or checks (false) a signature. */
+	bool is_signing;
+
+	/** Signature being produced, or a copy of the signature being verified. */
+	uint8_t *signature;
+	/** The length, in bytes, of `signature`. */
+	size_t length_signature;
+
+	/** Copy of the public key; only set when verifying. */
+	uint8_t *public_key;
+	/** The length, in bytes, of `public_key`. */
+	size_t length_public_key;
+
+	/** Scheme-specific state. */
+	void *inc_data;
+
+	/**
+	 * Absorb the next piece of the message.
+	 *
+	 * @param[in] ctx The incremental context.
+	 * @param[in] message_chunk The next piece of the message.
+	 * @param[in] chunk_len The length of the piece.
+	 * @return OQS_SUCCESS or OQS_ERROR
+	 */
+	OQS_STATUS (*update)(struct OQS_SIG_STFL_INC_CTX *ctx, const uint8_t *message_chunk, size_t chunk_len);
+
+	/**
+	 * Complete `signature` when signing, or check it when verifying.
+	 *
+	 * @param[in] ctx The incremental context.
+	 * @return OQS_SUCCESS or OQS_ERROR
+	 */
+	OQS_STATUS (*final)(struct OQS_SIG_STFL_INC_CTX *ctx);
+
+	/**
+	 * Release `inc_data`, whether or not `final` was called.
+	 *
+	 * @param[in] ctx The incremental context.
+	 */
+	void (*free_data)(struct OQS_SIG_STFL_INC_CTX *ctx);
+
+} OQS_SIG_STFL_INC_CTX;
+
 /**
  * Returns identifiers for available signature schemes in liboqs.  Used with `OQS_SIG_STFL_new`.
  *
@@ -294,6 +346,27 @@ typedef struct OQS_SIG_STFL {
 	 */
 	OQS_STATUS (*sigs_total)(unsigned long long *total, const OQS_SIG_STFL_SECRET_KEY *secret_key);
 
+	/**
+	 * Start an incremental signature.
+	 *
+	 * Reserves the next one-time key and stores the updated secret key through the
+	 * secure-store callback before returning, so `ctx->signature` can be finished later
+	 * without touching the secret key again.
+	 *
+	 * @param[in,out] ctx Context whose `signature` buffer has been allocated by the caller.
+	 * @param[in] secret_key The secret key object pointer.
+	 * @return OQS_SUCCESS or OQS_ERROR
+	 */
+	OQS_STATUS (*sign_init)(OQS_SIG_STFL_INC_CTX *ctx, OQS_SIG_STFL_SECRET_KEY *secret_key);
+
+	/**
+	 * Start an incremental verification of `ctx->signature` under `ctx->public_key`.
+	 *
+	 * @param[in,out] ctx Context holding the signature and public key.
+	 * @return OQS_SUCCESS or OQS_ERROR
+	 */
+	OQS_STATUS (*verify_init)(OQS_SIG_STFL_INC_CTX *ctx);
+
 } OQS_SIG_STFL;
 #endif //OQS_ALLOW_STFL_KEY_AND_SIG_GEN
 
@@ -476,6 +549,105 @@ OQS_API OQS_STATUS OQS_SIG_STFL_sign(const OQS_SIG_STFL *sig, uint8_t *signature
  */
 OQS_API OQS_STATUS OQS_SIG_STFL_verify(const OQS_SIG_STFL *sig, const uint8_t *message, size_t message_len, const uint8_t *signature, size_t signature_len, const uint8_t *public_key);
 
+/**
+ * Verify many signatures made under the same public key.
+ *
+ * The items are split across up to `num_threads` worker threads (when liboqs is built with
+ * pthreads; otherwise they are verified on the calling thread). The outcome of every item is
+ * written to `results`, so a single bad signature does not hide the others.
+ *
+ * @param[in] sig The OQS_SIG_STFL object representing the signature scheme.
+ * @param[in] count The number of message/signature pairs.
+ * @param[in] messages Array of `count` messages.
+ * @param[in] message_lens Array of `count` message lengths.
+ * @param[in] signatures Array of `count` signatures.
+ * @param[in] signature_lens Array of `count` signature lengths.
+ * @param[in] public_key The public key shared by all signatures.
+ * @param[out] results Array of `count` statuses, OQS_SUCCESS for every signature that verified.
+ * @param[in] num_threads The maximum number of threads to use; 0 picks the number of online CPUs.
+ * @return OQS_SUCCESS if every signature verified, OQS_ERROR otherwise
+ */
+OQS_API OQS_STATUS OQS_SIG_STFL_verify_batch(const OQS_SIG_STFL *sig, size_t count,
+        const uint8_t *const *messages, const size_t *message_lens,
+        const uint8_t *const *signatures, const size_t *signature_lens,
+        const uint8_t *public_key, OQS_STATUS *results, size_t num_threads);
+
+/**
+ * Start an incremental signature, for messages that are not available in one piece.
+ *
+ * The secret key counter is advanced and the updated key is handed to the secure-store
+ * callback before this function returns, so an abandoned context still consumes its
+ * one-time key.
+ *
+ * @param[in] sig The OQS_SIG_STFL object representing the signature scheme.
+ * @param[in] secret_key The secret key object pointer.
+ * @return A new context, or NULL on error or if the scheme has no incremental signing.
+ *
+ * @note Only available when key and signature generation are enabled at compile-time.
+ * @note The context may refer to state held by the secret key object, so it must be
+ *       freed before the secret key is.
+ */
+OQS_API OQS_SIG_STFL_INC_CTX *OQS_SIG_STFL_sign_init(const OQS_SIG_STFL *sig, OQS_SIG_STFL_SECRET_KEY *secret_key);
+
+/**
+ * Absorb the next piece of the message to sign.
+ *
+ * @param[in] ctx Context from OQS_SIG_STFL_sign_init.
+ * @param[in] message_chunk The next piece of the message.
+ * @param[in] chunk_len The length of the piece.
+ * @return OQS_SUCCESS or OQS_ERROR
+ */
+OQS_API OQS_STATUS OQS_SIG_STFL_sign_update(OQS_SIG_STFL_INC_CTX *ctx, const uint8_t *message_chunk, size_t chunk_len);
+
+/**
+ * Complete an incremental signature. The context must still be freed afterwards.
+ *
+ * @param[in] ctx Context from OQS_SIG_STFL_sign_init.
+ * @param[out] signature The signature, of up to `length_signature` bytes.
+ * @param[out] signature_len The length of the signature.
+ * @return OQS_SUCCESS or OQS_ERROR
+ */
+OQS_API OQS_STATUS OQS_SIG_STFL_sign_final(OQS_SIG_STFL_INC_CTX *ctx, uint8_t *signature, size_t *signature_len);
+
+/**
+ * Start an incremental verification. The signature and public key are copied into the context.
+ *
+ * @param[in] sig The OQS_SIG_STFL object representing the signature scheme.
+ * @param[in] signature The signature on the message is represented as a byte string.
+ * @param[in] signature_len The length of the signature.
+ * @param[in] public_key The public key is represented as a byte string.
+ * @return A new context, or NULL on error or if the scheme has no incremental verification.
+ *
+ * @note Only available when key and signature generation are enabled at compile-time, since
+ *       the scheme object otherwise lacks the `verify_init` member.
+ */
+OQS_API OQS_SIG_STFL_INC_CTX *OQS_SIG_STFL_verify_init(const OQS_SIG_STFL *sig, const uint8_t *signature, size_t signature_len, const uint8_t *public_key);
+
+/**
+ * Absorb the next piece of the message to verify.
+ *
+ * @param[in] ctx Context from OQS_SIG_STFL_verify_init.
+ * @param[in] message_chunk The next piece of the message.
+ * @param[in] chunk_len The length of the piece.
+ * @return OQS_SUCCESS or OQS_ERROR
+ */
+OQS_API OQS_STATUS OQS_SIG_STFL_verify_update(OQS_SIG_STFL_INC_CTX *ctx, const uint8_t *message_chunk, size_t chunk_len);
+
+/**
+ * Complete an incremental verification. The context must still be freed afterwards.
+ *
+ * @param[in] ctx Context from OQS_SIG_STFL_verify_init.
+ * @return OQS_SUCCESS if the signature is valid, OQS_ERROR otherwise.
+ */
+OQS_API OQS_STATUS OQS_SIG_STFL_verify_final(OQS_SIG_STFL_INC_CTX *ctx);
+
+/**
+ * Free an incremental signing or verification context.
+ *
+ * @param[in] ctx The context to free; may be NULL.
+ */
+OQS_API void OQS_SIG_STFL_INC_CTX_free(OQS_SIG_STFL_INC_CTX *ctx);
+
 /**
  * Query the number of remaining signatures.
  *
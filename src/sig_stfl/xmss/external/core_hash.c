@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: (Apache-2.0 OR MIT) AND CC0-1.0
 #include <oqs/sha2.h>
 #include <oqs/sha3.h>
+#include <oqs/sha3x4.h>
 #include "core_hash.h"
 #include <string.h>
 
@@ -37,3 +38,142 @@ int core_hash(const xmss_params *params,
 
 	return 0;
 }
+
+#ifdef XMSS_CORE_HASH_X4
+int core_hash_x4(const xmss_params *params,
+                 unsigned char *out[4],
+                 const unsigned char *in[4], unsigned long long inlen) {
+
+	(void)params;
+#if HASH == XMSS_CORE_HASH_SHAKE128_N32
+	OQS_SHA3_shake128_x4(out[0], out[1], out[2], out[3], 32,
+	                     in[0], in[1], in[2], in[3], (size_t)inlen);
+
+#elif HASH == XMSS_CORE_HASH_SHAKE256_N24
+	OQS_SHA3_shake256_x4(out[0], out[1], out[2], out[3], 24,
+	                     in[0], in[1], in[2], in[3], (size_t)inlen);
+
+#elif HASH == XMSS_CORE_HASH_SHAKE256_N32
+	OQS_SHA3_shake256_x4(out[0], out[1], out[2], out[3], 32,
+	                     in[0], in[1], in[2], in[3], (size_t)inlen);
+
+#else
+	OQS_SHA3_shake256_x4(out[0], out[1], out[2], out[3], 64,
+	                     in[0], in[1], in[2], in[3], (size_t)inlen);
+#endif
+
+	return 0;
+}
+#endif
+
+void core_hash_inc_init(const xmss_params *params, core_hash_ctx *ctx) {
+	(void)params;
+#if HASH == XMSS_CORE_HASH_SHA256_N24 || HASH == XMSS_CORE_HASH_SHA256_N32
+	OQS_SHA2_sha256_inc_init(&ctx->sha256);
+
+#elif HASH == XMSS_CORE_HASH_SHA512_N64
+	OQS_SHA2_sha512_inc_init(&ctx->sha512);
+	ctx->block_len = 0;
+
+#elif HASH == XMSS_CORE_HASH_SHAKE128_N32
+	OQS_SHA3_shake128_inc_init(&ctx->shake128);
+
+#else
+	OQS_SHA3_shake256_inc_init(&ctx->shake256);
+#endif
+}
+
+void core_hash_inc_update(const xmss_params *params, core_hash_ctx *ctx,
+                          const unsigned char *in, unsigned long long inlen) {
+	(void)params;
+#if HASH == XMSS_CORE_HASH_SHA256_N24 || HASH == XMSS_CORE_HASH_SHA256_N32
+	OQS_SHA2_sha256_inc(&ctx->sha256, in, (size_t)inlen);
+
+#elif HASH == XMSS_CORE_HASH_SHA512_N64
+	size_t take;
+
+	if (ctx->block_len > 0) {
+		take = sizeof(ctx->block) - ctx->block_len;
+		if (take > inlen) {
+			take = (size_t)inlen;
+		}
+		memcpy(ctx->block + ctx->block_len, in, take);
+		ctx->block_len += take;
+		in += take;
+		inlen -= take;
+		if (ctx->block_len < sizeof(ctx->block)) {
+			return;
+		}
+		OQS_SHA2_sha512_inc_blocks(&ctx->sha512, ctx->block, 1);
+		ctx->block_len = 0;
+	}
+	if (inlen >= sizeof(ctx->block)) {
+		take = (size_t)(inlen / sizeof(ctx->block));
+		OQS_SHA2_sha512_inc_blocks(&ctx->sha512, in, take);
+		in += take * sizeof(ctx->block);
+		inlen -= take * sizeof(ctx->block);
+	}
+	memcpy(ctx->block, in, (size_t)inlen);
+	ctx->block_len = (size_t)inlen;
+
+#elif HASH == XMSS_CORE_HASH_SHAKE128_N32
+	OQS_SHA3_shake128_inc_absorb(&ctx->shake128, in, (size_t)inlen);
+
+#else
+	OQS_SHA3_shake256_inc_absorb(&ctx->shake256, in, (size_t)inlen);
+#endif
+}
+
+void core_hash_inc_final(const xmss_params *params, core_hash_ctx *ctx,
+                         unsigned char *out) {
+	(void)params;
+#if HASH == XMSS_CORE_HASH_SHA256_N24
+	unsigned char buf[32];
+	OQS_SHA2_sha256_inc_finalize(buf, &ctx->sha256, NULL, 0);
+	memcpy(out, buf, 24);
+
+#elif HASH == XMSS_CORE_HASH_SHA256_N32
+	OQS_SHA2_sha256_inc_finalize(out, &ctx->sha256, NULL, 0);
+
+#elif HASH == XMSS_CORE_HASH_SHA512_N64
+	OQS_SHA2_sha512_inc_finalize(out, &ctx->sha512, ctx->block, ctx->block_len);
+	ctx->block_len = 0;
+
+#elif HASH == XMSS_CORE_HASH_SHAKE128_N32
+	OQS_SHA3_shake128_inc_finalize(&ctx->shake128);
+	OQS_SHA3_shake128_inc_squeeze(out, 32, &ctx->shake128);
+	OQS_SHA3_shake128_inc_ctx_release(&ctx->shake128);
+
+#elif HASH == XMSS_CORE_HASH_SHAKE256_N24
+	OQS_SHA3_shake256_inc_finalize(&ctx->shake256);
+	OQS_SHA3_shake256_inc_squeeze(out, 24, &ctx->shake256);
+	OQS_SHA3_shake256_inc_ctx_release(&ctx->shake256);
+
+#elif HASH == XMSS_CORE_HASH_SHAKE256_N32
+	OQS_SHA3_shake256_inc_finalize(&ctx->shake256);
+	OQS_SHA3_shake256_inc_squeeze(out, 32, &ctx->shake256);
+	OQS_SHA3_shake256_inc_ctx_release(&ctx->shake256);
+
+#else
+	OQS_SHA3_shake256_inc_finalize(&ctx->shake256);
+	OQS_SHA3_shake256_inc_squeeze(out, 64, &ctx->shake256);
+	OQS_SHA3_shake256_inc_ctx_release(&ctx->shake256);
+#endif
+}
+
+void core_hash_inc_release(const xmss_params *params, core_hash_ctx *ctx) {
+	(void)params;
+#if HASH == XMSS_CORE_HASH_SHA256_N24 || HASH == XMSS_CORE_HASH_SHA256_N32
+	OQS_SHA2_sha256_inc_ctx_release(&ctx->sha256);
+
+#elif HASH == XMSS_CORE_HASH_SHA512_N64
+	OQS_SHA2_sha512_inc_ctx_release(&ctx->sha512);
+	ctx->block_len = 0;
+
+#elif HASH == XMSS_CORE_HASH_SHAKE128_N32
+	OQS_SHA3_shake128_inc_ctx_release(&ctx->shake128);
+
+#else
+	OQS_SHA3_shake256_inc_ctx_release(&ctx->shake256);
+#endif
+}
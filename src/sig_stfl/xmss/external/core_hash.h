@@ -2,6 +2,9 @@
 #ifndef CORE_HASH
 #define CORE_HASH
 
+#include <stddef.h>
+#include <oqs/sha2.h>
+#include <oqs/sha3.h>
 #include "namespace.h"
 #include "params.h"
 
@@ -21,4 +24,53 @@ int core_hash(const xmss_params *params,
               unsigned char *out,
               const unsigned char *in, unsigned long long inlen);
 
+#if HASH == XMSS_CORE_HASH_SHAKE256_N24 || HASH == XMSS_CORE_HASH_SHAKE128_N32 || \
+    HASH == XMSS_CORE_HASH_SHAKE256_N32 || HASH == XMSS_CORE_HASH_SHAKE256_N64
+/* The SHAKE parameter sets can run four equal-length hashes in one go. */
+#define XMSS_CORE_HASH_X4 1
+
+/**
+ * Four independent core_hash calls on inputs of the same length, computed with
+ * the four-way Keccak permutation.
+ */
+#define core_hash_x4 XMSS_PARAMS_INNER_CORE_HASH(core_hash_x4)
+int core_hash_x4(const xmss_params *params,
+                 unsigned char *out[4],
+                 const unsigned char *in[4], unsigned long long inlen);
+#endif
+
+/**
+ * Incremental form of core_hash, used to hash messages that are streamed in
+ * pieces. The state must be finished with core_hash_inc_final or released
+ * with core_hash_inc_release.
+ */
+typedef struct {
+#if HASH == XMSS_CORE_HASH_SHA256_N24 || HASH == XMSS_CORE_HASH_SHA256_N32
+    OQS_SHA2_sha256_ctx sha256;
+#elif HASH == XMSS_CORE_HASH_SHA512_N64
+    OQS_SHA2_sha512_ctx sha512;
+    /* sha512 only absorbs whole blocks, so keep the partial one here */
+    unsigned char block[128];
+    size_t block_len;
+#elif HASH == XMSS_CORE_HASH_SHAKE128_N32
+    OQS_SHA3_shake128_inc_ctx shake128;
+#else
+    OQS_SHA3_shake256_inc_ctx shake256;
+#endif
+} core_hash_ctx;
+
+#define core_hash_inc_init XMSS_PARAMS_INNER_CORE_HASH(core_hash_inc_init)
+void core_hash_inc_init(const xmss_params *params, core_hash_ctx *ctx);
+
+#define core_hash_inc_update XMSS_PARAMS_INNER_CORE_HASH(core_hash_inc_update)
+void core_hash_inc_update(const xmss_params *params, core_hash_ctx *ctx,
+                          const unsigned char *in, unsigned long long inlen);
+
+#define core_hash_inc_final XMSS_PARAMS_INNER_CORE_HASH(core_hash_inc_final)
+void core_hash_inc_final(const xmss_params *params, core_hash_ctx *ctx,
+                         unsigned char *out);
+
+#define core_hash_inc_release XMSS_PARAMS_INNER_CORE_HASH(core_hash_inc_release)
+void core_hash_inc_release(const xmss_params *params, core_hash_ctx *ctx);
+
 #endif
@@ -61,25 +61,29 @@ int prf_keygen(const xmss_params *params,
 }
 
 /*
- * Computes the message hash using R, the public root, the index of the leaf
- * node, and the message. Notably, it requires m_with_prefix to have 3*n plus
- * the length of the padding as free space available before the message,
- * to use for the prefix. This is necessary to prevent having to move the
- * message around (and thus allocate memory for it).
+ * Starts the message hash using R, the public root and the index of the leaf
+ * node. The message itself is absorbed afterwards with core_hash_inc_update,
+ * in as many pieces as the caller likes, and the digest is read out with
+ * core_hash_inc_final. This way the message never has to be copied behind a
+ * prefix buffer.
  */
-int hash_message(const xmss_params *params, unsigned char *out,
-                 const unsigned char *R, const unsigned char *root,
-                 unsigned long long idx,
-                 unsigned char *m_with_prefix, unsigned long long mlen)
+int hash_message_init(const xmss_params *params, core_hash_ctx *ctx,
+                      const unsigned char *R, const unsigned char *root,
+                      unsigned long long idx)
 {
     /* We're creating a hash using input of the form:
        toByte(X, 32) || R || root || index || M */
-    ull_to_bytes(m_with_prefix, params->padding_len, XMSS_HASH_PADDING_HASH);
-    memcpy(m_with_prefix + params->padding_len, R, params->n);
-    memcpy(m_with_prefix + params->padding_len + params->n, root, params->n);
-    ull_to_bytes(m_with_prefix + params->padding_len + 2*params->n, params->n, idx);
+    unsigned char prefix[4*XMSS_CORE_MAX_N];
 
-    return core_hash(params, out, m_with_prefix, mlen + params->padding_len + 3*params->n);
+    ull_to_bytes(prefix, params->padding_len, XMSS_HASH_PADDING_HASH);
+    memcpy(prefix + params->padding_len, R, params->n);
+    memcpy(prefix + params->padding_len + params->n, root, params->n);
+    ull_to_bytes(prefix + params->padding_len + 2*params->n, params->n, idx);
+
+    core_hash_inc_init(params, ctx);
+    core_hash_inc_update(params, ctx, prefix, params->padding_len + 3*params->n);
+
+    return 0;
 }
 
 /**
@@ -152,3 +156,56 @@ int thash_f(const xmss_params *params,
 
     return ret;
 }
+
+#ifdef XMSS_CORE_HASH_X4
+int thash_f_x4(const xmss_params *params,
+               unsigned char *out[4], const unsigned char *in[4],
+               const unsigned char *pub_seed, uint32_t addr[4][8])
+{
+    /* Per lane: toByte(0, padding_len) || KEY || (M XOR BM) */
+    unsigned char buf[4][3*XMSS_CORE_MAX_N];
+    /* Per lane: toByte(3, padding_len) || SEED || ADRS */
+    unsigned char prf_buf[4][2*XMSS_CORE_MAX_N + 32];
+    unsigned char bitmask[4][XMSS_CORE_MAX_N];
+
+    unsigned char *key[4];
+    unsigned char *mask[4];
+    const unsigned char *prf_in[4];
+    const unsigned char *f_in[4];
+    const unsigned long long prf_len = params->padding_len + params->n + 32;
+    unsigned int i, j;
+
+    for (j = 0; j < 4; j++) {
+        ull_to_bytes(buf[j], params->padding_len, XMSS_HASH_PADDING_F);
+        ull_to_bytes(prf_buf[j], params->padding_len, XMSS_HASH_PADDING_PRF);
+        memcpy(prf_buf[j] + params->padding_len, pub_seed, params->n);
+
+        key[j] = buf[j] + params->padding_len;
+        mask[j] = bitmask[j];
+        prf_in[j] = prf_buf[j];
+        f_in[j] = buf[j];
+    }
+
+    /* Generate the n-byte keys. */
+    for (j = 0; j < 4; j++) {
+        set_key_and_mask(addr[j], 0);
+        addr_to_bytes(prf_buf[j] + params->padding_len + params->n, addr[j]);
+    }
+    core_hash_x4(params, key, prf_in, prf_len);
+
+    /* Generate the n-byte masks. */
+    for (j = 0; j < 4; j++) {
+        set_key_and_mask(addr[j], 1);
+        addr_to_bytes(prf_buf[j] + params->padding_len + params->n, addr[j]);
+    }
+    core_hash_x4(params, mask, prf_in, prf_len);
+
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < params->n; i++) {
+            buf[j][params->padding_len + params->n + i] = in[j][i] ^ bitmask[j][i];
+        }
+    }
+
+    return core_hash_x4(params, out, f_in, params->padding_len + 2 * params->n);
+}
+#endif
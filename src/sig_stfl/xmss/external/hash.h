@@ -39,10 +39,20 @@ int thash_f(const xmss_params *params,
             const unsigned char *pub_seed, uint32_t addr[8],
             unsigned char *buf);
 
-#define hash_message XMSS_INNER_NAMESPACE(hash_message)
-int hash_message(const xmss_params *params, unsigned char *out,
-                 const unsigned char *R, const unsigned char *root,
-                 unsigned long long idx,
-                 unsigned char *m_with_prefix, unsigned long long mlen);
+#ifdef XMSS_CORE_HASH_X4
+/**
+ * Four thash_f evaluations at once, one per lane. The lanes share pub_seed
+ * but each has its own input and address.
+ */
+#define thash_f_x4 XMSS_INNER_NAMESPACE(thash_f_x4)
+int thash_f_x4(const xmss_params *params,
+               unsigned char *out[4], const unsigned char *in[4],
+               const unsigned char *pub_seed, uint32_t addr[4][8]);
+#endif
+
+#define hash_message_init XMSS_INNER_NAMESPACE(hash_message_init)
+int hash_message_init(const xmss_params *params, core_hash_ctx *ctx,
+                      const unsigned char *R, const unsigned char *root,
+                      unsigned long long idx);
 
 #endif
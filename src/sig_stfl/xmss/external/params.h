@@ -13,6 +13,9 @@
 /* This is a result of the OID definitions in the draft; needed for parsing. */
 #define XMSS_OID_LEN 4
 
+/* Largest hash output (n) and padding length of any supported parameter set. */
+#define XMSS_CORE_MAX_N 64
+
 /* This structure will be populated when calling xmss[mt]_parse_oid. */
 typedef struct {
     unsigned int func;
@@ -55,6 +55,91 @@ static void gen_chain(const xmss_params *params,
     }
 }
 
+#ifdef XMSS_CORE_HASH_X4
+/* Returns the next chain from *next on that still needs hashing, or wots_len. */
+static unsigned int take_chain(const xmss_params *params,
+                               const unsigned int *start, unsigned int *next)
+{
+    while (*next < params->wots_len && start[*next] >= params->wots_w - 1) {
+        (*next)++;
+    }
+    if (*next < params->wots_len) {
+        return (*next)++;
+    }
+    return params->wots_len;
+}
+
+/**
+ * Completes all chains of a WOTS signature, i.e. the same as calling
+ * gen_chain from start[i] up to w - 1 for every chain i, but four chains at a
+ * time using thash_f_x4. A lane that reaches the end of its chain picks up the
+ * next unfinished one, so the lanes stay busy although the chains differ in
+ * length.
+ */
+static void gen_chains_x4(const xmss_params *params,
+                          unsigned char *pk, const unsigned char *sig,
+                          const unsigned int *start,
+                          const unsigned char *pub_seed, const uint32_t addr[8])
+{
+    uint32_t lane_addr[4][8];
+    unsigned int lane_chain[4];
+    unsigned int lane_pos[4];
+    unsigned char *out[4];
+    const unsigned char *in[4];
+    /* Scratch for lanes that ran out of chains near the end. */
+    unsigned char idle[4][XMSS_CORE_MAX_N] = {{0}};
+    unsigned int next = 0;
+    unsigned int active = 0;
+    unsigned int j;
+
+    /* Initialize every chain with the value at its start position. */
+    memcpy(pk, sig, params->wots_sig_bytes);
+
+    for (j = 0; j < 4; j++) {
+        memcpy(lane_addr[j], addr, sizeof(lane_addr[j]));
+        lane_chain[j] = take_chain(params, start, &next);
+        if (lane_chain[j] < params->wots_len) {
+            set_chain_addr(lane_addr[j], lane_chain[j]);
+            lane_pos[j] = start[lane_chain[j]];
+            active++;
+        }
+    }
+
+    while (active > 0) {
+        for (j = 0; j < 4; j++) {
+            if (lane_chain[j] < params->wots_len) {
+                set_hash_addr(lane_addr[j], lane_pos[j]);
+                out[j] = pk + lane_chain[j]*params->n;
+            }
+            else {
+                out[j] = idle[j];
+            }
+            in[j] = out[j];
+        }
+
+        thash_f_x4(params, out, in, pub_seed, lane_addr);
+
+        for (j = 0; j < 4; j++) {
+            if (lane_chain[j] >= params->wots_len) {
+                continue;
+            }
+            lane_pos[j]++;
+            if (lane_pos[j] < params->wots_w - 1) {
+                continue;
+            }
+            lane_chain[j] = take_chain(params, start, &next);
+            if (lane_chain[j] < params->wots_len) {
+                set_chain_addr(lane_addr[j], lane_chain[j]);
+                lane_pos[j] = start[lane_chain[j]];
+            }
+            else {
+                active--;
+            }
+        }
+    }
+}
+#endif
+
 /**
  * base_w algorithm as described in draft.
  * Interprets an array of bytes as integers in base w.
@@ -197,11 +282,16 @@ void wots_pk_from_sig(const xmss_params *params, unsigned char *pk,
 
     chain_lengths(params, lengths, msg);
 
+#ifdef XMSS_CORE_HASH_X4
+    (void)i;
+    gen_chains_x4(params, pk, sig, lengths, pub_seed, addr);
+#else
     for (i = 0; i < params->wots_len; i++) {
         set_chain_addr(addr, i);
         gen_chain(params, pk + i*params->n, sig + i*params->n,
                   lengths[i], params->wots_w - 1 - lengths[i], pub_seed, addr, thash_buf);
     }
+#endif
 
     OQS_MEM_insecure_free(lengths);
     OQS_MEM_insecure_free(thash_buf);
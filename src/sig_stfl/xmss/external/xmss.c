@@ -96,6 +96,36 @@ int xmss_sign(unsigned char *sk,
 }
 #endif
 
+/**
+ * Incremental counterpart of xmss_sign: parses the OID from the secret key
+ * into params and reserves the next one-time key. The message is fed to
+ * xmss_core_sign_update and the signature completed by xmss_core_sign_final.
+ *
+ * @return 0 on success, -1 on a bad OID and -2 when the key is exhausted.
+ */
+#ifndef OQS_ALLOW_XMSS_KEY_AND_SIG_GEN
+int xmss_sign_init(XMSS_UNUSED_ATT xmss_params *params, XMSS_UNUSED_ATT xmss_sign_ctx *ctx,
+                   XMSS_UNUSED_ATT unsigned char *sk, XMSS_UNUSED_ATT unsigned char *sm)
+{
+    return -1;
+}
+#else
+int xmss_sign_init(xmss_params *params, xmss_sign_ctx *ctx,
+                   unsigned char *sk, unsigned char *sm)
+{
+    uint32_t oid = 0;
+    unsigned int i;
+
+    for (i = 0; i < XMSS_OID_LEN; i++) {
+        oid |= sk[XMSS_OID_LEN - i - 1] << (i * 8);
+    }
+    if (xmss_parse_oid(params, oid)) {
+        return -1;
+    }
+    return xmss_core_sign_init(params, ctx, sk + XMSS_OID_LEN, sm);
+}
+#endif
+
 /**
  * The function xmss_sign_open verifies a signature and retrieves the original message using the XMSS
  * signature scheme.
@@ -127,6 +157,26 @@ int xmss_sign_open(const unsigned char *m, unsigned long long mlen,
     return xmss_core_sign_open(&params, m, mlen, sm, smlen, pk + XMSS_OID_LEN);
 }
 
+/**
+ * Incremental counterpart of xmss_sign_open: parses the OID from the public
+ * key into params and starts hashing the message.
+ */
+int xmss_sign_open_init(xmss_params *params, xmss_verify_ctx *ctx,
+                        const unsigned char *sm, unsigned long long smlen,
+                        const unsigned char *pk)
+{
+    uint32_t oid = 0;
+    unsigned int i;
+
+    for (i = 0; i < XMSS_OID_LEN; i++) {
+        oid |= pk[XMSS_OID_LEN - i - 1] << (i * 8);
+    }
+    if (xmss_parse_oid(params, oid)) {
+        return -1;
+    }
+    return xmssmt_core_sign_open_init(params, ctx, sm, smlen, pk + XMSS_OID_LEN);
+}
+
 /**
  * The function calculates the remaining number of signatures that can be generated using a given XMSS
  * private key.
@@ -226,6 +276,21 @@ int xmssmt_sign(unsigned char *sk,
     return xmssmt_core_sign(&params, sk + XMSS_OID_LEN, sm, smlen, m, mlen);
 }
 
+int xmssmt_sign_init(xmss_params *params, xmss_sign_ctx *ctx,
+                     unsigned char *sk, unsigned char *sm)
+{
+    uint32_t oid = 0;
+    unsigned int i;
+
+    for (i = 0; i < XMSS_OID_LEN; i++) {
+        oid |= sk[XMSS_OID_LEN - i - 1] << (i * 8);
+    }
+    if (xmssmt_parse_oid(params, oid)) {
+        return -1;
+    }
+    return xmssmt_core_sign_init(params, ctx, sk + XMSS_OID_LEN, sm);
+}
+
 int xmssmt_sign_open(const unsigned char *m, unsigned long long mlen,
                      const unsigned char *sm, unsigned long long smlen,
                      const unsigned char *pk)
@@ -243,6 +308,22 @@ int xmssmt_sign_open(const unsigned char *m, unsigned long long mlen,
     return xmssmt_core_sign_open(&params, m, mlen, sm, smlen, pk + XMSS_OID_LEN);
 }
 
+int xmssmt_sign_open_init(xmss_params *params, xmss_verify_ctx *ctx,
+                          const unsigned char *sm, unsigned long long smlen,
+                          const unsigned char *pk)
+{
+    uint32_t oid = 0;
+    unsigned int i;
+
+    for (i = 0; i < XMSS_OID_LEN; i++) {
+        oid |= pk[XMSS_OID_LEN - i - 1] << (i * 8);
+    }
+    if (xmssmt_parse_oid(params, oid)) {
+        return -1;
+    }
+    return xmssmt_core_sign_open_init(params, ctx, sm, smlen, pk + XMSS_OID_LEN);
+}
+
 
 /**
  * The function calculates the remaining number of signatures that can be generated using a given
@@ -4,6 +4,8 @@
 
 #include <stdint.h>
 #include "namespace.h"
+#include "params.h"
+#include "xmss_core.h"
 
 /**
  * Generates a XMSS key pair for a given parameter set.
@@ -24,6 +26,16 @@ int xmss_sign(unsigned char *sk,
               unsigned char *sm, unsigned long long *smlen,
               const unsigned char *m, unsigned long long mlen);
 
+/**
+ * Starts an incremental XMSS signature, see xmss_core_sign_init.
+ * Parses the OID from sk into params; the signature is then completed with
+ * xmss_core_sign_update and xmss_core_sign_final using those params.
+ * sm must have room for params->sig_bytes bytes.
+ */
+#define xmss_sign_init XMSS_NAMESPACE(xmss_sign_init)
+int xmss_sign_init(xmss_params *params, xmss_sign_ctx *ctx,
+                   unsigned char *sk, unsigned char *sm);
+
 /**
  * Verifies a given message signature pair using a given public key.
  *
@@ -36,6 +48,16 @@ int xmss_sign_open(const unsigned char *m, unsigned long long mlen,
                    const unsigned char *sm, unsigned long long smlen,
                    const unsigned char *pk);
 
+/**
+ * Starts an incremental XMSS verification. Parses the OID from pk into
+ * params; continue with xmssmt_core_sign_open_update and
+ * xmssmt_core_sign_open_final.
+ */
+#define xmss_sign_open_init XMSS_NAMESPACE(xmss_sign_open_init)
+int xmss_sign_open_init(xmss_params *params, xmss_verify_ctx *ctx,
+                        const unsigned char *sm, unsigned long long smlen,
+                        const unsigned char *pk);
+
 /* 
  * Write number of remaining signature to `remain` variable given `sk`
  */
@@ -67,6 +89,13 @@ int xmssmt_sign(unsigned char *sk,
                 unsigned char *sm, unsigned long long *smlen,
                 const unsigned char *m, unsigned long long mlen);
 
+/**
+ * Starts an incremental XMSSMT signature, see xmss_sign_init.
+ */
+#define xmssmt_sign_init XMSS_NAMESPACE(xmssmt_sign_init)
+int xmssmt_sign_init(xmss_params *params, xmss_sign_ctx *ctx,
+                     unsigned char *sk, unsigned char *sm);
+
 /**
  * Verifies a given message signature pair using a given public key.
  *
@@ -79,6 +108,14 @@ int xmssmt_sign_open(const unsigned char *m, unsigned long long mlen,
                      const unsigned char *sm, unsigned long long smlen,
                      const unsigned char *pk);
 
+/**
+ * Starts an incremental XMSSMT verification, see xmss_sign_open_init.
+ */
+#define xmssmt_sign_open_init XMSS_NAMESPACE(xmssmt_sign_open_init)
+int xmssmt_sign_open_init(xmss_params *params, xmss_verify_ctx *ctx,
+                          const unsigned char *sm, unsigned long long smlen,
+                          const unsigned char *pk);
+
 /* 
  * Write number of remaining signature to `remain` variable given `sk`
  */
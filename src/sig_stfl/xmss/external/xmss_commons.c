@@ -9,6 +9,7 @@
 #include "wots.h"
 #include "utils.h"
 #include "xmss_commons.h"
+#include "xmss_core.h"
 
 /**
  * Computes a leaf node from a WOTS public key using an L-tree.
@@ -140,20 +141,52 @@ int xmss_core_sign_open(const xmss_params *params,
 }
 
 /**
- * Verifies a given message signature pair under a given public key.
- * Note that this assumes a pk without an OID, i.e. [root || PUB_SEED]
+ * Starts verifying a signature: checks its length and absorbs the prefix of
+ * the message hash. The message itself is fed to
+ * xmssmt_core_sign_open_update and the hypertree is walked by
+ * xmssmt_core_sign_open_final.
  */
-int xmssmt_core_sign_open(const xmss_params *params,
-                          const unsigned char *m, unsigned long long mlen,
-                          const unsigned char *sm, unsigned long long smlen,
-                          const unsigned char *pk)
+int xmssmt_core_sign_open_init(const xmss_params *params, xmss_verify_ctx *ctx,
+                               const unsigned char *sm, unsigned long long smlen,
+                               const unsigned char *pk)
+{
+    unsigned long long idx;
+
+    if (smlen < params->sig_bytes) {
+        return -1;
+    }
+
+    /* Convert the index bytes from the signature to an integer. */
+    idx = bytes_to_ull(sm, params->index_bytes);
+
+    ctx->sm = sm;
+    ctx->pk = pk;
+    return hash_message_init(params, &ctx->hash_ctx, sm + params->index_bytes, pk, idx);
+}
+
+int xmssmt_core_sign_open_update(const xmss_params *params, xmss_verify_ctx *ctx,
+                                 const unsigned char *m, unsigned long long mlen)
+{
+    core_hash_inc_update(params, &ctx->hash_ctx, m, mlen);
+    return 0;
+}
+
+void xmssmt_core_sign_open_release(const xmss_params *params, xmss_verify_ctx *ctx)
+{
+    core_hash_inc_release(params, &ctx->hash_ctx);
+}
+
+int xmssmt_core_sign_open_final(const xmss_params *params, xmss_verify_ctx *ctx)
 {
+    const unsigned char *sm = ctx->sm;
+    const unsigned char *pk = ctx->pk;
     const unsigned char *pub_root = pk;
     const unsigned char *pub_seed = pk + params->n;
 
     unsigned char *tmp = OQS_MEM_malloc(params->wots_sig_bytes + params->n + params->n +
                                 + 2 *params->n + 2 * params->padding_len + 6 * params->n + 32);
     if (tmp == NULL) {
+        xmssmt_core_sign_open_release(params, ctx);
         return -1;
     }
     unsigned char *wots_pk = tmp;
@@ -162,9 +195,6 @@ int xmssmt_core_sign_open(const xmss_params *params,
     unsigned char *compute_root_buf = root + params->n;
     unsigned char *thash_buf = compute_root_buf + 2*params->n;
 
-    unsigned long long prefix_length = params->padding_len + 3*params->n;
-    unsigned long long m_with_prefix_len = mlen + prefix_length;
-    unsigned char *m_with_prefix = NULL;
     unsigned char *mhash = root;
     unsigned long long idx = 0;
     unsigned int i, ret;
@@ -178,26 +208,10 @@ int xmssmt_core_sign_open(const xmss_params *params,
     set_type(ltree_addr, XMSS_ADDR_TYPE_LTREE);
     set_type(node_addr, XMSS_ADDR_TYPE_HASHTREE);
 
-    // Unused since smlen is a constant
-    (void) smlen;
-
-    if ((m_with_prefix_len == 0) || (m_with_prefix = OQS_MEM_malloc(m_with_prefix_len)) == NULL){
-        ret = -1;
-        goto fail;
-    }
-
-    /* Convert the index bytes from the signature to an integer. */
     idx = bytes_to_ull(sm, params->index_bytes);
 
-    /* Put the message at the m_with_prefix buffer, so that we can
-     * prepend the required other inputs for the hash function. */
-    memcpy(m_with_prefix, sm + params->sig_bytes - prefix_length, (size_t)prefix_length);
-    memcpy(m_with_prefix + prefix_length, m, (size_t)mlen);
-
     /* Compute the message hash. */
-    hash_message(params, mhash, sm + params->index_bytes, pk, idx,
-                m_with_prefix,
-                 mlen);
+    core_hash_inc_final(params, &ctx->hash_ctx, mhash);
     sm += params->index_bytes + params->n;
 
     /* For each subtree.. */
@@ -238,7 +252,25 @@ int xmssmt_core_sign_open(const xmss_params *params,
     ret = 0;
 fail:
     OQS_MEM_insecure_free(tmp);
-    OQS_MEM_insecure_free(m_with_prefix);
     return ret;
 
 }
+
+/**
+ * Verifies a given message signature pair under a given public key.
+ * Note that this assumes a pk without an OID, i.e. [root || PUB_SEED]
+ */
+int xmssmt_core_sign_open(const xmss_params *params,
+                          const unsigned char *m, unsigned long long mlen,
+                          const unsigned char *sm, unsigned long long smlen,
+                          const unsigned char *pk)
+{
+    xmss_verify_ctx ctx;
+
+    if (xmssmt_core_sign_open_init(params, &ctx, sm, smlen, pk)) {
+        return -1;
+    }
+    xmssmt_core_sign_open_update(params, &ctx, m, mlen);
+
+    return xmssmt_core_sign_open_final(params, &ctx);
+}
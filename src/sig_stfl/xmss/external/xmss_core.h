@@ -2,7 +2,33 @@
 #ifndef XMSS_CORE_H
 #define XMSS_CORE_H
 
+#include <stdint.h>
 #include "params.h"
+#include "core_hash.h"
+
+/**
+ * State of a signature that is being produced incrementally. Everything but
+ * the bottom WOTS signature is written to sm (and the secret key updated) by
+ * xmss[mt]_core_sign_init; the message is then streamed into the hash and the
+ * remaining WOTS signature is filled in by xmss_core_sign_final.
+ */
+typedef struct {
+    core_hash_ctx hash_ctx;
+    unsigned char *sm;
+    unsigned char sk_seed[XMSS_CORE_MAX_N];
+    unsigned char pub_seed[XMSS_CORE_MAX_N];
+    uint32_t ots_addr[8];
+} xmss_sign_ctx;
+
+/**
+ * State of a signature that is being verified incrementally. sm and pk must
+ * stay valid until xmssmt_core_sign_open_final returns.
+ */
+typedef struct {
+    core_hash_ctx hash_ctx;
+    const unsigned char *sm;
+    const unsigned char *pk;
+} xmss_verify_ctx;
 
 /**
  * Given a set of parameters, this function returns the size of the secret key.
@@ -33,6 +59,36 @@ int xmss_core_sign(const xmss_params *params,
                    unsigned char *sm, unsigned long long *smlen,
                    const unsigned char *m, unsigned long long mlen);
 
+/**
+ * Incremental form of xmss_core_sign: reserves the next index in sk and
+ * prepares everything in sm but the one-time signature on the message.
+ */
+#define xmss_core_sign_init XMSS_INNER_NAMESPACE(xmss_core_sign_init)
+int xmss_core_sign_init(const xmss_params *params, xmss_sign_ctx *ctx,
+                        unsigned char *sk, unsigned char *sm);
+
+/**
+ * Absorbs the next piece of the message. Shared by XMSS and XMSSMT.
+ */
+#define xmss_core_sign_update XMSS_INNER_NAMESPACE(xmss_core_sign_update)
+int xmss_core_sign_update(const xmss_params *params, xmss_sign_ctx *ctx,
+                          const unsigned char *m, unsigned long long mlen);
+
+/**
+ * Completes the signature in ctx->sm and wipes the seeds held by ctx.
+ * Shared by XMSS and XMSSMT.
+ */
+#define xmss_core_sign_final XMSS_INNER_NAMESPACE(xmss_core_sign_final)
+int xmss_core_sign_final(const xmss_params *params, xmss_sign_ctx *ctx,
+                         unsigned long long *smlen);
+
+/**
+ * Abandons an incremental signature before xmss_core_sign_final. The index
+ * reserved by the init call stays consumed.
+ */
+#define xmss_core_sign_release XMSS_INNER_NAMESPACE(xmss_core_sign_release)
+void xmss_core_sign_release(const xmss_params *params, xmss_sign_ctx *ctx);
+
 /**
  * Verifies a given message signature pair under a given public key.
  * Note that this assumes a pk without an OID, i.e. [root || PUB_SEED]
@@ -73,6 +129,14 @@ int xmssmt_core_sign(const xmss_params *params,
                      unsigned char *sm, unsigned long long *smlen,
                      const unsigned char *m, unsigned long long mlen);
 
+/**
+ * Incremental form of xmssmt_core_sign, see xmss_core_sign_init. Continue
+ * with xmss_core_sign_update and xmss_core_sign_final.
+ */
+#define xmssmt_core_sign_init XMSS_INNER_NAMESPACE(xmssmt_core_sign_init)
+int xmssmt_core_sign_init(const xmss_params *params, xmss_sign_ctx *ctx,
+                          unsigned char *sk, unsigned char *sm);
+
 /**
  * Verifies a given message signature pair under a given public key.
  * Note that this assumes a pk without an OID, i.e. [root || PUB_SEED]
@@ -83,4 +147,24 @@ int xmssmt_core_sign_open(const xmss_params *params,
                           const unsigned char *sm, unsigned long long smlen,
                           const unsigned char *pk);
 
+/**
+ * Incremental form of xmss[mt]_core_sign_open. The init call checks the
+ * signature length and hashes the signature prefix, the message is streamed
+ * in with the update call and the final call walks the hypertree.
+ */
+#define xmssmt_core_sign_open_init XMSS_INNER_NAMESPACE(xmssmt_core_sign_open_init)
+int xmssmt_core_sign_open_init(const xmss_params *params, xmss_verify_ctx *ctx,
+                               const unsigned char *sm, unsigned long long smlen,
+                               const unsigned char *pk);
+
+#define xmssmt_core_sign_open_update XMSS_INNER_NAMESPACE(xmssmt_core_sign_open_update)
+int xmssmt_core_sign_open_update(const xmss_params *params, xmss_verify_ctx *ctx,
+                                 const unsigned char *m, unsigned long long mlen);
+
+#define xmssmt_core_sign_open_final XMSS_INNER_NAMESPACE(xmssmt_core_sign_open_final)
+int xmssmt_core_sign_open_final(const xmss_params *params, xmss_verify_ctx *ctx);
+
+#define xmssmt_core_sign_open_release XMSS_INNER_NAMESPACE(xmssmt_core_sign_open_release)
+void xmssmt_core_sign_open_release(const xmss_params *params, xmss_verify_ctx *ctx);
+
 #endif
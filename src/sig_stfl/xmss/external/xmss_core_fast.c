@@ -627,16 +627,14 @@ int xmss_core_keypair(const xmss_params *params,
 }
 
 /**
- * Signs a message.
- * Returns
- * 1. an array containing the signature followed by the message AND
- * 2. an updated secret key!
- *
+ * Starts signing a message.
+ * Reserves the next index in sk, writes the index, R and the authentication
+ * path into sm and advances the BDS state, so that the updated secret key
+ * can be stored before the message is even seen. The WOTS signature on the
+ * message hash is left for xmss_core_sign_final.
  */
-int xmss_core_sign(const xmss_params *params,
-                   unsigned char *sk,
-                   unsigned char *sm, unsigned long long *smlen,
-                   const unsigned char *m, unsigned long long mlen)
+int xmss_core_sign_init(const xmss_params *params, xmss_sign_ctx *ctx,
+                        unsigned char *sk, unsigned char *sm)
 {
     if (params->full_height > 60) {
         // Unsupport Tree height
@@ -655,6 +653,8 @@ int xmss_core_sign(const xmss_params *params,
     treehash_inst *treehash = OQS_MEM_calloc(params->tree_height - params->bds_k, sizeof(treehash_inst));
     unsigned char *tmp = OQS_MEM_malloc(tmp_size);
     if (treehash == NULL || tmp == NULL) {
+        OQS_MEM_insecure_free(treehash);
+        OQS_MEM_insecure_free(tmp);
         return -1;
     }
 
@@ -687,9 +687,9 @@ int xmss_core_sign(const xmss_params *params,
         }
     }
 
-    unsigned char *sk_seed = tmp;
-    unsigned char *sk_prf = sk_seed + params->n;
-    unsigned char *pub_seed = sk_prf + params->n;
+    unsigned char *sk_seed = ctx->sk_seed;
+    unsigned char *sk_prf = tmp;
+    unsigned char *pub_seed = ctx->pub_seed;
 
     memcpy(sk_seed, sk + params->index_bytes, params->n);
     memcpy(sk_prf, sk + params->index_bytes + params->n, params->n);
@@ -709,9 +709,8 @@ int xmss_core_sign(const xmss_params *params,
     //  and write the updated secret key at this point!
 
     // Init working params
-    unsigned char *R = pub_seed + params->n;
-    unsigned char *msg_h = R + params->n;
-    unsigned char *prf_buf = msg_h + params->n;
+    unsigned char *R = sk_prf + params->n;
+    unsigned char *prf_buf = R + params->n;
     uint32_t ots_addr[8] = {0};
 
     // ---------------------------------
@@ -722,24 +721,11 @@ int xmss_core_sign(const xmss_params *params,
     // First compute pseudorandom value
     prf(params, R, idx_bytes_32, sk_prf, prf_buf);
 
-    /* Already put the message in the right place, to make it easier to prepend
-     * things when computing the hash over the message. */
-    unsigned long long prefix_length = params->padding_len + 3*params->n;
-    unsigned char *m_with_prefix = OQS_MEM_malloc((size_t)(mlen + prefix_length));
-    if (m_with_prefix == NULL) {
-        ret = -1;
-        goto cleanup;
-    }
-    memcpy(m_with_prefix, sm + params->sig_bytes - prefix_length, (size_t)prefix_length);
-    memcpy(m_with_prefix + prefix_length, m, (size_t)mlen);
-
-    /* Compute the message hash. */
-    hash_message(params, msg_h, R, pub_root, idx,
-                 m_with_prefix,
-                 mlen);
+    /* Absorb the prefix; the message follows in xmss_core_sign_update. */
+    hash_message_init(params, &ctx->hash_ctx, R, pub_root, idx);
 
     // Start collecting signature
-    *smlen = 0;
+    ctx->sm = sm;
 
     // Copy index to signature
     sm[0] = (idx >> 24) & 255;
@@ -748,7 +734,6 @@ int xmss_core_sign(const xmss_params *params,
     sm[3] = idx & 255;
 
     sm += 4;
-    *smlen += 4;
 
     // Copy R to signature
     for (i = 0; i < params->n; i++) {
@@ -756,21 +741,14 @@ int xmss_core_sign(const xmss_params *params,
     }
 
     sm += params->n;
-    *smlen += params->n;
 
-    // ----------------------------------
-    // Now we start to "really sign"
-    // ----------------------------------
-
-    // Prepare Address
-    set_type(ots_addr, 0);
-    set_ots_addr(ots_addr, (uint32_t) idx);
-
-    // Compute WOTS signature
-    wots_sign(params, sm, msg_h, sk_seed, pub_seed, ots_addr);
+    // Prepare Address of the WOTS key that will sign the message
+    memset(ctx->ots_addr, 0, sizeof(ctx->ots_addr));
+    set_type(ctx->ots_addr, 0);
+    set_ots_addr(ctx->ots_addr, (uint32_t) idx);
 
+    // Leave room for the WOTS signature
     sm += params->wots_sig_bytes;
-    *smlen += params->wots_sig_bytes;
 
     // the auth path was already computed during the previous round
     memcpy(sm, state.auth, params->tree_height*params->n);
@@ -780,15 +758,11 @@ int xmss_core_sign(const xmss_params *params,
         bds_treehash_update(params, &state, (params->tree_height - params->bds_k) >> 1, sk_seed, pub_seed, ots_addr);
     }
 
-    *smlen += params->tree_height*params->n;
-
     /* Write the updated BDS state back into sk. */
     xmss_serialize_state(params, sk, &state);
 
     ret = 0;
 
-    OQS_MEM_insecure_free(m_with_prefix);
-
 cleanup:
     OQS_MEM_secure_free(tmp, tmp_size);
     OQS_MEM_secure_free(treehash, treehash_size);
@@ -796,6 +770,64 @@ cleanup:
     return ret;
 }
 
+int xmss_core_sign_update(const xmss_params *params, xmss_sign_ctx *ctx,
+                          const unsigned char *m, unsigned long long mlen)
+{
+    core_hash_inc_update(params, &ctx->hash_ctx, m, mlen);
+    return 0;
+}
+
+int xmss_core_sign_final(const xmss_params *params, xmss_sign_ctx *ctx,
+                         unsigned long long *smlen)
+{
+    unsigned char msg_h[XMSS_CORE_MAX_N];
+
+    core_hash_inc_final(params, &ctx->hash_ctx, msg_h);
+
+    // ----------------------------------
+    // Now we start to "really sign"
+    // ----------------------------------
+
+    // Compute WOTS signature
+    wots_sign(params, ctx->sm + params->index_bytes + params->n, msg_h,
+              ctx->sk_seed, ctx->pub_seed, ctx->ots_addr);
+
+    *smlen = params->sig_bytes;
+
+    OQS_MEM_cleanse(ctx->sk_seed, sizeof(ctx->sk_seed));
+    return 0;
+}
+
+void xmss_core_sign_release(const xmss_params *params, xmss_sign_ctx *ctx)
+{
+    core_hash_inc_release(params, &ctx->hash_ctx);
+    OQS_MEM_cleanse(ctx->sk_seed, sizeof(ctx->sk_seed));
+}
+
+/**
+ * Signs a message.
+ * Returns
+ * 1. an array containing the signature followed by the message AND
+ * 2. an updated secret key!
+ *
+ */
+int xmss_core_sign(const xmss_params *params,
+                   unsigned char *sk,
+                   unsigned char *sm, unsigned long long *smlen,
+                   const unsigned char *m, unsigned long long mlen)
+{
+    xmss_sign_ctx ctx;
+    int ret;
+
+    ret = xmss_core_sign_init(params, &ctx, sk, sm);
+    if (ret) {
+        return ret;
+    }
+    xmss_core_sign_update(params, &ctx, m, mlen);
+
+    return xmss_core_sign_final(params, &ctx, smlen);
+}
+
 /*
  * Generates a XMSSMT key pair for a given parameter set.
  * Format sk: [(ceil(h/8) bit) idx || SK_SEED || SK_PRF || root || PUB_SEED]
@@ -861,21 +893,20 @@ int xmssmt_core_keypair(const xmss_params *params,
 }
 
 /**
- * Signs a message.
- * Returns
- * 1. an array containing the signature followed by the message AND
- * 2. an updated secret key!
- *
+ * Starts signing a message, see xmss_core_sign_init.
+ * Besides the bottom layer this copies the cached WOTS signatures and
+ * authentication paths of the upper layers into sm and performs all BDS and
+ * next-tree updates, so only the bottom WOTS signature is left for
+ * xmss_core_sign_final.
  */
-int xmssmt_core_sign(const xmss_params *params,
-                     unsigned char *sk,
-                     unsigned char *sm, unsigned long long *smlen,
-                     const unsigned char *m, unsigned long long mlen)
+int xmssmt_core_sign_init(const xmss_params *params, xmss_sign_ctx *ctx,
+                          unsigned char *sk, unsigned char *sm)
 {
     if (params == NULL || params->full_height > 60) {
         // Unsupport parameter
         return -1;
     }
+    ctx->sm = NULL;
 
     const unsigned char *pub_root = sk + params->index_bytes + 2*params->n;
 
@@ -895,23 +926,22 @@ int xmssmt_core_sign(const xmss_params *params,
     unsigned char *tmp = OQS_MEM_malloc(5 * params->n +
                                 params->padding_len + params->n + 32);
     if (states == NULL || treehash == NULL || tmp == NULL) {
+        OQS_MEM_insecure_free(states);
+        OQS_MEM_insecure_free(treehash);
+        OQS_MEM_insecure_free(tmp);
         return -1;
     }
-    unsigned char *sk_seed = tmp;
-    unsigned char *sk_prf = sk_seed + params->n;
-    unsigned char *pub_seed = sk_prf + params->n;
+    unsigned char *sk_seed = ctx->sk_seed;
+    unsigned char *sk_prf = tmp;
+    unsigned char *pub_seed = ctx->pub_seed;
     // Init working params
-    unsigned char *R = pub_seed + params->n;
-    unsigned char *msg_h = R + params->n;
-    unsigned char *prf_buf = msg_h + params->n;
+    unsigned char *R = sk_prf + params->n;
+    unsigned char *prf_buf = R + params->n;
     uint32_t addr[8] = {0};
     uint32_t ots_addr[8] = {0};
     unsigned char idx_bytes_32[32];
 
     unsigned char *wots_sigs = NULL;
-    unsigned long long prefix_length = params->padding_len + 3*params->n;
-    unsigned long long m_with_prefix_len = mlen + prefix_length;
-    unsigned char *m_with_prefix = NULL;
     int ret = 0;
 
     for (i = 0; i < 2*params->d - 1; i++) {
@@ -925,11 +955,6 @@ int xmssmt_core_sign(const xmss_params *params,
         states[i].next_leaf = 0;
     }
 
-    if ((m_with_prefix_len == 0) || (m_with_prefix = OQS_MEM_malloc(m_with_prefix_len)) == NULL) {
-        ret = -1;
-        goto cleanup;
-    }
-
     xmssmt_deserialize_state(params, states, &wots_sigs, sk);
 
     // Extract SK
@@ -982,18 +1007,11 @@ int xmssmt_core_sign(const xmss_params *params,
     ull_to_bytes(idx_bytes_32, 32, idx);
     prf(params, R, idx_bytes_32, sk_prf, prf_buf);
 
-    /* Already put the message in the right place, to make it easier to prepend
-     * things when computing the hash over the message. */
-    memcpy(m_with_prefix, sm + params->sig_bytes - prefix_length, prefix_length);
-    memcpy(m_with_prefix + prefix_length, m, mlen);
-
-    /* Compute the message hash. */
-    hash_message(params, msg_h, R, pub_root, idx,
-                m_with_prefix,
-                 mlen);
+    /* Absorb the prefix; the message follows in xmss_core_sign_update. */
+    hash_message_init(params, &ctx->hash_ctx, R, pub_root, idx);
 
     // Start collecting signature
-    *smlen = 0;
+    ctx->sm = sm;
 
     // Copy index to signature
     for (i = 0; i < params->index_bytes; i++) {
@@ -1001,7 +1019,6 @@ int xmssmt_core_sign(const xmss_params *params,
     }
 
     sm += params->index_bytes;
-    *smlen += params->index_bytes;
 
     // Copy R to signature
     for (i = 0; i < params->n; i++) {
@@ -1009,7 +1026,6 @@ int xmssmt_core_sign(const xmss_params *params,
     }
 
     sm += params->n;
-    *smlen += params->n;
 
     // ----------------------------------
     // Now we start to "really sign"
@@ -1025,15 +1041,12 @@ int xmssmt_core_sign(const xmss_params *params,
     set_tree_addr(ots_addr, idx_tree);
     set_ots_addr(ots_addr, idx_leaf);
 
-    // Compute WOTS signature
-    wots_sign(params, sm, msg_h, sk_seed, pub_seed, ots_addr);
-
+    // The WOTS signature on the message is computed in xmss_core_sign_final
+    memcpy(ctx->ots_addr, ots_addr, sizeof(ctx->ots_addr));
     sm += params->wots_sig_bytes;
-    *smlen += params->wots_sig_bytes;
 
     memcpy(sm, states[0].auth, params->tree_height*params->n);
     sm += params->tree_height*params->n;
-    *smlen += params->tree_height*params->n;
 
     // prepare signature of remaining layers
     for (i = 1; i < params->d; i++) {
@@ -1041,7 +1054,6 @@ int xmssmt_core_sign(const xmss_params *params,
         memcpy(sm, wots_sigs + (i-1)*params->wots_sig_bytes, params->wots_sig_bytes);
 
         sm += params->wots_sig_bytes;
-        *smlen += params->wots_sig_bytes;
 
         // put AUTH nodes in place
         if (states[i].auth == NULL) {
@@ -1050,7 +1062,6 @@ int xmssmt_core_sign(const xmss_params *params,
         }
         memcpy(sm, states[i].auth, params->tree_height*params->n);
         sm += params->tree_height*params->n;
-        *smlen += params->tree_height*params->n;
     }
 
     updates = (params->tree_height - params->bds_k) >> 1;
@@ -1107,7 +1118,33 @@ cleanup:
     OQS_MEM_secure_free(treehash, treehash_size);
     OQS_MEM_secure_free(states, states_size);
     OQS_MEM_secure_free(tmp, tmp_size);
-    OQS_MEM_insecure_free(m_with_prefix);
+    if (ret != 0 && ctx->sm != NULL) {
+        xmss_core_sign_release(params, ctx);
+    }
 
     return ret;
 }
+
+/**
+ * Signs a message.
+ * Returns
+ * 1. an array containing the signature followed by the message AND
+ * 2. an updated secret key!
+ *
+ */
+int xmssmt_core_sign(const xmss_params *params,
+                     unsigned char *sk,
+                     unsigned char *sm, unsigned long long *smlen,
+                     const unsigned char *m, unsigned long long mlen)
+{
+    xmss_sign_ctx ctx;
+    int ret;
+
+    ret = xmssmt_core_sign_init(params, &ctx, sk, sm);
+    if (ret) {
+        return ret;
+    }
+    xmss_core_sign_update(params, &ctx, m, mlen);
+
+    return xmss_core_sign_final(params, &ctx, smlen);
+}
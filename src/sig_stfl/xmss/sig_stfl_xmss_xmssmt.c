@@ -16,14 +16,16 @@
 
 // macro to en/disable OQS_SIG_STFL-only structs used only in sig&gen case:
 #ifdef OQS_ALLOW_XMSS_KEY_AND_SIG_GEN
-#define XMSS_SIGGEN(xmss_v, XMSS_V) \
+#define XMSS_SIGGEN(mt, xmss_v, XMSS_V) \
         sig->oid = OQS_SIG_STFL_alg_xmss##xmss_v##_oid; \
         sig->sigs_remaining = OQS_SIG_STFL_alg_xmss##xmss_v##_sigs_remaining;\
         sig->sigs_total = OQS_SIG_STFL_alg_xmss##xmss_v##_sigs_total;\
         sig->keypair = OQS_SIG_STFL_alg_xmss##xmss_v##_keypair;\
-        sig->sign = OQS_SIG_STFL_alg_xmss##xmss_v##_sign;
+        sig->sign = OQS_SIG_STFL_alg_xmss##xmss_v##_sign;\
+        sig->sign_init = OQS_SIG_STFL_alg_xmss##mt##_sign_init;\
+        sig->verify_init = OQS_SIG_STFL_alg_xmss##mt##_verify_init;
 #else
-#define XMSS_SIGGEN(xmss_v, XMSS_V)
+#define XMSS_SIGGEN(mt, xmss_v, XMSS_V)
 #endif
 
 // generator for all alg-specific functions:
@@ -36,7 +38,7 @@ OQS_SIG_STFL *OQS_SIG_STFL_alg_xmss##xmss_v##_new(void) { \
         } \
         memset(sig, 0, sizeof(OQS_SIG_STFL)); \
 \
-        XMSS_SIGGEN(xmss_v, XMSS_V) \
+        XMSS_SIGGEN(mt, xmss_v, XMSS_V) \
         sig->method_name = OQS_SIG_STFL_alg_xmss##xmss_v; \
         sig->alg_version = "https://datatracker.ietf.org/doc/html/rfc8391"; \
         sig->euf_cma = true; \
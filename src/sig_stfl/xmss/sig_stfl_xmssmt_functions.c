@@ -84,6 +84,164 @@ OQS_API OQS_STATUS OQS_SIG_STFL_alg_xmssmt_verify(XMSS_UNUSED_ATT const uint8_t
 	return OQS_SUCCESS;
 }
 
+/* -------------- Incremental XMSSMT -------------- */
+typedef struct {
+	xmss_params params;
+	xmss_sign_ctx sign_ctx;
+	xmss_verify_ctx verify_ctx;
+	bool finished;
+} xmssmt_inc_data;
+
+static OQS_STATUS xmssmt_inc_update(OQS_SIG_STFL_INC_CTX *ctx, const uint8_t *message_chunk, size_t chunk_len) {
+	xmssmt_inc_data *data = (xmssmt_inc_data *)ctx->inc_data;
+
+	if (data == NULL || data->finished) {
+		return OQS_ERROR;
+	}
+
+	if (ctx->is_signing) {
+		xmss_core_sign_update(&data->params, &data->sign_ctx, message_chunk, (unsigned long long)chunk_len);
+	} else {
+		xmssmt_core_sign_open_update(&data->params, &data->verify_ctx, message_chunk, (unsigned long long)chunk_len);
+	}
+
+	return OQS_SUCCESS;
+}
+
+static OQS_STATUS xmssmt_inc_final(OQS_SIG_STFL_INC_CTX *ctx) {
+	xmssmt_inc_data *data = (xmssmt_inc_data *)ctx->inc_data;
+	unsigned long long sig_length = 0;
+
+	if (data == NULL || data->finished) {
+		return OQS_ERROR;
+	}
+	data->finished = true;
+
+	if (ctx->is_signing) {
+		if (xmss_core_sign_final(&data->params, &data->sign_ctx, &sig_length)) {
+			return OQS_ERROR;
+		}
+		ctx->length_signature = (size_t)sig_length;
+		return OQS_SUCCESS;
+	}
+
+	if (xmssmt_core_sign_open_final(&data->params, &data->verify_ctx)) {
+		return OQS_ERROR;
+	}
+	return OQS_SUCCESS;
+}
+
+static void xmssmt_inc_free(OQS_SIG_STFL_INC_CTX *ctx) {
+	xmssmt_inc_data *data = (xmssmt_inc_data *)ctx->inc_data;
+
+	if (data == NULL) {
+		return;
+	}
+
+	if (!data->finished) {
+		if (ctx->is_signing) {
+			xmss_core_sign_release(&data->params, &data->sign_ctx);
+		} else {
+			xmssmt_core_sign_open_release(&data->params, &data->verify_ctx);
+		}
+	}
+
+	OQS_MEM_secure_free(data, sizeof(xmssmt_inc_data));
+	ctx->inc_data = NULL;
+}
+
+#ifndef OQS_ALLOW_STFL_KEY_AND_SIG_GEN
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_xmssmt_sign_init(XMSS_UNUSED_ATT OQS_SIG_STFL_INC_CTX *ctx, XMSS_UNUSED_ATT OQS_SIG_STFL_SECRET_KEY *secret_key) {
+	return OQS_ERROR;
+}
+#else
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_xmssmt_sign_init(OQS_SIG_STFL_INC_CTX *ctx, OQS_SIG_STFL_SECRET_KEY *secret_key) {
+
+	OQS_STATUS status = OQS_ERROR;
+	xmssmt_inc_data *data = NULL;
+	uint8_t *sk_key_buf_ptr = NULL;
+	size_t sk_key_buf_len = 0;
+
+	if (ctx == NULL || ctx->signature == NULL || secret_key == NULL || secret_key->secret_key_data == NULL) {
+		return OQS_ERROR;
+	}
+
+	/* Don't even attempt signing without a way to safe the updated private key */
+	if (secret_key->secure_store_scrt_key == NULL) {
+		return OQS_ERROR;
+	}
+
+	data = OQS_MEM_calloc(1, sizeof(xmssmt_inc_data));
+	if (data == NULL) {
+		return OQS_ERROR;
+	}
+
+	/* Lock secret to ensure OTS use */
+	if (OQS_SECRET_KEY_XMSS_acquire_lock(secret_key) != OQS_SUCCESS) {
+		OQS_MEM_secure_free(data, sizeof(xmssmt_inc_data));
+		return OQS_ERROR;
+	}
+
+	if (xmssmt_sign_init(&data->params, &data->sign_ctx, secret_key->secret_key_data, ctx->signature)) {
+		OQS_MEM_secure_free(data, sizeof(xmssmt_inc_data));
+		goto err;
+	}
+
+	/* From here on the context owns the hash state, even if storing the key fails */
+	ctx->inc_data = data;
+	ctx->update = xmssmt_inc_update;
+	ctx->final = xmssmt_inc_final;
+	ctx->free_data = xmssmt_inc_free;
+
+	/*
+	 * The one-time key is reserved; store the updated private key before
+	 * any part of the message is signed.
+	 */
+	status = OQS_SECRET_KEY_XMSS_inner_serialize_key(&sk_key_buf_ptr, &sk_key_buf_len, secret_key);
+	if (status != OQS_SUCCESS) {
+		goto err;
+	}
+
+	// Store updated private key securely
+	status = secret_key->secure_store_scrt_key(sk_key_buf_ptr, sk_key_buf_len, secret_key->context);
+	OQS_MEM_secure_free(sk_key_buf_ptr, sk_key_buf_len);
+
+err:
+	/* Unlock the key if possible */
+	if (OQS_SECRET_KEY_XMSS_release_lock(secret_key) != OQS_SUCCESS) {
+		return OQS_ERROR;
+	}
+
+	return status;
+}
+#endif
+
+OQS_API OQS_STATUS OQS_SIG_STFL_alg_xmssmt_verify_init(OQS_SIG_STFL_INC_CTX *ctx) {
+
+	xmssmt_inc_data *data = NULL;
+
+	if (ctx == NULL || ctx->signature == NULL || ctx->public_key == NULL) {
+		return OQS_ERROR;
+	}
+
+	data = OQS_MEM_calloc(1, sizeof(xmssmt_inc_data));
+	if (data == NULL) {
+		return OQS_ERROR;
+	}
+
+	if (xmssmt_sign_open_init(&data->params, &data->verify_ctx, ctx->signature, (unsigned long long)ctx->length_signature, ctx->public_key)) {
+		OQS_MEM_insecure_free(data);
+		return OQS_ERROR;
+	}
+
+	ctx->inc_data = data;
+	ctx->update = xmssmt_inc_update;
+	ctx->final = xmssmt_inc_final;
+	ctx->free_data = xmssmt_inc_free;
+
+	return OQS_SUCCESS;
+}
+
 OQS_API OQS_STATUS OQS_SIG_STFL_alg_xmssmt_sigs_remaining(unsigned long long *remain, const OQS_SIG_STFL_SECRET_KEY *secret_key) {
 	if (remain == NULL || secret_key == NULL || secret_key->secret_key_data == NULL) {
 		return OQS_ERROR;
@@ -1,217 +1,54 @@
 #include "client.h"
 
-void client_cleanup(Client* client)
+int handshake_client(Client* client, Server_Keys* ser_keys, Transport* t, unsigned char* session_key)
 {
-    if (!client) return;
-
-    if (client->ecc_private_key) {
-        EC_KEY_free(client->ecc_private_key);
-        client->ecc_private_key = NULL;
-    }
-
-    if (client->ecc_public_key) {
-        EC_KEY_free(client->ecc_public_key);
-        client->ecc_public_key = NULL;
-    }
-
-    if (client->dilithium_private_key) {
-        OQS_MEM_cleanse(client->dilithium_private_key, OQS_SIG_dilithium_2_length_secret_key);
-    }
-
-    client->is_initialized = FALSE;
-
-    SAFE_AES_KEY_MEMSET(client->aes_key);
-    EVP_cleanup();
-    ERR_free_strings();
-}
-
-int client_init(Client* client)
-{
-    if (!client) {
-        return FALSE;
-    }
-    if (client->is_initialized == TRUE)
-    {
-        return TRUE;
-    }
-
-    int rc = generate_aes_key(client->aes_key, AES_KEY_SIZE);
-    if (rc != TRUE)
-    {
-        printf("aes keys generation failed!");
-        client_cleanup(client);
-        return FALSE;
-    }
-    
-    rc = generate_ecc_keys(&client->ecc_private_key, &client->ecc_public_key);
-    if (rc != TRUE)
-    {
-        printf("ecc keys generation failed!");
-        client_cleanup(client);
-        return FALSE;
-    }
-
-    rc = generate_dilithium_keys(&client->dilithium_private_key, &client->dilithium_public_key);
-    if (rc != TRUE)
-    {
-        printf("dilithium keys generation failed!");
-        client_cleanup(client);
-        return FALSE;
-    }
-
-    // Initialize function pointers
-    client->cleanup = client_cleanup;
-
-    client->is_initialized = TRUE;
-    return TRUE;
-}
-
-int public_key_exchange_client(Client* client, Server_Keys* ser_keys, int client_fd, struct sockaddr_in server_addr)
-{
-    size_t key_len = 0;
-    char* server_message = NULL;
-    
-    // Recieve the RSA Key
-    print_header_and_free(client_fd, server_addr, &server_message, &key_len);
-    receive_and_send(client_fd, server_addr, &server_message, &key_len);
-    if (server_message) {
-        // Deserialize the public key
-        ser_keys->rsa_public_key = deserialize_rsa_key(server_message, key_len);
-        if (ser_keys->rsa_public_key) {
-            printf("RSA public key successfully deserialized!\n");
-        }
-        else {
-            fprintf(stderr, "Failed to deserialize RSA public key\n");
-            return FALSE;
+    ClientHandshake h;
+    ProtocolEvent event = PROTOCOL_WANT_INPUT;
+    ProtocolRecord out;
+    unsigned char* record = NULL;
+    size_t record_len = 0;
+
+    client_handshake_init(&h, client, ser_keys);
+    while (event == PROTOCOL_WANT_INPUT) {
+        if (transport_recv(t, &record, &record_len) != TRUE) {
+            event = PROTOCOL_FAILED;
+            break;
         }
-    }
-
-    // Recieve the ECC Key
-    print_header_and_free(client_fd, server_addr, &server_message, &key_len);
-    receive_and_send(client_fd, server_addr, &server_message, &key_len);
-    if (server_message) {
-        ser_keys->ecc_public_key = deserialize_ecc_key(server_message, key_len);
-        if (ser_keys->ecc_public_key) {
-            printf("ECC public key successfully deserialized!\n");
-        }
-        else {
-            fprintf(stderr, "Failed to deserialize ECC public key\n");
-            return FALSE;
+        event = client_handshake_input(&h, record, record_len);
+        // the flight goes out once the last key is in
+        while (event != PROTOCOL_FAILED && protocol_next_output(&h.output, &out) == TRUE) {
+            if (transport_send(t, out.data, out.len) != TRUE) {
+                event = PROTOCOL_FAILED;
+            }
         }
     }
-    
-    // Recieve the Kyber Key
-    print_header_and_free(client_fd, server_addr, &server_message, &key_len);
-    receive_and_send(client_fd, server_addr, &server_message, &key_len);
-    if (key_len == OQS_KEM_kyber_768_length_secret_key) {
-        // saving the key in the cl_keys struct
-        memcpy(ser_keys->kyber_public_key, server_message, key_len);
-        printf("Kyber public key successfully saved!\n");
-    }
-    else {
-        fprintf(stderr, "Failed to save Kyber public key\n");
-        return FALSE;
-    }
+    free(record);
 
-    // Recieve the Dilithium Key
-    print_header_and_free(client_fd, server_addr, &server_message, &key_len);
-    receive_and_send(client_fd, server_addr, &server_message, &key_len);
-    if (key_len == OQS_SIG_dilithium_2_length_public_key) {
-        // saving the key in the cl_keys struct
-        memcpy(ser_keys->dilithium_public_key, server_message, key_len);
-        printf("Dilithium public key successfully saved!\n");
+    if (event == PROTOCOL_SESSION_READY) {
+        printf("transfer of session key completed\n");
+        memcpy(session_key, h.session_key, AES_KEY_SIZE);
     }
-    else {
-        fprintf(stderr, "Failed to save Dilithium public key\n");
-        return FALSE;
-    }
-
-    printf("server public keys saved successfully\n");
-
-    char* serialized_key = NULL;
-   
-    // Serialize ECC public key
-    serialized_key = serialize_ecc_key(client->ecc_public_key, &key_len);
-    if (!serialized_key) {
-        EC_KEY_free(client->ecc_public_key);
-        printf("failed to serilaze ecc key!\n");
-        return FALSE;
-    }
-    // Send the ECC Key
-    char* message_to_send = "ECC Key";
-    send_and_receive(client_fd, server_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(client_fd, server_addr, serialized_key, key_len);
-
-    // Send the Dilithium Key
-    message_to_send = "Dilithium Key";
-    send_and_receive(client_fd, server_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(client_fd, server_addr, client->dilithium_public_key, OQS_SIG_dilithium_2_length_public_key);
-
-    printf("all public keys sent successfully\n");
-    return TRUE;
+    client_handshake_free(&h);
+    return event == PROTOCOL_SESSION_READY;
 }
 
-int handshake_client(Client* client, Server_Keys* ser_keys,const int client_fd, struct sockaddr_in server_addr, unsigned char* session_key)
+int reconnect_client(Client* client, Server_Keys* ser_keys, Transport* t, unsigned char* session_key, RecordState* records)
 {
-    int rc;
-    unsigned int ecc_signature_len = 0;
-    size_t encrypted_len = 0, dil_sign_len = 0;
-    char* message_to_send = NULL;
-    unsigned char encrypted_key[RSA_KEY_SIZE / 8], ecc_sig[64], dil_sign[OQS_SIG_dilithium_2_length_signature];
-    uint8_t encapsulated_message[OQS_KEM_kyber_768_length_ciphertext], shared_secret[OQS_KEM_kyber_768_length_shared_secret];  
-
-    // Encrypt AES key using RSA
-    rc = rsa_encrypt(ser_keys->rsa_public_key, client->aes_key, AES_KEY_SIZE, encrypted_key, &encrypted_len);
-    if (rc != TRUE) {
-        printf("failed to encrypt aes key!\n");
-        return FALSE;
-    }
-
-    // Sign the Key using ECC
-    rc = ecc_sign(client->ecc_private_key, encrypted_key, encrypted_len, ecc_sig, &ecc_signature_len);
-    if (rc != TRUE) {
-        printf("failed to sign the key using ECC!\n");
-        return FALSE;
-    }
-
-    // Send the Encrypted Key
-    message_to_send = "Encrypted AES Key";
-    send_and_receive(client_fd, server_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(client_fd, server_addr, encrypted_key, encrypted_len);
-    // Send the Encrypted Key Signature
-    message_to_send = "Signature for AES Key";
-    send_and_receive(client_fd, server_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(client_fd, server_addr, ecc_sig, ecc_signature_len);
-
-    // Encapsulate data using Kyber
-    rc = kyber_encapsulate(encapsulated_message, shared_secret, ser_keys->kyber_public_key);
-    if (rc != TRUE) {
-        printf("failed to encapsulate with kyber!\n");
-        return FALSE;
-    }
+    const char* message = "Hello, Server!";
 
-    // Sign the Key using Dilithium
-    rc = dilithium_sign(client->dilithium_private_key, encapsulated_message, OQS_KEM_kyber_768_length_ciphertext, dil_sign, &dil_sign_len);
-    if (rc != TRUE) {
-        printf("failed to sign the key using Dilithium!\n");
+    // the server sends its keys again
+    RSA_free(ser_keys->rsa_public_key);
+    EC_KEY_free(ser_keys->ecc_public_key);
+    ser_keys->rsa_public_key = NULL;
+    ser_keys->ecc_public_key = NULL;
+    // from record 0 and without a connection ID, as the first session
+    transport_reset_records(t, 0, 0);
+    printf("Starting a new session with the server\n");
+    if (transport_send(t, message, strlen(message)) != TRUE || handshake_client(client, ser_keys, t, session_key) != TRUE) {
+        printf("Server did not take a new session - reconnect_client\n");
         return FALSE;
     }
-
-    // Send the Encapsulated message
-    message_to_send = "Encapsulated Kyber Data";
-    send_and_receive(client_fd, server_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(client_fd, server_addr, encapsulated_message, OQS_KEM_kyber_768_length_ciphertext);
-    // Send the Dilithium Signature
-    message_to_send = "Dilithium Signature";
-    send_and_receive(client_fd, server_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(client_fd, server_addr, dil_sign, dil_sign_len);
-
-    printf("transfer of session key completed\n");
-
-    // create the session key using xor between both keys
-    xor(client->aes_key,shared_secret,session_key,AES_KEY_SIZE);
-    printf("Session key is Ready to use\n");
-
+    memset(records, 0, sizeof(*records));
     return TRUE;
 }
 
@@ -263,97 +100,134 @@ int read_binary_file(const unsigned char* filename, unsigned char** dest, size_t
     return TRUE;
 }
 
-int send_user_with_encrypt_sign_and_result(int server_fd, struct sockaddr_in client_addr, const unsigned char* message, size_t len,
-                                unsigned char* enc_key, uint8_t* dilithium_client_secret_key, uint8_t* dilithium_server_public_key, unsigned char* result, size_t*  res_len)
+int send_user_with_encrypt_sign_and_result(Transport* t, const unsigned char* message, size_t len, unsigned char* enc_key, RecordState* records,
+                                uint8_t* dilithium_client_secret_key, uint8_t* dilithium_server_public_key, unsigned char* result, size_t*  res_len)
 {
-    unsigned char iv[AES_BLOCK_SIZE] = "000000000000000";
-    unsigned char ciphertext[256], dil_sign[OQS_SIG_dilithium_2_length_signature];
-    unsigned char* messageToSend = NULL;
-    size_t cipher_len = 0, dil_sign_len = 0,sent_len=0;
-    memset(ciphertext,'\0', 256);
+    SealedRecord sealed;
+    unsigned char* buffer = NULL;
+    size_t recv_len = 0;
 
     //write_key_file("usernamecheck.bin", message,len);
 
-    int rc = aes_encrypt(enc_key, message,len,iv,ciphertext,&cipher_len);
-    if (rc != TRUE)
-    {
-        printf("Failed to encrypt the message!\n");
+    // every request has a record number of its own; a retransmission is the same record, answered once
+    if (protocol_seal(enc_key, SEAL_CLIENT_TO_SERVER, records->send_seq++, dilithium_client_secret_key, message, len, &sealed) != TRUE) {
         return FALSE;
     }
 
-    //write_key_file("usernamecheckEcnrypted.bin", ciphertext, cipher_len);
+    // encrypted message followed by its signature, gathered by the transport in one write;
+    // over UDP it is sent again until the answer comes back
+    TransportSegment segments[2] = { { sealed.ciphertext, sealed.cipher_len }, { sealed.signature, sealed.signature_len } };
+    printf("Sending encrypted message to Server!\n");
+    if (transport_request(t, segments, 2, &buffer, &recv_len) != TRUE) {
+        printf("Failed to get an answer from the server!\n");
+        return FALSE;
+    }
 
-    rc = dilithium_sign(dilithium_client_secret_key, ciphertext, cipher_len, dil_sign,&dil_sign_len);
-    if (rc != TRUE)
-    {
-        printf("Failed to Sign the message!\n");
+    int rc = protocol_open(enc_key, SEAL_SERVER_TO_CLIENT, records, dilithium_server_public_key, buffer, recv_len, result, res_len);
+    free(buffer);
+    if (rc != TRUE) {
         return FALSE;
     }
 
+    printf("Got encrypted message from Server!\n");
 
-    sent_len = cipher_len + dil_sign_len;
-    messageToSend = malloc(sent_len);
-    if (messageToSend == NULL) {
-        perror("malloc - aes_encrypt_send_and_recv");
+    return TRUE;
+}
+
+int start_user_request(Transport* t, UserRequest* request, const unsigned char* message, size_t len, unsigned char* enc_key,
+                       RecordState* records, uint8_t* dilithium_client_secret_key)
+{
+    if (protocol_seal(enc_key, SEAL_CLIENT_TO_SERVER, records->send_seq++, dilithium_client_secret_key, message, len, &request->sealed) != TRUE) {
         return FALSE;
     }
 
-    // copy encrypted message and signature
-    memcpy(messageToSend, ciphertext, cipher_len);
-    memcpy((messageToSend + cipher_len), dil_sign, dil_sign_len);
-    (messageToSend)[sent_len] = '\0';
+    TransportSegment segments[2] = { { request->sealed.ciphertext, request->sealed.cipher_len },
+                                     { request->sealed.signature, request->sealed.signature_len } };
+    printf("Sending encrypted message to Server!\n");
+    if (transport_request_start(t, segments, 2, &request->id) != TRUE) {
+        return FALSE;
+    }
+    memmove(request->message, message, len);
+    request->message_len = len;
+    request->enc_key = enc_key;
+    request->active = TRUE;
+    return TRUE;
+}
 
-    int sendto_len = sendto(server_fd, messageToSend, sent_len, 0, (const struct sockaddr*)&client_addr, sizeof(client_addr));
-    if (sent_len < 0) {
-        perror("sendto - aes_encrypt_send_and_recv");
+int finish_user_request(UserRequest* request, RecordState* records, uint8_t* dilithium_server_public_key,
+                        const unsigned char* reply, size_t reply_len, unsigned char* result, size_t* res_len)
+{
+    request->active = FALSE;
+    if (reply == NULL) {
+        printf("Failed to get an answer from the server!\n");
         return FALSE;
     }
-    else if ((size_t)sendto_len != sent_len) {
-        fprintf(stderr, "Incomplete key sent: %zd/%zu bytes - aes_encrypt_send_and_recv\n", len, sent_len);
+    if (protocol_open(request->enc_key, SEAL_SERVER_TO_CLIENT, records, dilithium_server_public_key, reply, reply_len, result, res_len) != TRUE) {
         return FALSE;
     }
 
-    printf("Sent encrypted message to Server!\n");
+    printf("Got encrypted message from Server!\n");
+
+    return TRUE;
+}
+
+int resume_user_session(Transport* t, unsigned char* enc_key, RecordState* records)
+{
+    unsigned char secret[AES_KEY_SIZE];
+    int rc;
 
-    // waiting for response from server
-    unsigned char buffer[BUFFER_SIZE];
-    size_t recv_len = recvfrom(server_fd, buffer, BUFFER_SIZE, 0, NULL, NULL);
-    if (recv_len < 0) {
-        perror("recvfrom - send_user_with_encrypt_sign_and_result");
+    if (!t->ticket_held) {
         return FALSE;
     }
-    
-    int encryptMessageSize = recv_len - OQS_SIG_dilithium_2_length_signature;
-
-   rc = dilithium_verify(dilithium_server_public_key, buffer, encryptMessageSize, buffer + encryptMessageSize, OQS_SIG_dilithium_2_length_signature);
-   if (rc != TRUE)
-   {
-       printf("Failed to Verify the message!\n");
-       return FALSE;
-   }
-
-   unsigned char iv2[AES_BLOCK_SIZE] = "000000000000000";
-   rc = aes_decrypt(enc_key, buffer, encryptMessageSize, iv2, result, res_len);
-   if (rc != TRUE)
-   {
-       printf("Failed to Decrypt the message!\n");
-       return FALSE;
-   }
-   result[*res_len] = "\0";
-
-   printf("Got encrypted message from Server!\n");
-
-   return TRUE;
+    rc = protocol_resumption_secret(enc_key, secret);
+    if (rc == TRUE) {
+        rc = protocol_resumed_key(secret, t->ticket, enc_key);
+    }
+    SAFE_AES_KEY_MEMSET(secret);
+    if (rc != TRUE) {
+        return FALSE;
+    }
+    transport_resume(t, t->ticket);
+    memset(records, 0, sizeof(*records));
+    printf("Resuming the session, the next request opens it\n");
+    return TRUE;
 }
 
-int main() {
+// Tells the WPF receiver how a login went: "Good", "Bad", or "False" when there is no answer
+static void answer_wpf(Transport* wpf, int rc, const unsigned char* result, size_t result_len)
+{
+    const char* answer = rc != TRUE ? "False" : result_len == 4 && memcmp(result, "Good", 4) == 0 ? "Good" : "Bad";
+
+    if (transport_send(wpf, answer, strlen(answer)) != TRUE) {
+        perror("sendto wpf");
+    }
+    printf("Sent %s To WPF.\n", answer);
+}
+
+int main(int argc, char** argv) {
     WSADATA wsaData;
     int client_fd, rc,wpf_fd, isUser = 0, isPath = 0;
     struct sockaddr_in server_addr,wpf_client_addr,wpf_server_addr;
-    unsigned char buffer[BUFFER_SIZE], session_key[AES_KEY_SIZE],resultofDecryption[256];
-    unsigned char* wpfBuffer = NULL, *sessionKeyToUse = NULL;
-    size_t wpf_message_len=0, keyLenFromFile=0,resultOfDecryption_len=0;
+    unsigned char buffer[BUFFER_SIZE], session_key[AES_KEY_SIZE],resultofDecryption[SEALED_CIPHERTEXT_SIZE + 1];
+    unsigned char* wpfBuffer = NULL, *sessionKeyToUse = NULL, *reply = NULL;
+    size_t wpf_message_len=0, keyLenFromFile=0,resultOfDecryption_len=0, reply_len = 0;
     socklen_t wpf__client_addr_len = sizeof(wpf_client_addr);
+    TransportType transport_type = transport_type_from_args(argc, argv);
+    Transport transport, wpf;
+    TimerWheel timers;
+    RecordState records;
+    // logins sent to the server and not answered yet
+    UserRequest requests[MAX_OUTSTANDING_REQUESTS];
+    unsigned short reply_id;
+    // last time the server answered: a session idle for longer is gone there, the next login resumes it
+    uint64_t answered_ms;
+    // a login went unanswered: the server may have lost the session, the next login starts a new one
+    BOOL session_lost = FALSE;
+    // the session was resumed and the server has not answered on it yet
+    BOOL resumed = FALSE;
+    // logins waiting for a new session, see UserRequest.early
+    size_t retry_count = 0;
+    fd_set ready;
     Server_Keys sk;
     Client client;
 
@@ -371,7 +245,7 @@ int main() {
     }
 
     // Create socket
-    if ((client_fd = socket(AF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET) {
+    if ((client_fd = socket(AF_INET, transport_type == TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM, 0)) == INVALID_SOCKET) {
         printf("Socket creation failed: %d\n", WSAGetLastError());
         WSACleanup();
         return EXIT_FAILURE;
@@ -383,25 +257,48 @@ int main() {
     server_addr.sin_port = htons(SERVER_PORT);
     server_addr.sin_addr.s_addr = inet_addr(LOCALHOST);
 
+    if (transport_type == TRANSPORT_TCP) {
+        if (connect(client_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            perror("Connect failed");
+            closesocket(client_fd);
+            WSACleanup();
+            return EXIT_FAILURE;
+        }
+        // the handshake is a series of small records, do not hold them back
+        int nodelay = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+    }
+    transport_init(&transport, transport_type, client_fd, server_addr);
+    // "mtu=<bytes>": larger records are fragmented to fit the path instead of relying on IP fragmentation
+    transport.max_datagram = max_datagram_from_args(argc, argv);
+    // UDP to the server: records are acknowledged and retransmitted, a lost datagram does not wedge the handshake
+    timer_wheel_init(&timers, monotonic_ms());
+    if (transport_set_reliable(&transport, &timers) != TRUE) {
+        closesocket(client_fd);
+        WSACleanup();
+        return EXIT_FAILURE;
+    }
+    // the fragments of a record go out with one send and come back in with one receive where the kernel can
+    transport_use_offload(&transport);
+
     // Send message to server
     const char* message = "Hello, Server!";
-    sendto(client_fd, message, strlen(message), 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
-
-    // Transfer public keys between client and server
-    rc = public_key_exchange_client(&client, &sk, client_fd, server_addr);
-    if (rc != TRUE)
-    {
-        printf("public_key_exchange_client failed!, exiting...");
-        return;
+    if (transport_send(&transport, message, strlen(message)) != TRUE) {
+        printf("Server did not answer the hello, exiting...");
+        closesocket(client_fd);
+        WSACleanup();
+        return EXIT_FAILURE;
     }
 
-    // Create the session key and send it
-    rc = handshake_client(&client, &sk, client_fd, server_addr, session_key);
+    // Take in the server's public keys, then create the session key and send it with the client's keys
+    rc = handshake_client(&client, &sk, &transport, session_key);
     if (rc != TRUE)
     {
         printf("handshake_client failed!, exiting...");
         return;
     }
+    // the session's records are numbered from 0 each way
+    memset(&records, 0, sizeof(records));
 
     // Write key to PC
     rc = write_key_file("shared_client.bin", session_key, AES_KEY_SIZE);
@@ -441,13 +338,86 @@ int main() {
     }
     printf("Got Hello message from WPF receiver: %s \n", buffer);
 
-    // loop for safe communication
+    // the WPF receiver always talks UDP
+    transport_init(&wpf, TRANSPORT_UDP, wpf_fd, wpf_client_addr);
+
+    // loop for safe communication: a login waiting for the server holds up neither the WPF commands nor the other
+    // logins, its answer is passed on whenever it comes in
+    memset(requests, 0, sizeof(requests));
+    answered_ms = monotonic_ms();
     while (1)
     {
-        memset(resultofDecryption, '\0', 256);
-        
+        long wait_ms = transport.requests_outstanding > 0 ? timer_wheel_next_timeout(&timers, monotonic_ms()) : -1;
+        struct timeval tv = { wait_ms / 1000, (wait_ms % 1000) * 1000 };
+
+        FD_ZERO(&ready);
+        FD_SET(wpf_fd, &ready);
+        if (transport.requests_outstanding > 0) {
+            FD_SET(client_fd, &ready);
+        }
+        if (select((wpf_fd > client_fd ? wpf_fd : client_fd) + 1, &ready, NULL, NULL, wait_ms < 0 ? NULL : &tv) < 0) {
+            perror("select");
+            break;
+        }
+        // answers from the server, in the order they come
+        while ((rc = transport_request_next(&transport, 0, &reply_id, &reply, &reply_len)) == 1) {
+            for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; i++) {
+                if (requests[i].active && requests[i].id == reply_id) {
+                    memset(resultofDecryption, '\0', sizeof(resultofDecryption));
+                    session_lost |= reply == NULL;
+                    if (reply == NULL && requests[i].early) {
+                        printf("No answer on the resumed session, the login goes again on a new one\n");
+                        requests[i].active = FALSE;
+                        requests[i].retry = TRUE;
+                        retry_count++;
+                        break;
+                    }
+                    rc = finish_user_request(&requests[i], &records, sk.dilithium_public_key, reply, reply_len,
+                                             resultofDecryption, &resultOfDecryption_len);
+                    if (rc == TRUE) {
+                        resumed = FALSE;
+                    }
+                    answer_wpf(&wpf, rc, resultofDecryption, resultOfDecryption_len);
+                    answered_ms = monotonic_ms();
+                    break;
+                }
+            }
+        }
+        // a resumed session the server did not open: its logins go again, once, on a new session without a ticket.
+        // The transport starts over, so only when none is out
+        if (rc >= 0 && retry_count > 0 && transport.requests_outstanding == 0) {
+            int connected = reconnect_client(&client, &sk, &transport, sessionKeyToUse, &records);
+
+            if (connected == TRUE) {
+                resumed = FALSE;
+                session_lost = FALSE;
+                answered_ms = monotonic_ms();
+                if (write_key_file("shared_client.bin", sessionKeyToUse, AES_KEY_SIZE) != TRUE) {
+                    printf("failed to write to file\n");
+                }
+            }
+            for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; i++) {
+                if (!requests[i].retry) {
+                    continue;
+                }
+                requests[i].retry = FALSE;
+                requests[i].early = FALSE;
+                if (connected != TRUE || start_user_request(&transport, &requests[i], requests[i].message, requests[i].message_len,
+                                                            sessionKeyToUse, &records, client.dilithium_private_key) != TRUE) {
+                    answer_wpf(&wpf, FALSE, NULL, 0);
+                }
+            }
+            retry_count = 0;
+        }
+        if (rc < 0 || !FD_ISSET(wpf_fd, &ready)) {
+            if (rc < 0) {
+                break;
+            }
+            continue;
+        }
+
         // Receive message from WPF
-        receive_and_send(wpf_fd, wpf_client_addr, &wpfBuffer, &wpf_message_len);
+        receive_and_send(&wpf, &wpfBuffer, &wpf_message_len);
         
         // Check if the message is "Path"
         if (wpf_message_len == 4 && memcmp(wpfBuffer, "Path", 4) == 0) {
@@ -462,7 +432,7 @@ int main() {
         else {
             continue;
         }
-        receive_and_send(wpf_fd, wpf_client_addr, &wpfBuffer, &wpf_message_len);
+        receive_and_send(&wpf, &wpfBuffer, &wpf_message_len);
         if (isPath == 1)
         {
             rc = read_binary_file(wpfBuffer, &sessionKeyToUse, &keyLenFromFile);
@@ -475,39 +445,63 @@ int main() {
         }
         else if (isUser == 1)
         {
-            rc = send_user_with_encrypt_sign_and_result(client_fd, server_addr, wpfBuffer, wpf_message_len, sessionKeyToUse,
-                    client.dilithium_private_key, sk.dilithium_public_key, resultofDecryption, &resultOfDecryption_len);
-            if (rc != TRUE)
-            {
-                perror("Send User to server failed, return False to WPF!");
-
-                size_t sent_len = sendto(wpf_fd, "False", sizeof("False"), 0, (const struct sockaddr*)&wpf_client_addr, sizeof(wpf_client_addr));
-                if (sent_len < 0) {
-                    perror("sendto wpf");
+            UserRequest* request = NULL;
+
+            isUser = 0;
+            // the server drops a UDP session idle for SESSION_IDLE_TIMEOUT_MS: the login goes out as early data of
+            // the resumed session, answered in one round trip, or on a new session without a ticket
+            if (transport_type == TRANSPORT_UDP && transport.requests_outstanding == 0 && sessionKeyToUse != NULL &&
+                (session_lost || monotonic_ms() - answered_ms >= SESSION_IDLE_TIMEOUT_MS)) {
+                resumed = resume_user_session(&transport, sessionKeyToUse, &records);
+                if (resumed != TRUE && reconnect_client(&client, &sk, &transport, sessionKeyToUse, &records) != TRUE) {
+                    answer_wpf(&wpf, FALSE, NULL, 0);
+                    continue;
+                }
+                session_lost = FALSE;
+                answered_ms = monotonic_ms();
+                if (write_key_file("shared_client.bin", sessionKeyToUse, AES_KEY_SIZE) != TRUE) {
+                    printf("failed to write to file\n");
                 }
-                break;
             }
-
-            // Check if the message is "Good"
-            if (resultOfDecryption_len == 4 && memcmp(resultofDecryption, "Good", 4) == 0) {
-                size_t sent_len = sendto(wpf_fd, "Good", strlen("Good"), 0, (const struct sockaddr*)&wpf_client_addr, sizeof(wpf_client_addr));
-                if (sent_len < 0) {
-                    perror("sendto wpf");
+            for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; i++) {
+                if (!requests[i].active && !requests[i].retry) {
+                    request = &requests[i];
+                    break;
                 }
-                printf("Sent Good To WPF.\n");
             }
-            else {
-                size_t sent_len = sendto(wpf_fd, "Bad", strlen("Bad"), 0, (const struct sockaddr*)&wpf_client_addr, sizeof(wpf_client_addr));
-                if (sent_len < 0) {
+            // every slot waits for an answer: this login gets False, the others and the bridge go on
+            if (request == NULL) {
+                printf("%d logins waiting for the server already, refusing this one\n", MAX_OUTSTANDING_REQUESTS);
+                answer_wpf(&wpf, FALSE, NULL, 0);
+                continue;
+            }
+            // behind the logins waiting for the new session, and on it
+            if (retry_count > 0 && wpf_message_len <= MAX_SEALED_MESSAGE) {
+                memcpy(request->message, wpfBuffer, wpf_message_len);
+                request->message_len = wpf_message_len;
+                request->retry = TRUE;
+                retry_count++;
+                continue;
+            }
+            // the answer is passed on once it is in
+            if (start_user_request(&transport, request, wpfBuffer, wpf_message_len, sessionKeyToUse, &records,
+                                   client.dilithium_private_key) != TRUE)
+            {
+                perror("Send User to server failed, return False to WPF!");
+
+                if (transport_send(&wpf, "False", sizeof("False")) != TRUE) {
                     perror("sendto wpf");
                 }
-                printf("Sent Bad To WPF.\n");
+                break;
             }
+            request->early = resumed;
         }
     }
+    free(reply);
 
     // Cleanup
     client.cleanup(&client);
+    transport_release(&transport);
     closesocket(wpf_fd);
     closesocket(client_fd);
     WSACleanup();
@@ -1,31 +1,42 @@
 #pragma once
 #include "crypto_functions.h"
 #include "socket_functions.h"
+#include "protocol_functions.h"
 
-// Forward declarations of structs
-typedef struct Client Client;
+// A login request of the WPF receiver on its way to the server, pipelined with the others
+typedef struct UserRequest {
+    BOOL active;
+    // the transport's request ID, which its answer comes back with
+    unsigned short id;
+    // the session key the request was sealed with, its answer is opened with the same
+    unsigned char* enc_key;
+    // what goes out, in use until the answer is in
+    SealedRecord sealed;
+    // the login itself, for sending it again
+    unsigned char message[MAX_SEALED_MESSAGE];
+    size_t message_len;
+    // sent on a resumed session before the server answered on it: without an answer the server may not have opened
+    // it (the ticket was lost on the way, expired, or the server had no room for the session)
+    BOOL early;
+    // to go again on a new session once the requests still out are done
+    BOOL retry;
+} UserRequest;
 
-// Function pointer typedefs
-typedef void (*ClientCleanupFunc)(Client* client);
+// Seals message (which may be request->message) and sends it without waiting for the answer, see
+// transport_request_start
+int start_user_request(Transport* t, UserRequest* request, const unsigned char* message, size_t len, unsigned char* enc_key,
+                       RecordState* records, uint8_t* dilithium_client_secret_key);
 
-struct Client {
-    // Data members
-    EC_KEY* ecc_private_key; // For signing
-    EC_KEY* ecc_public_key;  // For verification
-    uint8_t dilithium_private_key[OQS_SIG_dilithium_2_length_secret_key];
-    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
+// Verifies and decrypts the answer to request, a reply of transport_request_next; the request is done either way
+int finish_user_request(UserRequest* request, RecordState* records, uint8_t* dilithium_server_public_key,
+                        const unsigned char* reply, size_t reply_len, unsigned char* result, size_t* res_len);
 
-    BOOL is_initialized;
+// A new session on t, hello and handshake, for when the server no longer has the one it had: its key in session_key
+// and records from 0. FALSE when the server does not take it
+int reconnect_client(Client* client, Server_Keys* ser_keys, Transport* t, unsigned char* session_key, RecordState* records);
 
-    // Generate AES key
-    unsigned char aes_key[AES_KEY_SIZE];
-
-    ClientCleanupFunc cleanup;
-};
-
-typedef struct Server_Keys {
-    RSA* rsa_public_key;
-    EC_KEY* ecc_public_key;
-    uint8_t kyber_public_key[OQS_KEM_kyber_768_length_secret_key];
-    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
-}Server_Keys;
\ No newline at end of file
+// The session on t is gone at the server once idle for SESSION_IDLE_TIMEOUT_MS: moves t to the session its ticket
+// resumes, with its key in enc_key (in place of the old one) and records from 0. The next request opens it, when
+// the server still has the ticket and room for the session; the requests sent before its first answer go again on
+// a new session when they get no answer (see reconnect_client). FALSE without a ticket, t is left as it was
+int resume_user_session(Transport* t, unsigned char* enc_key, RecordState* records);
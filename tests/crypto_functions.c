@@ -52,9 +52,11 @@
      const BIGNUM* r, * s;
      ECDSA_SIG_get0(ecc_sig, &r, &s);
 
-     *sig_len = BN_num_bytes(r) + BN_num_bytes(s);
-     BN_bn2bin(r, signature);
-     BN_bn2bin(s, signature + BN_num_bytes(r));
+     // r and s padded to the size of the curve order, ecc_verify splits the signature in the middle
+     int half = (EC_GROUP_order_bits(EC_KEY_get0_group(sign_key)) + 7) / 8;
+     *sig_len = 2 * half;
+     BN_bn2binpad(r, signature, half);
+     BN_bn2binpad(s, signature + half, half);
 
      ECDSA_SIG_free(ecc_sig);
      return TRUE;
@@ -296,6 +298,56 @@ BOOL aes_decrypt(unsigned char* dec_key, unsigned char* ciphertext, size_t ciphe
     return TRUE;
 }
 
+BOOL aead_encrypt(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, size_t aad_len,
+    const unsigned char* plaintext, size_t len, unsigned char* ciphertext, unsigned char* tag)
+{
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int out_len = 0;
+    BOOL rc = FALSE;
+
+    if (ctx == NULL) {
+        return FALSE;
+    }
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) == 1 &&
+        EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce) == 1 &&
+        (aad_len == 0 || EVP_EncryptUpdate(ctx, NULL, &out_len, aad, (int)aad_len) == 1) &&
+        (len == 0 || EVP_EncryptUpdate(ctx, ciphertext, &out_len, plaintext, (int)len) == 1) &&
+        EVP_EncryptFinal_ex(ctx, ciphertext + len, &out_len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_SIZE, tag) == 1) {
+        rc = TRUE;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return rc;
+}
+
+BOOL aead_decrypt(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, size_t aad_len,
+    const unsigned char* ciphertext, size_t len, const unsigned char* tag, unsigned char* plaintext)
+{
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int out_len = 0;
+    BOOL rc = FALSE;
+
+    if (ctx == NULL) {
+        return FALSE;
+    }
+    // the tag is checked by the final call, nothing decrypted is to be used before it passes
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) == 1 &&
+        EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce) == 1 &&
+        (aad_len == 0 || EVP_DecryptUpdate(ctx, NULL, &out_len, aad, (int)aad_len) == 1) &&
+        (len == 0 || EVP_DecryptUpdate(ctx, plaintext, &out_len, ciphertext, (int)len) == 1) &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_SIZE, (void*)tag) == 1 &&
+        EVP_DecryptFinal_ex(ctx, plaintext + len, &out_len) == 1) {
+        rc = TRUE;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    if (rc != TRUE) {
+        secure_memzero(plaintext, len);
+    }
+    return rc;
+}
+
 int generate_aes_key(unsigned char* key, int key_len) {
    
     if (!RAND_bytes(key, key_len)) {
@@ -398,6 +450,29 @@ int dilithium_verify(uint8_t* dilithium_public_key, uint8_t* message_to_verify,
     return TRUE;
 }
 
+int dilithium_verify_batch(uint8_t* dilithium_public_key, size_t count, const uint8_t* const* messages, const size_t* message_lens,
+                           const uint8_t* const* signatures, const size_t* signature_lens, int* results) {
+    OQS_STATUS statuses[64];
+    OQS_STATUS* status = count <= 64 ? statuses : malloc(count * sizeof(OQS_STATUS));
+    if (status == NULL) {
+        perror("malloc - dilithium_verify_batch");
+        return FALSE;
+    }
+
+    OQS_STATUS rc = OQS_SIG_dilithium_2_verify_batch(count, messages, message_lens, signatures, signature_lens, dilithium_public_key, status);
+    for (size_t i = 0; i < count; i++) {
+        results[i] = status[i] == OQS_SUCCESS ? TRUE : FALSE;
+    }
+    if (status != statuses) {
+        free(status);
+    }
+    if (rc != OQS_SUCCESS) {
+        fprintf(stderr, "ERROR: OQS_SIG_dilithium_2_verify_batch failed!\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
 #pragma endregion
 
 void xor(const unsigned char* first, const unsigned char* second, unsigned char* result, size_t size) {
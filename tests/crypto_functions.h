@@ -55,6 +55,14 @@ BOOL aes_encrypt(unsigned char* enc_key, unsigned char* plaintext, size_t plaint
 BOOL aes_decrypt(unsigned char* dec_key, unsigned char* ciphertext, size_t cipher_len, unsigned char* iv,
     unsigned char* plaintext, size_t* plaintext_len);
 
+// AES-256-GCM: encrypts len bytes into ciphertext (the same length) and writes the AEAD_TAG_SIZE tag over it and aad
+BOOL aead_encrypt(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, size_t aad_len,
+    const unsigned char* plaintext, size_t len, unsigned char* ciphertext, unsigned char* tag);
+
+// FALSE when the tag does not match: the ciphertext or aad was changed, or another key or nonce made it
+BOOL aead_decrypt(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, size_t aad_len,
+    const unsigned char* ciphertext, size_t len, const unsigned char* tag, unsigned char* plaintext);
+
 int generate_aes_key(unsigned char* key,int key_len);
 
 #pragma endregion
@@ -78,6 +86,10 @@ int dilithium_sign(uint8_t* dilithium_secret_key, uint8_t* message_to_sign, size
 
 int dilithium_verify(uint8_t* dilithium_public_key, uint8_t* message_to_verify, size_t message_len, uint8_t* signature, size_t signature_len);
 
+// Verifies count signatures made with the same key in one call; results[i] is TRUE or FALSE for each signature
+int dilithium_verify_batch(uint8_t* dilithium_public_key, size_t count, const uint8_t* const* messages, const size_t* message_lens,
+                           const uint8_t* const* signatures, const size_t* signature_lens, int* results);
+
 #pragma endregion
 
 void xor(const unsigned char* first, const unsigned char* second, unsigned char* result, size_t size);
@@ -0,0 +1,452 @@
+#include "crypto_pool.h"
+
+#include <time.h>
+
+static const char* const job_names[CRYPTO_JOB_TYPES] = {
+    "ecc verify", "rsa decrypt", "dilithium verify", "kyber decapsulate", "verify batch", "answer"
+};
+
+static uint64_t now_us(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e6 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+void crypto_job_init(CryptoJob* job, CryptoJobType type, int (*run)(void* arg), void* arg)
+{
+    memset(job, 0, sizeof(*job));
+    job->type = type;
+    job->run = run;
+    job->arg = arg;
+}
+
+void crypto_group_init(CryptoGroup* group)
+{
+    group->pending = 0;
+    group->completed = NULL;
+    group->last_completed = NULL;
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+#endif
+}
+
+void crypto_group_destroy(CryptoGroup* group)
+{
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_cond_destroy(&group->done);
+    pthread_mutex_destroy(&group->lock);
+#endif
+}
+
+static void group_add(CryptoGroup* group)
+{
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_mutex_lock(&group->lock);
+    group->pending++;
+    pthread_mutex_unlock(&group->lock);
+#else
+    group->pending++;
+#endif
+}
+
+static void group_complete(CryptoGroup* group, CryptoJob* job)
+{
+    job->completed_next = NULL;
+    if (group->last_completed != NULL) {
+        group->last_completed->completed_next = job;
+    }
+    else {
+        group->completed = job;
+    }
+    group->last_completed = job;
+    group->pending--;
+}
+
+// The count drops under the lock, so a waiter that sees it at zero may free the group right away
+static void group_remove(CryptoGroup* group, CryptoJob* job)
+{
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_mutex_lock(&group->lock);
+    group_complete(group, job);
+    // one waiter, for this job or for the last
+    pthread_cond_signal(&group->done);
+    pthread_mutex_unlock(&group->lock);
+#else
+    group_complete(group, job);
+#endif
+}
+
+void crypto_group_wait(CryptoGroup* group)
+{
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_mutex_lock(&group->lock);
+    while (group->pending > 0) {
+        pthread_cond_wait(&group->done, &group->lock);
+    }
+    pthread_mutex_unlock(&group->lock);
+#endif
+}
+
+CryptoJob* crypto_group_next(CryptoGroup* group, int wait)
+{
+    CryptoJob* job;
+
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_mutex_lock(&group->lock);
+    while (wait && group->completed == NULL && group->pending > 0) {
+        pthread_cond_wait(&group->done, &group->lock);
+    }
+#endif
+    job = group->completed;
+    if (job != NULL) {
+        group->completed = job->completed_next;
+        if (group->completed == NULL) {
+            group->last_completed = NULL;
+        }
+    }
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_mutex_unlock(&group->lock);
+#endif
+    return job;
+}
+
+size_t crypto_workers_from_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "crypto=", 7) == 0) {
+            return strtoul(argv[i] + 7, NULL, 10);
+        }
+    }
+#if defined(CRYPTO_POOL_THREADS)
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 1 ? (size_t)cores : 0;
+#else
+    return 0;
+#endif
+}
+
+#if defined(CRYPTO_POOL_THREADS)
+
+#include <stdatomic.h>
+
+// Bounded MPMC ring (Vyukov): every slot carries a sequence number that tells producers and consumers whose turn
+// it is, so a submit or a take is one compare-and-swap on its position with no lock
+typedef struct CryptoSlot {
+    atomic_size_t sequence;
+    CryptoJob* job;
+} CryptoSlot;
+
+// The counters of CryptoJobStats for one job type, as relaxed atomics on a cache line of their own: submitters and
+// workers count without waiting on each other, and a snapshot may be a job or so apart between counters
+typedef struct JobCounters {
+    _Alignas(64) atomic_uint_least64_t submitted;
+    atomic_uint_least64_t failed;
+    atomic_uint_least64_t inline_runs;
+    atomic_uint_least64_t depth;
+    atomic_uint_least64_t max_depth;
+    atomic_uint_least64_t wait_us;
+    atomic_uint_least64_t wait_max_us;
+    atomic_uint_least64_t run_us;
+    atomic_uint_least64_t run_max_us;
+} JobCounters;
+
+struct CryptoPool {
+    CryptoSlot slots[CRYPTO_RING_SIZE];
+    // producers and consumers on cache lines of their own
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos;
+    // one count per job in the ring, the workers sleep on it
+    sem_t ready;
+    atomic_int stopping;
+    pthread_t* threads;
+    size_t workers;
+    JobCounters stats[CRYPTO_JOB_TYPES];
+};
+
+static void counter_add(atomic_uint_least64_t* counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static void counter_max(atomic_uint_least64_t* counter, uint64_t value)
+{
+    uint_least64_t seen = atomic_load_explicit(counter, memory_order_relaxed);
+
+    while (value > seen &&
+           !atomic_compare_exchange_weak_explicit(counter, &seen, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static uint64_t counter_get(atomic_uint_least64_t* counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static int ring_push(CryptoPool* pool, CryptoJob* job)
+{
+    size_t pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+
+    while (1) {
+        CryptoSlot* slot = &pool->slots[pos & (CRYPTO_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&pool->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                slot->job = job;
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+                return TRUE;
+            }
+        }
+        else if (diff < 0) {
+            // a lap behind: the ring is full
+            return FALSE;
+        }
+        else {
+            pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static CryptoJob* ring_pop(CryptoPool* pool)
+{
+    size_t pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+
+    while (1) {
+        CryptoSlot* slot = &pool->slots[pos & (CRYPTO_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&pool->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                CryptoJob* job = slot->job;
+                atomic_store_explicit(&slot->sequence, pos + CRYPTO_RING_SIZE, memory_order_release);
+                return job;
+            }
+        }
+        else if (diff < 0) {
+            return NULL;
+        }
+        else {
+            pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Runs job where it is, records it, then submits its successor or completes its group
+static void run_job(CryptoPool* pool, CryptoJob* job, BOOL queued)
+{
+    uint64_t start = now_us();
+    job->result = job->run(job->arg);
+    uint64_t end = now_us();
+
+    if (pool != NULL) {
+        JobCounters* s = &pool->stats[job->type];
+        if (queued) {
+            atomic_fetch_sub_explicit(&s->depth, 1, memory_order_relaxed);
+            counter_add(&s->wait_us, start - job->submitted_us);
+            counter_max(&s->wait_max_us, start - job->submitted_us);
+        }
+        if (job->result != TRUE) {
+            counter_add(&s->failed, 1);
+        }
+        counter_add(&s->run_us, end - start);
+        counter_max(&s->run_max_us, end - start);
+    }
+
+    CryptoGroup* group = job->group;
+    if (job->result == TRUE && job->next != NULL) {
+        crypto_submit(pool, group, job->next);
+    }
+    // job may be freed by the waiter from here on
+    group_remove(group, job);
+}
+
+static void* crypto_worker(void* arg)
+{
+    CryptoPool* pool = arg;
+
+    while (1) {
+        if (sem_wait(&pool->ready) != 0) {
+            // interrupted by a signal
+            continue;
+        }
+        if (atomic_load(&pool->stopping)) {
+            break;
+        }
+        // the count says a job is in, a producer may only be finishing its store
+        CryptoJob* job;
+        while ((job = ring_pop(pool)) == NULL) {
+            sched_yield();
+        }
+        run_job(pool, job, TRUE);
+    }
+    return NULL;
+}
+
+CryptoPool* crypto_pool_create(size_t workers)
+{
+    CryptoPool* pool;
+
+    if (workers == 0) {
+        return NULL;
+    }
+    pool = calloc(1, sizeof(CryptoPool));
+    if (pool == NULL) {
+        perror("calloc - crypto_pool_create");
+        return NULL;
+    }
+    for (size_t i = 0; i < CRYPTO_RING_SIZE; i++) {
+        atomic_init(&pool->slots[i].sequence, i);
+    }
+    atomic_init(&pool->enqueue_pos, 0);
+    atomic_init(&pool->dequeue_pos, 0);
+    atomic_init(&pool->stopping, 0);
+    sem_init(&pool->ready, 0, 0);
+
+    pool->threads = calloc(workers, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        perror("calloc - crypto_pool_create");
+        crypto_pool_destroy(pool);
+        return NULL;
+    }
+    for (; pool->workers < workers; pool->workers++) {
+        if (pthread_create(&pool->threads[pool->workers], NULL, crypto_worker, pool) != 0) {
+            perror("pthread_create - crypto_pool_create");
+            crypto_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void crypto_pool_destroy(CryptoPool* pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+    // the jobs still in the ring are the submitters' to wait for, none are left once they have
+    atomic_store(&pool->stopping, 1);
+    for (size_t i = 0; i < pool->workers; i++) {
+        sem_post(&pool->ready);
+    }
+    for (size_t i = 0; i < pool->workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    sem_destroy(&pool->ready);
+    free(pool);
+}
+
+size_t crypto_pool_workers(const CryptoPool* pool)
+{
+    return pool ? pool->workers : 0;
+}
+
+void crypto_submit(CryptoPool* pool, CryptoGroup* group, CryptoJob* job)
+{
+    job->group = group;
+    group_add(group);
+    if (pool == NULL) {
+        run_job(NULL, job, FALSE);
+        return;
+    }
+
+    job->submitted_us = now_us();
+    JobCounters* s = &pool->stats[job->type];
+    counter_add(&s->submitted, 1);
+    // counted before the push, so a worker taking the job never counts it out first
+    counter_max(&s->max_depth, atomic_fetch_add_explicit(&s->depth, 1, memory_order_relaxed) + 1);
+
+    if (ring_push(pool, job) == TRUE) {
+        sem_post(&pool->ready);
+        return;
+    }
+    // no room: the submitter pays for the job itself rather than waiting for a slot
+    atomic_fetch_sub_explicit(&s->depth, 1, memory_order_relaxed);
+    counter_add(&s->inline_runs, 1);
+    run_job(pool, job, FALSE);
+}
+
+void crypto_pool_stats(CryptoPool* pool, CryptoJobStats* stats)
+{
+    if (pool == NULL) {
+        memset(stats, 0, sizeof(CryptoJobStats) * CRYPTO_JOB_TYPES);
+        return;
+    }
+    for (int i = 0; i < CRYPTO_JOB_TYPES; i++) {
+        JobCounters* s = &pool->stats[i];
+        stats[i].submitted = counter_get(&s->submitted);
+        stats[i].failed = counter_get(&s->failed);
+        stats[i].inline_runs = counter_get(&s->inline_runs);
+        stats[i].depth = counter_get(&s->depth);
+        stats[i].max_depth = counter_get(&s->max_depth);
+        stats[i].wait_us = counter_get(&s->wait_us);
+        stats[i].wait_max_us = counter_get(&s->wait_max_us);
+        stats[i].run_us = counter_get(&s->run_us);
+        stats[i].run_max_us = counter_get(&s->run_max_us);
+    }
+}
+
+#else
+
+CryptoPool* crypto_pool_create(size_t workers)
+{
+    if (workers > 0) {
+        printf("crypto workers need pthreads, running crypto on the I/O thread\n");
+    }
+    return NULL;
+}
+
+void crypto_pool_destroy(CryptoPool* pool)
+{
+}
+
+size_t crypto_pool_workers(const CryptoPool* pool)
+{
+    return 0;
+}
+
+void crypto_submit(CryptoPool* pool, CryptoGroup* group, CryptoJob* job)
+{
+    job->group = group;
+    group_add(group);
+    job->result = job->run(job->arg);
+    if (job->result == TRUE && job->next != NULL) {
+        crypto_submit(pool, group, job->next);
+    }
+    group_remove(group, job);
+}
+
+void crypto_pool_stats(CryptoPool* pool, CryptoJobStats* stats)
+{
+    memset(stats, 0, sizeof(CryptoJobStats) * CRYPTO_JOB_TYPES);
+}
+
+#endif
+
+void crypto_pool_print_stats(CryptoPool* pool, FILE* out)
+{
+    CryptoJobStats stats[CRYPTO_JOB_TYPES];
+
+    crypto_pool_stats(pool, stats);
+    for (int i = 0; i < CRYPTO_JOB_TYPES; i++) {
+        CryptoJobStats* s = &stats[i];
+        uint64_t queued = s->submitted - s->inline_runs;
+        if (s->submitted == 0) {
+            continue;
+        }
+        fprintf(out, "crypto %-18s %8llu jobs %6llu failed %6llu inline, depth %llu (max %llu), wait %.1f us (max %llu), run %.1f us (max %llu)\n",
+                job_names[i], (unsigned long long)s->submitted, (unsigned long long)s->failed, (unsigned long long)s->inline_runs,
+                (unsigned long long)s->depth, (unsigned long long)s->max_depth,
+                queued ? (double)s->wait_us / (double)queued : 0.0, (unsigned long long)s->wait_max_us,
+                (double)s->run_us / (double)s->submitted, (unsigned long long)s->run_max_us);
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "params.h"
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <semaphore.h>
+#define CRYPTO_POOL_THREADS
+#endif
+
+// Crypto worker pool: I/O threads submit jobs (a signature check, a decryption, ...) to a bounded multi-producer
+// multi-consumer ring and wait for a group of them to complete, while the workers run them. Without a pool (no
+// workers configured, one core, or no pthreads) and when the ring is full, a job runs on the submitting thread.
+
+// Slots in the ring, a power of two
+#define CRYPTO_RING_SIZE 1024
+
+typedef enum CryptoJobType {
+    CRYPTO_ECC_VERIFY,
+    CRYPTO_RSA_DECRYPT,
+    CRYPTO_DILITHIUM_VERIFY,
+    CRYPTO_KYBER_DECAPSULATE,
+    // the signatures of one session's requests in a batch
+    CRYPTO_VERIFY_BATCH,
+    // decrypt a request, then encrypt and sign its answer
+    CRYPTO_ANSWER,
+    CRYPTO_JOB_TYPES
+} CryptoJobType;
+
+typedef struct CryptoPool CryptoPool;
+typedef struct CryptoJob CryptoJob;
+
+// Jobs a thread waits for together, or takes one by one as they complete
+typedef struct CryptoGroup {
+    size_t pending;
+    // completed and not taken yet, oldest first
+    CryptoJob* completed;
+    CryptoJob* last_completed;
+#if defined(CRYPTO_POOL_THREADS)
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+#endif
+} CryptoGroup;
+
+struct CryptoJob {
+    CryptoJobType type;
+    // TRUE on success
+    int (*run)(void* arg);
+    void* arg;
+    // submitted to the same group once this job succeeded, for chains of dependent steps
+    CryptoJob* next;
+    CryptoGroup* group;
+    // after this one in its group's completed jobs
+    CryptoJob* completed_next;
+    int result;
+    uint64_t submitted_us;
+};
+
+// Per job type, since the pool was created
+typedef struct CryptoJobStats {
+    uint64_t submitted;
+    uint64_t failed;
+    // run by the submitting thread: no pool, or the ring was full
+    uint64_t inline_runs;
+    // jobs in the ring now, and the most there have been
+    uint64_t depth;
+    uint64_t max_depth;
+    // from submission to a worker taking the job, and from there to its completion
+    uint64_t wait_us;
+    uint64_t wait_max_us;
+    uint64_t run_us;
+    uint64_t run_max_us;
+} CryptoJobStats;
+
+// workers threads; NULL for no pool (workers == 0, or no pthreads), jobs then run inline
+CryptoPool* crypto_pool_create(size_t workers);
+
+// Waits for the workers to finish the jobs they hold, then frees the pool
+void crypto_pool_destroy(CryptoPool* pool);
+
+size_t crypto_pool_workers(const CryptoPool* pool);
+
+void crypto_job_init(CryptoJob* job, CryptoJobType type, int (*run)(void* arg), void* arg);
+
+void crypto_group_init(CryptoGroup* group);
+
+void crypto_group_destroy(CryptoGroup* group);
+
+// Queues job for the workers of pool, or runs it right away when pool is NULL or the ring is full. The group is
+// done once job and its successors are
+void crypto_submit(CryptoPool* pool, CryptoGroup* group, CryptoJob* job);
+
+// Blocks until every job submitted to group has completed
+void crypto_group_wait(CryptoGroup* group);
+
+// The next job of group to complete, successors included, each once and in the order they completed. With wait it
+// blocks while jobs are pending, and is NULL once all are taken; without, NULL when none has completed since
+CryptoJob* crypto_group_next(CryptoGroup* group, int wait);
+
+// Copies the counters of every job type into stats (CRYPTO_JOB_TYPES entries); zeroes without a pool
+void crypto_pool_stats(CryptoPool* pool, CryptoJobStats* stats);
+
+// One line per job type that ran
+void crypto_pool_print_stats(CryptoPool* pool, FILE* out);
+
+// "crypto=<n>" as an argument: the number of crypto workers. One per core online when absent, none on a single core
+size_t crypto_workers_from_args(int argc, char** argv);
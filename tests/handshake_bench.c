@@ -0,0 +1,373 @@
+/*
+ * handshake_bench.c
+ *
+ * End-to-end protocol cost without the network: a client and a server in one
+ * process, linked by memory pipes (transport_pipe), run the hello, key exchange
+ * and handshake of protocol_functions.h and then encrypted requests, one after
+ * the other on one thread. The server keys are made once, as a server does; the
+ * client keys once per handshake, as a new client does. Reports handshakes and
+ * requests per second, the latency of each phase, the bytes each direction
+ * carries (records framed as on TCP) and the memory the server's session table
+ * takes once every client has a session in it.
+ *
+ * The protocol log goes to stdout, the results to stderr: run with stdout sent
+ * to a file or the null device so that terminal output is not what is measured.
+ *
+ * Usage: handshake_bench [handshakes] [requests per handshake] [crypto=<workers>]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+
+#include "protocol_functions.h"
+#include "socket_functions.h"
+#include "session_table.h"
+
+// Phases of one connection, timed separately
+enum {
+    PHASE_CLIENT_KEYS,
+    PHASE_SERVER_KEYS,
+    PHASE_CLIENT_FLIGHT,
+    PHASE_SERVER_FINISH,
+    PHASE_HANDSHAKE,
+    PHASE_REQUEST,
+    PHASES
+};
+
+static const char* const phase_names[PHASES] = {
+    "client keys (client_init)",
+    "hello + server keys",
+    "client flight",
+    "server finish",
+    "whole handshake",
+    "request round trip"
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Sends every record the state machine has queued
+static int flush_output(Transport* t, ProtocolOutput* output)
+{
+    ProtocolRecord record;
+
+    while (protocol_next_output(output, &record) == TRUE) {
+        if (transport_send(t, record.data, record.len) != TRUE) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Feeds the client every queued record from the server, then sends its answer
+static ProtocolEvent client_turn(ClientHandshake* h, Transport* t)
+{
+    ProtocolEvent event = PROTOCOL_WANT_INPUT;
+    unsigned char* record = NULL;
+    size_t len = 0;
+
+    while (event == PROTOCOL_WANT_INPUT && transport_recv(t, &record, &len) == TRUE) {
+        event = client_handshake_input(h, record, len);
+    }
+    free(record);
+    if (event != PROTOCOL_FAILED && flush_output(t, &h->output) != TRUE) {
+        event = PROTOCOL_FAILED;
+    }
+    return event;
+}
+
+static ProtocolEvent server_turn(ServerHandshake* h, Transport* t)
+{
+    ProtocolEvent event = PROTOCOL_WANT_INPUT;
+    unsigned char* record = NULL;
+    size_t len = 0;
+
+    while (event == PROTOCOL_WANT_INPUT && transport_recv(t, &record, &len) == TRUE) {
+        event = server_handshake_input(h, record, len);
+    }
+    free(record);
+    if (event != PROTOCOL_FAILED && flush_output(t, &h->output) != TRUE) {
+        event = PROTOCOL_FAILED;
+    }
+    return event;
+}
+
+// Seals message on one end and opens it on the other; FALSE if it does not come out as sent
+static int pass_sealed(Transport* from, Transport* to, unsigned char* session_key, SealDirection direction, RecordState* sender,
+                       RecordState* receiver, uint8_t* private_key, uint8_t* public_key, const unsigned char* message, size_t len)
+{
+    SealedRecord sealed;
+    unsigned char plaintext[SEALED_CIPHERTEXT_SIZE + 1];
+    unsigned char* record = NULL;
+    size_t record_len = 0, plain_len = 0;
+    int rc = FALSE;
+
+    if (protocol_seal(session_key, direction, sender->send_seq++, private_key, message, len, &sealed) != TRUE) {
+        return FALSE;
+    }
+    TransportSegment segments[2] = { { sealed.ciphertext, sealed.cipher_len }, { sealed.signature, sealed.signature_len } };
+    if (transport_sendv(from, segments, 2) == TRUE && transport_recv(to, &record, &record_len) == TRUE &&
+        protocol_open(session_key, direction, receiver, public_key, record, record_len, plaintext, &plain_len) == TRUE) {
+        rc = plain_len == len && memcmp(plaintext, message, len) == 0;
+    }
+    free(record);
+    return rc;
+}
+
+// Bytes and records of one connection, each direction
+typedef struct WireCount {
+    size_t handshake_bytes[2];
+    size_t handshake_records[2];
+    size_t request_bytes[2];
+} WireCount;
+
+// One client from client_init to its last answer; its session stays in sessions under id. Fills in the time of
+// each phase, the requests' in request_times. FALSE when any step fails or the two ends disagree on the session key
+static int run_connection(Server* server, SessionTable* sessions, ConnectionId id, Transport* client_end, Transport* server_end,
+                          size_t requests, double* phase_times, double* request_times, WireCount* wire)
+{
+    // a login as the WPF front end sends it: username and password, each behind its 16-bit length
+    static const unsigned char login[] = { 5, 0, 'a', 'd', 'm', 'i', 'n', 8, 0, 'p', 'a', 's', 's', 'w', 'o', 'r', 'd' };
+    const char* hello = "Hello, Server!";
+    Client client;
+    Server_Keys server_keys;
+    Client_Keys client_keys;
+    ClientHandshake ch;
+    ServerHandshake sh;
+    RecordState client_records;
+    Session* session;
+    unsigned char* record = NULL;
+    size_t record_len = 0;
+    int rc = FALSE;
+
+    memset(&client, 0, sizeof(client));
+    memset(&server_keys, 0, sizeof(server_keys));
+    memset(&client_keys, 0, sizeof(client_keys));
+    memory_pipe_reset_counters(client_end->pipe_out);
+    memory_pipe_reset_counters(server_end->pipe_out);
+
+    double start = now_seconds(), mark = start, t;
+    if (client_init(&client) != TRUE) {
+        return FALSE;
+    }
+    client_handshake_init(&ch, &client, &server_keys);
+    t = now_seconds();
+    phase_times[PHASE_CLIENT_KEYS] = t - mark;
+    mark = t;
+
+    ProtocolEvent server_event = PROTOCOL_FAILED;
+    if (transport_send(client_end, hello, strlen(hello)) == TRUE && transport_recv(server_end, &record, &record_len) == TRUE) {
+        server_event = server_handshake_init(&sh, server, &client_keys);
+        if (server_event != PROTOCOL_FAILED && flush_output(server_end, &sh.output) != TRUE) {
+            server_event = PROTOCOL_FAILED;
+        }
+    }
+    else {
+        memset(&sh, 0, sizeof(sh));
+    }
+    free(record);
+    t = now_seconds();
+    phase_times[PHASE_SERVER_KEYS] = t - mark;
+    mark = t;
+    if (server_event == PROTOCOL_FAILED) {
+        goto cleanup;
+    }
+
+    if (client_turn(&ch, client_end) != PROTOCOL_SESSION_READY) {
+        goto cleanup;
+    }
+    t = now_seconds();
+    phase_times[PHASE_CLIENT_FLIGHT] = t - mark;
+    mark = t;
+
+    if (server_turn(&sh, server_end) != PROTOCOL_SESSION_READY) {
+        goto cleanup;
+    }
+    t = now_seconds();
+    phase_times[PHASE_SERVER_FINISH] = t - mark;
+    phase_times[PHASE_HANDSHAKE] = t - start;
+
+    if (memcmp(ch.session_key, sh.session_key, AES_KEY_SIZE) != 0) {
+        fprintf(stderr, "ERROR: client and server derived different session keys\n");
+        goto cleanup;
+    }
+    wire->handshake_bytes[0] = client_end->pipe_out->bytes;
+    wire->handshake_records[0] = client_end->pipe_out->records;
+    wire->handshake_bytes[1] = server_end->pipe_out->bytes;
+    wire->handshake_records[1] = server_end->pipe_out->records;
+    // kept as the server keeps it
+    session = session_table_add(sessions, id, &server_end->peer, 0);
+    if (session == NULL) {
+        fprintf(stderr, "ERROR: no room for session %llu\n", (unsigned long long)id);
+        goto cleanup;
+    }
+    session->identity = session_table_intern(sessions, client_keys.dilithium_public_key);
+    if (session->identity == NULL) {
+        session_table_remove(sessions, session);
+        goto cleanup;
+    }
+    memcpy(session->session_key, sh.session_key, AES_KEY_SIZE);
+    memset(&client_records, 0, sizeof(client_records));
+
+    for (size_t i = 0; i < requests; i++) {
+        mark = now_seconds();
+        // each end checks the signature with the key it got from the other in the handshake
+        if (pass_sealed(client_end, server_end, ch.session_key, SEAL_CLIENT_TO_SERVER, &client_records, &session->records,
+                        client.dilithium_private_key, session->identity->dilithium_public_key, login, sizeof(login)) != TRUE ||
+            pass_sealed(server_end, client_end, sh.session_key, SEAL_SERVER_TO_CLIENT, &session->records, &client_records,
+                        server->dilithium_private_key, server_keys.dilithium_public_key, (const unsigned char*)"Good", 4) != TRUE) {
+            fprintf(stderr, "ERROR: request %zu did not go through\n", i);
+            goto cleanup;
+        }
+        request_times[i] = now_seconds() - mark;
+    }
+    wire->request_bytes[0] = client_end->pipe_out->bytes - wire->handshake_bytes[0];
+    wire->request_bytes[1] = server_end->pipe_out->bytes - wire->handshake_bytes[1];
+    rc = TRUE;
+
+cleanup:
+    client_handshake_free(&ch);
+    server_handshake_free(&sh);
+    if (server_keys.rsa_public_key) {
+        RSA_free(server_keys.rsa_public_key);
+    }
+    if (server_keys.ecc_public_key) {
+        EC_KEY_free(server_keys.ecc_public_key);
+    }
+    if (client_keys.ecc_public_key) {
+        EC_KEY_free(client_keys.ecc_public_key);
+    }
+    client_cleanup(&client);
+    return rc;
+}
+
+static void print_phase(const char* name, double* samples, size_t count)
+{
+    double total = 0;
+
+    if (count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(*samples), compare_doubles);
+    fprintf(stderr, "%-26s %10.1f %10.1f %10.1f\n", name, total / (double)count * 1e6,
+            samples[count / 2] * 1e6, samples[(count * 99) / 100] * 1e6);
+}
+
+int main(int argc, char** argv) {
+    size_t handshakes = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+    size_t requests = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+    Server server;
+    SessionTable* sessions = NULL;
+    SessionMemory memory;
+    Transport client_end, server_end;
+    MemoryPipe to_server, to_client;
+    WireCount wire, total;
+    double* samples[PHASES] = { NULL };
+    double handshake_time = 0, request_time = 0;
+    int ret = EXIT_FAILURE;
+    size_t i, p;
+
+    if (handshakes == 0) {
+        fprintf(stderr, "ERROR: need at least one handshake\n");
+        return EXIT_FAILURE;
+    }
+    // the protocol log is not what is being measured
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    memset(&server, 0, sizeof(server));
+    memset(&total, 0, sizeof(total));
+    if (server_init(&server) != TRUE) {
+        fprintf(stderr, "ERROR: server_init failed\n");
+        return EXIT_FAILURE;
+    }
+    // "crypto=<n>": the server's handshake checks run on n workers, 0 keeps them on this thread
+    server.crypto = crypto_pool_create(crypto_workers_from_args(argc, argv));
+    transport_pipe(&client_end, &server_end, &to_server, &to_client);
+    sessions = session_table_create(handshakes);
+    if (sessions == NULL) {
+        fprintf(stderr, "ERROR: no session table for %zu sessions\n", handshakes);
+        goto cleanup;
+    }
+
+    for (p = 0; p < PHASES; p++) {
+        samples[p] = malloc(sizeof(double) * (p == PHASE_REQUEST ? handshakes * requests + 1 : handshakes));
+        if (samples[p] == NULL) {
+            perror("malloc");
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < handshakes; i++) {
+        double phase_times[PHASES];
+
+        if (run_connection(&server, sessions, i, &client_end, &server_end, requests, phase_times,
+                           samples[PHASE_REQUEST] + i * requests, &wire) != TRUE) {
+            fprintf(stderr, "ERROR: connection %zu failed\n", i);
+            goto cleanup;
+        }
+        for (p = 0; p < PHASE_REQUEST; p++) {
+            samples[p][i] = phase_times[p];
+        }
+        handshake_time += phase_times[PHASE_HANDSHAKE];
+        for (p = 0; p < 2; p++) {
+            total.handshake_bytes[p] += wire.handshake_bytes[p];
+            total.handshake_records[p] += wire.handshake_records[p];
+            total.request_bytes[p] += wire.request_bytes[p];
+        }
+    }
+    for (i = 0; i < handshakes * requests; i++) {
+        request_time += samples[PHASE_REQUEST][i];
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "%zu handshakes, %zu requests each, client and server in one process over memory pipes, %zu crypto workers\n",
+            handshakes, requests, crypto_pool_workers(server.crypto));
+    fprintf(stderr, "%-26s %10s %10s %10s\n", "phase", "mean us", "p50 us", "p99 us");
+    for (p = 0; p < PHASE_REQUEST; p++) {
+        print_phase(phase_names[p], samples[p], handshakes);
+    }
+    print_phase(phase_names[PHASE_REQUEST], samples[PHASE_REQUEST], handshakes * requests);
+    fprintf(stderr, "handshakes/sec %10.1f\n", (double)handshakes / handshake_time);
+    if (requests > 0) {
+        fprintf(stderr, "requests/sec   %10.1f\n", (double)(handshakes * requests) / request_time);
+    }
+    fprintf(stderr, "handshake      client -> server %zu bytes in %zu records, server -> client %zu bytes in %zu records\n",
+            total.handshake_bytes[0] / handshakes, total.handshake_records[0] / handshakes,
+            total.handshake_bytes[1] / handshakes, total.handshake_records[1] / handshakes);
+    if (requests > 0) {
+        fprintf(stderr, "request        client -> server %zu bytes, server -> client %zu bytes\n",
+                total.request_bytes[0] / (handshakes * requests), total.request_bytes[1] / (handshakes * requests));
+    }
+    session_table_memory(sessions, &memory);
+    fprintf(stderr, "sessions       %zu with %zu client identities: session %zu bytes, identity %zu bytes, %zu bytes per session with index\n",
+            memory.sessions, memory.identities, sizeof(Session), sizeof(PeerIdentity),
+            (memory.index_bytes + memory.session_bytes + memory.identity_bytes) / memory.sessions);
+    crypto_pool_print_stats(server.crypto, stderr);
+    ret = EXIT_SUCCESS;
+
+cleanup:
+    for (p = 0; p < PHASES; p++) {
+        free(samples[p]);
+    }
+    memory_pipe_release(&to_server);
+    memory_pipe_release(&to_client);
+    transport_release(&client_end);
+    transport_release(&server_end);
+    session_table_destroy(sessions);
+    crypto_pool_destroy(server.crypto);
+    server_cleanup(&server);
+    return ret;
+}
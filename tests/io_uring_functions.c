@@ -0,0 +1,478 @@
+#include "io_uring_functions.h"
+
+int io_uring_from_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "io_uring") == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_RECV_MULTISHOT)
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define RING_ENTRIES 128
+// Receive buffers handed to the kernel, a power of two
+#define RECV_BUFFER_COUNT 64
+#define RECV_BUFFER_GROUP 0
+// one receive completion per buffer, plus the one that ends the multishot receive when buffers run out
+#define STASH_SIZE (RECV_BUFFER_COUNT + 1)
+// Room for the io_uring_recvmsg_out header and the sender address in front of the payload
+#define RECV_BUFFER_SIZE (BUFFER_SIZE + sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in))
+
+#define TAG_RECV 1
+#define TAG_SEND 2
+
+typedef struct Completion {
+    int res;
+    unsigned int flags;
+} Completion;
+
+typedef struct Uring {
+    int ring_fd;
+    int socket_fd;
+
+    void* ring;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_local_tail;
+    unsigned int to_submit;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // receive buffers and the registered ring that hands them to the kernel
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    unsigned char* buffers;
+    unsigned short buf_tail;
+    // buffers lent to the caller by the last batch, given back on the next one
+    unsigned short held[MAX_BATCH];
+    size_t held_count;
+
+    // multishot recvmsg: the kernel reads the sender address length from this template
+    struct msghdr recv_template;
+    int recv_armed;
+
+    // receive completions reaped while waiting for sends
+    Completion stash[STASH_SIZE];
+    size_t stash_start;
+    size_t stash_count;
+
+    // sendmsg arguments must stay put until their completion
+    struct msghdr send_msgs[MAX_BATCH];
+    struct iovec send_vectors[MAX_BATCH][MAX_SEGMENTS];
+    struct sockaddr_in send_addrs[MAX_BATCH];
+} Uring;
+
+static int ring_enter(Uring* u, unsigned int min_complete)
+{
+    unsigned int flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    long rc;
+
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+    do {
+        rc = syscall(__NR_io_uring_enter, u->ring_fd, u->to_submit, min_complete, flags, NULL, 0);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        perror("io_uring_enter");
+        return FALSE;
+    }
+    u->to_submit -= (unsigned int)rc < u->to_submit ? (unsigned int)rc : u->to_submit;
+    return TRUE;
+}
+
+static struct io_uring_sqe* get_sqe(Uring* u)
+{
+    unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local_tail - head > u->sq_mask) {
+        // submission queue full, hand what is queued to the kernel first
+        if (ring_enter(u, 0) != TRUE) {
+            return NULL;
+        }
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (u->sq_local_tail - head > u->sq_mask) {
+            return NULL;
+        }
+    }
+
+    unsigned int index = u->sq_local_tail & u->sq_mask;
+    struct io_uring_sqe* sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[index] = index;
+    u->sq_local_tail++;
+    u->to_submit++;
+    return sqe;
+}
+
+// Takes the next completion off the queue; FALSE when it is empty
+static int pop_completion(Uring* u, unsigned long long* tag, Completion* c)
+{
+    unsigned int head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return FALSE;
+    }
+    struct io_uring_cqe* cqe = &u->cqes[head & u->cq_mask];
+    *tag = cqe->user_data;
+    c->res = cqe->res;
+    c->flags = cqe->flags;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static void give_buffer(Uring* u, unsigned short id)
+{
+    struct io_uring_buf* buf = &u->buf_ring->bufs[u->buf_tail & (RECV_BUFFER_COUNT - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)(u->buffers + (size_t)id * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = id;
+    u->buf_tail++;
+}
+
+static void publish_buffers(Uring* u)
+{
+    __atomic_store_n(&u->buf_ring->tail, u->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int arm_recv(Uring* u)
+{
+    struct io_uring_sqe* sqe = get_sqe(u);
+    if (sqe == NULL) {
+        return FALSE;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = u->socket_fd;
+    sqe->addr = (unsigned long long)(uintptr_t)&u->recv_template;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUFFER_GROUP;
+    sqe->user_data = TAG_RECV;
+    u->recv_armed = TRUE;
+    return TRUE;
+}
+
+// Turns a receive completion into a datagram pointing into its buffer. Returns 1 for a datagram, 0 for a completion
+// that carries none, -1 on error
+static int take_datagram(Uring* u, const Completion* c, ReceivedDatagram* d)
+{
+    if (!(c->flags & IORING_CQE_F_MORE)) {
+        // the multishot receive ended (e.g. it ran out of buffers), it is armed again on the next wait
+        u->recv_armed = FALSE;
+    }
+    if (c->res < 0) {
+        if (c->res == -ENOBUFS) {
+            return 0;
+        }
+        fprintf(stderr, "recvmsg - io_uring: %s\n", strerror(-c->res));
+        return -1;
+    }
+    if (!(c->flags & IORING_CQE_F_BUFFER)) {
+        return 0;
+    }
+
+    unsigned short id = (unsigned short)(c->flags >> IORING_CQE_BUFFER_SHIFT);
+    unsigned char* buffer = u->buffers + (size_t)id * RECV_BUFFER_SIZE;
+    struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buffer;
+    unsigned char* name = buffer + sizeof(*out);
+
+    u->held[u->held_count++] = id;
+    memset(&d->from, 0, sizeof(d->from));
+    memcpy(&d->from, name, out->namelen < sizeof(d->from) ? out->namelen : sizeof(d->from));
+    d->data = name + u->recv_template.msg_namelen + u->recv_template.msg_controllen;
+    d->len = (out->flags & MSG_TRUNC) ? 0 : out->payloadlen;
+    return 1;
+}
+
+static int uring_recv_batch(void* context, ReceivedDatagram* batch, size_t max)
+{
+    Uring* u = context;
+    size_t n = 0;
+
+    // the previous batch is done with: its buffers go back to the kernel
+    for (size_t i = 0; i < u->held_count; i++) {
+        give_buffer(u, u->held[i]);
+    }
+    u->held_count = 0;
+    publish_buffers(u);
+
+    while (n == 0) {
+        unsigned long long tag;
+        Completion c;
+
+        while (n < max && u->stash_count > 0) {
+            c = u->stash[u->stash_start];
+            u->stash_start = (u->stash_start + 1) % STASH_SIZE;
+            u->stash_count--;
+            int rc = take_datagram(u, &c, &batch[n]);
+            if (rc < 0) {
+                return -1;
+            }
+            n += (size_t)rc;
+        }
+        while (n < max && pop_completion(u, &tag, &c)) {
+            if (tag != TAG_RECV) {
+                continue;
+            }
+            int rc = take_datagram(u, &c, &batch[n]);
+            if (rc < 0) {
+                return -1;
+            }
+            n += (size_t)rc;
+        }
+        if (n > 0) {
+            break;
+        }
+
+        if (!u->recv_armed && arm_recv(u) != TRUE) {
+            return -1;
+        }
+        if (ring_enter(u, 1) != TRUE) {
+            return -1;
+        }
+    }
+    return (int)n;
+}
+
+// Datagrams complete on the ring, the socket is drained as they come: it is the ring that is waited on. A receive
+// that ran out of buffers leaves a completion too, uring_recv_batch gives them back and arms it again
+static int uring_wait(void* context, long timeout_ms)
+{
+    Uring* u = context;
+    struct pollfd p;
+    int rc;
+
+    if (u->stash_count > 0 || *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 1;
+    }
+    if (!u->recv_armed && arm_recv(u) != TRUE) {
+        return -1;
+    }
+    if (u->to_submit > 0 && ring_enter(u, 0) != TRUE) {
+        return -1;
+    }
+    do {
+        p.fd = u->ring_fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        rc = poll(&p, 1, timeout_ms < 0 ? -1 : (int)timeout_ms);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        perror("poll - io_uring");
+    }
+    return rc;
+}
+
+static int uring_send_batch(void* context, const OutgoingDatagram* batch, size_t count)
+{
+    Uring* u = context;
+    size_t done = 0;
+
+    while (done < count) {
+        size_t chunk = count - done > MAX_BATCH ? MAX_BATCH : count - done;
+        size_t completed = 0, i, j;
+        int failed = FALSE;
+
+        for (i = 0; i < chunk; i++) {
+            const OutgoingDatagram* d = &batch[done + i];
+            struct msghdr* msg = &u->send_msgs[i];
+            for (j = 0; j < d->segment_count; j++) {
+                u->send_vectors[i][j].iov_base = (void*)d->segments[j].data;
+                u->send_vectors[i][j].iov_len = d->segments[j].len;
+            }
+            u->send_addrs[i] = d->to;
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_name = &u->send_addrs[i];
+            msg->msg_namelen = sizeof(u->send_addrs[i]);
+            msg->msg_iov = u->send_vectors[i];
+            msg->msg_iovlen = d->segment_count;
+
+            struct io_uring_sqe* sqe = get_sqe(u);
+            if (sqe == NULL) {
+                fprintf(stderr, "io_uring submission queue full - uring_send_batch\n");
+                return FALSE;
+            }
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = u->socket_fd;
+            sqe->addr = (unsigned long long)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->user_data = TAG_SEND;
+        }
+
+        // one syscall submits the whole chunk and waits for it
+        if (ring_enter(u, (unsigned int)chunk) != TRUE) {
+            return FALSE;
+        }
+        while (completed < chunk) {
+            unsigned long long tag;
+            Completion c;
+            if (!pop_completion(u, &tag, &c)) {
+                if (ring_enter(u, 1) != TRUE) {
+                    return FALSE;
+                }
+                continue;
+            }
+            if (tag == TAG_RECV) {
+                // keep it for the next uring_recv_batch
+                u->stash[(u->stash_start + u->stash_count) % STASH_SIZE] = c;
+                u->stash_count++;
+                continue;
+            }
+            if (c.res < 0) {
+                fprintf(stderr, "sendmsg - io_uring: %s\n", strerror(-c.res));
+                failed = TRUE;
+            }
+            completed++;
+        }
+        if (failed) {
+            return FALSE;
+        }
+        done += chunk;
+    }
+    return TRUE;
+}
+
+static void uring_release(void* context)
+{
+    Uring* u = context;
+    if (u == NULL) {
+        return;
+    }
+    if (u->ring_fd >= 0) {
+        close(u->ring_fd);
+    }
+    if (u->ring != NULL && u->ring != MAP_FAILED) {
+        munmap(u->ring, u->ring_size);
+    }
+    if (u->sqes != NULL && (void*)u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqes_size);
+    }
+    if (u->buf_ring != NULL && (void*)u->buf_ring != MAP_FAILED) {
+        munmap(u->buf_ring, u->buf_ring_size);
+    }
+    free(u->buffers);
+    free(u);
+}
+
+int transport_use_io_uring(Transport* t)
+{
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    Uring* u;
+
+    if (t->type != TRANSPORT_UDP) {
+        fprintf(stderr, "io_uring backend only drives UDP transports\n");
+        return FALSE;
+    }
+
+    u = calloc(1, sizeof(*u));
+    if (u == NULL) {
+        perror("calloc - transport_use_io_uring");
+        return FALSE;
+    }
+    u->socket_fd = t->fd;
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    // every receive buffer and every send of a batch can have a completion waiting
+    params.cq_entries = 2 * (RECV_BUFFER_COUNT + MAX_BATCH);
+    u->ring_fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (u->ring_fd < 0) {
+        perror("io_uring_setup");
+        free(u);
+        return FALSE;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        fprintf(stderr, "io_uring: kernel too old\n");
+        uring_release(u);
+        return FALSE;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    u->ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (u->ring == MAP_FAILED || (void*)u->sqes == MAP_FAILED) {
+        perror("mmap - io_uring");
+        uring_release(u);
+        return FALSE;
+    }
+
+    unsigned char* ring = u->ring;
+    u->sq_head = (unsigned int*)(ring + params.sq_off.head);
+    u->sq_tail = (unsigned int*)(ring + params.sq_off.tail);
+    u->sq_mask = *(unsigned int*)(ring + params.sq_off.ring_mask);
+    u->sq_array = (unsigned int*)(ring + params.sq_off.array);
+    u->sq_local_tail = *u->sq_tail;
+    u->cq_head = (unsigned int*)(ring + params.cq_off.head);
+    u->cq_tail = (unsigned int*)(ring + params.cq_off.tail);
+    u->cq_mask = *(unsigned int*)(ring + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+
+    // receive buffers, registered once as a provided buffer ring: multishot receive picks them without copies
+    u->buf_ring_size = RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    u->buf_ring = mmap(NULL, u->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->buffers = malloc((size_t)RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+    if ((void*)u->buf_ring == MAP_FAILED || u->buffers == NULL) {
+        perror("receive buffers - io_uring");
+        uring_release(u);
+        return FALSE;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)u->buf_ring;
+    reg.ring_entries = RECV_BUFFER_COUNT;
+    reg.bgid = RECV_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register - receive buffers");
+        uring_release(u);
+        return FALSE;
+    }
+    for (unsigned short id = 0; id < RECV_BUFFER_COUNT; id++) {
+        give_buffer(u, id);
+    }
+    publish_buffers(u);
+
+    u->recv_template.msg_namelen = sizeof(struct sockaddr_in);
+    if (arm_recv(u) != TRUE || ring_enter(u, 0) != TRUE) {
+        uring_release(u);
+        return FALSE;
+    }
+
+    transport_detach_backend(t);
+    t->backend.recv_batch = uring_recv_batch;
+    t->backend.send_batch = uring_send_batch;
+    t->backend.wait = uring_wait;
+    t->backend.release = uring_release;
+    t->backend.context = u;
+    return TRUE;
+}
+
+#else
+
+int transport_use_io_uring(Transport* t)
+{
+    (void)t;
+    fprintf(stderr, "io_uring is not available in this build\n");
+    return FALSE;
+}
+
+#endif
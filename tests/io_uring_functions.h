@@ -0,0 +1,12 @@
+#pragma once
+#include "socket_functions.h"
+
+// Attaches an io_uring backend to a UDP transport; transport_recv_batch / transport_send_batch then go through it.
+// Receives come from one multishot recvmsg into a ring of receive buffers registered with the kernel, so datagrams
+// are handed out in place and a busy socket needs no syscall per datagram; each batch of replies is submitted with one
+// io_uring_enter. Returns FALSE (and leaves the socket path in place) when io_uring is not available.
+// Release with transport_release.
+int transport_use_io_uring(Transport* t);
+
+// "io_uring" anywhere in the arguments
+int io_uring_from_args(int argc, char** argv);
@@ -0,0 +1,674 @@
+/*
+ * load_gen.c
+ *
+ * Open-loop load generator for the QSSL server (UDP). A pool of simulated
+ * clients, each with its own socket and session, is connected first; then
+ * operations arrive at a fixed rate whatever the server does, a mix of full
+ * handshakes (a new client: keys, hello, key exchange, handshake) and login
+ * requests on an established session. Worker threads take the operations in
+ * arrival order, each on an idle client. The latency of an operation runs from
+ * its scheduled arrival to its answer, so time spent queued behind a slow
+ * server is counted (no coordinated omission). A share of the logins can go
+ * out as resumed sessions instead: the session is left for the one its ticket
+ * resumes, and the login is the early data that opens it. Reports throughput
+ * and latency percentiles per operation from log-linear histograms.
+ *
+ * The server takes sessions up to its max_sessions and refuses more: clients
+ * past that fail to connect in the warm-up, which is part of what this shows.
+ * A session left idle for SESSION_IDLE_TIMEOUT_MS is dropped, so a client
+ * that sees no operation for that long fails its next login. The server
+ * admits handshakes per source /24: on Linux the clients of a loopback server
+ * come from 127.x.y.z, CLIENTS_PER_PREFIX to a /24, and thousands of them
+ * connect without being throttled. Every client holds a socket, the open
+ * file limit is raised to match. The protocol log goes to stdout, the results
+ * to stderr.
+ *
+ * Usage: load_gen [rate=<ops/s>] [duration=<s>] [clients=<n>] [workers=<n>]
+ *                 [handshakes=<percent>] [resumes=<percent>] [port=<n>]
+ *                 [mtu=<bytes>]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+
+#include "protocol_functions.h"
+#include "socket_functions.h"
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sys/resource.h>
+#define LOAD_SUPPORTED
+#endif
+
+#if defined(LOAD_SUPPORTED)
+
+typedef enum OpType {
+    OP_HANDSHAKE,
+    OP_LOGIN,
+    // a login as the early data of the resumed session
+    OP_RESUME,
+    OP_TYPES
+} OpType;
+
+static const char* const op_names[OP_TYPES] = { "handshake", "login", "resume" };
+
+// Log-linear latency histogram in microseconds: values below HIST_SUB_COUNT are exact, above that every power of two
+// is cut into HIST_SUB_COUNT / 2 buckets, so a recorded value is off by less than 2 / HIST_SUB_COUNT
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB_COUNT + (64 - HIST_SUB_BITS) * (HIST_SUB_COUNT / 2))
+
+typedef struct Histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+    double sum;
+} Histogram;
+
+#define DEFAULT_CLIENTS 2048
+// Clients sharing a source /24, within the handshake burst the server admits from one (HANDSHAKE_BURST in server.h)
+#define CLIENTS_PER_PREFIX 32
+
+// Operations scheduled but not started yet, beyond this they are counted as dropped
+#define MAX_QUEUED_JOBS 65536
+
+typedef struct Job {
+    OpType type;
+    // when the operation was due to arrive
+    uint64_t scheduled_us;
+} Job;
+
+typedef struct SimClient SimClient;
+
+struct SimClient {
+    int fd;
+    // the address it sends from, see source_address
+    struct sockaddr_in source;
+    Transport transport;
+    TimerWheel timers;
+    Client client;
+    Server_Keys server_keys;
+    unsigned char session_key[AES_KEY_SIZE];
+    RecordState records;
+    BOOL ready;
+    SimClient* next_idle;
+};
+
+typedef struct LoadConfig {
+    double rate;
+    double duration;
+    size_t clients;
+    size_t workers;
+    unsigned int handshake_percent;
+    unsigned int resume_percent;
+    struct sockaddr_in server;
+    size_t max_datagram;
+} LoadConfig;
+
+typedef struct LoadGen {
+    LoadConfig config;
+    pthread_mutex_t lock;
+    pthread_cond_t jobs_ready;
+    Job* jobs;
+    size_t job_head;
+    size_t job_count;
+    size_t dropped;
+    BOOL done;
+    SimClient* clients;
+    // clients no worker is using, a stack
+    SimClient* idle;
+} LoadGen;
+
+typedef struct Worker {
+    LoadGen* gen;
+    size_t index;
+    pthread_t thread;
+    Histogram latency[OP_TYPES];
+    size_t errors[OP_TYPES];
+    // warm-up: clients that failed to connect
+    size_t failed;
+} Worker;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static size_t histogram_index(uint64_t value)
+{
+    if (value < HIST_SUB_COUNT) {
+        return (size_t)value;
+    }
+    int msb = 63;
+    while (!(value >> msb)) {
+        msb--;
+    }
+    // keep the top HIST_SUB_BITS bits of the value
+    int shift = msb - (HIST_SUB_BITS - 1);
+    return HIST_SUB_COUNT + (size_t)(shift - 1) * (HIST_SUB_COUNT / 2) + (size_t)((value >> shift) - HIST_SUB_COUNT / 2);
+}
+
+// Highest value that lands in bucket index
+static uint64_t histogram_value(size_t index)
+{
+    if (index < HIST_SUB_COUNT) {
+        return index;
+    }
+    size_t shift = (index - HIST_SUB_COUNT) / (HIST_SUB_COUNT / 2) + 1;
+    uint64_t top = (index - HIST_SUB_COUNT) % (HIST_SUB_COUNT / 2) + HIST_SUB_COUNT / 2;
+    return ((top + 1) << shift) - 1;
+}
+
+static void histogram_record(Histogram* h, uint64_t value)
+{
+    h->counts[histogram_index(value)]++;
+    h->total++;
+    h->sum += (double)value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+static void histogram_add(Histogram* into, const Histogram* from)
+{
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+static uint64_t histogram_percentile(const Histogram* h, double percentile)
+{
+    uint64_t wanted = (uint64_t)((double)h->total * percentile / 100.0 + 0.5), seen = 0;
+
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= wanted) {
+            uint64_t value = histogram_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void disconnect_client(SimClient* c)
+{
+    if (c->fd != INVALID_SOCKET) {
+        transport_release(&c->transport);
+        closesocket(c->fd);
+        c->fd = INVALID_SOCKET;
+    }
+    if (c->server_keys.rsa_public_key) {
+        RSA_free(c->server_keys.rsa_public_key);
+    }
+    if (c->server_keys.ecc_public_key) {
+        EC_KEY_free(c->server_keys.ecc_public_key);
+    }
+    memset(&c->server_keys, 0, sizeof(c->server_keys));
+    if (c->client.is_initialized) {
+        client_cleanup(&c->client);
+    }
+    memset(&c->client, 0, sizeof(c->client));
+    SAFE_AES_KEY_MEMSET(c->session_key);
+    c->ready = FALSE;
+}
+
+// The address client i sends from: any but for a loopback server on Linux, where all of 127/8 is the host's and the
+// clients are spread over 127.x.y.0/24 from 127.0.1.0 on
+static struct sockaddr_in source_address(const LoadConfig* config, size_t i)
+{
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+#if defined(__linux__)
+    if ((ntohl(config->server.sin_addr.s_addr) >> 24) == 127) {
+        uint32_t prefix = (uint32_t)(i / CLIENTS_PER_PREFIX) + 1;
+        addr.sin_addr.s_addr = htonl(0x7f000000u | (prefix & 0xffff) << 8 | (uint32_t)(i % CLIENTS_PER_PREFIX + 1));
+    }
+#endif
+    return addr;
+}
+
+// Every client holds a socket: raises the soft limit on open files to what clients need, as far as the hard limit goes
+static int raise_file_limit(size_t clients)
+{
+    struct rlimit limit;
+    rlim_t wanted = (rlim_t)clients + 64;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        perror("getrlimit - raise_file_limit");
+        return FALSE;
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted) {
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < wanted) {
+            fprintf(stderr, "ERROR: %zu clients need %llu open files, at most %llu are allowed\n", clients,
+                    (unsigned long long)wanted, (unsigned long long)limit.rlim_max);
+            return FALSE;
+        }
+        limit.rlim_cur = wanted;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            perror("setrlimit - raise_file_limit");
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// A new client as client.c runs it: fresh keys and socket, hello, then the handshake
+static int connect_client(SimClient* c, const LoadConfig* config)
+{
+    const char* hello = "Hello, Server!";
+    ClientHandshake h;
+    ProtocolEvent event = PROTOCOL_WANT_INPUT;
+    ProtocolRecord out;
+    unsigned char* record = NULL;
+    size_t record_len = 0;
+
+    disconnect_client(c);
+    if (client_init(&c->client) != TRUE) {
+        return FALSE;
+    }
+    if ((c->fd = socket(AF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET) {
+        perror("socket - connect_client");
+        return FALSE;
+    }
+    if (bind(c->fd, (const struct sockaddr*)&c->source, sizeof(c->source)) < 0) {
+        perror("bind - connect_client");
+        return FALSE;
+    }
+    transport_init(&c->transport, TRANSPORT_UDP, c->fd, config->server);
+    c->transport.max_datagram = config->max_datagram;
+    timer_wheel_init(&c->timers, monotonic_ms());
+    if (transport_set_reliable(&c->transport, &c->timers) != TRUE) {
+        return FALSE;
+    }
+    if (transport_send(&c->transport, hello, strlen(hello)) != TRUE) {
+        return FALSE;
+    }
+
+    client_handshake_init(&h, &c->client, &c->server_keys);
+    while (event == PROTOCOL_WANT_INPUT) {
+        if (transport_recv(&c->transport, &record, &record_len) != TRUE) {
+            event = PROTOCOL_FAILED;
+            break;
+        }
+        event = client_handshake_input(&h, record, record_len);
+        while (event != PROTOCOL_FAILED && protocol_next_output(&h.output, &out) == TRUE) {
+            if (transport_send(&c->transport, out.data, out.len) != TRUE) {
+                event = PROTOCOL_FAILED;
+            }
+        }
+    }
+    free(record);
+    if (event == PROTOCOL_SESSION_READY) {
+        memcpy(c->session_key, h.session_key, AES_KEY_SIZE);
+        memset(&c->records, 0, sizeof(c->records));
+        c->ready = TRUE;
+    }
+    client_handshake_free(&h);
+    return c->ready;
+}
+
+// One login on the client's session, as the WPF front end sends it; TRUE when the server answers Good
+static int login(SimClient* c)
+{
+    static const unsigned char message[] = { 5, 0, 'a', 'd', 'm', 'i', 'n', 8, 0, 'p', 'a', 's', 's', 'w', 'o', 'r', 'd' };
+    SealedRecord sealed;
+    unsigned char answer[SEALED_CIPHERTEXT_SIZE + 1];
+    unsigned char* reply = NULL;
+    size_t reply_len = 0, answer_len = 0;
+    int rc = FALSE;
+
+    if (protocol_seal(c->session_key, SEAL_CLIENT_TO_SERVER, c->records.send_seq++, c->client.dilithium_private_key, message, sizeof(message),
+                      &sealed) != TRUE) {
+        return FALSE;
+    }
+    TransportSegment segments[2] = { { sealed.ciphertext, sealed.cipher_len }, { sealed.signature, sealed.signature_len } };
+    if (transport_request(&c->transport, segments, 2, &reply, &reply_len) == TRUE &&
+        protocol_open(c->session_key, SEAL_SERVER_TO_CLIENT, &c->records, c->server_keys.dilithium_public_key, reply, reply_len,
+                      answer, &answer_len) == TRUE) {
+        rc = answer_len == 4 && memcmp(answer, "Good", 4) == 0;
+    }
+    free(reply);
+    return rc;
+}
+
+// Leaves the client's session for the one its ticket resumes, as client.c does once a session went idle; the next
+// login opens it. FALSE without a session or a ticket yet
+static int resume_client(SimClient* c)
+{
+    unsigned char secret[AES_KEY_SIZE];
+    int rc;
+
+    if (!c->ready || !c->transport.ticket_held) {
+        return FALSE;
+    }
+    rc = protocol_resumption_secret(c->session_key, secret) == TRUE &&
+         protocol_resumed_key(secret, c->transport.ticket, c->session_key) == TRUE;
+    SAFE_AES_KEY_MEMSET(secret);
+    if (rc) {
+        transport_resume(&c->transport, c->transport.ticket);
+        memset(&c->records, 0, sizeof(c->records));
+    }
+    return rc;
+}
+
+// Warm-up: worker i connects clients i, i + workers, ...
+static void* warm_up(void* arg)
+{
+    Worker* w = arg;
+    LoadGen* gen = w->gen;
+
+    for (size_t i = w->index; i < gen->config.clients; i += gen->config.workers) {
+        if (connect_client(&gen->clients[i], &gen->config) != TRUE) {
+            w->failed++;
+        }
+    }
+    return NULL;
+}
+
+static void* run_worker(void* arg)
+{
+    Worker* w = arg;
+    LoadGen* gen = w->gen;
+
+    while (1) {
+        pthread_mutex_lock(&gen->lock);
+        while (gen->job_count == 0 && !gen->done) {
+            pthread_cond_wait(&gen->jobs_ready, &gen->lock);
+        }
+        if (gen->job_count == 0) {
+            pthread_mutex_unlock(&gen->lock);
+            break;
+        }
+        Job job = gen->jobs[gen->job_head];
+        gen->job_head = (gen->job_head + 1) % MAX_QUEUED_JOBS;
+        gen->job_count--;
+        // there are never fewer idle clients than idle workers
+        SimClient* c = gen->idle;
+        gen->idle = c->next_idle;
+        pthread_mutex_unlock(&gen->lock);
+
+        int ok;
+        if (job.type == OP_HANDSHAKE) {
+            ok = connect_client(c, &gen->config);
+        }
+        else if (job.type == OP_RESUME) {
+            // a client without a ticket yet (no login answered) does a handshake, as a user would
+            ok = (resume_client(c) || connect_client(c, &gen->config)) && login(c);
+        }
+        else {
+            // a client whose session was lost reconnects first, as a user would
+            ok = (c->ready || connect_client(c, &gen->config)) && login(c);
+        }
+        uint64_t done = now_us();
+        if (ok) {
+            histogram_record(&w->latency[job.type], done > job.scheduled_us ? done - job.scheduled_us : 0);
+        }
+        else {
+            w->errors[job.type]++;
+        }
+
+        pthread_mutex_lock(&gen->lock);
+        c->next_idle = gen->idle;
+        gen->idle = c;
+        pthread_mutex_unlock(&gen->lock);
+    }
+    return NULL;
+}
+
+static int start_workers(LoadGen* gen, Worker* workers, void* (*body)(void*))
+{
+    for (size_t i = 0; i < gen->config.workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, body, &workers[i]) != 0) {
+            perror("pthread_create");
+            for (size_t j = 0; j < i; j++) {
+                pthread_join(workers[j].thread, NULL);
+            }
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void join_workers(LoadGen* gen, Worker* workers)
+{
+    for (size_t i = 0; i < gen->config.workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+}
+
+// Schedules operations at the configured rate until the duration is over. Sleeps until the next arrival,
+// then queues every operation that is due by now, so the rate holds even when the sleep oversleeps
+static void dispatch(LoadGen* gen, uint64_t start)
+{
+    double interval = 1e6 / gen->config.rate;
+    uint64_t end = start + (uint64_t)(gen->config.duration * 1e6);
+    uint32_t random = 2463534242u;
+    size_t k = 0;
+
+    while (1) {
+        uint64_t next = start + (uint64_t)((double)k * interval);
+        if (next >= end) {
+            break;
+        }
+        uint64_t now = now_us();
+        if (now < next) {
+            struct timespec pause = { (time_t)((next - now) / 1000000), (long)((next - now) % 1000000) * 1000 };
+            nanosleep(&pause, NULL);
+            now = now_us();
+        }
+
+        pthread_mutex_lock(&gen->lock);
+        while (next <= now && next < end) {
+            // xorshift picks the operation
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            if (gen->job_count == MAX_QUEUED_JOBS) {
+                gen->dropped++;
+            }
+            else {
+                Job* job = &gen->jobs[(gen->job_head + gen->job_count) % MAX_QUEUED_JOBS];
+                unsigned int pick = random % 100;
+                job->type = pick < gen->config.handshake_percent ? OP_HANDSHAKE :
+                            pick < gen->config.handshake_percent + gen->config.resume_percent ? OP_RESUME : OP_LOGIN;
+                job->scheduled_us = next;
+                gen->job_count++;
+            }
+            k++;
+            next = start + (uint64_t)((double)k * interval);
+        }
+        pthread_cond_broadcast(&gen->jobs_ready);
+        pthread_mutex_unlock(&gen->lock);
+    }
+
+    pthread_mutex_lock(&gen->lock);
+    gen->done = TRUE;
+    pthread_cond_broadcast(&gen->jobs_ready);
+    pthread_mutex_unlock(&gen->lock);
+}
+
+static void print_latency(const char* name, const Histogram* h, size_t errors, double seconds)
+{
+    fprintf(stderr, "%-10s %8llu %7zu %9.1f", name, (unsigned long long)h->total, errors, (double)h->total / seconds);
+    if (h->total == 0) {
+        fprintf(stderr, "\n");
+        return;
+    }
+    fprintf(stderr, " %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", h->sum / (double)h->total / 1e3,
+            histogram_percentile(h, 50) / 1e3, histogram_percentile(h, 90) / 1e3, histogram_percentile(h, 99) / 1e3,
+            histogram_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+static int parse_args(int argc, char** argv, LoadConfig* config)
+{
+    unsigned short port = SERVER_PORT;
+
+    config->rate = 100;
+    config->duration = 10;
+    config->clients = DEFAULT_CLIENTS;
+    config->workers = 16;
+    config->handshake_percent = 10;
+    config->max_datagram = max_datagram_from_args(argc, argv);
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = strchr(argv[i], '=');
+        if (value == NULL) {
+            printf("Ignoring %s - parse_args\n", argv[i]);
+            continue;
+        }
+        value++;
+        if (strncmp(argv[i], "rate=", 5) == 0) {
+            config->rate = strtod(value, NULL);
+        }
+        else if (strncmp(argv[i], "duration=", 9) == 0) {
+            config->duration = strtod(value, NULL);
+        }
+        else if (strncmp(argv[i], "clients=", 8) == 0) {
+            config->clients = strtoul(value, NULL, 10);
+        }
+        else if (strncmp(argv[i], "workers=", 8) == 0) {
+            config->workers = strtoul(value, NULL, 10);
+        }
+        else if (strncmp(argv[i], "handshakes=", 11) == 0) {
+            config->handshake_percent = (unsigned int)strtoul(value, NULL, 10);
+        }
+        else if (strncmp(argv[i], "resumes=", 8) == 0) {
+            config->resume_percent = (unsigned int)strtoul(value, NULL, 10);
+        }
+        else if (strncmp(argv[i], "port=", 5) == 0) {
+            port = (unsigned short)strtoul(value, NULL, 10);
+        }
+        else if (strncmp(argv[i], "mtu=", 4) != 0) {
+            printf("Ignoring %s - parse_args\n", argv[i]);
+        }
+    }
+
+    if (config->rate <= 0 || config->duration <= 0 || config->workers == 0 || config->clients < config->workers ||
+        config->handshake_percent + config->resume_percent > 100) {
+        fprintf(stderr, "ERROR: need a positive rate and duration, at least one worker, no more workers than clients "
+                        "and handshake and resumption shares of 0 to 100 percent together\n");
+        return FALSE;
+    }
+
+    memset(&config->server, 0, sizeof(config->server));
+    config->server.sin_family = AF_INET;
+    config->server.sin_port = htons(port);
+    config->server.sin_addr.s_addr = inet_addr(LOCALHOST);
+    return TRUE;
+}
+
+int main(int argc, char** argv) {
+    LoadGen gen;
+    Worker* workers = NULL;
+    Histogram* all = NULL;
+    Histogram* totals = NULL;
+    size_t errors[OP_TYPES] = { 0 }, failed = 0, i;
+    int ret = EXIT_FAILURE;
+
+    memset(&gen, 0, sizeof(gen));
+    if (parse_args(argc, argv, &gen.config) != TRUE || raise_file_limit(gen.config.clients) != TRUE) {
+        return EXIT_FAILURE;
+    }
+    // the protocol log is not what is being measured
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    pthread_mutex_init(&gen.lock, NULL);
+    pthread_cond_init(&gen.jobs_ready, NULL);
+    gen.jobs = malloc(sizeof(Job) * MAX_QUEUED_JOBS);
+    gen.clients = calloc(gen.config.clients, sizeof(SimClient));
+    workers = calloc(gen.config.workers, sizeof(Worker));
+    totals = calloc(OP_TYPES + 1, sizeof(Histogram));
+    if (gen.jobs == NULL || gen.clients == NULL || workers == NULL || totals == NULL) {
+        perror("malloc");
+        goto cleanup;
+    }
+    all = &totals[OP_TYPES];
+    for (i = 0; i < gen.config.clients; i++) {
+        gen.clients[i].fd = INVALID_SOCKET;
+        gen.clients[i].source = source_address(&gen.config, i);
+    }
+    for (i = 0; i < gen.config.workers; i++) {
+        workers[i].gen = &gen;
+        workers[i].index = i;
+    }
+
+    fprintf(stderr, "connecting %zu clients with %zu workers\n", gen.config.clients, gen.config.workers);
+    uint64_t warm_up_start = now_us();
+    if (start_workers(&gen, workers, warm_up) != TRUE) {
+        goto cleanup;
+    }
+    join_workers(&gen, workers);
+    for (i = 0; i < gen.config.workers; i++) {
+        failed += workers[i].failed;
+    }
+    fprintf(stderr, "connected in %.2f s, %zu failed\n", (double)(now_us() - warm_up_start) / 1e6, failed);
+    for (i = gen.config.clients; i-- > 0;) {
+        gen.clients[i].next_idle = gen.idle;
+        gen.idle = &gen.clients[i];
+    }
+
+    fprintf(stderr, "open loop at %.1f ops/s for %.1f s, %u%% handshakes, %u%% resumptions\n", gen.config.rate,
+            gen.config.duration, gen.config.handshake_percent, gen.config.resume_percent);
+    if (start_workers(&gen, workers, run_worker) != TRUE) {
+        goto cleanup;
+    }
+    uint64_t start = now_us();
+    dispatch(&gen, start);
+    join_workers(&gen, workers);
+    double seconds = (double)(now_us() - start) / 1e6;
+    fflush(stdout);
+
+    for (i = 0; i < gen.config.workers; i++) {
+        for (int op = 0; op < OP_TYPES; op++) {
+            histogram_add(&totals[op], &workers[i].latency[op]);
+            histogram_add(all, &workers[i].latency[op]);
+            errors[op] += workers[i].errors[op];
+        }
+    }
+    fprintf(stderr, "%-10s %8s %7s %9s %9s %9s %9s %9s %9s %9s\n", "operation", "done", "errors", "ops/s", "mean ms", "p50 ms",
+            "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+    for (int op = 0; op < OP_TYPES; op++) {
+        print_latency(op_names[op], &totals[op], errors[op], seconds);
+    }
+    print_latency("all", all, errors[OP_HANDSHAKE] + errors[OP_LOGIN] + errors[OP_RESUME], seconds);
+    fprintf(stderr, "offered %.1f ops/s, completed %.1f ops/s in %.2f s, %zu not started (queue full)\n",
+            gen.config.rate, (double)all->total / seconds, seconds, gen.dropped);
+    ret = EXIT_SUCCESS;
+
+cleanup:
+    if (gen.clients) {
+        for (i = 0; i < gen.config.clients; i++) {
+            disconnect_client(&gen.clients[i]);
+        }
+    }
+    free(gen.clients);
+    free(gen.jobs);
+    free(workers);
+    free(totals);
+    pthread_cond_destroy(&gen.jobs_ready);
+    pthread_mutex_destroy(&gen.lock);
+    return ret;
+}
+
+#else
+
+int main(void) {
+    printf("load_gen needs pthreads\n");
+    return EXIT_FAILURE;
+}
+
+#endif
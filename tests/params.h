@@ -2,9 +2,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_WIN32)
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #pragma comment(lib, "ws2_32.lib") // Link with Winsock library
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Winsock names used by the socket code
+typedef int BOOL;
+#define TRUE 1
+#define FALSE 0
+#define INVALID_SOCKET (-1)
+#define closesocket close
+// no Winsock to start or stop
+typedef int WSADATA;
+#define MAKEWORD(low, high) 0
+#define WSAStartup(version, data) ((void)(data), 0)
+#define WSACleanup() ((void)0)
+#define WSAGetLastError() errno
+#endif
 
 #include <openssl/rsa.h>
 #include <openssl/pem.h>
@@ -14,6 +37,8 @@
 #include <openssl/ecdsa.h>
 #include <openssl/obj_mac.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
 
 #include <oqs/oqs.h>
 
@@ -37,8 +62,16 @@ static void secure_memzero(void* ptr, size_t len) {
 
 #define AES_KEY_SIZE 32  // 256 bits
 #define AES_BLOCK_SIZE 16
+// AES-GCM nonce and tag
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
 #define MAX_DATA_SIZE 1024
 #define RSA_KEY_SIZE 2048
+// handshake cookie: 32-bit big endian timestamp in seconds and a truncated HMAC-SHA256 of it, the peer address and
+// the connection ID sent with it
+#define COOKIE_SIZE 20
+// connection ID: one AES block, see connection_id_issue
+#define CONNECTION_ID_SIZE 16
 
 #if defined(OPENSSL_VERSION)
 
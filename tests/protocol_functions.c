@@ -0,0 +1,866 @@
+#include "protocol_functions.h"
+
+void client_cleanup(Client* client)
+{
+    if (!client) return;
+
+    if (client->ecc_private_key) {
+        EC_KEY_free(client->ecc_private_key);
+        client->ecc_private_key = NULL;
+    }
+
+    if (client->ecc_public_key) {
+        EC_KEY_free(client->ecc_public_key);
+        client->ecc_public_key = NULL;
+    }
+
+    if (client->dilithium_private_key) {
+        OQS_MEM_cleanse(client->dilithium_private_key, OQS_SIG_dilithium_2_length_secret_key);
+    }
+
+    client->is_initialized = FALSE;
+
+    SAFE_AES_KEY_MEMSET(client->aes_key);
+    EVP_cleanup();
+    ERR_free_strings();
+}
+
+int client_init(Client* client)
+{
+    if (!client) {
+        return FALSE;
+    }
+    if (client->is_initialized == TRUE)
+    {
+        return TRUE;
+    }
+
+    int rc = generate_aes_key(client->aes_key, AES_KEY_SIZE);
+    if (rc != TRUE)
+    {
+        printf("aes keys generation failed!");
+        client_cleanup(client);
+        return FALSE;
+    }
+    
+    rc = generate_ecc_keys(&client->ecc_private_key, &client->ecc_public_key);
+    if (rc != TRUE)
+    {
+        printf("ecc keys generation failed!");
+        client_cleanup(client);
+        return FALSE;
+    }
+
+    rc = generate_dilithium_keys(&client->dilithium_private_key, &client->dilithium_public_key);
+    if (rc != TRUE)
+    {
+        printf("dilithium keys generation failed!");
+        client_cleanup(client);
+        return FALSE;
+    }
+
+    // Initialize function pointers
+    client->cleanup = client_cleanup;
+
+    client->is_initialized = TRUE;
+    return TRUE;
+}
+
+void server_cleanup(Server* server)
+{
+    if (!server) return;
+
+    if (server->rsa_private_key) {
+        RSA_free(server->rsa_private_key);
+        server->rsa_private_key = NULL;
+    }
+
+    if (server->rsa_public_key) {
+        RSA_free(server->rsa_public_key);
+        server->rsa_public_key = NULL;
+    }
+
+    if (server->ecc_private_key) {
+        EC_KEY_free(server->ecc_private_key);
+        server->ecc_private_key = NULL;
+    }
+
+    if (server->ecc_public_key) {
+        EC_KEY_free(server->ecc_public_key);
+        server->ecc_public_key = NULL;
+    }
+
+    if (server->kyber_private_key) {
+        OQS_MEM_cleanse(server->kyber_private_key, OQS_KEM_kyber_768_length_secret_key);
+    }
+
+    if (server->dilithium_private_key) {
+        OQS_MEM_cleanse(server->dilithium_private_key, OQS_SIG_dilithium_2_length_secret_key);
+    }
+
+    server->is_initialized = FALSE;
+    EVP_cleanup();
+    ERR_free_strings();
+}
+
+int server_init(Server* server)
+{
+    if (!server) {
+        return FALSE;
+    }
+    if (server->is_initialized == TRUE)
+    {
+        return TRUE;
+    }
+
+    int rc = generate_rsa_keys(&server->rsa_private_key, &server->rsa_public_key);
+    if (rc != TRUE)
+    {
+        printf("rsa keys generation failed!");
+        server_cleanup(server);
+        return FALSE;
+    }
+
+    rc = generate_ecc_keys(&server->ecc_private_key, &server->ecc_public_key);
+    if (rc != TRUE)
+    {
+        printf("ecc keys generation failed!");
+        server_cleanup(server);
+        return FALSE;
+    }
+   
+    rc = generate_kyber_keys(&server->kyber_private_key, &server->kyber_public_key);
+    if (rc != TRUE)
+    {
+        printf("kyber keys generation failed!");
+        server_cleanup(server);
+        return FALSE;
+    } 
+
+    rc = generate_dilithium_keys(&server->dilithium_private_key, &server->dilithium_public_key);
+    if (rc != TRUE)
+    {
+        printf("dilithium keys generation failed!");
+        server_cleanup(server);
+        return FALSE;
+    }
+
+    // Initialize function pointers
+    server->cleanup = server_cleanup;
+
+    server->is_initialized = TRUE;
+    return TRUE;
+}
+
+// Labels of the records each side sends, every one followed by its value
+static const char* const server_labels[SERVER_FLIGHT_RECORDS / 2] = {
+    "RSA Key", "ECC Key", "Kyber Key", "Dilithium Key"
+};
+static const char* const client_labels[CLIENT_FLIGHT_RECORDS / 2] = {
+    "ECC Key", "Dilithium Key", "Encrypted AES Key", "Signature for AES Key", "Encapsulated Kyber Data", "Dilithium Signature"
+};
+
+static void queue_record(ProtocolOutput* output, const void* data, size_t len)
+{
+    output->records[output->count].data = data;
+    output->records[output->count].len = len;
+    output->count++;
+}
+
+static void queue_labeled(ProtocolOutput* output, const char* label, const void* data, size_t len)
+{
+    queue_record(output, label, strlen(label));
+    queue_record(output, data, len);
+}
+
+int protocol_next_output(ProtocolOutput* output, ProtocolRecord* record)
+{
+    if (output->next == output->count) {
+        output->next = output->count = 0;
+        return FALSE;
+    }
+    *record = output->records[output->next++];
+    return TRUE;
+}
+
+// Even steps are labels: they must name the value that comes next
+static int check_label(const char* expected, const unsigned char* record, size_t len)
+{
+    if (len != strlen(expected) || memcmp(record, expected, len) != 0) {
+        fprintf(stderr, "Expected a %s record, got %.*s - check_label\n", expected, (int)(len < 32 ? len : 32), (const char*)record);
+        return FALSE;
+    }
+    printf("%s:\n", expected);
+    return TRUE;
+}
+
+void client_handshake_init(ClientHandshake* h, Client* client, Server_Keys* server_keys)
+{
+    memset(h, 0, sizeof(*h));
+    h->client = client;
+    h->server_keys = server_keys;
+}
+
+// All of the server's keys are in: encrypt and sign the AES key, encapsulate and sign a Kyber secret, queue it all
+static ProtocolEvent client_flight(ClientHandshake* h)
+{
+    Client* client = h->client;
+    Server_Keys* ser_keys = h->server_keys;
+    uint8_t shared_secret[OQS_KEM_kyber_768_length_shared_secret];
+
+    // Serialize ECC public key
+    h->ecc_key = serialize_ecc_key(client->ecc_public_key, &h->ecc_key_len);
+    if (!h->ecc_key) {
+        printf("failed to serilaze ecc key!\n");
+        return PROTOCOL_FAILED;
+    }
+
+    // Encrypt AES key using RSA
+    if (rsa_encrypt(ser_keys->rsa_public_key, client->aes_key, AES_KEY_SIZE, h->encrypted_key, &h->encrypted_len) != TRUE) {
+        printf("failed to encrypt aes key!\n");
+        return PROTOCOL_FAILED;
+    }
+    // Sign the Key using ECC
+    if (ecc_sign(client->ecc_private_key, h->encrypted_key, h->encrypted_len, h->ecc_signature, &h->ecc_signature_len) != TRUE) {
+        printf("failed to sign the key using ECC!\n");
+        return PROTOCOL_FAILED;
+    }
+
+    // Encapsulate data using Kyber
+    if (kyber_encapsulate(h->encapsulated, shared_secret, ser_keys->kyber_public_key) != TRUE) {
+        printf("failed to encapsulate with kyber!\n");
+        return PROTOCOL_FAILED;
+    }
+    // Sign the Key using Dilithium
+    if (dilithium_sign(client->dilithium_private_key, h->encapsulated, OQS_KEM_kyber_768_length_ciphertext,
+                       h->dilithium_signature, &h->dilithium_signature_len) != TRUE) {
+        printf("failed to sign the key using Dilithium!\n");
+        OQS_MEM_cleanse(shared_secret, sizeof(shared_secret));
+        return PROTOCOL_FAILED;
+    }
+
+    queue_labeled(&h->output, client_labels[0], h->ecc_key, h->ecc_key_len);
+    queue_labeled(&h->output, client_labels[1], client->dilithium_public_key, OQS_SIG_dilithium_2_length_public_key);
+    queue_labeled(&h->output, client_labels[2], h->encrypted_key, h->encrypted_len);
+    queue_labeled(&h->output, client_labels[3], h->ecc_signature, h->ecc_signature_len);
+    queue_labeled(&h->output, client_labels[4], h->encapsulated, OQS_KEM_kyber_768_length_ciphertext);
+    queue_labeled(&h->output, client_labels[5], h->dilithium_signature, h->dilithium_signature_len);
+
+    // create the session key using xor between both keys
+    xor(client->aes_key, shared_secret, h->session_key, AES_KEY_SIZE);
+    OQS_MEM_cleanse(shared_secret, sizeof(shared_secret));
+    printf("Session key is Ready to use\n");
+    return PROTOCOL_SESSION_READY;
+}
+
+ProtocolEvent client_handshake_input(ClientHandshake* h, const unsigned char* record, size_t len)
+{
+    Server_Keys* ser_keys = h->server_keys;
+    size_t step = h->step++;
+
+    if (step >= SERVER_FLIGHT_RECORDS) {
+        fprintf(stderr, "Unexpected record after the handshake - client_handshake_input\n");
+        return PROTOCOL_FAILED;
+    }
+    if (step % 2 == 0) {
+        return check_label(server_labels[step / 2], record, len) == TRUE ? PROTOCOL_WANT_INPUT : PROTOCOL_FAILED;
+    }
+
+    switch (step / 2) {
+    case 0:
+        // Deserialize the public key
+        ser_keys->rsa_public_key = deserialize_rsa_key((const char*)record, len);
+        if (!ser_keys->rsa_public_key) {
+            fprintf(stderr, "Failed to deserialize RSA public key\n");
+            return PROTOCOL_FAILED;
+        }
+        printf("RSA public key successfully deserialized!\n");
+        return PROTOCOL_WANT_INPUT;
+    case 1:
+        ser_keys->ecc_public_key = deserialize_ecc_key((const char*)record, len);
+        if (!ser_keys->ecc_public_key) {
+            fprintf(stderr, "Failed to deserialize ECC public key\n");
+            return PROTOCOL_FAILED;
+        }
+        printf("ECC public key successfully deserialized!\n");
+        return PROTOCOL_WANT_INPUT;
+    case 2:
+        if (len != sizeof(ser_keys->kyber_public_key)) {
+            fprintf(stderr, "Failed to save Kyber public key\n");
+            return PROTOCOL_FAILED;
+        }
+        memcpy(ser_keys->kyber_public_key, record, len);
+        printf("Kyber public key successfully saved!\n");
+        return PROTOCOL_WANT_INPUT;
+    default:
+        if (len != OQS_SIG_dilithium_2_length_public_key) {
+            fprintf(stderr, "Failed to save Dilithium public key\n");
+            return PROTOCOL_FAILED;
+        }
+        memcpy(ser_keys->dilithium_public_key, record, len);
+        printf("server public keys saved successfully\n");
+        return client_flight(h);
+    }
+}
+
+void client_handshake_free(ClientHandshake* h)
+{
+    free(h->ecc_key);
+    h->ecc_key = NULL;
+    SAFE_AES_KEY_MEMSET(h->session_key);
+}
+
+ProtocolEvent server_handshake_init(ServerHandshake* h, Server* server, Client_Keys* client_keys)
+{
+    memset(h, 0, sizeof(*h));
+    h->server = server;
+    h->client_keys = client_keys;
+
+    // Serialize RSA and ECC public keys
+    h->rsa_key = serialize_rsa_key(server->rsa_public_key, &h->rsa_key_len);
+    h->ecc_key = serialize_ecc_key(server->ecc_public_key, &h->ecc_key_len);
+    if (!h->rsa_key || !h->ecc_key) {
+        printf("failed to serilaze the public keys!\n");
+        return PROTOCOL_FAILED;
+    }
+
+    queue_labeled(&h->output, server_labels[0], h->rsa_key, h->rsa_key_len);
+    queue_labeled(&h->output, server_labels[1], h->ecc_key, h->ecc_key_len);
+    queue_labeled(&h->output, server_labels[2], server->kyber_public_key, sizeof(server->kyber_public_key));
+    queue_labeled(&h->output, server_labels[3], server->dilithium_public_key, OQS_SIG_dilithium_2_length_public_key);
+    return PROTOCOL_WANT_INPUT;
+}
+
+// The server's checks of the client's flight as a task graph: the classical chain (verify the ECC signature, then
+// decrypt the RSA wrapped key) and the post-quantum chain (verify the Dilithium signature, then decapsulate Kyber)
+// share nothing, so they run at the same time on the crypto pool and the session key is derived once both are done
+typedef enum HandshakeStep {
+    STEP_ECC_VERIFY,
+    STEP_RSA_DECRYPT,
+    STEP_DILITHIUM_VERIFY,
+    STEP_KYBER_DECAPSULATE,
+    HANDSHAKE_STEPS
+} HandshakeStep;
+
+typedef struct HandshakeChecks {
+    ServerHandshake* h;
+    const unsigned char* dil_sign;
+    size_t dil_sign_len;
+    unsigned char decrypted_key[RSA_KEY_SIZE / 8];
+    size_t decrypted_len;
+    uint8_t shared_secret[OQS_KEM_kyber_768_length_shared_secret];
+    int done[HANDSHAKE_STEPS];
+} HandshakeChecks;
+
+static int run_ecc_verify(void* arg)
+{
+    HandshakeChecks* c = arg;
+    ServerHandshake* h = c->h;
+    if (ecc_verify(h->client_keys->ecc_public_key, h->encrypted_key, h->encrypted_len, h->ecc_signature, (unsigned int)h->ecc_signature_len) != TRUE) {
+        printf("failed to verify the message using ECC!\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int run_rsa_decrypt(void* arg)
+{
+    HandshakeChecks* c = arg;
+    ServerHandshake* h = c->h;
+    if (rsa_decrypt(h->server->rsa_private_key, h->encrypted_key, h->encrypted_len, c->decrypted_key, &c->decrypted_len) != TRUE ||
+        c->decrypted_len != AES_KEY_SIZE) {
+        printf("failed to decrypt RSA !\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int run_dilithium_verify(void* arg)
+{
+    HandshakeChecks* c = arg;
+    ServerHandshake* h = c->h;
+    if (dilithium_verify(h->client_keys->dilithium_public_key, h->encapsulated, OQS_KEM_kyber_768_length_ciphertext,
+                         (uint8_t*)c->dil_sign, c->dil_sign_len) != TRUE) {
+        printf("failed to verify the message using Dilithium!\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int run_kyber_decapsulate(void* arg)
+{
+    HandshakeChecks* c = arg;
+    if (kyber_decapsulate(c->h->encapsulated, c->shared_secret, c->h->server->kyber_private_key) != TRUE) {
+        printf("failed to decpasulate Kyber !\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Each step and the one it waits for, -1 for none: a step only runs once its predecessor succeeded, there is
+// no need to decrypt what failed to verify
+static const struct {
+    CryptoJobType type;
+    int (*run)(void* arg);
+    int after;
+} handshake_steps[HANDSHAKE_STEPS] = {
+    { CRYPTO_ECC_VERIFY, run_ecc_verify, -1 },
+    { CRYPTO_RSA_DECRYPT, run_rsa_decrypt, STEP_ECC_VERIFY },
+    { CRYPTO_DILITHIUM_VERIFY, run_dilithium_verify, -1 },
+    { CRYPTO_KYBER_DECAPSULATE, run_kyber_decapsulate, STEP_DILITHIUM_VERIFY },
+};
+
+// Submits the first step of every chain to the server's crypto pool, each step carrying the one waiting for it,
+// so the chains run on workers of their own; without a pool they run one after the other on this thread
+static void run_checks(HandshakeChecks* c)
+{
+    CryptoJob jobs[HANDSHAKE_STEPS];
+    CryptoGroup group;
+    int i;
+
+    crypto_group_init(&group);
+    for (i = 0; i < HANDSHAKE_STEPS; i++) {
+        crypto_job_init(&jobs[i], handshake_steps[i].type, handshake_steps[i].run, c);
+    }
+    for (i = 0; i < HANDSHAKE_STEPS; i++) {
+        if (handshake_steps[i].after != -1) {
+            jobs[handshake_steps[i].after].next = &jobs[i];
+        }
+    }
+    for (i = 0; i < HANDSHAKE_STEPS; i++) {
+        if (handshake_steps[i].after == -1) {
+            crypto_submit(c->h->server->crypto, &group, &jobs[i]);
+        }
+    }
+    crypto_group_wait(&group);
+    crypto_group_destroy(&group);
+
+    // a step that never ran because its predecessor failed is left at FALSE
+    for (i = 0; i < HANDSHAKE_STEPS; i++) {
+        c->done[i] = jobs[i].result;
+    }
+}
+
+// The last record, the Dilithium signature of the Kyber ciphertext, is in: check both signatures, then take
+// the AES key out of RSA and the shared secret out of Kyber
+static ProtocolEvent server_finish(ServerHandshake* h, const unsigned char* dil_sign, size_t dil_sign_len)
+{
+    HandshakeChecks c;
+    ProtocolEvent event = PROTOCOL_SESSION_READY;
+
+    memset(&c, 0, sizeof(c));
+    c.h = h;
+    c.dil_sign = dil_sign;
+    c.dil_sign_len = dil_sign_len;
+
+    printf("transfer of session key completed\n");
+    run_checks(&c);
+    for (int i = 0; i < HANDSHAKE_STEPS; i++) {
+        if (c.done[i] != TRUE) {
+            event = PROTOCOL_FAILED;
+        }
+    }
+
+    if (event == PROTOCOL_SESSION_READY) {
+        // create the session key using xor between both keys
+        xor(c.decrypted_key, c.shared_secret, h->session_key, AES_KEY_SIZE);
+        printf("Session key is Ready to use\n");
+    }
+    SAFE_AES_KEY_MEMSET(c.decrypted_key);
+    OQS_MEM_cleanse(c.shared_secret, sizeof(c.shared_secret));
+    return event;
+}
+
+ProtocolEvent server_handshake_input(ServerHandshake* h, const unsigned char* record, size_t len)
+{
+    Client_Keys* cl_keys = h->client_keys;
+    size_t step = h->step++;
+
+    if (step >= CLIENT_FLIGHT_RECORDS) {
+        fprintf(stderr, "Unexpected record after the handshake - server_handshake_input\n");
+        return PROTOCOL_FAILED;
+    }
+    if (step % 2 == 0) {
+        return check_label(client_labels[step / 2], record, len) == TRUE ? PROTOCOL_WANT_INPUT : PROTOCOL_FAILED;
+    }
+
+    switch (step / 2) {
+    case 0:
+        cl_keys->ecc_public_key = deserialize_ecc_key((const char*)record, len);
+        if (!cl_keys->ecc_public_key) {
+            fprintf(stderr, "Failed to deserialize ECC public key\n");
+            return PROTOCOL_FAILED;
+        }
+        printf("ECC public key successfully deserialized!\n");
+        return PROTOCOL_WANT_INPUT;
+    case 1:
+        if (len != OQS_SIG_dilithium_2_length_public_key) {
+            fprintf(stderr, "Failed to save Dilithium public key\n");
+            return PROTOCOL_FAILED;
+        }
+        memcpy(cl_keys->dilithium_public_key, record, len);
+        printf("client public keys saved successfully\n");
+        return PROTOCOL_WANT_INPUT;
+    case 2:
+        if (len == 0 || len > sizeof(h->encrypted_key)) {
+            fprintf(stderr, "Failed to get encrypted key from client\n");
+            return PROTOCOL_FAILED;
+        }
+        memcpy(h->encrypted_key, record, len);
+        h->encrypted_len = len;
+        return PROTOCOL_WANT_INPUT;
+    case 3:
+        if (len == 0 || len > sizeof(h->ecc_signature)) {
+            fprintf(stderr, "Failed to get encrypted key signature from client\n");
+            return PROTOCOL_FAILED;
+        }
+        memcpy(h->ecc_signature, record, len);
+        h->ecc_signature_len = len;
+        return PROTOCOL_WANT_INPUT;
+    case 4:
+        if (len != OQS_KEM_kyber_768_length_ciphertext) {
+            fprintf(stderr, "Failed to get encapsulated message from client\n");
+            return PROTOCOL_FAILED;
+        }
+        memcpy(h->encapsulated, record, len);
+        return PROTOCOL_WANT_INPUT;
+    default:
+        return server_finish(h, record, len);
+    }
+}
+
+void server_handshake_free(ServerHandshake* h)
+{
+    free(h->rsa_key);
+    free(h->ecc_key);
+    h->rsa_key = NULL;
+    h->ecc_key = NULL;
+    SAFE_AES_KEY_MEMSET(h->session_key);
+}
+
+// The GCM nonce of record seq from direction: the direction, then the record number
+static void seal_nonce(SealDirection direction, uint64_t seq, unsigned char* nonce)
+{
+    memset(nonce, 0, AEAD_NONCE_SIZE);
+    nonce[3] = (unsigned char)direction;
+    for (int i = 0; i < SEALED_SEQ_SIZE; i++) {
+        nonce[AEAD_NONCE_SIZE - 1 - i] = (unsigned char)(seq >> (8 * i));
+    }
+}
+
+int protocol_seal(unsigned char* session_key, SealDirection direction, uint64_t seq, uint8_t* dilithium_private_key,
+                  const unsigned char* message, size_t len, SealedRecord* sealed)
+{
+    unsigned char nonce[AEAD_NONCE_SIZE];
+
+    if (len > MAX_SEALED_MESSAGE) {
+        printf("Message too long: %zu bytes - protocol_seal\n", len);
+        return FALSE;
+    }
+    // the record number goes out as it is in the nonce, and is authenticated as associated data
+    seal_nonce(direction, seq, nonce);
+    memcpy(sealed->ciphertext, nonce + AEAD_NONCE_SIZE - SEALED_SEQ_SIZE, SEALED_SEQ_SIZE);
+    if (aead_encrypt(session_key, nonce, sealed->ciphertext, SEALED_SEQ_SIZE, message, len,
+                     sealed->ciphertext + SEALED_SEQ_SIZE, sealed->ciphertext + SEALED_SEQ_SIZE + len) != TRUE) {
+        printf("Failed to encrypt the message! - protocol_seal\n");
+        return FALSE;
+    }
+    sealed->cipher_len = SEALED_OVERHEAD + len;
+    if (dilithium_sign(dilithium_private_key, sealed->ciphertext, sealed->cipher_len, sealed->signature, &sealed->signature_len) != TRUE) {
+        printf("Failed to Sign the message! - protocol_seal\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int protocol_sealed_split(size_t len, size_t* cipher_len)
+{
+    if (len < OQS_SIG_dilithium_2_length_signature) {
+        return FALSE;
+    }
+    *cipher_len = len - OQS_SIG_dilithium_2_length_signature;
+    return TRUE;
+}
+
+int protocol_sealed_seq(const unsigned char* ciphertext, size_t cipher_len, uint64_t* seq)
+{
+    if (cipher_len < SEALED_OVERHEAD) {
+        return FALSE;
+    }
+    *seq = 0;
+    for (int i = 0; i < SEALED_SEQ_SIZE; i++) {
+        *seq = (*seq << 8) | ciphertext[i];
+    }
+    return TRUE;
+}
+
+int protocol_decrypt(unsigned char* session_key, SealDirection direction, const unsigned char* ciphertext, size_t cipher_len,
+                     unsigned char* plaintext, size_t* plain_len, uint64_t* seq)
+{
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    size_t len;
+
+    if (cipher_len > SEALED_CIPHERTEXT_SIZE || protocol_sealed_seq(ciphertext, cipher_len, seq) != TRUE) {
+        return FALSE;
+    }
+    len = cipher_len - SEALED_OVERHEAD;
+    seal_nonce(direction, *seq, nonce);
+    if (aead_decrypt(session_key, nonce, ciphertext, SEALED_SEQ_SIZE, ciphertext + SEALED_SEQ_SIZE, len,
+                     ciphertext + SEALED_SEQ_SIZE + len, plaintext) != TRUE) {
+        return FALSE;
+    }
+    plaintext[len] = '\0';
+    *plain_len = len;
+    return TRUE;
+}
+
+int protocol_open(unsigned char* session_key, SealDirection direction, RecordState* records, uint8_t* dilithium_public_key,
+                  const unsigned char* record, size_t len, unsigned char* plaintext, size_t* plain_len)
+{
+    size_t cipher_len;
+    uint64_t seq;
+
+    if (protocol_sealed_split(len, &cipher_len) != TRUE || protocol_sealed_seq(record, cipher_len, &seq) != TRUE) {
+        printf("Message too short! - protocol_open\n");
+        return FALSE;
+    }
+    if (replay_check(&records->replay, seq) != TRUE) {
+        printf("Record %llu seen already! - protocol_open\n", (unsigned long long)seq);
+        return FALSE;
+    }
+    if (dilithium_verify(dilithium_public_key, (uint8_t*)record, cipher_len, (uint8_t*)record + cipher_len, OQS_SIG_dilithium_2_length_signature) != TRUE) {
+        printf("Failed to Verify the message! - protocol_open\n");
+        return FALSE;
+    }
+    if (protocol_decrypt(session_key, direction, record, cipher_len, plaintext, plain_len, &seq) != TRUE) {
+        printf("Failed to Decrypt the message! - protocol_open\n");
+        return FALSE;
+    }
+    replay_update(&records->replay, seq);
+    return TRUE;
+}
+
+int replay_check(const ReplayWindow* window, uint64_t seq)
+{
+    // seen is empty until the first record, whose number may be 0
+    if (window->seen == 0 || seq > window->newest) {
+        return TRUE;
+    }
+    if (window->newest - seq >= REPLAY_WINDOW_SIZE) {
+        return FALSE;
+    }
+    return !(window->seen & (1ULL << (window->newest - seq)));
+}
+
+void replay_update(ReplayWindow* window, uint64_t seq)
+{
+    if (window->seen == 0) {
+        window->newest = seq;
+        window->seen = 1;
+    }
+    else if (seq > window->newest) {
+        uint64_t shift = seq - window->newest;
+        window->seen = shift >= REPLAY_WINDOW_SIZE ? 1 : (window->seen << shift) | 1;
+        window->newest = seq;
+    }
+    else {
+        window->seen |= 1ULL << (window->newest - seq);
+    }
+}
+
+// Replaces the secrets once their period is over
+static int cookie_rotate(CookieJar* jar, uint64_t now_s)
+{
+    uint64_t epoch = now_s / COOKIE_ROTATE_S;
+
+    if (epoch == jar->epoch) {
+        return TRUE;
+    }
+    if (epoch == jar->epoch + 1) {
+        memcpy(jar->secrets[1], jar->secrets[0], COOKIE_SECRET_SIZE);
+    }
+    // a period went by without a hello: the old secret is too old to keep
+    else if (RAND_bytes(jar->secrets[1], COOKIE_SECRET_SIZE) != 1) {
+        printf("Failed to generate the cookie secret - cookie_rotate\n");
+        return FALSE;
+    }
+    if (RAND_bytes(jar->secrets[0], COOKIE_SECRET_SIZE) != 1) {
+        printf("Failed to generate the cookie secret - cookie_rotate\n");
+        return FALSE;
+    }
+    jar->epoch = epoch;
+    return TRUE;
+}
+
+// The cookie's MAC over its timestamp, the peer's address and port and the connection ID, as they are on the wire
+static int cookie_mac(const unsigned char* secret, const struct sockaddr_in* peer, const unsigned char* connection_id,
+                      const unsigned char* timestamp, unsigned char* mac)
+{
+    unsigned char input[4 + sizeof(peer->sin_addr.s_addr) + sizeof(peer->sin_port) + CONNECTION_ID_SIZE];
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    size_t at = 4;
+
+    memcpy(input, timestamp, 4);
+    memcpy(input + at, &peer->sin_addr.s_addr, sizeof(peer->sin_addr.s_addr));
+    at += sizeof(peer->sin_addr.s_addr);
+    memcpy(input + at, &peer->sin_port, sizeof(peer->sin_port));
+    at += sizeof(peer->sin_port);
+    memcpy(input + at, connection_id, CONNECTION_ID_SIZE);
+    if (HMAC(EVP_sha256(), secret, COOKIE_SECRET_SIZE, input, sizeof(input), digest, &digest_len) == NULL) {
+        printf("Failed to compute the cookie - cookie_mac\n");
+        return FALSE;
+    }
+    memcpy(mac, digest, COOKIE_SIZE - 4);
+    return TRUE;
+}
+
+int cookie_jar_init(CookieJar* jar, uint64_t now_s)
+{
+    memset(jar, 0, sizeof(*jar));
+    // two periods back, so that the first rotation draws both secrets
+    jar->epoch = now_s / COOKIE_ROTATE_S - 2;
+    return cookie_rotate(jar, now_s);
+}
+
+void cookie_jar_clear(CookieJar* jar)
+{
+    secure_memzero(jar->secrets, sizeof(jar->secrets));
+}
+
+int cookie_make(CookieJar* jar, const struct sockaddr_in* peer, const unsigned char* connection_id, uint64_t now_s,
+                unsigned char* cookie)
+{
+    if (cookie_rotate(jar, now_s) != TRUE) {
+        return FALSE;
+    }
+    cookie[0] = (unsigned char)(now_s >> 24);
+    cookie[1] = (unsigned char)(now_s >> 16);
+    cookie[2] = (unsigned char)(now_s >> 8);
+    cookie[3] = (unsigned char)now_s;
+    return cookie_mac(jar->secrets[0], peer, connection_id, cookie, cookie + 4);
+}
+
+int cookie_check(CookieJar* jar, const struct sockaddr_in* peer, const unsigned char* connection_id, uint64_t now_s,
+                 const unsigned char* cookie)
+{
+    unsigned char mac[COOKIE_SIZE - 4];
+    uint32_t made = ((uint32_t)cookie[0] << 24) | ((uint32_t)cookie[1] << 16) | ((uint32_t)cookie[2] << 8) | cookie[3];
+    uint64_t epoch;
+
+    if (cookie_rotate(jar, now_s) != TRUE) {
+        return FALSE;
+    }
+    if ((uint32_t)now_s - made > COOKIE_LIFETIME_S) {
+        return FALSE;
+    }
+    // the secret of the period the cookie was made in, if it is still kept
+    epoch = (now_s - ((uint32_t)now_s - made)) / COOKIE_ROTATE_S;
+    if (epoch != jar->epoch && epoch + 1 != jar->epoch) {
+        return FALSE;
+    }
+    if (cookie_mac(jar->secrets[epoch == jar->epoch ? 0 : 1], peer, connection_id, cookie, mac) != TRUE) {
+        return FALSE;
+    }
+    return CRYPTO_memcmp(mac, cookie + 4, sizeof(mac)) == 0;
+}
+
+int routing_key_load(RoutingKey* key, const char* path)
+{
+    unsigned char secret[AES_KEY_SIZE];
+    FILE* file = fopen(path, "rb");
+    int rc = TRUE;
+
+    if (file != NULL) {
+        if (fread(secret, 1, sizeof(secret), file) != sizeof(secret)) {
+            printf("Routing key file %s is too short - routing_key_load\n", path);
+            rc = FALSE;
+        }
+        fclose(file);
+    }
+    else if (RAND_bytes(secret, sizeof(secret)) != 1) {
+        printf("Failed to generate the routing key - routing_key_load\n");
+        rc = FALSE;
+    }
+    else {
+        rc = write_key_file(path, secret, sizeof(secret));
+    }
+
+    if (rc == TRUE &&
+        (AES_set_encrypt_key(secret, AES_KEY_SIZE * 8, &key->encrypt) < 0 || AES_set_decrypt_key(secret, AES_KEY_SIZE * 8, &key->decrypt) < 0)) {
+        printf("Failed to set the routing key - routing_key_load\n");
+        rc = FALSE;
+    }
+    SAFE_AES_KEY_MEMSET(secret);
+    return rc;
+}
+
+void routing_key_clear(RoutingKey* key)
+{
+    secure_memzero(key, sizeof(*key));
+}
+
+int connection_id_issue(const RoutingKey* key, uint8_t server_id, ConnectionId* id, unsigned char* wire)
+{
+    // 0 stands for no session
+    do {
+        if (RAND_bytes((unsigned char*)id, sizeof(*id)) != 1) {
+            printf("Failed to generate the connection ID - connection_id_issue\n");
+            return FALSE;
+        }
+    } while (*id == 0);
+    connection_id_seal(key, server_id, *id, wire);
+    return TRUE;
+}
+
+void connection_id_seal(const RoutingKey* key, uint8_t server_id, ConnectionId id, unsigned char* wire)
+{
+    unsigned char block[CONNECTION_ID_SIZE];
+
+    memset(block, 0, sizeof(block));
+    block[0] = server_id;
+    memcpy(block + 1 + ROUTING_CHECK_SIZE, &id, sizeof(id));
+    AES_encrypt(block, wire, &key->encrypt);
+}
+
+int connection_id_open(const RoutingKey* key, const unsigned char* wire, uint8_t* server_id, ConnectionId* id)
+{
+    static const unsigned char zeros[ROUTING_CHECK_SIZE] = { 0 };
+    unsigned char block[CONNECTION_ID_SIZE];
+
+    AES_decrypt(wire, block, &key->decrypt);
+    if (memcmp(block + 1, zeros, ROUTING_CHECK_SIZE) != 0) {
+        return FALSE;
+    }
+    *server_id = block[0];
+    memcpy(id, block + 1 + ROUTING_CHECK_SIZE, sizeof(*id));
+    return *id != 0;
+}
+
+// HMAC-SHA256 of label and extra (extra_len bytes, may be 0) under key
+static int derive_key(const unsigned char* key, const char* label, const unsigned char* extra, size_t extra_len, unsigned char* out)
+{
+    unsigned char input[32 + CONNECTION_ID_SIZE];
+    size_t label_len = strlen(label);
+    unsigned int out_len = 0;
+
+    memcpy(input, label, label_len);
+    if (extra_len > 0) {
+        memcpy(input + label_len, extra, extra_len);
+    }
+    if (HMAC(EVP_sha256(), key, AES_KEY_SIZE, input, label_len + extra_len, out, &out_len) == NULL) {
+        printf("Failed to derive the key - derive_key\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int protocol_resumption_secret(const unsigned char* session_key, unsigned char* secret)
+{
+    return derive_key(session_key, "qssl resumption", NULL, 0, secret);
+}
+
+int protocol_resumed_key(const unsigned char* secret, const unsigned char* ticket, unsigned char* session_key)
+{
+    return derive_key(secret, "qssl resumed session", ticket, CONNECTION_ID_SIZE, session_key);
+}
@@ -0,0 +1,301 @@
+#pragma once
+#include "crypto_functions.h"
+#include "crypto_pool.h"
+
+// Sans-IO QSSL protocol: the key exchange and handshake of both sides as state machines that take in the peer's
+// records and queue the records to send, plus the sealing of requests and answers. Nothing here touches a socket:
+// whoever drives it (the blocking drivers in client.c / server.c, the UDP batch loop, an event loop, a benchmark)
+// moves the records, each one as a unit of its own transport (a frame, a reliable UDP record).
+// The hello that opens a connection stays with the driver.
+
+// Forward declarations of structs
+typedef struct Client Client;
+typedef struct Server Server;
+
+// Function pointer typedefs
+typedef void (*ClientCleanupFunc)(Client* client);
+typedef void (*ServerCleanupFunc)(Server* server);
+
+struct Client {
+    // Data members
+    EC_KEY* ecc_private_key; // For signing
+    EC_KEY* ecc_public_key;  // For verification
+    uint8_t dilithium_private_key[OQS_SIG_dilithium_2_length_secret_key];
+    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
+
+    BOOL is_initialized;
+
+    // Generate AES key
+    unsigned char aes_key[AES_KEY_SIZE];
+
+    ClientCleanupFunc cleanup;
+};
+
+typedef struct Server_Keys {
+    RSA* rsa_public_key;
+    EC_KEY* ecc_public_key;
+    uint8_t kyber_public_key[OQS_KEM_kyber_768_length_public_key];
+    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
+}Server_Keys;
+
+struct Server {
+    // Data members
+    RSA* rsa_private_key;
+    RSA* rsa_public_key;
+    EC_KEY* ecc_private_key;
+    EC_KEY* ecc_public_key;
+    uint8_t kyber_private_key[OQS_KEM_kyber_768_length_secret_key];
+    uint8_t kyber_public_key[OQS_KEM_kyber_768_length_public_key];
+    uint8_t dilithium_private_key[OQS_SIG_dilithium_2_length_secret_key];
+    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
+    // workers for the handshake checks and the requests' crypto, NULL to run it on the I/O thread; owned by the caller
+    CryptoPool* crypto;
+
+    BOOL is_initialized;
+
+    ServerCleanupFunc cleanup;
+};
+
+typedef struct Client_Keys {
+    EC_KEY* ecc_public_key;
+    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
+}Client_Keys;
+
+// Long-term keys of each side; the cleanup frees them
+int client_init(Client* client);
+void client_cleanup(Client* client);
+int server_init(Server* server);
+void server_cleanup(Server* server);
+
+// Every key and handshake value goes out as a label record ("RSA Key") followed by the value itself
+#define SERVER_FLIGHT_RECORDS 8
+#define CLIENT_FLIGHT_RECORDS 12
+
+// Largest ECC signature (r and s of P-256)
+#define ECC_SIGNATURE_SIZE 64
+// Largest sealed ciphertext with its record number and tag, and so the largest message a request or an answer carries
+#define SEALED_CIPHERTEXT_SIZE 256
+#define SEALED_SEQ_SIZE 8
+#define SEALED_OVERHEAD (SEALED_SEQ_SIZE + AEAD_TAG_SIZE)
+#define MAX_SEALED_MESSAGE (SEALED_CIPHERTEXT_SIZE - SEALED_OVERHEAD)
+// Records of a session older than the newest one taken in by this many or more are refused as replays
+#define REPLAY_WINDOW_SIZE 64
+
+typedef enum ProtocolEvent {
+    // nothing to report yet, feed the next record from the peer (after sending the queued ones)
+    PROTOCOL_WANT_INPUT,
+    // the handshake is over and session_key is set; records may still be queued for the peer
+    PROTOCOL_SESSION_READY,
+    // the peer broke the protocol or a key operation failed, the connection is to be dropped
+    PROTOCOL_FAILED
+} ProtocolEvent;
+
+typedef struct ProtocolRecord {
+    const unsigned char* data;
+    size_t len;
+} ProtocolRecord;
+
+// Records waiting to be sent, in order; they point into the state machine that queued them
+typedef struct ProtocolOutput {
+    ProtocolRecord records[CLIENT_FLIGHT_RECORDS];
+    size_t count;
+    size_t next;
+} ProtocolOutput;
+
+typedef struct ClientHandshake {
+    Client* client;
+    // filled in as the server's records come in, owned by the caller
+    Server_Keys* server_keys;
+    // index of the next record expected from the server
+    size_t step;
+    ProtocolOutput output;
+    unsigned char session_key[AES_KEY_SIZE];
+    // the values queued in output
+    char* ecc_key;
+    size_t ecc_key_len;
+    unsigned char encrypted_key[RSA_KEY_SIZE / 8];
+    size_t encrypted_len;
+    unsigned char ecc_signature[ECC_SIGNATURE_SIZE];
+    unsigned int ecc_signature_len;
+    uint8_t encapsulated[OQS_KEM_kyber_768_length_ciphertext];
+    uint8_t dilithium_signature[OQS_SIG_dilithium_2_length_signature];
+    size_t dilithium_signature_len;
+} ClientHandshake;
+
+typedef struct ServerHandshake {
+    Server* server;
+    // filled in as the client's records come in, owned by the caller (the ECC key included)
+    Client_Keys* client_keys;
+    size_t step;
+    ProtocolOutput output;
+    unsigned char session_key[AES_KEY_SIZE];
+    // the serialized keys queued in output
+    char* rsa_key;
+    size_t rsa_key_len;
+    char* ecc_key;
+    size_t ecc_key_len;
+    // the client's handshake values, checked once the last one is in
+    unsigned char encrypted_key[RSA_KEY_SIZE / 8];
+    size_t encrypted_len;
+    unsigned char ecc_signature[ECC_SIGNATURE_SIZE];
+    size_t ecc_signature_len;
+    uint8_t encapsulated[OQS_KEM_kyber_768_length_ciphertext];
+} ServerHandshake;
+
+// Which end sealed a record: both directions use the session key, the nonces of the two never meet
+typedef enum SealDirection {
+    SEAL_CLIENT_TO_SERVER = 0,
+    SEAL_SERVER_TO_CLIENT = 1
+} SealDirection;
+
+// Record numbers taken in (DTLS style): the newest one, and a bit for each of the REPLAY_WINDOW_SIZE before it,
+// bit i for newest - i. One shift and one test per record, whatever order the records come in
+typedef struct ReplayWindow {
+    uint64_t newest;
+    uint64_t seen;
+} ReplayWindow;
+
+// One end of a session: the number of the next record it seals, and the records it took in from the other end
+typedef struct RecordState {
+    uint64_t send_seq;
+    ReplayWindow replay;
+} RecordState;
+
+// A request or an answer: its 64-bit big endian record number, then the message under AES-256-GCM with the session
+// key, the direction and the record number as nonce, and its tag; all of it signed with the sender's Dilithium key.
+// On the wire the ciphertext (number, encrypted message, tag) is followed by the signature
+typedef struct SealedRecord {
+    unsigned char ciphertext[SEALED_CIPHERTEXT_SIZE];
+    size_t cipher_len;
+    uint8_t signature[OQS_SIG_dilithium_2_length_signature];
+    size_t signature_len;
+} SealedRecord;
+
+// Hands out the next queued record; FALSE once there are none left
+int protocol_next_output(ProtocolOutput* output, ProtocolRecord* record);
+
+// The client waits for the server's keys first, nothing is queued yet
+void client_handshake_init(ClientHandshake* h, Client* client, Server_Keys* server_keys);
+
+// Takes in one record from the server. After the last key the client's flight is queued and the session is ready
+ProtocolEvent client_handshake_input(ClientHandshake* h, const unsigned char* record, size_t len);
+
+void client_handshake_free(ClientHandshake* h);
+
+// Queues the server's keys. PROTOCOL_FAILED when they cannot be serialized
+ProtocolEvent server_handshake_init(ServerHandshake* h, Server* server, Client_Keys* client_keys);
+
+// Takes in one record from the client; the signatures are checked and the session key derived after the last one
+ProtocolEvent server_handshake_input(ServerHandshake* h, const unsigned char* record, size_t len);
+
+void server_handshake_free(ServerHandshake* h);
+
+// Encrypts message (at most MAX_SEALED_MESSAGE bytes) as record seq from direction, and signs it, into sealed. A
+// record number is never to be sealed twice under one session key
+int protocol_seal(unsigned char* session_key, SealDirection direction, uint64_t seq, uint8_t* dilithium_private_key,
+                  const unsigned char* message, size_t len, SealedRecord* sealed);
+
+// Splits a received sealed record: the ciphertext is the first *cipher_len bytes, the signature the rest.
+// FALSE when it is too short to carry a signature
+int protocol_sealed_split(size_t len, size_t* cipher_len);
+
+// The record number of a ciphertext, read before anything is checked so that replays are dropped cheaply; it only
+// counts once protocol_decrypt accepts the ciphertext. FALSE when it is too short to be one
+int protocol_sealed_seq(const unsigned char* ciphertext, size_t cipher_len, uint64_t* seq);
+
+// Decrypts a ciphertext from direction whose signature was checked already (a verification batch) into plaintext,
+// which takes SEALED_CIPHERTEXT_SIZE + 1 bytes and is NUL terminated, and gives its record number. FALSE for a longer
+// ciphertext or one the tag does not match. Replays are for the caller to check, see replay_check
+int protocol_decrypt(unsigned char* session_key, SealDirection direction, const unsigned char* ciphertext, size_t cipher_len,
+                     unsigned char* plaintext, size_t* plain_len, uint64_t* seq);
+
+// Checks the signature of a received sealed record and decrypts it, as protocol_decrypt; then checks its record
+// number against records and counts it there. FALSE for a replay too
+int protocol_open(unsigned char* session_key, SealDirection direction, RecordState* records, uint8_t* dilithium_public_key,
+                  const unsigned char* record, size_t len, unsigned char* plaintext, size_t* plain_len);
+
+// TRUE when record seq was not taken in yet and is not too old to tell
+int replay_check(const ReplayWindow* window, uint64_t seq);
+
+// Counts record seq as taken in; only for a record that passed replay_check and was authenticated
+void replay_update(ReplayWindow* window, uint64_t seq);
+
+// Stateless handshake cookies (RECORD_RETRY): the server answers a hello with a cookie bound to the peer's
+// address and only starts a handshake, with its state and public-key operations, for a hello that brings a
+// fresh one back. Cookies are signed with a secret that is replaced every COOKIE_ROTATE_S seconds; the one
+// before it is still accepted, so a cookie is good for COOKIE_LIFETIME_S whenever it was made
+#define COOKIE_SECRET_SIZE 32
+#define COOKIE_ROTATE_S 60
+#define COOKIE_LIFETIME_S 30
+
+typedef struct CookieJar {
+    // the current secret, then the previous one
+    unsigned char secrets[2][COOKIE_SECRET_SIZE];
+    // COOKIE_ROTATE_S periods since the clock's origin, of the current secret
+    uint64_t epoch;
+} CookieJar;
+
+// now_s: seconds on any clock that does not go back, the same one for every call on jar
+int cookie_jar_init(CookieJar* jar, uint64_t now_s);
+
+void cookie_jar_clear(CookieJar* jar);
+
+// Writes the COOKIE_SIZE cookie of peer and the connection ID it is sent with to cookie
+int cookie_make(CookieJar* jar, const struct sockaddr_in* peer, const unsigned char* connection_id, uint64_t now_s,
+                unsigned char* cookie);
+
+// TRUE when cookie was made for peer and connection_id, by this jar, at most COOKIE_LIFETIME_S ago
+int cookie_check(CookieJar* jar, const struct sockaddr_in* peer, const unsigned char* connection_id, uint64_t now_s,
+                 const unsigned char* cookie);
+
+// Connection IDs: the server gives every UDP session a CONNECTION_ID_SIZE ID with its cookie, and the client puts it
+// in front of every datagram it sends. The ID is one AES block under a routing key that the servers share with the
+// balancer in front of them. It holds the server ID (a shard the balancer can send to), ROUTING_CHECK_SIZE zero bytes,
+// and the 64-bit key of the session in the table. The balancer decrypts one block to route a datagram, and the
+// server decrypts the same block to find the session, whatever address the datagram came from. An ID that does not
+// decrypt to the zero bytes was not made with the key. Without the key nobody can read the server ID or link two IDs
+#define ROUTING_KEY_FILE "routing_key.bin"
+#define ROUTING_CHECK_SIZE 7
+// Server IDs fit in one byte
+#define MAX_SERVER_IDS 256
+
+typedef uint64_t ConnectionId;
+
+typedef struct RoutingKey {
+    AES_KEY encrypt;
+    AES_KEY decrypt;
+} RoutingKey;
+
+// Reads the AES_KEY_SIZE routing key from path, or makes one and writes it there for the other processes to read
+int routing_key_load(RoutingKey* key, const char* path);
+
+void routing_key_clear(RoutingKey* key);
+
+// A new random, nonzero session key id for server_id, and its encrypted form for the wire
+int connection_id_issue(const RoutingKey* key, uint8_t server_id, ConnectionId* id, unsigned char* wire);
+
+// The wire form of id for server_id, the same every time
+void connection_id_seal(const RoutingKey* key, uint8_t server_id, ConnectionId id, unsigned char* wire);
+
+// Decrypts an ID from the wire; FALSE when it was not made with key
+int connection_id_open(const RoutingKey* key, const unsigned char* wire, uint8_t* server_id, ConnectionId* id);
+
+// Session resumption (UDP): every session comes with a ticket, the connection ID of the session that resumes it, sent
+// along with its first answers (RECORD_TICKET). Both ends derive the ticket's resumption secret from the session key,
+// and the resumed session's key from the secret and the ticket, so the ticket itself carries nothing secret. A client
+// whose session went idle sends its next request under the ticket's connection ID, sealed and signed as in any session
+// but with the resumed key: the request is the hello (0-RTT early data) and its answer comes back one round trip later.
+// The server takes the ticket out of its table as it opens the resumed session, so the early data is taken in once: a
+// replay meets the session's replay window, or no ticket at all. A resumed session keeps the client's Dilithium key
+// from the handshake it goes back to, and has no forward secrecy of its own
+#define TICKET_LIFETIME_S (2 * 60 * 60)
+// Answers of a session that carry its ticket along, in case some are lost
+#define TICKET_REPEATS 4
+// A session without a request for this long is dropped by the server; the client resumes instead of using it again
+#define SESSION_IDLE_TIMEOUT_MS (5 * 60 * 1000)
+
+// The AES_KEY_SIZE resumption secret of the session with session_key
+int protocol_resumption_secret(const unsigned char* session_key, unsigned char* secret);
+
+// The session key of the session resumed with secret and ticket, the connection ID on the wire
+int protocol_resumed_key(const unsigned char* secret, const unsigned char* ticket, unsigned char* session_key);
@@ -1,462 +1,966 @@
+#if defined(__linux__)
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
 #include "server.h"
 
-void server_cleanup(Server* server)
-{
-    if (!server) return;
-
-    if (server->rsa_private_key) {
-        RSA_free(server->rsa_private_key);
-        server->rsa_private_key = NULL;
-    }
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+#include <pthread.h>
+#define SHARDS_SUPPORTED
+#endif
 
-    if (server->rsa_public_key) {
-        RSA_free(server->rsa_public_key);
-        server->rsa_public_key = NULL;
+int handshake_server(Server* server, Client_Keys* cl_keys, Transport* t, unsigned char* session_key)
+{
+    ServerHandshake h;
+    ProtocolRecord out;
+    unsigned char* record = NULL;
+    size_t record_len = 0;
+
+    // the server's keys go out first, then the client's records come in one at a time
+    ProtocolEvent event = server_handshake_init(&h, server, cl_keys);
+    while (event != PROTOCOL_FAILED && protocol_next_output(&h.output, &out) == TRUE) {
+        if (transport_send(t, out.data, out.len) != TRUE) {
+            event = PROTOCOL_FAILED;
+        }
     }
-
-    if (server->ecc_private_key) {
-        EC_KEY_free(server->ecc_private_key);
-        server->ecc_private_key = NULL;
+    if (event != PROTOCOL_FAILED) {
+        printf("all public keys sent successfully\n");
     }
 
-    if (server->ecc_public_key) {
-        EC_KEY_free(server->ecc_public_key);
-        server->ecc_public_key = NULL;
+    while (event == PROTOCOL_WANT_INPUT) {
+        if (transport_recv(t, &record, &record_len) != TRUE) {
+            event = PROTOCOL_FAILED;
+            break;
+        }
+        event = server_handshake_input(&h, record, record_len);
     }
+    free(record);
 
-    if (server->kyber_private_key) {
-        OQS_MEM_cleanse(server->kyber_private_key, OQS_KEM_kyber_768_length_secret_key);
+    if (event == PROTOCOL_SESSION_READY) {
+        memcpy(session_key, h.session_key, AES_KEY_SIZE);
     }
+    server_handshake_free(&h);
+    return event == PROTOCOL_SESSION_READY;
+}
 
-    if (server->kyber_shared_secret) {
-        OQS_MEM_cleanse(server->kyber_shared_secret, OQS_KEM_kyber_768_length_shared_secret);
-    }
+int recv_encrypted_user(Transport* t, unsigned char* enc_key, RecordState* records, uint8_t* dilithium_client_public_key,
+                        uint8_t* dilithium_server_private_key, unsigned char* result, size_t* res_len)
+{
+    unsigned char* buffer = NULL;
+    size_t recv_len = 0;
 
-    if (server->dilithium_private_key) {
-        OQS_MEM_cleanse(server->dilithium_private_key, OQS_SIG_dilithium_2_length_secret_key);
+    // waiting for message from client
+    if (transport_recv(t, &buffer, &recv_len) != TRUE) {
+        printf("Failed to receive the message! - recv_encrypted_user\n");
+        return FALSE;
     }
 
-    server->is_initialized = FALSE;
-    EVP_cleanup();
-    ERR_free_strings();
+    // verify the message, then decrypt the data; a record taken in before is refused
+    int rc = protocol_open(enc_key, SEAL_CLIENT_TO_SERVER, records, dilithium_client_public_key, buffer, recv_len, result, res_len);
+    free(buffer);
+    return rc;
 }
 
-int server_init(Server* server) 
+int send_encrypted_answer(Transport* t, unsigned char* enc_key, RecordState* records,
+    uint8_t* dilithium_server_private_key, const unsigned char* message, size_t msg_len)
 {
-    if (!server) {
-        return FALSE;
-    }
-    if (server->is_initialized == TRUE)
-    {
-        return TRUE;
-    }
+    SealedRecord sealed;
 
-    int rc = generate_rsa_keys(&server->rsa_private_key, &server->rsa_public_key);
-    if (rc != TRUE)
-    {
-        printf("rsa keys generation failed!");
-        server_cleanup(server);
+    if (protocol_seal(enc_key, SEAL_SERVER_TO_CLIENT, records->send_seq++, dilithium_server_private_key, message, msg_len, &sealed) != TRUE) {
         return FALSE;
     }
 
-    rc = generate_ecc_keys(&server->ecc_private_key, &server->ecc_public_key);
-    if (rc != TRUE)
-    {
-        printf("ecc keys generation failed!");
-        server_cleanup(server);
+    // encrypted message followed by its signature, gathered by the transport in one write
+    TransportSegment segments[2] = { { sealed.ciphertext, sealed.cipher_len }, { sealed.signature, sealed.signature_len } };
+    if (transport_sendv(t, segments, 2) != TRUE) {
+        printf("Failed to send the message! - send_encrypted_answer\n");
         return FALSE;
     }
-   
-    rc = generate_kyber_keys(&server->kyber_private_key, &server->kyber_public_key);
-    if (rc != TRUE)
-    {
-        printf("kyber keys generation failed!");
-        server_cleanup(server);
+
+    return TRUE;
+}
+
+int parse_user_and_check_validity(const char* message,size_t len)
+{
+    // Parse the message
+    unsigned short usernameLen = *(unsigned short*)message;
+    // check length
+    if (usernameLen != strlen("admin"))
         return FALSE;
-    } 
+    
+    char username[256] = { 0 };
+    memcpy(username, message + 2, usernameLen);
+    username[usernameLen] = '\0';
 
-    rc = generate_dilithium_keys(&server->dilithium_private_key, &server->dilithium_public_key);
-    if (rc != TRUE)
-    {
-        printf("dilithium keys generation failed!");
-        server_cleanup(server);
+    unsigned short passwordLen = *(unsigned short*)(message + 2 + usernameLen);
+    // check length
+    if (passwordLen != strlen("password"))
         return FALSE;
-    }
 
-    // Initialize function pointers
-    server->cleanup = server_cleanup;
+    char password[256] = { 0 };
+    memcpy(password, message + 2 + usernameLen + 2, passwordLen);
+    password[passwordLen] = '\0';
+    
+    // check data
+    if(memcmp(username, "admin", usernameLen) != 0 || memcmp(password, "password", passwordLen) != 0)
+        return FALSE;
 
-    server->is_initialized = TRUE;
     return TRUE;
 }
 
-int public_key_exchange_server(Server* server,Client_Keys* cl_keys, int server_fd, struct sockaddr_in client_addr)
+static void session_idle(Timer* timer, void* context)
 {
-    size_t key_len;
-    char* serialized_key = NULL;
+    ServerShard* shard = context;
+    Session* session = (Session*)((char*)timer - offsetof(Session, idle));
 
-    // Serialize RSA public key
-    serialized_key = serialize_rsa_key(server->rsa_public_key, &key_len);
-    if (!serialized_key) {
-        RSA_free(server->rsa_public_key);
-        RSA_free(server->rsa_private_key);
-        printf("failed to serilaze rsa key!\n");
-        return FALSE;
+    printf("shard %d: session idle for %d s, dropping it\n", shard->index, SESSION_IDLE_TIMEOUT_MS / 1000);
+    session_table_remove(shard->sessions, session);
+}
+
+static void handshake_late(Timer* timer, void* context)
+{
+    ServerShard* shard = context;
+    PendingHandshake* h = (PendingHandshake*)((char*)timer - offsetof(PendingHandshake, deadline));
+
+    if (h->over) {
+        return;
     }
-    // Send the RSA Key
-    char* message_to_send = "RSA Key";
-    send_and_receive(server_fd, client_addr, message_to_send,strlen(message_to_send));
-    send_and_receive(server_fd, client_addr, serialized_key, key_len);
+    printf("shard %d: handshake not done after %d s, dropping the client\n", shard->index, HANDSHAKE_DEADLINE_MS / 1000);
+    shard->counters.handshakes_expired++;
+    h->over = TRUE;
+}
 
-    // Serialize ECC public key
-    serialized_key = serialize_ecc_key(server->ecc_public_key, &key_len);
-    if (!serialized_key) {
-        EC_KEY_free(server->ecc_public_key);
-        printf("failed to serilaze ecc key!\n");
-        return FALSE;
+// Our record in flight again, until the peer acknowledges it or MAX_RETRANSMITS went unanswered
+static void handshake_retransmit(Timer* timer, void* context)
+{
+    ServerShard* shard = context;
+    PendingHandshake* h = (PendingHandshake*)((char*)timer - offsetof(PendingHandshake, retransmit_timer));
+
+    if (!h->flight_pending || h->over) {
+        return;
+    }
+    if (h->retransmits >= MAX_RETRANSMITS) {
+        printf("shard %d: no answer from the client after %d retransmissions, dropping it\n", shard->index, MAX_RETRANSMITS);
+        shard->counters.handshakes_expired++;
+        h->over = TRUE;
+        return;
     }
-    // Send the ECC Key
-    message_to_send = "ECC Key";
-    send_and_receive(server_fd, client_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(server_fd, client_addr, serialized_key, key_len);
+    h->retransmits++;
+    h->rto_ms = h->rto_ms * 2 > RTO_MAX_MS ? RTO_MAX_MS : h->rto_ms * 2;
+    transport_send_batch(&shard->transport, h->flight.datagrams, h->flight.count);
+    timer_arm(&shard->timers, timer, monotonic_ms() + h->rto_ms);
+}
 
-    // Send the Kyber Key
-    message_to_send = "Kyber Key";
-    send_and_receive(server_fd, client_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(server_fd, client_addr, server->kyber_public_key, OQS_KEM_kyber_768_length_secret_key);
+// Gives session a ticket for the session that resumes it, sent along with its first answers. Without room for one
+// the session goes without: once it is dropped, its client has no ticket and starts a new session with a handshake.
+// A client whose ticket is lost, expired or finds no room for its session gets no answer to the requests it resumed
+// with, and sends them again on a new session
+static void issue_ticket(ServerShard* shard, Session* session, uint64_t now_ms)
+{
+    unsigned char secret[AES_KEY_SIZE];
+    unsigned char wire[CONNECTION_ID_SIZE];
+    ConnectionId id;
+
+    if (connection_id_issue(shard->routing, shard->server_id, &id, wire) == TRUE &&
+        protocol_resumption_secret(session->session_key, secret) == TRUE &&
+        session_table_ticket_add(shard->sessions, id, secret, session->identity, now_ms / 1000 + TICKET_LIFETIME_S) == TRUE) {
+        session->ticket = id;
+    }
+    SAFE_AES_KEY_MEMSET(secret);
+}
 
-    // Send the Dilithium Key
-    message_to_send = "Dilithium Key";
-    send_and_receive(server_fd, client_addr, message_to_send, strlen(message_to_send));
-    send_and_receive(server_fd, client_addr, server->dilithium_public_key, OQS_SIG_dilithium_2_length_public_key);
+// A record under the connection ID of a ticket, ticket on the wire: the session it resumes, opened by this shard and
+// given a ticket of its own. NULL when there is no ticket (any more) for it
+static Session* resume_session(ServerShard* shard, const struct sockaddr_in* peer, ConnectionId id, const unsigned char* ticket,
+                               uint64_t now_ms)
+{
+    unsigned char secret[AES_KEY_SIZE];
+    Session* session = session_table_resume(shard->sessions, id, peer, shard->index, now_ms / 1000, secret);
+    int rc;
 
-    printf("all public keys sent successfully\n");
-    
-    // Recieve the ECC Key
-    char* client_message = NULL;
-    print_header_and_free(server_fd, client_addr, &client_message, &key_len);
-    receive_and_send(server_fd, client_addr, &client_message, &key_len);
-    if (client_message) {
-        cl_keys->ecc_public_key = deserialize_ecc_key(client_message, key_len);
-        if (cl_keys->ecc_public_key) {
-            printf("ECC public key successfully deserialized!\n");
-        }
-        else {
-            fprintf(stderr, "Failed to deserialize ECC public key\n");
-            return FALSE;
-        }
+    if (session == NULL) {
+        return NULL;
+    }
+    rc = protocol_resumed_key(secret, ticket, session->session_key);
+    SAFE_AES_KEY_MEMSET(secret);
+    if (rc != TRUE) {
+        session_table_remove(shard->sessions, session);
+        return NULL;
     }
+    issue_ticket(shard, session, now_ms);
+    timer_init(&session->idle, session_idle, shard);
+    timer_arm(&shard->timers, &session->idle, now_ms + SESSION_IDLE_TIMEOUT_MS);
+    shard->counters.sessions_resumed++;
+    printf("shard %d: session resumed, %zu open\n", shard->index, session_table_count(shard->sessions));
+    return session;
+}
 
-    // Recieve the Dilithium Key
-    client_message = NULL;
-    print_header_and_free(server_fd, client_addr, &client_message, &key_len);
-    receive_and_send(server_fd, client_addr, &client_message, &key_len);
-    
-    if (key_len == OQS_SIG_dilithium_2_length_public_key) {
-        // saving the key in the cl_keys struct
-        memcpy(cl_keys->dilithium_public_key, client_message, key_len);
-        printf("Dilithium public key successfully saved!\n");
+// Sends the next record the handshake queued for the peer, if any, and arms its retransmission. FALSE when it cannot
+// be sent
+static int send_handshake_record(ServerShard* shard, PendingHandshake* h)
+{
+    Transport* t = &shard->transport;
+    ProtocolRecord record;
+    TransportSegment segment;
+
+    if (protocol_next_output(&h->protocol.output, &record) != TRUE) {
+        return TRUE;
     }
-    else {
-        fprintf(stderr, "Failed to save Dilithium public key\n");
+    segment.data = record.data;
+    segment.len = record.len;
+    h->flight_seq = h->send_seq++;
+    h->flight.count = record_fragment(RECORD_DATA, h->flight_seq, t->fragment_id++, &segment, 1, t->max_datagram, &h->peer,
+                                      h->flight.datagrams, h->flight.headers, MAX_FRAGMENTS);
+    if (h->flight.count == 0) {
         return FALSE;
     }
-
-    printf("client public keys saved successfully\n");
-    return TRUE;
+    h->flight_pending = TRUE;
+    h->rto_ms = RTO_INITIAL_MS;
+    h->retransmits = 0;
+    timer_arm(&shard->timers, &h->retransmit_timer, monotonic_ms() + h->rto_ms);
+    return transport_send_batch(t, h->flight.datagrams, h->flight.count);
 }
 
-int handshake_server(Server* server, Client_Keys* cl_keys, int server_fd, struct sockaddr_in client_addr, unsigned char* session_key)
+// The hello of an admitted peer is acknowledged, and the server's first record goes out
+static void start_handshake(ServerShard* shard, PendingHandshake* h)
 {
-    int rc , errCode = 0;
-    unsigned int ecc_signature_len = 0;
-    unsigned char* encrypted_key = NULL, *signature = NULL;
-    unsigned char  decrypted_key[AES_KEY_SIZE];
-    uint8_t* encapsulated_message = NULL, shared_secret[OQS_KEM_kyber_768_length_shared_secret];
-    size_t encrypted_len = 0, message_len = 0, decrypted_len = 0, encapsulated_len = 0, dil_sign_len = 0, ecc_sign_len_size_t = 0;
+    h->started = TRUE;
+    // the hello was record 0 of the peer, our records start from 0 too
+    transport_send_ack(&shard->transport, &h->peer, 0);
+    if (server_handshake_init(&h->protocol, shard->server, &h->client_keys) != PROTOCOL_WANT_INPUT ||
+        send_handshake_record(shard, h) != TRUE) {
+        printf("shard %d: handshake failed, dropping the client\n", shard->index);
+        shard->counters.handshakes_failed++;
+        h->over = TRUE;
+    }
+}
 
-    // Recieve the AES Key with RSA encryption
-    char* client_message = NULL;
-    print_header_and_free(server_fd, client_addr, &client_message, &message_len);
-    receive_and_send(server_fd, client_addr, &encrypted_key, &encrypted_len);
-    if (!encrypted_key) 
+// The handshake with h's peer is done: its session goes in the table, under the connection ID of the handshake
+static void open_session(ServerShard* shard, PendingHandshake* h)
+{
+    int rc = write_key_file("shared_server.bin", h->protocol.session_key, AES_KEY_SIZE);
+    if (rc != TRUE)
     {
-            fprintf(stderr, "Failed to get encrypted key from client\n");
+        printf("failed to write to file\n");
     }
-    // Recieve the ECC Signature
-    client_message = NULL;
-    print_header_and_free(server_fd, client_addr, &client_message, &message_len);
-    receive_and_send(server_fd, client_addr, &signature, &ecc_sign_len_size_t);
-    if (!signature)
-    {
-        fprintf(stderr, "Failed to get encrypted key signature from client\n");
+
+    Session* session = session_table_add(shard->sessions, h->id, &h->peer, shard->index);
+    if (session != NULL) {
+        session->identity = session_table_intern(shard->sessions, h->client_keys.dilithium_public_key);
+        if (session->identity == NULL) {
+            session_table_remove(shard->sessions, session);
+            session = NULL;
+        }
+    }
+    if (session == NULL) {
+        printf("shard %d: no room for the session, dropping the client\n", shard->index);
+        shard->counters.handshakes_failed++;
+        return;
     }
+    memcpy(session->session_key, h->protocol.session_key, AES_KEY_SIZE);
+    issue_ticket(shard, session, monotonic_ms());
+    timer_init(&session->idle, session_idle, shard);
+    timer_arm(&shard->timers, &session->idle, monotonic_ms() + SESSION_IDLE_TIMEOUT_MS);
+    shard->counters.handshakes_completed++;
+    printf("shard %d: session ready, %zu open\n", shard->index, session_table_count(shard->sessions));
+}
 
-    ecc_signature_len = (unsigned int)ecc_sign_len_size_t;
-    // Verify ECC signature
-    rc = ecc_verify(cl_keys->ecc_public_key, encrypted_key, encrypted_len, signature, ecc_signature_len);
-    if (rc != TRUE) {
-        printf("failed to verify the message using ECC!\n");
-        errCode = -1;
+// Takes in one datagram of h's peer, its connection ID stripped: the acknowledgement of our record in flight, or the
+// peer's next record, which is acknowledged and handed to the protocol. The last one opens the session. Nothing here
+// waits for the peer, a record that is not there yet is taken in by a later batch
+static void handshake_datagram(ServerShard* shard, PendingHandshake* h, const unsigned char* data, size_t len)
+{
+    Transport* t = &shard->transport;
+    // a record put together from fragments
+    unsigned char* record = NULL;
+    unsigned char type;
+    unsigned short seq;
+    ProtocolEvent event;
+
+    if (!h->started || h->over || record_parse(data, len, &type, &seq) != TRUE) {
+        return;
     }
-    else {// if we fail to verify there is no need to decrypt the message
-        rc = rsa_decrypt(server->rsa_private_key, encrypted_key, encrypted_len, decrypted_key, &decrypted_len);
-        if (rc != TRUE) {
-            printf("failed to decrypt RSA !\n");
-            errCode = -2;
+    if (type == RECORD_ACK) {
+        if (h->flight_pending && seq == h->flight_seq) {
+            h->flight_pending = FALSE;
+            timer_cancel(&shard->timers, &h->retransmit_timer);
+            if (send_handshake_record(shard, h) != TRUE) {
+                printf("shard %d: handshake failed, dropping the client\n", shard->index);
+                shard->counters.handshakes_failed++;
+                h->over = TRUE;
+            }
         }
+        return;
     }
-
-
-    // Recieve the Kyber shared secret
-    client_message = NULL;
-    print_header_and_free(server_fd, client_addr, &client_message, &message_len);
-    receive_and_send(server_fd, client_addr, &encapsulated_message, &encapsulated_len);
-    if (!encapsulated_message)
-    {
-        fprintf(stderr, "Failed to get encapsulated message from client\n");
+    if ((type & ~FRAGMENT_FLAG) != RECORD_DATA) {
+        return;
     }
-    // Recieve the Dilithium Signature
-    client_message = NULL;
-    print_header_and_free(server_fd, client_addr, &client_message, &message_len);
-    receive_and_send(server_fd, client_addr, &signature, &dil_sign_len);
-    if (!signature)
-    {
-        fprintf(stderr, "Failed to get encapsulated message signature from client\n");
+    if (seq != h->recv_seq) {
+        // seen before and our acknowledgement got lost (the hello too): replay it
+        if ((short)(seq - h->recv_seq) < 0) {
+            transport_send_ack(t, &h->peer, seq);
+        }
+        return;
+    }
+    if (type & FRAGMENT_FLAG) {
+        if (reassembly_add(&h->reassembly, &h->peer, data, len) != TRUE) {
+            return;
+        }
+        record = h->reassembly.buffer;
+        len = h->reassembly.total;
+        h->reassembly.buffer = NULL;
+        reassembly_reset(&h->reassembly);
+        data = record;
+    }
+    else {
+        data += RECORD_HEADER_SIZE;
+        len -= RECORD_HEADER_SIZE;
+    }
+    h->recv_seq++;
+    transport_send_ack(t, &h->peer, seq);
+    // the peer only sends its records once it has all of ours
+    if (h->flight_pending) {
+        h->flight_pending = FALSE;
+        timer_cancel(&shard->timers, &h->retransmit_timer);
     }
 
-    // Verify Dilithium signature
-    rc = dilithium_verify(cl_keys->dilithium_public_key, encapsulated_message, encapsulated_len, signature, dil_sign_len);
-    if (rc != TRUE) {
-        printf("failed to verify the message using Dilithium!\n");
-        errCode = -3;
+    event = server_handshake_input(&h->protocol, data, len);
+    free(record);
+    if (event == PROTOCOL_FAILED) {
+        printf("shard %d: handshake failed, dropping the client\n", shard->index);
+        shard->counters.handshakes_failed++;
+        h->over = TRUE;
+    }
+    else if (event == PROTOCOL_SESSION_READY) {
+        open_session(shard, h);
+        h->over = TRUE;
     }
-    else {// if we fail to verify there is no need to decapsulate the message
-        rc = kyber_decapsulate(encapsulated_message, shared_secret,server->kyber_private_key);
-        if (rc != TRUE) {
-            printf("failed to decpasulate Kyber !\n");
-            errCode = -4;
+}
+
+// The handshake in progress under connection ID id, NULL when there is none
+static PendingHandshake* find_handshake(ServerShard* shard, ConnectionId id)
+{
+    for (size_t i = 0; i < shard->handshakes.count; i++) {
+        if (shard->handshakes.entries[i]->id == id) {
+            return shard->handshakes.entries[i];
         }
     }
+    return NULL;
+}
 
-    if (errCode < 0)
-    {
-        printf("transfer of session key failed with error code - %d", errCode);
-        return TRUE;
+static void release_handshake(ServerShard* shard, PendingHandshake* h)
+{
+    timer_cancel(&shard->timers, &h->retransmit_timer);
+    timer_cancel(&shard->timers, &h->deadline);
+    reassembly_reset(&h->reassembly);
+    server_handshake_free(&h->protocol);
+    // the client's ECC key only signs its handshake
+    if (h->client_keys.ecc_public_key) {
+        EC_KEY_free(h->client_keys.ecc_public_key);
     }
+    free(h);
+}
 
-    printf("transfer of session key completed\n");
-    // create the session key using xor between both keys
-    xor (decrypted_key, shared_secret, session_key, AES_KEY_SIZE);
-    printf("Session key is Ready to use\n");
+// Lets go of the handshakes that are over, done or not
+static void reap_handshakes(ServerShard* shard)
+{
+    HandshakeTable* table = &shard->handshakes;
+    size_t kept = 0;
 
-    return TRUE;
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->entries[i]->over) {
+            release_handshake(shard, table->entries[i]);
+            continue;
+        }
+        table->entries[kept++] = table->entries[i];
+    }
+    table->count = kept;
 }
 
-int recv_encrypted_user(int server_fd, struct sockaddr_in client_addr, unsigned char* enc_key, uint8_t* dilithium_client_public_key, 
-                        uint8_t* dilithium_server_private_key, unsigned char* result, size_t* res_len)
+// Slot putting together the request seq from peer: the one already at it, else a free one, else the oldest
+static Reassembly* find_reassembly(ServerShard* shard, const struct sockaddr_in* peer, unsigned short seq)
 {
-    unsigned char iv[AES_BLOCK_SIZE] = "000000000000000";
-    unsigned char plaintext[256], dil_sign[OQS_SIG_dilithium_2_length_signature];
-    unsigned char* messageToSend = NULL;
-    size_t plain_len = 0, dil_sign_len = 0, sent_len = 0;
-    memset(plaintext, '\0', 256);
-
-    // waiting for message from client
-    unsigned char buffer[BUFFER_SIZE];
-    size_t recv_len = recvfrom(server_fd, buffer, BUFFER_SIZE, 0, NULL, NULL);
-    if (recv_len < 0) {
-        perror("recvfrom - recv_encrypted_user");
-        return;
+    Reassembly* free_slot = NULL;
+    Reassembly* r;
+
+    for (size_t i = 0; i < MAX_REASSEMBLIES; i++) {
+        r = &shard->reassemblies[i];
+        if (!r->active) {
+            if (free_slot == NULL) {
+                free_slot = r;
+            }
+            continue;
+        }
+        if (r->seq == seq && r->from.sin_addr.s_addr == peer->sin_addr.s_addr && r->from.sin_port == peer->sin_port) {
+            return r;
+        }
     }
+    if (free_slot != NULL) {
+        return free_slot;
+    }
+    r = &shard->reassemblies[shard->next_reassembly];
+    shard->next_reassembly = (shard->next_reassembly + 1) % MAX_REASSEMBLIES;
+    reassembly_reset(r);
+    return r;
+}
 
-    int encryptMessageSize = recv_len - OQS_SIG_dilithium_2_length_signature;
+// Takes a token from the bucket of peer's source prefix; FALSE when it has none left. A bucket starts full once and
+// is only ever refilled with time: a prefix that hashes to a bucket in use takes from what is left
+static int admit_handshake(ServerShard* shard, const struct sockaddr_in* peer, uint64_t now_ms)
+{
+    uint32_t prefix = ntohl(peer->sin_addr.s_addr) >> (32 - ADMISSION_PREFIX_BITS);
+    TokenBucket* bucket = &shard->buckets[(prefix * 2654435761u) % ADMISSION_BUCKETS];
 
-    // verify the message
-    int rc = dilithium_verify(dilithium_client_public_key, buffer, encryptMessageSize, buffer + encryptMessageSize, OQS_SIG_dilithium_2_length_signature);
-    if (rc != TRUE)
-    {
-        printf("Failed to Verify the message! - recv_encrypted_user\n");
-        return FALSE;
+    if (!bucket->used) {
+        bucket->used = TRUE;
+        bucket->tokens = HANDSHAKE_BURST * 1000ULL;
+        bucket->refilled_ms = now_ms;
     }
-   
-    // decrypt the data
-    rc = aes_decrypt(enc_key, buffer, encryptMessageSize, iv, result, res_len);
-    if (rc != TRUE)
-    {
-        printf("Failed to Decrypt the message! - recv_encrypted_user\n");
+    bucket->tokens += (now_ms - bucket->refilled_ms) * HANDSHAKE_RATE;
+    if (bucket->tokens > HANDSHAKE_BURST * 1000ULL) {
+        bucket->tokens = HANDSHAKE_BURST * 1000ULL;
+    }
+    bucket->refilled_ms = now_ms;
+    if (bucket->tokens < 1000) {
         return FALSE;
     }
-
+    bucket->tokens -= 1000;
     return TRUE;
 }
 
-int send_encrypted_answer(int server_fd, struct sockaddr_in client_addr, unsigned char* enc_key,
-    uint8_t* dilithium_server_private_key, const unsigned char* message, size_t msg_len)
+// Takes on the handshake of a peer whose hello brought a valid cookie, if there is room for it and its prefix has a
+// token for it; it starts once the batch's answers are out. Its hello sent again finds it by the connection ID
+static void add_handshake(ServerShard* shard, const struct sockaddr_in* peer, ConnectionId id, uint64_t now_ms,
+                            const unsigned char* hello, size_t hello_len)
 {
-    unsigned char iv[AES_BLOCK_SIZE] = "000000000000000";
-    unsigned char ciphertext[256], dil_sign[OQS_SIG_dilithium_2_length_signature];
-    unsigned char* messageToSend = NULL;
-    size_t cipher_len = 0, dil_sign_len = 0, sent_len = 0;
+    HandshakeTable* table = &shard->handshakes;
+    PendingHandshake* h;
 
-    memset(ciphertext, '\0', 256);
-    int rc = aes_encrypt(enc_key, message, msg_len, iv, ciphertext, &cipher_len);
-    if (rc != TRUE)
-    {
-        printf("Failed to encrypt the message! - send_encrypted_answer\n");
-        return FALSE;
+    if (table->count == MAX_PENDING_HANDSHAKES || session_table_full(shard->sessions)) {
+        shard->counters.handshakes_dropped++;
+        return;
     }
-
-    rc = dilithium_sign(dilithium_server_private_key, ciphertext, cipher_len, dil_sign, &dil_sign_len);
-    if (rc != TRUE)
-    {
-        printf("Failed to Sign the message! - send_encrypted_answer\n");
-        return FALSE;
+    if (admit_handshake(shard, peer, now_ms) != TRUE) {
+        shard->counters.handshakes_throttled++;
+        return;
     }
+    h = calloc(1, sizeof(PendingHandshake));
+    if (h == NULL) {
+        perror("calloc - add_handshake");
+        shard->counters.handshakes_dropped++;
+        return;
+    }
+    printf("Client: %.*s\n", (int)hello_len, (const char*)hello);
+    h->peer = *peer;
+    h->id = id;
+    h->recv_seq = 1;
+    timer_init(&h->retransmit_timer, handshake_retransmit, shard);
+    timer_init(&h->deadline, handshake_late, shard);
+    timer_arm(&shard->timers, &h->deadline, now_ms + HANDSHAKE_DEADLINE_MS);
+    table->entries[table->count++] = h;
+    shard->counters.handshakes_admitted++;
+}
 
+static void print_counters(const ServerShard* shard)
+{
+    const ShardCounters* c = &shard->counters;
+
+    printf("shard %d: requests %llu answered %llu rejected %llu resent %llu replayed, %zu answers kept (%llu evicted), "
+           "cookies %llu, handshakes %llu "
+           "admitted %llu throttled %llu dropped %llu expired %llu done %llu failed, %zu in progress, %llu misrouted, "
+           "%llu migrated %llu resumed\n",
+           shard->index, (unsigned long long)c->requests_answered, (unsigned long long)c->requests_rejected,
+           (unsigned long long)c->requests_resent, (unsigned long long)c->requests_replayed, shard->replies.count,
+           (unsigned long long)c->replies_evicted, (unsigned long long)c->cookies_sent, (unsigned long long)c->handshakes_admitted,
+           (unsigned long long)c->handshakes_throttled, (unsigned long long)c->handshakes_dropped,
+           (unsigned long long)c->handshakes_expired, (unsigned long long)c->handshakes_completed,
+           (unsigned long long)c->handshakes_failed, shard->handshakes.count,
+           (unsigned long long)c->records_misrouted, (unsigned long long)c->sessions_migrated,
+           (unsigned long long)c->sessions_resumed);
+}
 
-    sent_len = cipher_len + dil_sign_len;
-    messageToSend = malloc(sent_len);
-    if (messageToSend == NULL) {
-        perror("malloc - send_encrypted_answer");
-        return FALSE;
-    }
+// Crypto job: the signatures of one session's requests, the result of each in valid
+static int verify_group(void* arg)
+{
+    VerifyGroup* group = (VerifyGroup*)arg;
+    return dilithium_verify_batch(group->public_key, group->count, group->messages, group->message_lens,
+                                  group->signatures, group->signature_lens, group->valid);
+}
 
-    // copy encrypted message and signature
-    memcpy(messageToSend, ciphertext, cipher_len);
-    memcpy((messageToSend + cipher_len), dil_sign, dil_sign_len);
-    (messageToSend)[sent_len] = '\0';
+// Crypto job: decrypts a verified request, checks the user in it and seals the answer. Whether the request is a
+// replay is for the I/O thread to tell, which owns the session's window
+static int answer_request(void* arg)
+{
+    AnswerJob* job = (AnswerJob*)arg;
+    unsigned char plaintext[SEALED_CIPHERTEXT_SIZE + 1];
+    size_t plain_len = 0;
+    uint64_t request_seq;
 
-    int sendto_len = sendto(server_fd, messageToSend, sent_len, 0, (const struct sockaddr*)&client_addr, sizeof(client_addr));
-    if (sendto_len < 0) {
-        perror("sendto - send_encrypted_answer");
-        return FALSE;
-    }
-    else if ((size_t)sendto_len != sent_len) {
-        fprintf(stderr, "Incomplete key sent: %zd/%zu bytes - send_encrypted_answer\n", sendto_len, sent_len);
+    if (protocol_decrypt(job->session_key, SEAL_CLIENT_TO_SERVER, job->message, job->message_len, plaintext, &plain_len, &request_seq) != TRUE) {
+        printf("Failed to Decrypt the message! - answer_request\n");
         return FALSE;
     }
+    printf("Got encrypted message from Client\n");
 
-    return TRUE;
+    job->answer = parse_user_and_check_validity((const char*)plaintext, plain_len) == TRUE ? "Good" : "Bad";
+    return protocol_seal(job->session_key, SEAL_SERVER_TO_CLIENT, job->seq, job->dilithium_private_key, (const unsigned char*)job->answer,
+                         strlen(job->answer), &job->sealed);
 }
 
-int parse_user_and_check_validity(const char* message,size_t len)
+static CachedReply** reply_bucket(ReplyCache* cache, ConnectionId id, uint64_t seq)
 {
-    // Parse the message
-    unsigned short usernameLen = *(unsigned short*)message;
-    // check length
-    if (usernameLen != strlen("admin"))
-        return FALSE;
-    
-    char username[256] = { 0 };
-    memcpy(username, message + 2, usernameLen);
-    username[usernameLen] = '\0';
+    return &cache->buckets[((id ^ seq) * 0x9e3779b97f4a7c15ULL >> 32) & (REPLY_CACHE_BUCKETS - 1)];
+}
 
-    unsigned short passwordLen = *(unsigned short*)(message + 2 + usernameLen);
-    // check length
-    if (passwordLen != strlen("password"))
-        return FALSE;
+// The answer to record seq of session id, NULL when it is not kept (any more)
+static CachedReply* find_reply(ReplyCache* cache, ConnectionId id, uint64_t seq)
+{
+    CachedReply* cached = *reply_bucket(cache, id, seq);
 
-    char password[256] = { 0 };
-    memcpy(password, message + 2 + usernameLen + 2, passwordLen);
-    password[passwordLen] = '\0';
-    
-    // check data
-    if(memcmp(username, "admin", usernameLen) != 0 || memcmp(password, "password", passwordLen) != 0)
-        return FALSE;
+    while (cached != NULL && (cached->id != id || cached->seq != seq)) {
+        cached = cached->next;
+    }
+    return cached;
+}
 
-    return TRUE;
+// Takes the oldest answer out of the cache, for the caller to reuse or free
+static CachedReply* pop_oldest_reply(ReplyCache* cache)
+{
+    CachedReply* oldest = cache->oldest;
+    CachedReply** link = reply_bucket(cache, oldest->id, oldest->seq);
+
+    while (*link != oldest) {
+        link = &(*link)->next;
+    }
+    *link = oldest->next;
+    cache->oldest = oldest->newer;
+    if (cache->oldest == NULL) {
+        cache->newest = NULL;
+    }
+    cache->count--;
+    return oldest;
 }
 
-int main() {
-    WSADATA wsaData;
-    int server_fd, rc;
-    struct sockaddr_in server_addr, client_addr;
-    unsigned char buffer[BUFFER_SIZE], session_key[AES_KEY_SIZE];
-    socklen_t client_addr_len = sizeof(client_addr);
-    Client_Keys ck;
-    Server server;
-    rc = server_init(&server);
-    if (rc != TRUE)
-    {
-        printf("server init failed!, exiting...");
-        return;
+// Lets go of the answers whose clients stopped sending their requests again by now_ms
+static void expire_replies(ReplyCache* cache, uint64_t now_ms)
+{
+    while (cache->oldest != NULL && now_ms - cache->oldest->sent_ms >= REPLY_KEEP_MS) {
+        free(pop_oldest_reply(cache));
     }
+}
 
-    // Initialize Winsock
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        printf("WSAStartup failed: %d\n", WSAGetLastError());
-        return EXIT_FAILURE;
+// Keeps the answer to record seq of session id, sent at now_ms; the oldest answer makes room when the cache is full
+static void keep_reply(ServerShard* shard, ConnectionId id, uint64_t seq, const SealedRecord* sealed, uint64_t now_ms)
+{
+    ReplyCache* cache = &shard->replies;
+    CachedReply* cached;
+    CachedReply** bucket;
+
+    expire_replies(cache, now_ms);
+    if (cache->count == REPLY_CACHE_MAX) {
+        cached = pop_oldest_reply(cache);
+        shard->counters.replies_evicted++;
     }
+    else if ((cached = malloc(sizeof(CachedReply))) == NULL) {
+        perror("malloc - keep_reply");
+        return;
+    }
+    bucket = reply_bucket(cache, id, seq);
+    cached->id = id;
+    cached->seq = seq;
+    cached->sent_ms = now_ms;
+    cached->sealed = *sealed;
+    cached->next = *bucket;
+    cached->newer = NULL;
+    *bucket = cached;
+    if (cache->newest != NULL) {
+        cache->newest->newer = cached;
+    }
+    else {
+        cache->oldest = cached;
+    }
+    cache->newest = cached;
+    cache->count++;
+}
 
-    // Create socket
-    if ((server_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+static void clear_replies(ReplyCache* cache)
+{
+    while (cache->oldest != NULL) {
+        free(pop_oldest_reply(cache));
     }
+}
 
-    // Bind socket to the address
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(SERVER_PORT);
+// UDP request loop body: drains up to MAX_BATCH datagrams with one receive, hands the signature checks of each
+// session's requests and the answers to the crypto workers, and sends each answer once it is signed, together with
+// the others signed by then. Requests and answers longer than a datagram travel as fragments; fragments are
+// reassembled per shard across batches.
+// Datagrams are matched to sessions by the connection ID in front of them, and a session follows its client to a
+// new address. Datagrams without a session belong to a handshake in progress, or are hellos: without a valid cookie
+// they get a RECORD_RETRY carrying one and a new connection ID, with it and a token of their prefix a handshake of
+// their own. Handshake records are taken in once the answers are out, a handshake never holds up the batch.
+// Requests that fail to verify or decrypt are dropped. A request whose record number the session's replay window
+// has seen gets the answer kept for it again, or nothing. Returns FALSE only when the socket fails.
+int serve_user_batch(ServerShard* shard)
+{
+    BatchScratch* scratch = &shard->scratch;
+    ReceivedDatagram* requests = scratch->requests;
+    Transport* t = &shard->transport;
+    uint8_t* dilithium_server_private_key = shard->server->dilithium_private_key;
+    const uint8_t* messages[MAX_BATCH];
+    const uint8_t* request_signatures[MAX_BATCH];
+    size_t message_lens[MAX_BATCH], signature_lens[MAX_BATCH];
+    const struct sockaddr_in* senders[MAX_BATCH];
+    // requests completed by a fragment in this batch, freed once it is answered
+    unsigned char* assembled[MAX_BATCH];
+    size_t assembled_count = 0, reply_count = 0;
+    unsigned short request_seqs[MAX_BATCH];
+    // record numbers of the sealed requests, where the transport's request_seqs wrap at 16 bits
+    uint64_t record_seqs[MAX_BATCH];
+    Session* owners[MAX_BATCH];
+    int valid[MAX_BATCH], grouped[MAX_BATCH], sent = TRUE, exists;
+    // answered since the last send, kept once it went out
+    size_t fresh[MAX_BATCH], fresh_count = 0;
+    // datagrams of handshakes in progress, and their handshakes
+    size_t handshake_records[MAX_BATCH], handshake_count = 0;
+    PendingHandshake* handshake_owners[MAX_BATCH];
+    size_t count, i, j, checked = 0, answer_count = 0, group_count = 0;
+    CryptoGroup jobs_done;
+    uint64_t now_ms, now_s;
+
+    // handshakes retransmit on the shard's timers: no datagram is waited for past the next one
+    int n = transport_wait(t, timer_wheel_next_timeout(&shard->timers, monotonic_ms()));
+    if (n > 0) {
+        n = transport_recv_batch(t, requests, MAX_BATCH);
+    }
+    if (n < 0) {
+        return FALSE;
+    }
+    count = (size_t)n;
+    // idle sessions go before their owners are looked up
+    now_ms = monotonic_ms();
+    now_s = now_ms / 1000;
+    timer_wheel_advance(&shard->timers, now_ms);
+
+    for (i = 0; i < count; i++) {
+        Session* session = NULL;
+        const unsigned char* data = requests[i].data;
+        const unsigned char* connection_id;
+        const unsigned char* payload;
+        size_t len = requests[i].len, payload_len;
+        ConnectionId id = 0;
+        uint8_t server_id;
+        unsigned char type;
+        unsigned short seq;
+
+        if (record_strip_route(&data, &len, &connection_id) != TRUE || record_parse(data, len, &type, &seq) != TRUE) {
+            continue;
+        }
+        payload = data + RECORD_HEADER_SIZE;
+        payload_len = len - RECORD_HEADER_SIZE;
+        if (connection_id != NULL && connection_id_open(shard->routing, connection_id, &server_id, &id) == TRUE) {
+            if (server_id != shard->server_id) {
+                shard->counters.records_misrouted++;
+                continue;
+            }
+            session = session_table_find(shard->sessions, id, shard->index, &exists);
+            if (session == NULL && exists) {
+                // another shard's: the kernel hashed the client's new address elsewhere
+                shard->counters.records_misrouted++;
+                continue;
+            }
+            // a record of a handshake in progress, from the address of its hello
+            if (session == NULL) {
+                PendingHandshake* h = find_handshake(shard, id);
+                if (h != NULL) {
+                    if (h->peer.sin_addr.s_addr == requests[i].from.sin_addr.s_addr && h->peer.sin_port == requests[i].from.sin_port) {
+                        handshake_records[handshake_count] = i;
+                        handshake_owners[handshake_count++] = h;
+                    }
+                    continue;
+                }
+            }
+            // a request under a ticket is early data: it opens the resumed session, and is served in it
+            if (session == NULL && (type & ~FRAGMENT_FLAG) == RECORD_REQUEST) {
+                session = resume_session(shard, &requests[i].from, id, connection_id, now_ms);
+                if (session == NULL) {
+                    continue;
+                }
+            }
+        }
 
-    if (bind(server_fd, (const struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind failed");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+        if (session == NULL) {
+            // only a hello, record 0, opens a session
+            if (type != RECORD_DATA || seq != 0) {
+                continue;
+            }
+            // and only with a cookie proving the peer gets our datagrams, for the connection ID it came with;
+            // until then it is answered without keeping anything, nor spending more than an HMAC on it
+            if (id == 0 || payload_len < COOKIE_SIZE ||
+                cookie_check(&shard->cookies, &requests[i].from, connection_id, now_s, payload + payload_len - COOKIE_SIZE) != TRUE) {
+                OutgoingDatagram* out = &scratch->answers[answer_count];
+                if (connection_id_issue(shard->routing, shard->server_id, &id, scratch->connection_ids[i]) != TRUE ||
+                    cookie_make(&shard->cookies, &requests[i].from, scratch->connection_ids[i], now_s, scratch->cookies[i]) != TRUE) {
+                    continue;
+                }
+                record_header(scratch->headers[answer_count], RECORD_RETRY, seq);
+                out->segments[0].data = scratch->headers[answer_count];
+                out->segments[0].len = RECORD_HEADER_SIZE;
+                out->segments[1].data = scratch->cookies[i];
+                out->segments[1].len = COOKIE_SIZE;
+                out->segments[2].data = scratch->connection_ids[i];
+                out->segments[2].len = CONNECTION_ID_SIZE;
+                out->segment_count = 3;
+                out->to = requests[i].from;
+                answer_count++;
+                shard->counters.cookies_sent++;
+                continue;
+            }
+            payload_len -= COOKIE_SIZE;
+            add_handshake(shard, &requests[i].from, id, now_ms, payload, payload_len);
+            continue;
+        }
+        if ((type & ~FRAGMENT_FLAG) == RECORD_DATA) {
+            // a handshake record again, our acknowledgement was lost: replay it
+            OutgoingDatagram* out = &scratch->answers[answer_count];
+            record_header(scratch->headers[answer_count], RECORD_ACK, seq);
+            out->segments[0].data = scratch->headers[answer_count];
+            out->segments[0].len = RECORD_HEADER_SIZE;
+            out->segment_count = 1;
+            out->to = requests[i].from;
+            answer_count++;
+            continue;
+        }
+        if (type == (RECORD_REQUEST | FRAGMENT_FLAG)) {
+            Reassembly* r = find_reassembly(shard, &requests[i].from, seq);
+            if (reassembly_add(r, &requests[i].from, data, len) != TRUE) {
+                continue;
+            }
+            // the request is complete: take its buffer, the slot can start on another one
+            payload = r->buffer;
+            payload_len = r->total;
+            assembled[assembled_count++] = r->buffer;
+            r->buffer = NULL;
+            reassembly_reset(r);
+            type = RECORD_REQUEST;
+        }
+        if (type != RECORD_REQUEST) {
+            continue;
+        }
+        if (protocol_sealed_split(payload_len, &message_lens[checked]) != TRUE ||
+            protocol_sealed_seq(payload, message_lens[checked], &record_seqs[checked]) != TRUE) {
+            printf("Message too short! - serve_user_batch\n");
+            continue;
+        }
+        // sent again before the answer got there, or replayed: the answer already made, or nothing
+        if (replay_check(&session->records.replay, record_seqs[checked]) != TRUE) {
+            CachedReply* cached = find_reply(&shard->replies, session->id, record_seqs[checked]);
+            size_t datagrams = 0;
+
+            if (cached != NULL) {
+                TransportSegment reply[2] = { { cached->sealed.ciphertext, cached->sealed.cipher_len },
+                                              { cached->sealed.signature, cached->sealed.signature_len } };
+                datagrams = record_fragment(RECORD_REPLY, seq, t->fragment_id++, reply, 2, t->max_datagram, &requests[i].from,
+                                            &scratch->answers[answer_count], &scratch->headers[answer_count],
+                                            MAX_BATCH * MAX_REPLY_DATAGRAMS - answer_count);
+            }
+            if (datagrams == 0) {
+                shard->counters.requests_replayed++;
+                continue;
+            }
+            answer_count += datagrams;
+            shard->counters.requests_resent++;
+            continue;
+        }
+        // only the well formed requests go on to verification, pointing into the receive buffers
+        messages[checked] = payload;
+        request_signatures[checked] = payload + message_lens[checked];
+        signature_lens[checked] = payload_len - message_lens[checked];
+        senders[checked] = &requests[i].from;
+        request_seqs[checked] = seq;
+        owners[checked] = session;
+        checked++;
     }
 
-    printf("Server is running on port %d\n", SERVER_PORT);
+    // one verification job per session, requests of a session share its public key. A session's verified requests
+    // go on to their answer jobs, and the answers out, as soon as their own jobs complete: a slow job holds back no
+    // other answer, and answers that complete together leave with one send
+    crypto_group_init(&jobs_done);
+    memset(grouped, 0, sizeof(grouped));
+    for (i = 0; i < checked; i++) {
+        VerifyGroup* group = &scratch->verify_groups[group_count];
 
-    // Receive Hello message from client
-    memset(buffer, 0, BUFFER_SIZE);
-    int n = recvfrom(server_fd, buffer, BUFFER_SIZE, 0, (struct sockaddr*)&client_addr, &client_addr_len);
-    if (n < 0) {
-        perror("Receive failed");
-        return;
+        if (grouped[i]) {
+            continue;
+        }
+        group->public_key = owners[i]->identity->dilithium_public_key;
+        group->count = 0;
+        for (j = i; j < checked; j++) {
+            if (owners[j] != owners[i]) {
+                continue;
+            }
+            grouped[j] = TRUE;
+            valid[j] = FALSE;
+            group->messages[group->count] = messages[j];
+            group->message_lens[group->count] = message_lens[j];
+            group->signatures[group->count] = request_signatures[j];
+            group->signature_lens[group->count] = signature_lens[j];
+            group->index[group->count++] = j;
+        }
+        crypto_job_init(&scratch->verify_jobs[group_count], CRYPTO_VERIFY_BATCH, verify_group, group);
+        crypto_submit(shard->server->crypto, &jobs_done, &scratch->verify_jobs[group_count]);
+        group_count++;
     }
 
-    buffer[n] = '\0';
-    printf("Client: %s\n", buffer);
+    // answers resent from the cache leave at once, with the answers signed by then
+    while (TRUE) {
+        CryptoJob* completed = crypto_group_next(&jobs_done, answer_count == 0);
+
+        if (completed == NULL) {
+            if (answer_count == 0) {
+                break;
+            }
+            if (sent == TRUE && transport_send_batch(t, scratch->answers, answer_count) != TRUE) {
+                sent = FALSE;
+            }
+            // kept once sent: answers resent with them pointed into the cache
+            now_ms = monotonic_ms();
+            for (j = 0; sent == TRUE && j < fresh_count; j++) {
+                keep_reply(shard, owners[fresh[j]]->id, record_seqs[fresh[j]], &scratch->answer_jobs[fresh[j]].sealed, now_ms);
+            }
+            answer_count = 0;
+            fresh_count = 0;
+            continue;
+        }
 
-    // start tls handshake
-    rc = public_key_exchange_server(&server,&ck, server_fd, client_addr);
-    if (rc != TRUE)
-    {
-        printf("tls_server failed!, exiting...");
-        return;
+        // then one job per verified request decrypts it and signs its answer
+        if (completed->type == CRYPTO_VERIFY_BATCH) {
+            VerifyGroup* group = (VerifyGroup*)completed->arg;
+
+            for (j = 0; j < group->count; j++) {
+                AnswerJob* job = &scratch->answer_jobs[group->index[j]];
+
+                i = group->index[j];
+                valid[i] = group->valid[j];
+                if (valid[i] != TRUE) {
+                    printf("Failed to Verify the message! - serve_user_batch\n");
+                    shard->counters.requests_rejected++;
+                    continue;
+                }
+                job->session_key = owners[i]->session_key;
+                job->seq = owners[i]->records.send_seq++;
+                job->dilithium_private_key = dilithium_server_private_key;
+                job->message = messages[i];
+                job->message_len = message_lens[i];
+                crypto_job_init(&scratch->jobs[i], CRYPTO_ANSWER, answer_request, job);
+                crypto_submit(shard->server->crypto, &jobs_done, &scratch->jobs[i]);
+            }
+            continue;
+        }
+
+        // fragment ids are the I/O thread's, the answers are cut and queued here in the order they were signed
+        i = (size_t)(completed - scratch->jobs);
+        SealedRecord* sealed = &scratch->answer_jobs[i].sealed;
+
+        if (scratch->jobs[i].result != TRUE) {
+            shard->counters.requests_rejected++;
+            continue;
+        }
+        // authentic now; the same record twice in one batch is answered once
+        if (replay_check(&owners[i]->records.replay, record_seqs[i]) != TRUE) {
+            shard->counters.requests_replayed++;
+            valid[i] = FALSE;
+            continue;
+        }
+        replay_update(&owners[i]->records.replay, record_seqs[i]);
+        // the client's address changed (NAT rebinding, a new path): answers follow it, once a request from the new
+        // address proved to be the client's and new
+        if (owners[i]->peer.sin_addr.s_addr != senders[i]->sin_addr.s_addr || owners[i]->peer.sin_port != senders[i]->sin_port) {
+            owners[i]->peer = *senders[i];
+            shard->counters.sessions_migrated++;
+        }
+
+        // the session's ticket goes along with its first answers, ahead of them: a client that has the answer
+        // mostly has the ticket too
+        size_t first = answer_count;
+        if (owners[i]->ticket != 0 && scratch->answer_jobs[i].seq < TICKET_REPEATS &&
+            answer_count < MAX_BATCH * MAX_REPLY_DATAGRAMS) {
+            OutgoingDatagram* out = &scratch->answers[answer_count];
+            connection_id_seal(shard->routing, shard->server_id, owners[i]->ticket, scratch->tickets[i]);
+            record_header(scratch->headers[answer_count], RECORD_TICKET, request_seqs[i]);
+            out->segments[0].data = scratch->headers[answer_count];
+            out->segments[0].len = RECORD_HEADER_SIZE;
+            out->segments[1].data = scratch->tickets[i];
+            out->segments[1].len = CONNECTION_ID_SIZE;
+            out->segment_count = 2;
+            out->to = *senders[i];
+            answer_count++;
+        }
+        // the reply carries the number of the request it answers, cut to the path MTU. An answer sent again from
+        // the cache gets a fragment id of its own, which keeps it from mixing with the first one
+        TransportSegment reply[2] = { { sealed->ciphertext, sealed->cipher_len }, { sealed->signature, sealed->signature_len } };
+        size_t datagrams = record_fragment(RECORD_REPLY, request_seqs[i], t->fragment_id++, reply, 2, t->max_datagram, senders[i],
+                                           &scratch->answers[answer_count], &scratch->headers[answer_count],
+                                           MAX_BATCH * MAX_REPLY_DATAGRAMS - answer_count);
+        if (datagrams == 0) {
+            printf("No room for the answer in this batch! - serve_user_batch\n");
+            answer_count = first;
+            valid[i] = FALSE;
+            continue;
+        }
+        answer_count += datagrams;
+        reply_count++;
+        shard->counters.requests_answered++;
+        owners[i]->request_seq = request_seqs[i];
+        timer_arm(&shard->timers, &owners[i]->idle, now_ms + SESSION_IDLE_TIMEOUT_MS);
+        printf("Answering %s to Client\n", scratch->answer_jobs[i].answer);
+        fresh[fresh_count++] = i;
     }
+    crypto_group_destroy(&jobs_done);
 
-    // Receive the session key
-    rc = handshake_server(&server, &ck, server_fd, client_addr, session_key);
-    if (rc != TRUE)
-    {
-        printf("handshake_server failed!, exiting...");
-        return;
+    for (i = 0; i < assembled_count; i++) {
+        free(assembled[i]);
     }
+    if (sent != TRUE) {
+        return FALSE;
+    }
+    expire_replies(&shard->replies, monotonic_ms());
 
+    // established sessions come first, then the records of the handshakes in the order they came, and the
+    // handshakes admitted in this batch start. Each takes in what is there and goes on in a later batch
+    for (i = 0; i < handshake_count; i++) {
+        const unsigned char* data = requests[handshake_records[i]].data;
+        const unsigned char* connection_id;
+        size_t len = requests[handshake_records[i]].len;
 
-    rc = write_key_file("shared_server.bin", session_key, AES_KEY_SIZE);
-    if (rc != TRUE)
-    {
-        printf("failed to write to file, exiting...");
-        return;
+        if (record_strip_route(&data, &len, &connection_id) == TRUE) {
+            handshake_datagram(shard, handshake_owners[i], data, len);
+        }
     }
+    for (i = 0; i < shard->handshakes.count; i++) {
+        if (!shard->handshakes.entries[i]->started) {
+            start_handshake(shard, shard->handshakes.entries[i]);
+        }
+    }
+    reap_handshakes(shard);
+    return TRUE;
+}
 
-
-    size_t buff_len = 0;
+// Request loop of one stream connection, until the client goes away
+static void serve_stream_client(ServerShard* shard, Session* session)
+{
+    unsigned char buffer[BUFFER_SIZE];
     unsigned char answer[5];
-    // loop for safe communication
+    size_t buff_len = 0;
+    int rc;
+
     while (1)
     {
         memset(buffer, '\0', 256);
         memset(answer, '\0', 5);
-        rc = recv_encrypted_user(server_fd, client_addr, session_key, ck.dilithium_public_key,
-            server.dilithium_private_key, buffer, &buff_len);
+        rc = recv_encrypted_user(&shard->transport, session->session_key, &session->records, session->identity->dilithium_public_key,
+            shard->server->dilithium_private_key, buffer, &buff_len);
         if (rc != TRUE)
         {
-            printf("failed to get encrypted user, exiting...\n");
+            printf("failed to get encrypted user, closing the connection...\n");
             break;
         }
 
@@ -472,20 +976,333 @@ int main() {
             answer[3] = '\0'; 
         }
 
-        rc = send_encrypted_answer(server_fd,client_addr,session_key,server.dilithium_private_key, answer,strlen(answer));
+        rc = send_encrypted_answer(&shard->transport, session->session_key, &session->records, shard->server->dilithium_private_key,
+                                   answer, strlen(answer));
         if (rc != TRUE)
         {
-            printf("failed to send encrypted answer, exiting...\n");
+            printf("failed to send encrypted answer, closing the connection...\n");
             break;
         }
 
         printf("Sent encrypted %s to Client\n", answer);
     }
+}
+
+// Accepts stream clients one after the other: hello, key exchange, handshake, then their requests
+static void serve_stream_clients(ServerShard* shard)
+{
+    unsigned char session_key[AES_KEY_SIZE];
+    unsigned char* hello = NULL;
+    size_t hello_len = 0;
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len;
+    Client_Keys ck;
+    ConnectionId id;
+    int rc;
+
+    while (1) {
+        client_addr_len = sizeof(client_addr);
+        int client_fd = accept(shard->fd, (struct sockaddr*)&client_addr, &client_addr_len);
+        if (client_fd < 0) {
+            perror("Accept failed");
+            return;
+        }
+        // the handshake is a series of small records, do not hold them back
+        int nodelay = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+        transport_init(&shard->transport, TRANSPORT_TCP, client_fd, client_addr);
+        memset(&ck, 0, sizeof(ck));
+
+        if (transport_recv(&shard->transport, &hello, &hello_len) == TRUE) {
+            printf("Client: %s\n", hello);
+            free(hello);
+            hello = NULL;
+
+            rc = handshake_server(shard->server, &ck, &shard->transport, session_key);
+            // the connection is the session: it is in the table while the client stays connected. Its records
+            // carry no connection ID, the socket is enough, so the ID is only its key in the table
+            if (rc == TRUE && RAND_bytes((unsigned char*)&id, sizeof(id)) != 1) {
+                rc = FALSE;
+            }
+            Session* session = rc == TRUE ? session_table_add(shard->sessions, id, &client_addr, shard->index) : NULL;
+            if (session != NULL) {
+                session->identity = session_table_intern(shard->sessions, ck.dilithium_public_key);
+                if (session->identity == NULL) {
+                    session_table_remove(shard->sessions, session);
+                    session = NULL;
+                }
+            }
+            if (session != NULL) {
+                rc = write_key_file("shared_server.bin", session_key, AES_KEY_SIZE);
+                if (rc != TRUE)
+                {
+                    printf("failed to write to file\n");
+                }
+                memcpy(session->session_key, session_key, AES_KEY_SIZE);
+                shard->counters.handshakes_completed++;
+                serve_stream_client(shard, session);
+                session_table_remove(shard->sessions, session);
+            }
+            else {
+                printf("shard %d: handshake failed, dropping the client\n", shard->index);
+                shard->counters.handshakes_failed++;
+            }
+        }
+
+        SAFE_AES_KEY_MEMSET(session_key);
+        if (ck.ecc_public_key) {
+            EC_KEY_free(ck.ecc_public_key);
+        }
+        closesocket(client_fd);
+    }
+}
+
+static int open_shard_socket(ServerShard* shard)
+{
+    struct sockaddr_in server_addr;
+
+    if ((shard->fd = socket(AF_INET, shard->transport_type == TRANSPORT_TCP ? SOCK_STREAM : SOCK_DGRAM, 0)) < 0) {
+        perror("Socket creation failed");
+        return FALSE;
+    }
+
+#if defined(SO_REUSEPORT)
+    if (shard->reuse_port) {
+        int on = 1;
+        if (setsockopt(shard->fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&on, sizeof(on)) < 0) {
+            perror("SO_REUSEPORT");
+            closesocket(shard->fd);
+            return FALSE;
+        }
+    }
+#endif
+
+    // Bind socket to the address
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(shard->port);
+
+    if (bind(shard->fd, (const struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Bind failed");
+        closesocket(shard->fd);
+        return FALSE;
+    }
+
+    if (shard->transport_type == TRANSPORT_TCP && listen(shard->fd, SOMAXCONN) < 0) {
+        perror("Listen failed");
+        closesocket(shard->fd);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void pin_to_cpu(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "could not pin to cpu %d\n", cpu);
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+static void* run_shard(void* arg)
+{
+    ServerShard* shard = arg;
+
+    if (shard->cpu >= 0) {
+        pin_to_cpu(shard->cpu);
+    }
+    printf("Server shard %d is running on port %d (%s, server ID %d)\n", shard->index, shard->port,
+           shard->transport_type == TRANSPORT_TCP ? "tcp" : "udp", shard->server_id);
+
+    if (shard->transport_type == TRANSPORT_TCP) {
+        serve_stream_clients(shard);
+    }
+    else {
+        struct sockaddr_in nobody;
+        memset(&nobody, 0, sizeof(nobody));
+        transport_init(&shard->transport, TRANSPORT_UDP, shard->fd, nobody);
+        shard->transport.max_datagram = shard->max_datagram;
+        timer_wheel_init(&shard->timers, monotonic_ms());
+        if (transport_set_reliable(&shard->transport, &shard->timers) != TRUE ||
+            cookie_jar_init(&shard->cookies, monotonic_ms() / 1000) != TRUE) {
+            return NULL;
+        }
+        // "io_uring" on the command line moves the batches onto io_uring, otherwise recvmmsg / sendmmsg
+        if (shard->use_io_uring && transport_use_io_uring(&shard->transport) == TRUE) {
+            printf("shard %d: using io_uring for the request loop\n", shard->index);
+        }
+        // fragmented replies leave as one GSO send and fragmented requests come in as one GRO receive
+        else if (transport_use_offload(&shard->transport) == TRUE) {
+            printf("shard %d: UDP segmentation offload on (gso %d, gro %d)\n", shard->index,
+                   shard->transport.gso, shard->transport.gro);
+        }
+        // loop for safe communication, a batch of datagrams at a time; every shard reports its counters now and
+        // then, the first one the crypto workers' queues too and drops the tickets that expired
+        uint64_t next_stats = monotonic_ms() + STATS_INTERVAL_MS;
+        while (serve_user_batch(shard) == TRUE) {
+            if (monotonic_ms() >= next_stats) {
+                print_counters(shard);
+                if (shard->index == 0) {
+                    crypto_pool_print_stats(shard->server->crypto, stdout);
+                    session_table_expire_tickets(shard->sessions, monotonic_ms() / 1000);
+                }
+                next_stats = monotonic_ms() + STATS_INTERVAL_MS;
+            }
+        }
+        print_counters(shard);
+        printf("shard %d: failed to serve encrypted users, exiting...\n", shard->index);
+        transport_release(&shard->transport);
+        for (size_t i = 0; i < MAX_REASSEMBLIES; i++) {
+            reassembly_reset(&shard->reassemblies[i]);
+        }
+        for (size_t i = 0; i < shard->handshakes.count; i++) {
+            release_handshake(shard, shard->handshakes.entries[i]);
+        }
+        shard->handshakes.count = 0;
+        cookie_jar_clear(&shard->cookies);
+        clear_replies(&shard->replies);
+    }
+    return NULL;
+}
+
+// "shards" on the command line: one worker per online core
+static int shard_count_from_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "shards") == 0) {
+#if defined(SHARDS_SUPPORTED)
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            return cpus > 1 ? (int)cpus : 1;
+#else
+            printf("shards need SO_REUSEPORT and pthreads, running a single server\n");
+#endif
+        }
+    }
+    return 1;
+}
+
+// "server_id=<n>" on the command line: behind a balancer, the shards take server IDs from n on, each listening on
+// BACKEND_BASE_PORT + its ID; -1 when absent
+static int first_server_id_from_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "server_id=", 10) == 0) {
+            return atoi(argv[i] + 10);
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    WSADATA wsaData;
+    int rc, i, shard_count = shard_count_from_args(argc, argv), first_server_id = first_server_id_from_args(argc, argv);
+    ServerShard* shards;
+    SessionTable* sessions;
+    RoutingKey routing;
+    Server server;
+    memset(&server, 0, sizeof(server));
+    rc = server_init(&server);
+    if (rc != TRUE)
+    {
+        printf("server init failed!, exiting...");
+        return EXIT_FAILURE;
+    }
+    // signature checks, decryptions and signing run on their own workers, the shards only do I/O
+    server.crypto = crypto_pool_create(crypto_workers_from_args(argc, argv));
+    printf("crypto workers: %zu\n", crypto_pool_workers(server.crypto));
+    // one table for every shard, sized once: "max_sessions=<n>"
+    sessions = session_table_create(max_sessions_from_args(argc, argv));
+    if (sessions == NULL) {
+        printf("session table creation failed!, exiting...");
+        return EXIT_FAILURE;
+    }
+    // the connection IDs' key, shared with the other servers and the balancer through the file
+    if (routing_key_load(&routing, ROUTING_KEY_FILE) != TRUE) {
+        printf("routing key load failed!, exiting...");
+        return EXIT_FAILURE;
+    }
+    if (first_server_id + shard_count > MAX_SERVER_IDS) {
+        printf("server IDs %d to %d do not fit in a connection ID, exiting...", first_server_id, first_server_id + shard_count - 1);
+        return EXIT_FAILURE;
+    }
+
+    // Initialize Winsock
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("WSAStartup failed: %d\n", WSAGetLastError());
+        return EXIT_FAILURE;
+    }
+
+    // the shards are large (their batch buffers), keep them off the stack
+    shards = calloc((size_t)shard_count, sizeof(ServerShard));
+    if (shards == NULL) {
+        perror("calloc shards");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < shard_count; i++) {
+        shards[i].index = i;
+        shards[i].cpu = shard_count > 1 ? i : -1;
+        shards[i].server = &server;
+        shards[i].sessions = sessions;
+        shards[i].transport_type = transport_type_from_args(argc, argv);
+        shards[i].use_io_uring = io_uring_from_args(argc, argv);
+        shards[i].max_datagram = max_datagram_from_args(argc, argv);
+        shards[i].routing = &routing;
+        // behind a balancer every shard has a port of its own, otherwise they share SERVER_PORT
+        if (first_server_id >= 0) {
+            shards[i].server_id = (uint8_t)(first_server_id + i);
+            shards[i].port = (unsigned short)(BACKEND_BASE_PORT + first_server_id + i);
+        }
+        else {
+            shards[i].server_id = (uint8_t)i;
+            shards[i].port = SERVER_PORT;
+            shards[i].reuse_port = shard_count > 1;
+        }
+        if (open_shard_socket(&shards[i]) != TRUE) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (shard_count == 1) {
+        run_shard(&shards[0]);
+    }
+#if defined(SHARDS_SUPPORTED)
+    else {
+        pthread_t* threads = calloc((size_t)shard_count, sizeof(pthread_t));
+        if (threads == NULL) {
+            perror("calloc threads");
+            return EXIT_FAILURE;
+        }
+        for (i = 0; i < shard_count; i++) {
+            if (pthread_create(&threads[i], NULL, run_shard, &shards[i]) != 0) {
+                perror("pthread_create");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (i = 0; i < shard_count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+#endif
 
     // Cleanup
+    crypto_pool_print_stats(server.crypto, stdout);
+    crypto_pool_destroy(server.crypto);
+    session_table_destroy(sessions);
+    routing_key_clear(&routing);
     server.cleanup(&server);
-    closesocket(server_fd);
+    for (i = 0; i < shard_count; i++) {
+        closesocket(shards[i].fd);
+    }
+    free(shards);
     WSACleanup();
     system("PAUSE");
     return 0;
-}
\ No newline at end of file
+}
@@ -1,31 +1,197 @@
 #pragma once
 #include "crypto_functions.h"
 #include "socket_functions.h"
+#include "io_uring_functions.h"
+#include "protocol_functions.h"
+#include "session_table.h"
 
-// Forward declarations of structs
-typedef struct Server Server;
-
-// Function pointer typedefs
-typedef void (*ServerCleanupFunc)(Server* server);
-
-struct Server {
-    // Data members
-    RSA* rsa_private_key;
-    RSA* rsa_public_key;
-    EC_KEY* ecc_private_key;
-    EC_KEY* ecc_public_key;
-    uint8_t kyber_private_key[OQS_KEM_kyber_768_length_secret_key];
-    uint8_t kyber_public_key[OQS_KEM_kyber_768_length_secret_key];
-    uint8_t kyber_shared_secret[OQS_KEM_kyber_768_length_shared_secret];
-    uint8_t dilithium_private_key[OQS_SIG_dilithium_2_length_secret_key];
-    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
-
-    BOOL is_initialized;
-
-    ServerCleanupFunc cleanup;
-};
-
-typedef struct Client_Keys {
-    EC_KEY* ecc_public_key;
-    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
-}Client_Keys;
+// Datagrams one reply may be cut into: a signed answer is about two full datagrams
+#define MAX_REPLY_DATAGRAMS 4
+// How often the shards' counters and the crypto workers' queue depths and latencies are printed
+#define STATS_INTERVAL_MS 10000
+// Fragmented requests one shard puts together at a time, the oldest is dropped when full
+#define MAX_REASSEMBLIES 16
+
+// Handshake admission: a source prefix (/24) may start HANDSHAKE_RATE handshakes a second, in bursts of up to
+// HANDSHAKE_BURST. A hello over the limit is dropped, the peer's retransmission asks again later
+#define HANDSHAKE_RATE 20
+#define HANDSHAKE_BURST 40
+#define ADMISSION_PREFIX_BITS 24
+// Buckets of one shard, prefixes hashed to them; prefixes that hash alike share a bucket, and its limit
+#define ADMISSION_BUCKETS 1024
+// Admitted handshakes one shard has in progress at once; a hello past them is dropped like one over its rate
+#define MAX_PENDING_HANDSHAKES 64
+// Longest a handshake may take from its hello, however slowly the peer sends its records
+#define HANDSHAKE_DEADLINE_MS 10000
+// Answers a shard keeps for requests that come again because the answer was lost. A request seen already is
+// answered from here, and is not run a second time; without its answer here it is dropped. An answer is kept for as
+// long as its client may send the request again, and is found by session and record number whatever else is kept.
+// Past REPLY_CACHE_MAX answers (REPLY_KEEP_MS of answers at about 3000 a second, under 3 KB each) the oldest go early
+#define REPLY_KEEP_MS ((MAX_RETRANSMITS + 1) * RTO_MAX_MS)
+#define REPLY_CACHE_MAX (1 << 16)
+// Hash buckets of the answers, a power of two
+#define REPLY_CACHE_BUCKETS (1 << 16)
+
+typedef struct TokenBucket {
+    // thousandths of a token, refilled every millisecond
+    uint64_t tokens;
+    uint64_t refilled_ms;
+    BOOL used;
+} TokenBucket;
+
+// A handshake with a UDP peer, run by the batch loop a datagram at a time and never waited on: the server's records
+// go out one at a time, each sent again until the peer acknowledges it, and the peer's records are taken in as they
+// come. Other peers are served in between
+typedef struct PendingHandshake {
+    struct sockaddr_in peer;
+    // the session's key in the table, from the connection ID the hello brought back; the handshake is found by it
+    ConnectionId id;
+    ServerHandshake protocol;
+    Client_Keys client_keys;
+    // number of our next record, and of the next one expected from the peer (its hello was record 0)
+    unsigned short send_seq;
+    unsigned short recv_seq;
+    // the record in flight, until it is acknowledged
+    Flight flight;
+    unsigned short flight_seq;
+    BOOL flight_pending;
+    unsigned int rto_ms;
+    int retransmits;
+    Timer retransmit_timer;
+    // HANDSHAKE_DEADLINE_MS after the hello
+    Timer deadline;
+    // a record of the peer arriving as fragments
+    Reassembly reassembly;
+    // its first record went out; it failed or ran out of time, and goes at the end of the batch
+    BOOL started;
+    BOOL over;
+} PendingHandshake;
+
+typedef struct HandshakeTable {
+    PendingHandshake* entries[MAX_PENDING_HANDSHAKES];
+    size_t count;
+} HandshakeTable;
+
+typedef struct CachedReply {
+    // in its bucket, and the answer sent after it
+    struct CachedReply* next;
+    struct CachedReply* newer;
+    // session and record number of the request
+    ConnectionId id;
+    uint64_t seq;
+    uint64_t sent_ms;
+    SealedRecord sealed;
+} CachedReply;
+
+typedef struct ReplyCache {
+    CachedReply* buckets[REPLY_CACHE_BUCKETS];
+    // the answers in the order they were sent
+    CachedReply* oldest;
+    CachedReply* newest;
+    size_t count;
+} ReplyCache;
+
+// What a shard did with the work offered to it, since it started
+typedef struct ShardCounters {
+    uint64_t requests_answered;
+    // failed to verify or decrypt
+    uint64_t requests_rejected;
+    // seen already, or too old for the replay window: answered again from the cache, or dropped
+    uint64_t requests_resent;
+    uint64_t requests_replayed;
+    // answers let go of before REPLY_KEEP_MS to make room
+    uint64_t replies_evicted;
+    uint64_t cookies_sent;
+    uint64_t handshakes_admitted;
+    // over the rate of their prefix
+    uint64_t handshakes_throttled;
+    // the handshake table or the session table was full
+    uint64_t handshakes_dropped;
+    // the peer went quiet, or did not finish within HANDSHAKE_DEADLINE_MS
+    uint64_t handshakes_expired;
+    uint64_t handshakes_completed;
+    uint64_t handshakes_failed;
+    // connection IDs of another server, or of a session of another shard
+    uint64_t records_misrouted;
+    // sessions whose client came back from a new address
+    uint64_t sessions_migrated;
+    // sessions opened with a ticket, their first request on the hello
+    uint64_t sessions_resumed;
+} ShardCounters;
+
+// The requests of one session in a batch, their signatures checked together by one crypto job
+typedef struct VerifyGroup {
+    uint8_t* public_key;
+    size_t count;
+    const uint8_t* messages[MAX_BATCH];
+    size_t message_lens[MAX_BATCH];
+    const uint8_t* signatures[MAX_BATCH];
+    size_t signature_lens[MAX_BATCH];
+    // position of each request in the batch
+    size_t index[MAX_BATCH];
+    int valid[MAX_BATCH];
+} VerifyGroup;
+
+// A verified request decrypted and answered by one crypto job
+typedef struct AnswerJob {
+    unsigned char* session_key;
+    // record number of the answer
+    uint64_t seq;
+    uint8_t* dilithium_private_key;
+    const uint8_t* message;
+    size_t message_len;
+    const char* answer;
+    SealedRecord sealed;
+} AnswerJob;
+
+// Buffers of one UDP request batch
+typedef struct BatchScratch {
+    ReceivedDatagram requests[MAX_BATCH];
+    OutgoingDatagram answers[MAX_BATCH * MAX_REPLY_DATAGRAMS];
+    unsigned char headers[MAX_BATCH * MAX_REPLY_DATAGRAMS][FRAGMENT_HEADER_SIZE];
+    // cookies sent with RECORD_RETRY, one per datagram of the batch at most
+    unsigned char cookies[MAX_BATCH][COOKIE_SIZE];
+    unsigned char connection_ids[MAX_BATCH][CONNECTION_ID_SIZE];
+    // tickets sent with the answers, one per request at most
+    unsigned char tickets[MAX_BATCH][CONNECTION_ID_SIZE];
+    VerifyGroup verify_groups[MAX_BATCH];
+    AnswerJob answer_jobs[MAX_BATCH];
+    // a session's signature check, and each request's answer
+    CryptoJob verify_jobs[MAX_BATCH];
+    CryptoJob jobs[MAX_BATCH];
+} BatchScratch;
+
+// One server worker with its own socket, timers and scratch buffers. Shards share the long-term keys in Server,
+// which they never write, and the session table, where each one only touches the sessions it made.
+typedef struct ServerShard {
+    int index;
+    // core the worker is pinned to, -1 for none
+    int cpu;
+    Server* server;
+    TransportType transport_type;
+    BOOL use_io_uring;
+    // bind with SO_REUSEPORT so the kernel spreads clients over the shards
+    BOOL reuse_port;
+    unsigned short port;
+    // in the connection IDs the shard gives out, for a balancer to send their datagrams back here
+    uint8_t server_id;
+    RoutingKey* routing;
+    // largest datagram sent, see max_datagram_from_args
+    size_t max_datagram;
+    int fd;
+    Transport transport;
+    // retransmissions and deadlines of the handshakes, idle timeouts of the sessions
+    TimerWheel timers;
+    SessionTable* sessions;
+    // requests arriving as fragments, kept across batches
+    Reassembly reassemblies[MAX_REASSEMBLIES];
+    size_t next_reassembly;
+    // UDP: a hello needs a cookie from here before the shard keeps anything for the peer, then a token of its
+    // prefix; the records of handshakes in progress are taken in behind those of established sessions
+    CookieJar cookies;
+    TokenBucket buckets[ADMISSION_BUCKETS];
+    HandshakeTable handshakes;
+    ReplyCache replies;
+    ShardCounters counters;
+    BatchScratch scratch;
+} ServerShard;
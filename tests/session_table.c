@@ -0,0 +1,567 @@
+#include "session_table.h"
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <stdatomic.h>
+#define SESSION_TABLE_LOCKS
+#endif
+
+typedef struct SessionStripe {
+#if defined(SESSION_TABLE_LOCKS)
+    pthread_mutex_t lock;
+#endif
+    Session** slots;
+    size_t count;
+} SessionStripe;
+
+// Interned identities: chained buckets, each stripe of buckets behind its own lock
+typedef struct IdentityStripe {
+#if defined(SESSION_TABLE_LOCKS)
+    pthread_mutex_t lock;
+#endif
+    size_t count;
+} IdentityStripe;
+
+// A resumption ticket, in chained buckets behind stripes like those of the identities
+typedef struct Ticket {
+    struct Ticket* next;
+    // the tickets of its stripe made before and after it
+    struct Ticket* older;
+    struct Ticket* newer;
+    ConnectionId id;
+    unsigned char secret[AES_KEY_SIZE];
+    // a reference of its own
+    PeerIdentity* identity;
+    uint64_t expires_s;
+} Ticket;
+
+// Every ticket is good for the same time, so a stripe's tickets by age are its tickets by expiry: the expired ones
+// are the oldest, and go without looking at the others
+typedef struct TicketStripe {
+#if defined(SESSION_TABLE_LOCKS)
+    pthread_mutex_t lock;
+#endif
+    size_t count;
+    Ticket* oldest;
+    Ticket* newest;
+} TicketStripe;
+
+struct SessionTable {
+    SessionStripe stripes[SESSION_STRIPES];
+    IdentityStripe identity_stripes[SESSION_STRIPES];
+    TicketStripe ticket_stripes[SESSION_STRIPES];
+    PeerIdentity** identities;
+    Ticket** tickets;
+    // of identities and of tickets, a power of two
+    size_t identity_buckets;
+    // slots of every stripe, a power of two; a stripe takes at most three quarters of them
+    size_t stripe_slots;
+    size_t max_sessions;
+#if defined(SESSION_TABLE_LOCKS)
+    atomic_size_t count;
+    atomic_size_t ticket_count;
+#else
+    size_t count;
+    size_t ticket_count;
+#endif
+};
+
+// splitmix64 finalizer: the stripe comes from the top bits, the slot from the bottom ones
+static uint64_t hash_id(ConnectionId id)
+{
+    uint64_t h = id;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static SessionStripe* stripe_of(SessionTable* table, uint64_t hash)
+{
+    return &table->stripes[hash >> 58];
+}
+
+#if defined(SESSION_TABLE_LOCKS)
+#define stripe_lock(stripe) pthread_mutex_lock(&(stripe)->lock)
+#define stripe_unlock(stripe) pthread_mutex_unlock(&(stripe)->lock)
+#else
+#define stripe_lock(stripe)
+#define stripe_unlock(stripe)
+#endif
+
+// A Dilithium public key starts with a random seed: its first bytes hash well enough
+static uint64_t hash_key(const uint8_t* dilithium_public_key)
+{
+    uint64_t seed;
+    memcpy(&seed, dilithium_public_key, sizeof(seed));
+    return hash_id(seed);
+}
+
+SessionTable* session_table_create(size_t max_sessions)
+{
+    SessionTable* table;
+    size_t slots = 16;
+
+    if (max_sessions == 0 || max_sessions > MAX_MAX_SESSIONS) {
+        return NULL;
+    }
+    // twice the share of a stripe, so that probes stay short and an unlucky stripe has room
+    while (slots < 2 * ((max_sessions + SESSION_STRIPES - 1) / SESSION_STRIPES)) {
+        slots *= 2;
+    }
+    table = calloc(1, sizeof(SessionTable));
+    if (table == NULL) {
+        perror("calloc - session_table_create");
+        return NULL;
+    }
+    table->stripe_slots = slots;
+    table->max_sessions = max_sessions;
+    // one bucket per session, as many clients as sessions at worst
+    table->identity_buckets = slots * SESSION_STRIPES / 2;
+    table->identities = calloc(table->identity_buckets, sizeof(PeerIdentity*));
+    table->tickets = calloc(table->identity_buckets, sizeof(Ticket*));
+    if (table->identities == NULL || table->tickets == NULL) {
+        perror("calloc - session_table_create");
+        free(table->identities);
+        free(table->tickets);
+        free(table);
+        return NULL;
+    }
+    for (size_t i = 0; i < SESSION_STRIPES; i++) {
+#if defined(SESSION_TABLE_LOCKS)
+        pthread_mutex_init(&table->identity_stripes[i].lock, NULL);
+        pthread_mutex_init(&table->ticket_stripes[i].lock, NULL);
+#endif
+    }
+    for (size_t i = 0; i < SESSION_STRIPES; i++) {
+        table->stripes[i].slots = calloc(slots, sizeof(Session*));
+        if (table->stripes[i].slots == NULL) {
+            perror("calloc - session_table_create");
+            session_table_destroy(table);
+            return NULL;
+        }
+#if defined(SESSION_TABLE_LOCKS)
+        pthread_mutex_init(&table->stripes[i].lock, NULL);
+#endif
+    }
+    return table;
+}
+
+PeerIdentity* session_table_intern(SessionTable* table, const uint8_t* dilithium_public_key)
+{
+    uint64_t hash = hash_key(dilithium_public_key);
+    size_t bucket = hash & (table->identity_buckets - 1);
+    IdentityStripe* stripe = &table->identity_stripes[bucket % SESSION_STRIPES];
+    PeerIdentity* identity;
+
+    stripe_lock(stripe);
+    for (identity = table->identities[bucket]; identity != NULL; identity = identity->next) {
+        if (memcmp(identity->dilithium_public_key, dilithium_public_key, sizeof(identity->dilithium_public_key)) == 0) {
+            break;
+        }
+    }
+    if (identity == NULL) {
+        identity = malloc(sizeof(PeerIdentity));
+        if (identity == NULL) {
+            perror("malloc - session_table_intern");
+            stripe_unlock(stripe);
+            return NULL;
+        }
+        memcpy(identity->dilithium_public_key, dilithium_public_key, sizeof(identity->dilithium_public_key));
+        identity->refs = 0;
+        identity->next = table->identities[bucket];
+        table->identities[bucket] = identity;
+        stripe->count++;
+    }
+    identity->refs++;
+    stripe_unlock(stripe);
+    return identity;
+}
+
+static void release_identity(SessionTable* table, PeerIdentity* identity)
+{
+    size_t bucket = hash_key(identity->dilithium_public_key) & (table->identity_buckets - 1);
+    IdentityStripe* stripe = &table->identity_stripes[bucket % SESSION_STRIPES];
+    PeerIdentity** link;
+
+    stripe_lock(stripe);
+    if (--identity->refs > 0) {
+        stripe_unlock(stripe);
+        return;
+    }
+    for (link = &table->identities[bucket]; *link != identity; link = &(*link)->next) {
+    }
+    *link = identity->next;
+    stripe->count--;
+    stripe_unlock(stripe);
+    free(identity);
+}
+
+static void retain_identity(SessionTable* table, PeerIdentity* identity)
+{
+    size_t bucket = hash_key(identity->dilithium_public_key) & (table->identity_buckets - 1);
+    IdentityStripe* stripe = &table->identity_stripes[bucket % SESSION_STRIPES];
+
+    stripe_lock(stripe);
+    identity->refs++;
+    stripe_unlock(stripe);
+}
+
+static void free_ticket(SessionTable* table, Ticket* ticket)
+{
+    if (ticket->identity != NULL) {
+        release_identity(table, ticket->identity);
+    }
+    SAFE_AES_KEY_MEMSET(ticket->secret);
+    free(ticket);
+#if defined(SESSION_TABLE_LOCKS)
+    atomic_fetch_sub(&table->ticket_count, 1);
+#else
+    table->ticket_count--;
+#endif
+}
+
+static void free_session(SessionTable* table, Session* session)
+{
+    if (session->identity != NULL) {
+        release_identity(table, session->identity);
+    }
+    SAFE_AES_KEY_MEMSET(session->session_key);
+    free(session);
+}
+
+void session_table_destroy(SessionTable* table)
+{
+    if (table == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < SESSION_STRIPES; i++) {
+        SessionStripe* stripe = &table->stripes[i];
+        if (stripe->slots == NULL) {
+            continue;
+        }
+        for (size_t j = 0; j < table->stripe_slots; j++) {
+            if (stripe->slots[j] != NULL) {
+                free_session(table, stripe->slots[j]);
+            }
+        }
+        free(stripe->slots);
+#if defined(SESSION_TABLE_LOCKS)
+        pthread_mutex_destroy(&stripe->lock);
+#endif
+    }
+    // tickets let go of their identities before those go
+    session_table_expire_tickets(table, UINT64_MAX);
+    for (size_t i = 0; i < SESSION_STRIPES; i++) {
+#if defined(SESSION_TABLE_LOCKS)
+        pthread_mutex_destroy(&table->identity_stripes[i].lock);
+        pthread_mutex_destroy(&table->ticket_stripes[i].lock);
+#endif
+    }
+    free(table->identities);
+    free(table->tickets);
+    free(table);
+}
+
+Session* session_table_find(SessionTable* table, ConnectionId id, int shard, int* exists)
+{
+    uint64_t hash = hash_id(id);
+    SessionStripe* stripe = stripe_of(table, hash);
+    size_t mask = table->stripe_slots - 1;
+    Session* found = NULL;
+    int any = FALSE;
+
+    // the owner removes its sessions under this lock, so the one found is still there to read its shard
+    stripe_lock(stripe);
+    for (size_t i = hash & mask; stripe->slots[i] != NULL; i = (i + 1) & mask) {
+        if (stripe->slots[i]->id == id) {
+            any = TRUE;
+            if (stripe->slots[i]->shard == shard) {
+                found = stripe->slots[i];
+            }
+            break;
+        }
+    }
+    stripe_unlock(stripe);
+    if (exists != NULL) {
+        *exists = any;
+    }
+    return found;
+}
+
+Session* session_table_add(SessionTable* table, ConnectionId id, const struct sockaddr_in* peer, int shard)
+{
+    uint64_t hash = hash_id(id);
+    SessionStripe* stripe = stripe_of(table, hash);
+    size_t mask = table->stripe_slots - 1, i;
+    Session* session;
+
+    // the place is taken first, so that a full table costs no allocation
+#if defined(SESSION_TABLE_LOCKS)
+    if (atomic_fetch_add(&table->count, 1) >= table->max_sessions) {
+        atomic_fetch_sub(&table->count, 1);
+        return NULL;
+    }
+#else
+    if (table->count >= table->max_sessions) {
+        return NULL;
+    }
+    table->count++;
+#endif
+    session = calloc(1, sizeof(Session));
+    if (session == NULL) {
+        perror("calloc - session_table_add");
+    }
+    else {
+        session->id = id;
+        session->peer = *peer;
+        session->shard = shard;
+
+        stripe_lock(stripe);
+        if (stripe->count + 1 > table->stripe_slots / 4 * 3) {
+            free(session);
+            session = NULL;
+        }
+        else {
+            for (i = hash & mask; stripe->slots[i] != NULL; i = (i + 1) & mask) {
+                if (stripe->slots[i]->id == id) {
+                    break;
+                }
+            }
+            if (stripe->slots[i] != NULL) {
+                free(session);
+                session = NULL;
+            }
+            else {
+                stripe->slots[i] = session;
+                stripe->count++;
+            }
+        }
+        stripe_unlock(stripe);
+    }
+    if (session == NULL) {
+#if defined(SESSION_TABLE_LOCKS)
+        atomic_fetch_sub(&table->count, 1);
+#else
+        table->count--;
+#endif
+    }
+    return session;
+}
+
+void session_table_remove(SessionTable* table, Session* session)
+{
+    uint64_t hash = hash_id(session->id);
+    SessionStripe* stripe = stripe_of(table, hash);
+    size_t mask = table->stripe_slots - 1, i, j;
+
+    stripe_lock(stripe);
+    for (i = hash & mask; stripe->slots[i] != NULL && stripe->slots[i] != session; i = (i + 1) & mask) {
+    }
+    if (stripe->slots[i] == NULL) {
+        stripe_unlock(stripe);
+        return;
+    }
+    // backward shift: the entries after the hole that probed past it move up, no tombstones are left
+    stripe->slots[i] = NULL;
+    for (j = (i + 1) & mask; stripe->slots[j] != NULL; j = (j + 1) & mask) {
+        size_t home = hash_id(stripe->slots[j]->id) & mask;
+        // j stays when its home lies cyclically in (i, j]
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        stripe->slots[i] = stripe->slots[j];
+        stripe->slots[j] = NULL;
+        i = j;
+    }
+    stripe->count--;
+    stripe_unlock(stripe);
+
+#if defined(SESSION_TABLE_LOCKS)
+    atomic_fetch_sub(&table->count, 1);
+#else
+    table->count--;
+#endif
+    free_session(table, session);
+}
+
+// Takes ticket out of its stripe's age order, under the stripe lock
+static void unlink_by_age(TicketStripe* stripe, Ticket* ticket)
+{
+    if (ticket->older != NULL) {
+        ticket->older->newer = ticket->newer;
+    }
+    else {
+        stripe->oldest = ticket->newer;
+    }
+    if (ticket->newer != NULL) {
+        ticket->newer->older = ticket->older;
+    }
+    else {
+        stripe->newest = ticket->older;
+    }
+    stripe->count--;
+}
+
+int session_table_ticket_add(SessionTable* table, ConnectionId id, const unsigned char* secret, PeerIdentity* identity,
+                             uint64_t expires_s)
+{
+    size_t bucket = hash_id(id) & (table->identity_buckets - 1);
+    TicketStripe* stripe = &table->ticket_stripes[bucket % SESSION_STRIPES];
+    Ticket* ticket;
+
+#if defined(SESSION_TABLE_LOCKS)
+    if (atomic_fetch_add(&table->ticket_count, 1) >= table->max_sessions) {
+        atomic_fetch_sub(&table->ticket_count, 1);
+        return FALSE;
+    }
+#else
+    if (table->ticket_count >= table->max_sessions) {
+        return FALSE;
+    }
+    table->ticket_count++;
+#endif
+    ticket = malloc(sizeof(Ticket));
+    if (ticket == NULL) {
+        perror("malloc - session_table_ticket_add");
+#if defined(SESSION_TABLE_LOCKS)
+        atomic_fetch_sub(&table->ticket_count, 1);
+#else
+        table->ticket_count--;
+#endif
+        return FALSE;
+    }
+    ticket->id = id;
+    memcpy(ticket->secret, secret, AES_KEY_SIZE);
+    retain_identity(table, identity);
+    ticket->identity = identity;
+    ticket->expires_s = expires_s;
+
+    stripe_lock(stripe);
+    ticket->next = table->tickets[bucket];
+    table->tickets[bucket] = ticket;
+    ticket->older = stripe->newest;
+    ticket->newer = NULL;
+    if (stripe->newest != NULL) {
+        stripe->newest->newer = ticket;
+    }
+    else {
+        stripe->oldest = ticket;
+    }
+    stripe->newest = ticket;
+    stripe->count++;
+    stripe_unlock(stripe);
+    return TRUE;
+}
+
+Session* session_table_resume(SessionTable* table, ConnectionId id, const struct sockaddr_in* peer, int shard, uint64_t now_s,
+                              unsigned char* secret)
+{
+    size_t bucket = hash_id(id) & (table->identity_buckets - 1);
+    TicketStripe* stripe = &table->ticket_stripes[bucket % SESSION_STRIPES];
+    Ticket** link;
+    Ticket* ticket;
+    Session* session = NULL;
+
+    // out of the table before anything else, so two shards cannot both resume with it
+    stripe_lock(stripe);
+    for (link = &table->tickets[bucket]; *link != NULL && (*link)->id != id; link = &(*link)->next) {
+    }
+    ticket = *link;
+    if (ticket != NULL) {
+        *link = ticket->next;
+        unlink_by_age(stripe, ticket);
+    }
+    stripe_unlock(stripe);
+    if (ticket == NULL) {
+        return NULL;
+    }
+
+    if (ticket->expires_s > now_s) {
+        session = session_table_add(table, id, peer, shard);
+    }
+    if (session != NULL) {
+        // the ticket's reference goes to the session
+        session->identity = ticket->identity;
+        ticket->identity = NULL;
+        memcpy(secret, ticket->secret, AES_KEY_SIZE);
+    }
+    free_ticket(table, ticket);
+    return session;
+}
+
+void session_table_expire_tickets(SessionTable* table, uint64_t now_s)
+{
+    for (size_t i = 0; i < SESSION_STRIPES; i++) {
+        TicketStripe* stripe = &table->ticket_stripes[i];
+        Ticket* expired = NULL;
+
+        stripe_lock(stripe);
+        while (stripe->oldest != NULL && stripe->oldest->expires_s <= now_s) {
+            Ticket* ticket = stripe->oldest;
+            Ticket** link = &table->tickets[hash_id(ticket->id) & (table->identity_buckets - 1)];
+
+            while (*link != ticket) {
+                link = &(*link)->next;
+            }
+            *link = ticket->next;
+            unlink_by_age(stripe, ticket);
+            ticket->next = expired;
+            expired = ticket;
+        }
+        stripe_unlock(stripe);
+        // freed outside the ticket lock, they take identity locks
+        while (expired != NULL) {
+            Ticket* next = expired->next;
+            free_ticket(table, expired);
+            expired = next;
+        }
+    }
+}
+
+size_t session_table_count(SessionTable* table)
+{
+#if defined(SESSION_TABLE_LOCKS)
+    return atomic_load(&table->count);
+#else
+    return table->count;
+#endif
+}
+
+void session_table_memory(SessionTable* table, SessionMemory* memory)
+{
+    memset(memory, 0, sizeof(*memory));
+    memory->sessions = session_table_count(table);
+    for (size_t i = 0; i < SESSION_STRIPES; i++) {
+        IdentityStripe* identities = &table->identity_stripes[i];
+        TicketStripe* tickets = &table->ticket_stripes[i];
+        stripe_lock(identities);
+        memory->identities += identities->count;
+        stripe_unlock(identities);
+        stripe_lock(tickets);
+        memory->tickets += tickets->count;
+        stripe_unlock(tickets);
+    }
+    memory->index_bytes = SESSION_STRIPES * table->stripe_slots * sizeof(Session*) +
+                          table->identity_buckets * (sizeof(PeerIdentity*) + sizeof(Ticket*));
+    memory->session_bytes = memory->sessions * sizeof(Session);
+    memory->identity_bytes = memory->identities * sizeof(PeerIdentity);
+    memory->ticket_bytes = memory->tickets * sizeof(Ticket);
+}
+
+int session_table_full(SessionTable* table)
+{
+    return session_table_count(table) >= table->max_sessions;
+}
+
+size_t max_sessions_from_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "max_sessions=", 13) == 0) {
+            return strtoul(argv[i] + 13, NULL, 10);
+        }
+    }
+    return DEFAULT_MAX_SESSIONS;
+}
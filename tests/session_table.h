@@ -0,0 +1,110 @@
+#pragma once
+#include "protocol_functions.h"
+#include "timer_wheel.h"
+
+// Session table shared by the server shards: open addressing with linear probing, split in SESSION_STRIPES
+// stripes with a lock each so that shards adding and removing sessions at the same time rarely meet. Sessions are
+// found by connection ID (see connection_id_issue), so a client keeps its session when its address changes. A
+// session belongs to the shard that made it: only that shard uses, touches the timers of and removes it, so a
+// pointer found by its owner stays good without holding a lock.
+// The table is sized once for max_sessions (up to one million and more): its index takes three pointers per session,
+// the sessions themselves are allocated as they are made and never more than max_sessions at a time. A session
+// only keeps what its requests need, well under 256 bytes; the client's Dilithium public key, the one large part,
+// is interned: every session of the same client refers to one PeerIdentity.
+// The table also keeps the resumption tickets of UDP sessions (see protocol_functions.h), at most max_sessions of them,
+// past the end of their sessions: each one holds on to the identity and the resumption secret of its session until a
+// shard opens the resumed session with it, or it expires.
+
+#define SESSION_STRIPES 64
+// Default and largest max_sessions
+#define DEFAULT_MAX_SESSIONS (1 << 20)
+#define MAX_MAX_SESSIONS (1 << 24)
+
+// Identity of a client, shared by its sessions and freed with the last one
+typedef struct PeerIdentity {
+    struct PeerIdentity* next;
+    size_t refs;
+    uint8_t dilithium_public_key[OQS_SIG_dilithium_2_length_public_key];
+} PeerIdentity;
+
+// A client that finished the handshake
+typedef struct Session {
+    ConnectionId id;
+    struct sockaddr_in peer;
+    unsigned char session_key[AES_KEY_SIZE];
+    // checks the signatures of the client's requests
+    PeerIdentity* identity;
+    // numbers of our answers and of the client's requests taken in
+    RecordState records;
+    // connection ID of the session that resumes this one, 0 without a ticket
+    ConnectionId ticket;
+    // fires after SESSION_IDLE_TIMEOUT_MS without a request, on the owner's wheel
+    Timer idle;
+    // index of the shard that owns it
+    int shard;
+    // number of the last request answered
+    unsigned short request_seq;
+} Session;
+
+// What the table takes, see session_table_memory
+typedef struct SessionMemory {
+    size_t sessions;
+    size_t identities;
+    size_t tickets;
+    size_t index_bytes;
+    size_t session_bytes;
+    size_t identity_bytes;
+    size_t ticket_bytes;
+} SessionMemory;
+
+typedef struct SessionTable SessionTable;
+
+// NULL when max_sessions is 0, too large, or out of memory
+SessionTable* session_table_create(size_t max_sessions);
+
+// Frees the table and every session still in it
+void session_table_destroy(SessionTable* table);
+
+// The session under id if shard owns it, NULL otherwise. Another shard's session is only looked at under the lock,
+// its pointer never leaves the table; *exists (when not NULL) tells whether there is a session under id at all
+Session* session_table_find(SessionTable* table, ConnectionId id, int shard, int* exists);
+
+// A new zeroed session under id for peer, owned by shard; NULL when the table (or the stripe of id) is full or id
+// has a session already
+Session* session_table_add(SessionTable* table, ConnectionId id, const struct sockaddr_in* peer, int shard);
+
+// Takes the session out of the table, wipes its key, lets go of its identity and frees it. Its idle timer must not
+// be armed
+void session_table_remove(SessionTable* table, Session* session);
+
+// The identity with this key, made on first use; every call takes a reference that the session it is stored in
+// gives back when it is removed. NULL when out of memory
+PeerIdentity* session_table_intern(SessionTable* table, const uint8_t* dilithium_public_key);
+
+// Keeps the ticket of a session of identity: id is the connection ID of the session it resumes, secret its
+// AES_KEY_SIZE resumption secret. Good until expires_s, seconds on the clock given to session_table_resume, which is
+// meant to be the same time after the ticket is added for every ticket. FALSE when there are max_sessions tickets
+// already, or out of memory
+int session_table_ticket_add(SessionTable* table, ConnectionId id, const unsigned char* secret, PeerIdentity* identity,
+                             uint64_t expires_s);
+
+// Takes the ticket for id out of the table, it is good once: a new session under id for peer, owned by shard, with the
+// ticket's identity and its resumption secret copied to secret. NULL when there is no such ticket, it expired, or there
+// is no room for the session
+Session* session_table_resume(SessionTable* table, ConnectionId id, const struct sockaddr_in* peer, int shard, uint64_t now_s,
+                              unsigned char* secret);
+
+// Drops the tickets expired at now_s. Each stripe is walked from its oldest ticket up to the first one still good,
+// so a ticket added out of expiry order may stay past its time; session_table_resume refuses it all the same
+void session_table_expire_tickets(SessionTable* table, uint64_t now_s);
+
+// Sessions, identities, tickets and the bytes they take now
+void session_table_memory(SessionTable* table, SessionMemory* memory);
+
+size_t session_table_count(SessionTable* table);
+
+// TRUE when there is no room for another session
+int session_table_full(SessionTable* table);
+
+// "max_sessions=<n>" as an argument, DEFAULT_MAX_SESSIONS when absent
+size_t max_sessions_from_args(int argc, char** argv);
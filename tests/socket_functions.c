@@ -1,67 +1,1733 @@
+#if defined(__linux__)
+#define _GNU_SOURCE // recvmmsg / sendmmsg
+#endif
 #include "socket_functions.h"
 
-void send_and_receive(int fd, struct sockaddr_in addr, const char* message, size_t len) {
+#if defined(_WIN32)
+#define poll WSAPoll
+#else
+#include <poll.h>
+#include <sys/ioctl.h>
+#endif
+#if defined(__linux__)
+#include <netinet/udp.h>
+// older headers lack the segmentation offload options, the kernel takes them since 4.18 / 5.0
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
 
-    size_t sent_len = sendto(fd, message, len, 0, (const struct sockaddr*)&addr, sizeof(addr));
-    if (sent_len < 0) {
-        perror("sendto - send_and_receive");
+#if defined(_WIN32)
+typedef WSABUF IoVec;
+#define IOVEC_SET(v, data, size) do { (v)->buf = (char*)(data); (v)->len = (ULONG)(size); } while (0)
+#define IOVEC_BASE(v) ((unsigned char*)(v)->buf)
+#define IOVEC_LEN(v) ((size_t)(v)->len)
+#else
+typedef struct iovec IoVec;
+#define IOVEC_SET(v, data, size) do { (v)->iov_base = (void*)(data); (v)->iov_len = (size); } while (0)
+#define IOVEC_BASE(v) ((unsigned char*)(v)->iov_base)
+#define IOVEC_LEN(v) ((v)->iov_len)
+#endif
+
+void transport_init(Transport* t, TransportType type, int fd, struct sockaddr_in peer)
+{
+    memset(t, 0, sizeof(*t));
+    t->type = type;
+    t->fd = fd;
+    t->peer = peer;
+    t->max_datagram = DEFAULT_MAX_DATAGRAM;
+}
+
+void transport_detach_backend(Transport* t)
+{
+    if (t->backend.release != NULL) {
+        t->backend.release(t->backend.context);
     }
-    else if ((size_t)sent_len != len) {
-        fprintf(stderr, "Incomplete key sent: %zd/%zu bytes - send_and_receive\n", sent_len, len);
+    memset(&t->backend, 0, sizeof(t->backend));
+}
+
+void transport_release(Transport* t)
+{
+    transport_detach_backend(t);
+    free(t->gro_buffers);
+    free(t->gro_segments);
+    t->gro_buffers = NULL;
+    t->gro_segments = NULL;
+    t->gro_next = t->gro_count = 0;
+    t->gro = FALSE;
+    t->gso = FALSE;
+    if (t->reliable) {
+        transport_reset_records(t, 0, 0);
+        reassembly_reset(&t->reassembly);
+        free(t->flight);
+        free(t->datagram);
+        free(t->requests);
+        t->flight = NULL;
+        t->datagram = NULL;
+        t->requests = NULL;
+        t->reliable = FALSE;
     }
+}
 
-    // waiting for response from client
-    char buffer[10];
-    size_t recv_len = recvfrom(fd, buffer, sizeof(buffer), 0, NULL, NULL);
-    if (recv_len < 0) {
-        perror("recvfrom - send_and_receive");
+void transport_pipe(Transport* a, Transport* b, MemoryPipe* a_to_b, MemoryPipe* b_to_a)
+{
+    struct sockaddr_in none;
+
+    memset(&none, 0, sizeof(none));
+    memset(a_to_b, 0, sizeof(*a_to_b));
+    memset(b_to_a, 0, sizeof(*b_to_a));
+    transport_init(a, TRANSPORT_MEMORY, INVALID_SOCKET, none);
+    transport_init(b, TRANSPORT_MEMORY, INVALID_SOCKET, none);
+    a->pipe_out = b->pipe_in = a_to_b;
+    a->pipe_in = b->pipe_out = b_to_a;
+}
+
+int memory_pipe_pending(const MemoryPipe* p)
+{
+    return p->start != p->end;
+}
+
+void memory_pipe_reset_counters(MemoryPipe* p)
+{
+    p->records = 0;
+    p->bytes = 0;
+}
+
+void memory_pipe_release(MemoryPipe* p)
+{
+    free(p->data);
+    memset(p, 0, sizeof(*p));
+}
+
+// Queues one record behind its length, moving the queued records to the front or growing the buffer when full
+static int pipe_write(MemoryPipe* p, const TransportSegment* segments, size_t count, size_t total)
+{
+    size_t needed = FRAME_HEADER_SIZE + total;
+    unsigned char* dest;
+
+    if (p->start == p->end) {
+        p->start = p->end = 0;
+    }
+    if (p->capacity - p->end < needed && p->start > 0) {
+        memmove(p->data, p->data + p->start, p->end - p->start);
+        p->end -= p->start;
+        p->start = 0;
+    }
+    if (p->capacity - p->end < needed) {
+        size_t capacity = p->capacity ? p->capacity : BUFFER_SIZE;
+        while (capacity - p->end < needed) {
+            capacity *= 2;
+        }
+        unsigned char* data = realloc(p->data, capacity);
+        if (data == NULL) {
+            perror("realloc - pipe_write");
+            return FALSE;
+        }
+        p->data = data;
+        p->capacity = capacity;
+    }
+
+    dest = p->data + p->end;
+    dest[0] = (unsigned char)(total >> 24);
+    dest[1] = (unsigned char)(total >> 16);
+    dest[2] = (unsigned char)(total >> 8);
+    dest[3] = (unsigned char)total;
+    dest += FRAME_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(dest, segments[i].data, segments[i].len);
+        dest += segments[i].len;
+    }
+    p->end += needed;
+    p->records++;
+    p->bytes += needed;
+    return TRUE;
+}
+
+TransportType transport_type_from_args(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "tcp") == 0) {
+        return TRANSPORT_TCP;
+    }
+    return TRANSPORT_UDP;
+}
+
+size_t max_datagram_from_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "mtu=", 4) == 0) {
+            long mtu = strtol(argv[i] + 4, NULL, 10);
+            // room for the IPv4 and UDP headers, and for at least one fragment unit behind a connection ID and a
+            // fragment header
+            if (mtu >= 28 + ROUTE_PREFIX_SIZE + FRAGMENT_HEADER_SIZE + FRAGMENT_UNIT && mtu - 28 <= MAX_DATAGRAM_SIZE) {
+                return (size_t)(mtu - 28);
+            }
+            printf("Ignoring %s - max_datagram_from_args\n", argv[i]);
+        }
+    }
+    return DEFAULT_MAX_DATAGRAM;
+}
+
+static long write_vector(int fd, IoVec* v, size_t count)
+{
+#if defined(_WIN32)
+    DWORD sent = 0;
+    if (WSASend(fd, v, (DWORD)count, &sent, 0, NULL, NULL) != 0) {
+        return -1;
+    }
+    return (long)sent;
+#else
+    ssize_t sent;
+    do {
+        sent = writev(fd, v, (int)count);
+    } while (sent < 0 && errno == EINTR);
+    return (long)sent;
+#endif
+}
+
+static long send_vector_to(int fd, IoVec* v, size_t count, const struct sockaddr_in* addr)
+{
+#if defined(_WIN32)
+    DWORD sent = 0;
+    if (WSASendTo(fd, v, (DWORD)count, &sent, 0, (const struct sockaddr*)addr, sizeof(*addr), NULL, NULL) != 0) {
+        return -1;
+    }
+    return (long)sent;
+#else
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void*)addr;
+    msg.msg_namelen = sizeof(*addr);
+    msg.msg_iov = v;
+    msg.msg_iovlen = count;
+    return (long)sendmsg(fd, &msg, 0);
+#endif
+}
+
+static long recv_datagram(Transport* t, void* buffer, size_t size, size_t* segment);
+static int socket_send_batch(Transport* t, const OutgoingDatagram* batch, size_t count);
+static int same_address(const struct sockaddr_in* a, const struct sockaddr_in* b);
+
+void record_header(unsigned char* header, unsigned char type, unsigned short seq)
+{
+    header[0] = type;
+    header[1] = (unsigned char)(seq >> 8);
+    header[2] = (unsigned char)seq;
+}
+
+int record_parse(const unsigned char* data, size_t len, unsigned char* type, unsigned short* seq)
+{
+    if (len < RECORD_HEADER_SIZE) {
+        return FALSE;
+    }
+    *type = data[0];
+    *seq = (unsigned short)((data[1] << 8) | data[2]);
+    return TRUE;
+}
+
+int record_strip_route(const unsigned char** data, size_t* len, const unsigned char** connection_id)
+{
+    *connection_id = NULL;
+    if (*len == 0 || (*data)[0] != CONNECTION_ID_MARK) {
+        return TRUE;
+    }
+    if (*len < ROUTE_PREFIX_SIZE) {
+        return FALSE;
+    }
+    *connection_id = *data + 1;
+    *data += ROUTE_PREFIX_SIZE;
+    *len -= ROUTE_PREFIX_SIZE;
+    return TRUE;
+}
+
+size_t record_fragment(unsigned char type, unsigned short seq, unsigned short id, const TransportSegment* segments, size_t count,
+                       size_t max_datagram, const struct sockaddr_in* addr,
+                       OutgoingDatagram* out, unsigned char (*headers)[FRAGMENT_HEADER_SIZE], size_t capacity)
+{
+    size_t total = 0, offset = 0, segment = 0, segment_offset = 0, chunk, n = 0, i;
+
+    // a fragment may take a piece of every segment, behind its header
+    if (count > MAX_SEGMENTS - 1 || capacity == 0) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        total += segments[i].len;
+    }
+    if (total > MAX_RECORD_SIZE) {
+        return 0;
+    }
+
+    if (RECORD_HEADER_SIZE + total <= max_datagram) {
+        record_header(headers[0], type, seq);
+        out[0].segments[0].data = headers[0];
+        out[0].segments[0].len = RECORD_HEADER_SIZE;
+        for (i = 0; i < count; i++) {
+            out[0].segments[i + 1] = segments[i];
+        }
+        out[0].segment_count = count + 1;
+        out[0].to = *addr;
+        return 1;
+    }
+
+    if (max_datagram < FRAGMENT_HEADER_SIZE + FRAGMENT_UNIT) {
+        return 0;
+    }
+    chunk = (max_datagram - FRAGMENT_HEADER_SIZE) / FRAGMENT_UNIT * FRAGMENT_UNIT;
+    while (offset < total) {
+        if (n == capacity) {
+            return 0;
+        }
+        OutgoingDatagram* d = &out[n];
+        unsigned char* header = headers[n];
+        size_t left = total - offset < chunk ? total - offset : chunk;
+
+        record_header(header, (unsigned char)(type | FRAGMENT_FLAG), seq);
+        header[3] = (unsigned char)(id >> 8);
+        header[4] = (unsigned char)id;
+        header[5] = (unsigned char)(offset >> 8);
+        header[6] = (unsigned char)offset;
+        header[7] = (unsigned char)(total >> 8);
+        header[8] = (unsigned char)total;
+        d->segments[0].data = header;
+        d->segments[0].len = FRAGMENT_HEADER_SIZE;
+        d->segment_count = 1;
+        d->to = *addr;
+        offset += left;
+
+        // the payload stays in the caller's segments, the fragment only points at its slice of them
+        while (left > 0) {
+            size_t take = segments[segment].len - segment_offset;
+            if (take == 0) {
+                segment++;
+                segment_offset = 0;
+                continue;
+            }
+            if (take > left) {
+                take = left;
+            }
+            d->segments[d->segment_count].data = (const unsigned char*)segments[segment].data + segment_offset;
+            d->segments[d->segment_count].len = take;
+            d->segment_count++;
+            segment_offset += take;
+            left -= take;
+        }
+        n++;
+    }
+    return n;
+}
+
+void reassembly_reset(Reassembly* r)
+{
+    free(r->buffer);
+    r->buffer = NULL;
+    r->active = FALSE;
+}
+
+int reassembly_add(Reassembly* r, const struct sockaddr_in* addr, const unsigned char* data, size_t len)
+{
+    unsigned char type;
+    unsigned short seq, id;
+    size_t offset, total, unit, end;
+    BOOL added = FALSE;
+
+    if (len < FRAGMENT_HEADER_SIZE || !(data[0] & FRAGMENT_FLAG) || record_parse(data, len, &type, &seq) != TRUE) {
+        return FALSE;
+    }
+    id = (unsigned short)((data[3] << 8) | data[4]);
+    offset = ((size_t)data[5] << 8) | data[6];
+    total = ((size_t)data[7] << 8) | data[8];
+    data += FRAGMENT_HEADER_SIZE;
+    len -= FRAGMENT_HEADER_SIZE;
+
+    // fragments start on a unit and only the one at the end of the record may stop between units
+    end = offset + len;
+    if (len == 0 || offset % FRAGMENT_UNIT != 0 || end > total || (end % FRAGMENT_UNIT != 0 && end != total)) {
+        return FALSE;
+    }
+
+    if (!r->active || r->type != type || r->seq != seq || r->id != id || r->total != total || !same_address(&r->from, addr)) {
+        reassembly_reset(r);
+        r->buffer = malloc(total + 1);
+        if (r->buffer == NULL) {
+            perror("malloc - reassembly_add");
+            return FALSE;
+        }
+        r->active = TRUE;
+        r->type = type;
+        r->seq = seq;
+        r->id = id;
+        r->from = *addr;
+        r->total = total;
+        r->missing = (total + FRAGMENT_UNIT - 1) / FRAGMENT_UNIT;
+        memset(r->have, 0, (r->missing + 7) / 8);
+    }
+
+    // straight to its place in the record, a fragment seen twice just writes the same bytes again
+    memcpy(r->buffer + offset, data, len);
+    for (unit = offset / FRAGMENT_UNIT; unit < (end + FRAGMENT_UNIT - 1) / FRAGMENT_UNIT; unit++) {
+        if (!(r->have[unit / 8] & (1 << (unit % 8)))) {
+            r->have[unit / 8] |= (unsigned char)(1 << (unit % 8));
+            r->missing--;
+            added = TRUE;
+        }
+    }
+    // complete once, duplicates of a finished record are not delivered again
+    if (!added || r->missing != 0) {
+        return FALSE;
+    }
+    r->buffer[total] = '\0';
+    return TRUE;
+}
+
+static int send_datagram(Transport* t, const void* data, size_t len, const struct sockaddr_in* addr)
+{
+    IoVec v;
+    IOVEC_SET(&v, data, len);
+    if (send_vector_to(t->fd, &v, 1, addr) != (long)len) {
+        perror("sendto - send_datagram");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int transport_send_ack(Transport* t, const struct sockaddr_in* addr, unsigned short seq)
+{
+    unsigned char ack[ROUTE_PREFIX_SIZE + RECORD_HEADER_SIZE];
+    size_t at = 0;
+
+    if (t->route_held) {
+        memcpy(ack, t->route, ROUTE_PREFIX_SIZE);
+        at = ROUTE_PREFIX_SIZE;
+    }
+    record_header(ack + at, RECORD_ACK, seq);
+    return send_datagram(t, ack, at + RECORD_HEADER_SIZE, addr);
+}
+
+// Waits up to timeout_ms (-1: no limit) for a datagram. 1 when one is there, 0 on timeout, -1 on error. poll, as a
+// process with thousands of sockets (load_gen) has descriptors past what select takes
+static int wait_readable(int fd, long timeout_ms)
+{
+    struct pollfd p;
+    int rc;
+
+    do {
+        p.fd = fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        rc = poll(&p, 1, timeout_ms < 0 ? -1 : (int)timeout_ms);
+    } while (rc < 0 && errno == EINTR);
+    return rc;
+}
+
+// Every datagram of the record in flight, in one batch. The backend, if any, is detached during an exchange
+static int send_flight(Transport* t)
+{
+    return socket_send_batch(t, t->flight->datagrams, t->flight->count);
+}
+
+static void retransmit_flight(Timer* timer, void* context)
+{
+    Transport* t = context;
+
+    if (!t->flight_pending) {
+        return;
+    }
+    if (t->retransmits >= MAX_RETRANSMITS) {
+        t->flight_failed = TRUE;
         return;
     }
+    t->retransmits++;
+    t->rto_ms = t->rto_ms * 2 > RTO_MAX_MS ? RTO_MAX_MS : t->rto_ms * 2;
+    send_flight(t);
+    timer_arm(t->timers, timer, monotonic_ms() + t->rto_ms);
 }
 
-void receive_and_send(int fd, struct sockaddr_in addr, char** message, size_t* len) {
+static void retransmit_request(Timer* timer, void* context)
+{
+    PendingRequest* p = context;
 
-    // waiting for message from client
-    char buffer[BUFFER_SIZE];
-    size_t recv_len = recvfrom(fd, buffer, sizeof(buffer), 0, NULL, NULL);
-    if (recv_len < 0) {
-        perror("recvfrom - receive_and_send");
+    if (p->retransmits >= MAX_RETRANSMITS) {
+        p->failed = TRUE;
+        return;
+    }
+    p->retransmits++;
+    p->rto_ms = p->rto_ms * 2 > RTO_MAX_MS ? RTO_MAX_MS : p->rto_ms * 2;
+    socket_send_batch(p->transport, p->flight.datagrams, p->flight.count);
+    timer_arm(p->transport->timers, timer, monotonic_ms() + p->rto_ms);
+}
+
+static void deadline_passed(Timer* timer, void* context)
+{
+    (void)timer;
+    ((Transport*)context)->deadline_passed = TRUE;
+}
+
+int transport_set_reliable(Transport* t, TimerWheel* timers)
+{
+    // a stream is reliable already
+    if (t->type != TRANSPORT_UDP) {
+        return TRUE;
+    }
+    if (t->flight == NULL) {
+        t->flight = malloc(sizeof(Flight));
+    }
+    if (t->datagram == NULL) {
+        t->datagram = malloc(MAX_RECORD_SIZE);
+    }
+    if (t->flight == NULL || t->datagram == NULL) {
+        perror("malloc - transport_set_reliable");
+        return FALSE;
+    }
+    t->reliable = TRUE;
+    t->timers = timers;
+    timer_init(&t->retransmit_timer, retransmit_flight, t);
+    timer_init(&t->deadline_timer, deadline_passed, t);
+    transport_reset_records(t, 0, 0);
+    return TRUE;
+}
+
+static void release_request(Transport* t, PendingRequest* p)
+{
+    timer_cancel(t->timers, &p->retransmit_timer);
+    reassembly_reset(&p->reassembly);
+    free(p->reply);
+    p->reply = NULL;
+    p->active = FALSE;
+    t->requests_outstanding--;
+}
+
+// Forgets the pipelined requests still outstanding, their replies will not be taken in
+static void drop_requests(Transport* t)
+{
+    for (size_t i = 0; t->requests != NULL && i < MAX_OUTSTANDING_REQUESTS; i++) {
+        if (t->requests[i].active) {
+            release_request(t, &t->requests[i]);
+        }
+    }
+    t->requests_outstanding = 0;
+}
+
+void transport_reset_records(Transport* t, unsigned short send_seq, unsigned short recv_seq)
+{
+    t->send_seq = send_seq;
+    t->recv_seq = recv_seq;
+    t->flight_pending = FALSE;
+    t->flight_failed = FALSE;
+    t->cancelled = FALSE;
+    // a new hello may be asked for a new cookie
+    t->cookie_held = FALSE;
+    t->retry = FALSE;
+    t->route_held = FALSE;
+    t->ticket_held = FALSE;
+    if (t->timers != NULL) {
+        timer_cancel(t->timers, &t->retransmit_timer);
+        timer_cancel(t->timers, &t->deadline_timer);
+    }
+    free(t->early);
+    t->early = NULL;
+    t->early_len = 0;
+    reassembly_reset(&t->reassembly);
+    drop_requests(t);
+}
+
+void transport_resume(Transport* t, const unsigned char* ticket)
+{
+    unsigned char connection_id[CONNECTION_ID_SIZE];
+
+    // the ticket may be t's own
+    memcpy(connection_id, ticket, CONNECTION_ID_SIZE);
+    transport_reset_records(t, 0, 0);
+    t->route[0] = CONNECTION_ID_MARK;
+    memcpy(t->route + 1, connection_id, CONNECTION_ID_SIZE);
+    t->route_held = TRUE;
+}
+
+int transport_use_offload(Transport* t)
+{
+#if defined(__linux__)
+    int off = 0, on = 1;
+
+    if (t->type != TRANSPORT_UDP) {
+        return FALSE;
+    }
+    // every send sets its own segment size, a zero one on the socket only probes that the kernel knows the option
+    t->gso = setsockopt(t->fd, SOL_UDP, UDP_SEGMENT, &off, sizeof(off)) == 0;
+
+    if (!t->gro && t->backend.recv_batch == NULL) {
+        t->gro_buffers = malloc((size_t)GRO_BUFFERS * MAX_RECORD_SIZE);
+        t->gro_segments = malloc(GRO_MAX_SEGMENTS * sizeof(GroSegment));
+        if (t->gro_buffers == NULL || t->gro_segments == NULL) {
+            perror("malloc - transport_use_offload");
+        }
+        else {
+            t->gro = setsockopt(t->fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+        }
+        if (!t->gro) {
+            free(t->gro_buffers);
+            free(t->gro_segments);
+            t->gro_buffers = NULL;
+            t->gro_segments = NULL;
+        }
+    }
+    return t->gso || t->gro;
+#else
+    // Windows has USO / URO (UDP_SEND_MSG_SIZE, UDP_RECV_MAX_COALESCED_SIZE) but they are not wired up here
+    (void)t;
+    return FALSE;
+#endif
+}
+
+static void flight_done(Transport* t)
+{
+    t->flight_pending = FALSE;
+    timer_cancel(t->timers, &t->retransmit_timer);
+}
+
+// Keeps a record in *into: record is a reassembled record that is taken over as it is, NULL to copy data
+static int keep_record(unsigned char** into, size_t* into_len, const unsigned char* data, size_t len, unsigned char* record)
+{
+    if (record != NULL) {
+        *into = record;
+        *into_len = len;
+        return TRUE;
+    }
+    *into = malloc(len + 1);
+    if (*into == NULL) {
+        perror("malloc - keep_record");
+        return FALSE;
+    }
+    memcpy(*into, data, len);
+    (*into)[len] = '\0';
+    *into_len = len;
+    return TRUE;
+}
+
+// The pipelined request seq is the reply to, while it waits for one
+static PendingRequest* find_pending(Transport* t, unsigned short seq)
+{
+    for (size_t i = 0; t->requests != NULL && i < MAX_OUTSTANDING_REQUESTS; i++) {
+        PendingRequest* p = &t->requests[i];
+        if (p->active && p->seq == seq && p->reply == NULL && !p->failed) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// A record the exchange can take in now: the next one from the peer, or the reply to our request
+static int record_wanted(Transport* t, unsigned char type, unsigned short seq)
+{
+    if (t->early != NULL) {
+        return FALSE;
+    }
+    if (type == RECORD_DATA) {
+        return seq == t->recv_seq;
+    }
+    return type == RECORD_REPLY && t->flight_pending && t->flight_type == RECORD_REQUEST && seq == t->flight_seq;
+}
+
+// Takes in one datagram from the peer
+static void handle_record(Transport* t, const unsigned char* data, size_t len)
+{
+    unsigned char type;
+    unsigned short seq;
+    // a record put together from fragments, handed on without another copy
+    unsigned char* record = NULL;
+    const unsigned char* connection_id;
+    PendingRequest* pending = NULL;
+
+    // the peer is known by its address while records are exchanged here, its connection ID is not needed
+    if (record_strip_route(&data, &len, &connection_id) != TRUE || record_parse(data, len, &type, &seq) != TRUE) {
         return;
     }
-   
-    if (*message != NULL)
-    {
+    if ((type & ~FRAGMENT_FLAG) == RECORD_REPLY) {
+        pending = find_pending(t, seq);
+    }
+    if (type & FRAGMENT_FLAG) {
+        // the replies to pipelined requests are put together side by side
+        Reassembly* r = pending != NULL ? &pending->reassembly : &t->reassembly;
+
+        type &= (unsigned char)~FRAGMENT_FLAG;
+        if (pending != NULL || record_wanted(t, type, seq)) {
+            if (reassembly_add(r, &t->peer, data, len) != TRUE) {
+                return;
+            }
+            record = r->buffer;
+            len = r->total;
+            r->buffer = NULL;
+            reassembly_reset(r);
+            data = record;
+        }
+        else if (type != RECORD_DATA) {
+            return;
+        }
+    }
+    else {
+        data += RECORD_HEADER_SIZE;
+        len -= RECORD_HEADER_SIZE;
+    }
+
+    switch (type) {
+    case RECORD_ACK:
+        if (t->flight_pending && t->flight_type == RECORD_DATA && seq == t->flight_seq) {
+            flight_done(t);
+        }
+        break;
+    case RECORD_DATA:
+        if (record_wanted(t, type, seq)) {
+            if (keep_record(&t->early, &t->early_len, data, len, record) != TRUE) {
+                // not acknowledged, the peer sends it again
+                return;
+            }
+            t->recv_seq++;
+            transport_send_ack(t, &t->peer, seq);
+            // the peer only sends its next record once it has all of ours, so this also acknowledges our flight
+            if (t->flight_pending && t->flight_type == RECORD_DATA) {
+                flight_done(t);
+            }
+        }
+        else if ((short)(seq - t->recv_seq) < 0) {
+            // seen before and our acknowledgement got lost: replay it, the record is not delivered twice
+            transport_send_ack(t, &t->peer, seq);
+        }
+        break;
+    case RECORD_RETRY:
+        // only for our hello, and only once: a RETRY for the hello that carries the cookie is a stale copy
+        if (t->flight_pending && t->flight_type == RECORD_DATA && t->flight_seq == 0 && seq == 0 && !t->cookie_held &&
+            len == COOKIE_SIZE + CONNECTION_ID_SIZE) {
+            memcpy(t->cookie, data, COOKIE_SIZE);
+            t->cookie_held = TRUE;
+            t->route[0] = CONNECTION_ID_MARK;
+            memcpy(t->route + 1, data + COOKIE_SIZE, CONNECTION_ID_SIZE);
+            t->route_held = TRUE;
+            t->retry = TRUE;
+            flight_done(t);
+        }
+        break;
+    case RECORD_TICKET:
+        // a late repeat of the ticket this session was resumed with is spent already
+        if (len == CONNECTION_ID_SIZE &&
+            (!t->route_held || memcmp(t->route + 1, data, CONNECTION_ID_SIZE) != 0)) {
+            memcpy(t->ticket, data, CONNECTION_ID_SIZE);
+            t->ticket_held = TRUE;
+        }
+        break;
+    case RECORD_REPLY:
+        if (pending != NULL) {
+            if (keep_record(&pending->reply, &pending->reply_len, data, len, record) == TRUE) {
+                timer_cancel(t->timers, &pending->retransmit_timer);
+            }
+        }
+        else if (record_wanted(t, type, seq)) {
+            if (keep_record(&t->early, &t->early_len, data, len, record) == TRUE) {
+                flight_done(t);
+            }
+        }
+        else {
+            free(record);
+        }
+        break;
+    default:
+        free(record);
+        break;
+    }
+}
+
+// Drives retransmissions and incoming records until the flight in progress is acknowledged or, with
+// want_record, until the next record (or reply) from the peer is in t->early
+static int reliable_wait(Transport* t, BOOL want_record)
+{
+    BOOL filter_peer = t->filter_peer;
+    int rc;
+
+    // the exchange is with t->peer, whatever else arrives is not part of it
+    t->filter_peer = TRUE;
+    if (want_record) {
+        t->deadline_passed = FALSE;
+        timer_arm(t->timers, &t->deadline_timer, monotonic_ms() + RECV_TIMEOUT_MS);
+    }
+
+    while (1) {
+        if (want_record ? t->early != NULL : !t->flight_pending) {
+            rc = TRUE;
+            break;
+        }
+        if (t->flight_failed) {
+            fprintf(stderr, "No answer from the peer after %d retransmissions - reliable_wait\n", MAX_RETRANSMITS);
+            rc = FALSE;
+            break;
+        }
+        if (t->cancelled) {
+            fprintf(stderr, "Exchange cancelled - reliable_wait\n");
+            rc = FALSE;
+            break;
+        }
+        if (want_record && t->deadline_passed) {
+            fprintf(stderr, "Timed out waiting for the peer - reliable_wait\n");
+            rc = FALSE;
+            break;
+        }
+
+        int ready = wait_readable(t->fd, timer_wheel_next_timeout(t->timers, monotonic_ms()));
+        if (ready < 0) {
+            perror("select - reliable_wait");
+            rc = FALSE;
+            break;
+        }
+        if (ready > 0) {
+            size_t segment;
+            long n = recv_datagram(t, t->datagram, MAX_RECORD_SIZE, &segment);
+            if (n >= 0) {
+                // a GRO receive may carry several datagrams of the peer
+                for (size_t offset = 0; offset < (size_t)n; offset += segment) {
+                    size_t left = (size_t)n - offset;
+                    handle_record(t, t->datagram + offset, left < segment ? left : segment);
+                }
+            }
+#if defined(_WIN32)
+            // an ICMP port unreachable for an earlier datagram, the peer may not be up yet
+            else if (WSAGetLastError() == WSAECONNRESET) {
+            }
+#endif
+            else {
+                perror("recvfrom - reliable_wait");
+                rc = FALSE;
+                break;
+            }
+        }
+        timer_wheel_advance(t->timers, monotonic_ms());
+    }
+
+    if (want_record) {
+        timer_cancel(t->timers, &t->deadline_timer);
+    }
+    if (rc != TRUE && t->flight_pending) {
+        flight_done(t);
+    }
+    t->flight_failed = FALSE;
+    t->filter_peer = filter_peer;
+    return rc;
+}
+
+// Cuts a record into the datagrams of flight, the connection ID in front of each once we have one. The segments
+// stay in use as long as the flight does
+static int cut_flight(Transport* t, Flight* flight, unsigned char type, unsigned short seq, const TransportSegment* segments,
+                      size_t count)
+{
+    // the connection ID goes in front of every datagram, as one more segment
+    size_t prefix = t->route_held ? ROUTE_PREFIX_SIZE : 0;
+
+    if (t->route_held && count > MAX_SEGMENTS - 2) {
+        fprintf(stderr, "Too many segments: %zu - cut_flight\n", count);
+        return FALSE;
+    }
+    flight->count = record_fragment(type, seq, t->fragment_id++, segments, count, t->max_datagram - prefix,
+                                    &t->peer, flight->datagrams, flight->headers, MAX_FRAGMENTS);
+    if (flight->count == 0) {
+        fprintf(stderr, "Record too large for %zu byte datagrams - cut_flight\n", t->max_datagram);
+        return FALSE;
+    }
+    for (size_t i = 0; prefix > 0 && i < flight->count; i++) {
+        OutgoingDatagram* d = &flight->datagrams[i];
+        memmove(&d->segments[1], &d->segments[0], d->segment_count * sizeof(d->segments[0]));
+        d->segments[0].data = t->route;
+        d->segments[0].len = ROUTE_PREFIX_SIZE;
+        d->segment_count++;
+    }
+    return TRUE;
+}
+
+// Sends the datagrams of the record in flight and arms its retransmission. The segments stay in use until
+// it is acknowledged
+static int start_flight(Transport* t, const TransportSegment* segments, size_t count)
+{
+    if (cut_flight(t, t->flight, t->flight_type, t->flight_seq, segments, count) != TRUE || send_flight(t) != TRUE) {
+        return FALSE;
+    }
+
+    t->flight_pending = TRUE;
+    t->flight_failed = FALSE;
+    t->rto_ms = RTO_INITIAL_MS;
+    t->retransmits = 0;
+    timer_arm(t->timers, &t->retransmit_timer, monotonic_ms() + t->rto_ms);
+    return TRUE;
+}
+
+// Sends one numbered record, fragmented to max_datagram, and waits for its acknowledgement (for a request:
+// its reply, in t->early)
+static int reliable_send(Transport* t, unsigned char type, const TransportSegment* segments, size_t count)
+{
+    TransportSegment with_cookie[MAX_SEGMENTS + 1];
+    int rc;
+
+    t->flight_type = type;
+    t->flight_seq = t->send_seq++;
+    if (start_flight(t, segments, count) != TRUE) {
+        return FALSE;
+    }
+    rc = reliable_wait(t, type == RECORD_REQUEST);
+
+    // the server answered our hello with a cookie: the same record again, the cookie appended
+    if (rc == TRUE && t->retry) {
+        t->retry = FALSE;
+        memcpy(with_cookie, segments, count * sizeof(*segments));
+        with_cookie[count].data = t->cookie;
+        with_cookie[count].len = COOKIE_SIZE;
+        if (start_flight(t, with_cookie, count + 1) != TRUE) {
+            return FALSE;
+        }
+        rc = reliable_wait(t, FALSE);
+    }
+    return rc;
+}
+
+int transport_sendv(Transport* t, const TransportSegment* segments, size_t count)
+{
+    unsigned char header[FRAME_HEADER_SIZE];
+    IoVec vectors[MAX_SEGMENTS + 1];
+    IoVec* v = vectors;
+    size_t total = 0, n = 0, i;
+    long sent;
+
+    if (count > MAX_SEGMENTS) {
+        fprintf(stderr, "Too many segments: %zu - transport_sendv\n", count);
+        return FALSE;
+    }
+    for (i = 0; i < count; i++) {
+        total += segments[i].len;
+    }
+
+    if (t->type == TRANSPORT_MEMORY) {
+        if (total > MAX_FRAME_SIZE) {
+            fprintf(stderr, "Record too large: %zu bytes - transport_sendv\n", total);
+            return FALSE;
+        }
+        return pipe_write(t->pipe_out, segments, count, total);
+    }
+    if (t->type == TRANSPORT_UDP && t->reliable) {
+        return reliable_send(t, RECORD_DATA, segments, count);
+    }
+    if (t->type == TRANSPORT_UDP) {
+        for (i = 0; i < count; i++) {
+            IOVEC_SET(&vectors[n], segments[i].data, segments[i].len);
+            n++;
+        }
+        sent = send_vector_to(t->fd, vectors, n, &t->peer);
+        if (sent < 0) {
+            perror("sendto - transport_sendv");
+            return FALSE;
+        }
+        if ((size_t)sent != total) {
+            fprintf(stderr, "Incomplete datagram sent: %ld/%zu bytes - transport_sendv\n", sent, total);
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    if (total > MAX_FRAME_SIZE) {
+        fprintf(stderr, "Record too large: %zu bytes - transport_sendv\n", total);
+        return FALSE;
+    }
+    header[0] = (unsigned char)(total >> 24);
+    header[1] = (unsigned char)(total >> 16);
+    header[2] = (unsigned char)(total >> 8);
+    header[3] = (unsigned char)total;
+    IOVEC_SET(&vectors[n], header, FRAME_HEADER_SIZE);
+    n++;
+    for (i = 0; i < count; i++) {
+        IOVEC_SET(&vectors[n], segments[i].data, segments[i].len);
+        n++;
+    }
+
+    // A stream write may be partial: skip what went out and write the rest
+    while (n > 0) {
+        sent = write_vector(t->fd, v, n);
+        if (sent < 0) {
+            perror("send - transport_sendv");
+            return FALSE;
+        }
+        while (n > 0 && (size_t)sent >= IOVEC_LEN(v)) {
+            sent -= (long)IOVEC_LEN(v);
+            v++;
+            n--;
+        }
+        if (n > 0 && sent > 0) {
+            IOVEC_SET(v, IOVEC_BASE(v) + sent, IOVEC_LEN(v) - (size_t)sent);
+        }
+    }
+    return TRUE;
+}
+
+int transport_send(Transport* t, const void* data, size_t len)
+{
+    TransportSegment segment = { data, len };
+    return transport_sendv(t, &segment, 1);
+}
+
+int transport_request(Transport* t, const TransportSegment* segments, size_t count, unsigned char** reply, size_t* reply_len)
+{
+    if (t->type == TRANSPORT_UDP && t->reliable) {
+        if (*reply != NULL) {
+            free(*reply);
+            *reply = NULL;
+        }
+        if (reliable_send(t, RECORD_REQUEST, segments, count) != TRUE) {
+            return FALSE;
+        }
+        *reply = t->early;
+        *reply_len = t->early_len;
+        t->early = NULL;
+        return TRUE;
+    }
+
+    if (transport_sendv(t, segments, count) != TRUE) {
+        return FALSE;
+    }
+    return transport_recv(t, reply, reply_len);
+}
+
+int transport_request_start(Transport* t, const TransportSegment* segments, size_t count, unsigned short* id)
+{
+    PendingRequest* p = NULL;
+
+    if (t->requests_outstanding >= MAX_OUTSTANDING_REQUESTS) {
+        fprintf(stderr, "%d requests outstanding already - transport_request_start\n", MAX_OUTSTANDING_REQUESTS);
+        return FALSE;
+    }
+    if (t->type == TRANSPORT_TCP) {
+        if (transport_sendv(t, segments, count) != TRUE) {
+            return FALSE;
+        }
+        if (t->requests_outstanding == 0) {
+            t->next_reply_seq = t->send_seq;
+        }
+        *id = t->send_seq++;
+        t->requests_outstanding++;
+        return TRUE;
+    }
+    if (t->type != TRANSPORT_UDP || !t->reliable) {
+        fprintf(stderr, "Pipelined requests need reliable UDP or TCP - transport_request_start\n");
+        return FALSE;
+    }
+
+    if (t->requests == NULL) {
+        t->requests = calloc(MAX_OUTSTANDING_REQUESTS, sizeof(PendingRequest));
+        if (t->requests == NULL) {
+            perror("calloc - transport_request_start");
+            return FALSE;
+        }
+    }
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; i++) {
+        if (!t->requests[i].active) {
+            p = &t->requests[i];
+            break;
+        }
+    }
+    p->transport = t;
+    p->seq = t->send_seq++;
+    p->failed = FALSE;
+    p->reply = NULL;
+    if (cut_flight(t, &p->flight, RECORD_REQUEST, p->seq, segments, count) != TRUE ||
+        socket_send_batch(t, p->flight.datagrams, p->flight.count) != TRUE) {
+        return FALSE;
+    }
+    p->active = TRUE;
+    t->requests_outstanding++;
+    p->rto_ms = RTO_INITIAL_MS;
+    p->retransmits = 0;
+    timer_init(&p->retransmit_timer, retransmit_request, p);
+    timer_arm(t->timers, &p->retransmit_timer, monotonic_ms() + p->rto_ms);
+    *id = p->seq;
+    return TRUE;
+}
+
+// Hands out a pipelined request that is done, if any
+static int request_done(Transport* t, unsigned short* id, unsigned char** reply, size_t* reply_len)
+{
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; i++) {
+        PendingRequest* p = &t->requests[i];
+        if (!p->active || (p->reply == NULL && !p->failed)) {
+            continue;
+        }
+        *id = p->seq;
+        *reply = p->reply;
+        *reply_len = p->reply != NULL ? p->reply_len : 0;
+        p->reply = NULL;
+        release_request(t, p);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+int transport_request_next(Transport* t, long timeout_ms, unsigned short* id, unsigned char** reply, size_t* reply_len)
+{
+    uint64_t deadline = monotonic_ms() + (timeout_ms < 0 ? 0 : (uint64_t)timeout_ms);
+    BOOL filter_peer = t->filter_peer;
+    int rc = 0;
+
+    free(*reply);
+    *reply = NULL;
+    if (t->requests_outstanding == 0) {
+        return 0;
+    }
+    if (t->type == TRANSPORT_TCP) {
+        // a reply may be read in part already
+        if (t->read_start == t->read_end && (rc = wait_readable(t->fd, timeout_ms)) <= 0) {
+            return rc;
+        }
+        if (transport_recv(t, reply, reply_len) != TRUE) {
+            return -1;
+        }
+        *id = t->next_reply_seq++;
+        t->requests_outstanding--;
+        return 1;
+    }
+
+    t->filter_peer = TRUE;
+    while (1) {
+        uint64_t now_ms = monotonic_ms();
+        long wait_ms = timer_wheel_next_timeout(t->timers, now_ms);
+
+        if (request_done(t, id, reply, reply_len)) {
+            rc = 1;
+            break;
+        }
+        if (timeout_ms >= 0) {
+            long left = now_ms >= deadline ? 0 : (long)(deadline - now_ms);
+            wait_ms = wait_ms < 0 || wait_ms > left ? left : wait_ms;
+        }
+        int ready = wait_readable(t->fd, wait_ms);
+        if (ready < 0) {
+            perror("select - transport_request_next");
+            rc = -1;
+            break;
+        }
+        // every datagram already there is taken in, each may complete another request
+        while (ready > 0) {
+            size_t segment;
+            long n = recv_datagram(t, t->datagram, MAX_RECORD_SIZE, &segment);
+            if (n < 0) {
+#if defined(_WIN32)
+                if (WSAGetLastError() == WSAECONNRESET) {
+                    break;
+                }
+#endif
+                perror("recvfrom - transport_request_next");
+                rc = -1;
+                break;
+            }
+            for (size_t offset = 0; offset < (size_t)n; offset += segment) {
+                size_t left = (size_t)n - offset;
+                handle_record(t, t->datagram + offset, left < segment ? left : segment);
+            }
+            ready = wait_readable(t->fd, 0);
+        }
+        if (rc < 0) {
+            break;
+        }
+        timer_wheel_advance(t->timers, monotonic_ms());
+        if (request_done(t, id, reply, reply_len)) {
+            rc = 1;
+            break;
+        }
+        if (timeout_ms >= 0 && monotonic_ms() >= deadline) {
+            break;
+        }
+    }
+    t->filter_peer = filter_peer;
+    return rc;
+}
+
+// Fills dest from the read buffer, refilling the buffer from the socket as needed
+static int stream_read(Transport* t, unsigned char* dest, size_t len)
+{
+    while (len > 0) {
+        if (t->read_start == t->read_end) {
+            // Reads at least as large as the buffer go straight into dest
+            unsigned char* target = len >= sizeof(t->read_buffer) ? dest : t->read_buffer;
+            size_t target_len = len >= sizeof(t->read_buffer) ? len : sizeof(t->read_buffer);
+            long n = recv(t->fd, (char*)target, (int)target_len, 0);
+            if (n < 0) {
+                perror("recv - stream_read");
+                return FALSE;
+            }
+            if (n == 0) {
+                fprintf(stderr, "Connection closed by peer - stream_read\n");
+                return FALSE;
+            }
+            if (target == dest) {
+                dest += n;
+                len -= (size_t)n;
+                continue;
+            }
+            t->read_start = 0;
+            t->read_end = (size_t)n;
+        }
+
+        size_t chunk = t->read_end - t->read_start;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(dest, t->read_buffer + t->read_start, chunk);
+        t->read_start += chunk;
+        dest += chunk;
+        len -= chunk;
+    }
+    return TRUE;
+}
+
+static int same_address(const struct sockaddr_in* a, const struct sockaddr_in* b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+#if defined(__linux__)
+// Size of the datagrams a GRO receive of len bytes coalesced, len when it holds a single one
+static size_t gro_segment_size(struct msghdr* msg, size_t len)
+{
+    struct cmsghdr* c;
+
+    for (c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int segment;
+            memcpy(&segment, CMSG_DATA(c), sizeof(segment));
+            return segment > 0 && (size_t)segment < len ? (size_t)segment : len;
+        }
+    }
+    return len;
+}
+#endif
+
+// recvfrom that also tells the size of the datagrams a GRO receive coalesced into buffer (the whole length otherwise)
+static long recv_segments(Transport* t, void* buffer, size_t size, struct sockaddr_in* from, size_t* segment)
+{
+    socklen_t addr_len = sizeof(*from);
+    long n;
+
+#if defined(__linux__)
+    if (t->gro) {
+        union {
+            char buffer[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg;
+        struct iovec v;
+
+        v.iov_base = buffer;
+        v.iov_len = size;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = from;
+        msg.msg_namelen = sizeof(*from);
+        msg.msg_iov = &v;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        n = (long)recvmsg(t->fd, &msg, 0);
+        if (n > 0) {
+            *segment = gro_segment_size(&msg, (size_t)n);
+        }
+        return n;
+    }
+#endif
+    n = recvfrom(t->fd, (char*)buffer, (int)size, 0, (struct sockaddr*)from, &addr_len);
+    if (n > 0) {
+        *segment = (size_t)n;
+    }
+    return n;
+}
+
+// One datagram from the peer (several of the same size with GRO, see *segment, which may be NULL where GRO
+// is off); without filter_peer whoever sends becomes the peer
+static long recv_datagram(Transport* t, void* buffer, size_t size, size_t* segment)
+{
+    struct sockaddr_in from;
+    size_t coalesced = 1;
+    unsigned char spill[BUFFER_SIZE];
+    // a datagram that gets deferred must not be cut to the size the caller asked for
+    unsigned char* target = t->filter_peer && size < BUFFER_SIZE ? spill : buffer;
+    size_t target_size = target == spill ? BUFFER_SIZE : size;
+    long n;
+
+    while (1) {
+        n = recv_segments(t, target, target_size, &from, &coalesced);
+        if (n < 0) {
+            return n;
+        }
+        if (n == 0) {
+            coalesced = 1;
+        }
+        if (!t->filter_peer) {
+            t->peer = from;
+            break;
+        }
+        if (same_address(&from, &t->peer)) {
+            if (target == spill) {
+                n = (size_t)n < size ? n : (long)size;
+                memcpy(buffer, spill, (size_t)n);
+                coalesced = coalesced < (size_t)n ? coalesced : (size_t)n;
+            }
+            break;
+        }
+        // parked one datagram at a time, a GRO receive may hold several
+        for (size_t offset = 0; offset < (size_t)n; offset += coalesced) {
+            size_t len = (size_t)n - offset < coalesced ? (size_t)n - offset : coalesced;
+            if (t->deferred != NULL && t->deferred_count < t->deferred_capacity && len <= BUFFER_SIZE) {
+                ReceivedDatagram* d = &t->deferred[t->deferred_count++];
+                memcpy(d->storage, target + offset, len);
+                d->data = d->storage;
+                d->len = len;
+                d->from = from;
+            }
+        }
+    }
+    if (segment != NULL) {
+        *segment = coalesced;
+    }
+    return n;
+}
+
+int transport_recv(Transport* t, unsigned char** message, size_t* len)
+{
+    unsigned char header[FRAME_HEADER_SIZE];
+    unsigned char* buffer;
+    size_t frame_len;
+
+    if (*message != NULL) {
         free(*message);
         *message = NULL;
     }
 
-    // Allocate memory for the received message
-    *message = malloc(recv_len); 
-    if (*message == NULL) {
-        perror("malloc - receive_and_send");
+    if (t->type == TRANSPORT_UDP && t->reliable) {
+        if (reliable_wait(t, TRUE) != TRUE) {
+            return FALSE;
+        }
+        *message = t->early;
+        *len = t->early_len;
+        t->early = NULL;
+        return TRUE;
+    }
+    if (t->type == TRANSPORT_MEMORY) {
+        MemoryPipe* p = t->pipe_in;
+        if (!memory_pipe_pending(p)) {
+            return FALSE;
+        }
+        const unsigned char* frame = p->data + p->start;
+        frame_len = ((size_t)frame[0] << 24) | ((size_t)frame[1] << 16) | ((size_t)frame[2] << 8) | frame[3];
+        buffer = malloc(frame_len + 1);
+        if (buffer == NULL) {
+            perror("malloc - transport_recv");
+            return FALSE;
+        }
+        memcpy(buffer, frame + FRAME_HEADER_SIZE, frame_len);
+        p->start += FRAME_HEADER_SIZE + frame_len;
+    }
+    else if (t->type == TRANSPORT_UDP) {
+        buffer = malloc(MAX_DATAGRAM_SIZE + 1);
+        if (buffer == NULL) {
+            perror("malloc - transport_recv");
+            return FALSE;
+        }
+        long n = recv_datagram(t, buffer, MAX_DATAGRAM_SIZE, NULL);
+        if (n < 0) {
+            perror("recvfrom - transport_recv");
+            free(buffer);
+            return FALSE;
+        }
+        frame_len = (size_t)n;
+    }
+    else {
+        if (stream_read(t, header, FRAME_HEADER_SIZE) != TRUE) {
+            return FALSE;
+        }
+        frame_len = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | header[3];
+        if (frame_len > MAX_FRAME_SIZE) {
+            fprintf(stderr, "Record too large: %zu bytes - transport_recv\n", frame_len);
+            return FALSE;
+        }
+        buffer = malloc(frame_len + 1);
+        if (buffer == NULL) {
+            perror("malloc - transport_recv");
+            return FALSE;
+        }
+        if (stream_read(t, buffer, frame_len) != TRUE) {
+            free(buffer);
+            return FALSE;
+        }
+    }
+
+    buffer[frame_len] = '\0';
+    *message = buffer;
+    *len = frame_len;
+    return TRUE;
+}
+
+#if defined(__linux__)
+
+// GRO: one recvmmsg of coalesced messages into gro_buffers, cut into datagrams that are handed out over as many
+// calls as it takes; the buffers are only refilled once all of them are out
+static int gro_recv_batch(Transport* t, ReceivedDatagram* batch, size_t max)
+{
+    struct mmsghdr msgs[GRO_BUFFERS];
+    struct iovec vectors[GRO_BUFFERS];
+    struct sockaddr_in from[GRO_BUFFERS];
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control[GRO_BUFFERS];
+    size_t i, n;
+
+    if (t->gro_next == t->gro_count) {
+        int received;
+
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < GRO_BUFFERS; i++) {
+            vectors[i].iov_base = t->gro_buffers + i * MAX_RECORD_SIZE;
+            vectors[i].iov_len = MAX_RECORD_SIZE;
+            msgs[i].msg_hdr.msg_iov = &vectors[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            msgs[i].msg_hdr.msg_control = control[i].buffer;
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buffer);
+        }
+        do {
+            received = recvmmsg(t->fd, msgs, GRO_BUFFERS, MSG_WAITFORONE, NULL);
+        } while (received < 0 && errno == EINTR);
+        if (received < 0) {
+            perror("recvmmsg - transport_recv_batch");
+            return -1;
+        }
+
+        t->gro_next = t->gro_count = 0;
+        for (i = 0; i < (size_t)received; i++) {
+            unsigned char* data = vectors[i].iov_base;
+            size_t len = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;
+            size_t segment = gro_segment_size(&msgs[i].msg_hdr, len), offset = 0;
+
+            // an empty (or truncated) datagram is still handed out, with length 0
+            do {
+                GroSegment* g;
+                if (t->gro_count == GRO_MAX_SEGMENTS) {
+                    break;
+                }
+                g = &t->gro_segments[t->gro_count++];
+                g->data = data + offset;
+                g->len = len - offset < segment ? len - offset : segment;
+                g->from = from[i];
+                offset += segment;
+            } while (offset < len);
+        }
+    }
+
+    n = t->gro_count - t->gro_next < max ? t->gro_count - t->gro_next : max;
+    for (i = 0; i < n; i++) {
+        const GroSegment* g = &t->gro_segments[t->gro_next + i];
+        batch[i].data = g->data;
+        batch[i].len = g->len;
+        batch[i].from = g->from;
+    }
+    t->gro_next += n;
+    return (int)n;
+}
+
+static int socket_recv_batch(Transport* t, ReceivedDatagram* batch, size_t max)
+{
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec vectors[MAX_BATCH];
+    size_t i;
+    int n;
+
+    if (t->gro) {
+        return gro_recv_batch(t, batch, max);
+    }
+    memset(msgs, 0, max * sizeof(msgs[0]));
+    for (i = 0; i < max; i++) {
+        batch[i].data = batch[i].storage;
+        vectors[i].iov_base = batch[i].storage;
+        vectors[i].iov_len = sizeof(batch[i].storage);
+        msgs[i].msg_hdr.msg_iov = &vectors[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &batch[i].from;
+        msgs[i].msg_hdr.msg_namelen = sizeof(batch[i].from);
+    }
+
+    // MSG_WAITFORONE: block for the first datagram only, then return what is queued
+    do {
+        n = recvmmsg(t->fd, msgs, (unsigned int)max, MSG_WAITFORONE, NULL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror("recvmmsg - transport_recv_batch");
+        return -1;
+    }
+
+    for (i = 0; i < (size_t)n; i++) {
+        batch[i].len = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;
+    }
+    return n;
+}
+
+static size_t datagram_len(const OutgoingDatagram* d)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < d->segment_count; i++) {
+        len += d->segments[i].len;
+    }
+    return len;
+}
+
+// How many datagrams from batch[0] on can go out as one GSO send: same address, same length except for a shorter
+// last one, within the kernel's limits and the vectors left. 0 when not even the first fits in the vectors
+static size_t gso_run(const OutgoingDatagram* batch, size_t count, size_t vectors_left)
+{
+    size_t len = datagram_len(&batch[0]), total = 0, vectors = 0, run = 0;
+
+    while (run < count && run < GSO_MAX_SEGMENTS) {
+        const OutgoingDatagram* d = &batch[run];
+        size_t l = run == 0 ? len : datagram_len(d);
+        if (vectors + d->segment_count > vectors_left || total + l > MAX_DATAGRAM_SIZE ||
+            l > len || !same_address(&d->to, &batch[0].to)) {
+            break;
+        }
+        total += l;
+        vectors += d->segment_count;
+        run++;
+        if (l < len) {
+            break;
+        }
+    }
+    // the kernel needs a segment size
+    return len == 0 && run > 1 ? 1 : run;
+}
+
+static int socket_send_batch(Transport* t, const OutgoingDatagram* batch, size_t count)
+{
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec vectors[MAX_BATCH * MAX_SEGMENTS];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control[MAX_BATCH];
+    // datagrams behind each message, more than one for a GSO send
+    size_t datagrams[MAX_BATCH];
+    size_t done = 0;
+
+    while (done < count) {
+        size_t m = 0, used = 0, next = done, i, j;
+        int n;
+
+        memset(msgs, 0, sizeof(msgs));
+        while (m < MAX_BATCH && next < count) {
+            size_t run = t->gso ? gso_run(&batch[next], count - next, MAX_BATCH * MAX_SEGMENTS - used) : 1;
+            if (run == 0 || used + batch[next].segment_count > MAX_BATCH * MAX_SEGMENTS) {
+                break;
+            }
+            msgs[m].msg_hdr.msg_iov = &vectors[used];
+            for (i = next; i < next + run; i++) {
+                for (j = 0; j < batch[i].segment_count; j++) {
+                    vectors[used].iov_base = (void*)batch[i].segments[j].data;
+                    vectors[used].iov_len = batch[i].segments[j].len;
+                    used++;
+                }
+            }
+            msgs[m].msg_hdr.msg_iovlen = (size_t)(&vectors[used] - msgs[m].msg_hdr.msg_iov);
+            msgs[m].msg_hdr.msg_name = (void*)&batch[next].to;
+            msgs[m].msg_hdr.msg_namelen = sizeof(batch[next].to);
+            if (run > 1) {
+                // one buffer for the run, the kernel cuts it into datagrams of the first one's size
+                uint16_t segment = (uint16_t)datagram_len(&batch[next]);
+                struct cmsghdr* c;
+                msgs[m].msg_hdr.msg_control = control[m].buffer;
+                msgs[m].msg_hdr.msg_controllen = sizeof(control[m].buffer);
+                c = CMSG_FIRSTHDR(&msgs[m].msg_hdr);
+                c->cmsg_level = SOL_UDP;
+                c->cmsg_type = UDP_SEGMENT;
+                c->cmsg_len = CMSG_LEN(sizeof(segment));
+                memcpy(CMSG_DATA(c), &segment, sizeof(segment));
+            }
+            datagrams[m++] = run;
+            next += run;
+        }
+
+        // sendmmsg may stop early, carry on from the first datagram not sent
+        do {
+            n = sendmmsg(t->fd, msgs, (unsigned int)m, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && t->gso && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+            // the route or the device cannot segment, send the same datagrams one by one from now on
+            fprintf(stderr, "UDP GSO refused, sending datagrams one by one - transport_send_batch\n");
+            t->gso = FALSE;
+            continue;
+        }
+        if (n <= 0) {
+            perror("sendmmsg - transport_send_batch");
+            return FALSE;
+        }
+        for (i = 0; i < (size_t)n; i++) {
+            done += datagrams[i];
+        }
+    }
+    return TRUE;
+}
+
+#else
+
+static size_t bytes_pending(int fd)
+{
+#if defined(_WIN32)
+    u_long pending = 0;
+    if (ioctlsocket(fd, FIONREAD, &pending) != 0) {
+        return 0;
+    }
+#else
+    int pending = 0;
+    if (ioctl(fd, FIONREAD, &pending) != 0) {
+        return 0;
+    }
+#endif
+    return (size_t)pending;
+}
+
+// No recvmmsg here: one recvfrom per datagram, but the caller still gets the queued datagrams as one batch
+static int socket_recv_batch(Transport* t, ReceivedDatagram* batch, size_t max)
+{
+    size_t n = 0;
+
+    while (n < max && (n == 0 || bytes_pending(t->fd) > 0)) {
+        socklen_t addr_len = sizeof(batch[n].from);
+        batch[n].data = batch[n].storage;
+        long len = recvfrom(t->fd, (char*)batch[n].storage, (int)sizeof(batch[n].storage), 0, (struct sockaddr*)&batch[n].from, &addr_len);
+        if (len < 0) {
+#if defined(_WIN32)
+            if (WSAGetLastError() == WSAEMSGSIZE) {
+                batch[n++].len = 0;
+                continue;
+            }
+#endif
+            if (n > 0) {
+                break;
+            }
+            perror("recvfrom - transport_recv_batch");
+            return -1;
+        }
+        batch[n++].len = (size_t)len;
+    }
+    return (int)n;
+}
+
+static int socket_send_batch(Transport* t, const OutgoingDatagram* batch, size_t count)
+{
+    IoVec vectors[MAX_SEGMENTS];
+    size_t i, j;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < batch[i].segment_count; j++) {
+            IOVEC_SET(&vectors[j], batch[i].segments[j].data, batch[i].segments[j].len);
+        }
+        if (send_vector_to(t->fd, vectors, batch[i].segment_count, &batch[i].to) < 0) {
+            perror("sendto - transport_send_batch");
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+#endif
+
+int transport_recv_batch(Transport* t, ReceivedDatagram* batch, size_t max)
+{
+    if (max > MAX_BATCH) {
+        max = MAX_BATCH;
+    }
+    if (t->deferred_count > 0) {
+        size_t n = t->deferred_count < max ? t->deferred_count : max;
+        for (size_t i = 0; i < n; i++) {
+            batch[i].len = t->deferred[i].len;
+            batch[i].from = t->deferred[i].from;
+            memcpy(batch[i].storage, t->deferred[i].storage, t->deferred[i].len);
+            batch[i].data = batch[i].storage;
+        }
+        t->deferred_count -= n;
+        memmove(t->deferred, t->deferred + n, t->deferred_count * sizeof(ReceivedDatagram));
+        return (int)n;
+    }
+    if (t->backend.recv_batch != NULL) {
+        return t->backend.recv_batch(t->backend.context, batch, max);
+    }
+    return socket_recv_batch(t, batch, max);
+}
+
+int transport_send_batch(Transport* t, const OutgoingDatagram* batch, size_t count)
+{
+    if (t->backend.send_batch != NULL) {
+        return t->backend.send_batch(t->backend.context, batch, count);
+    }
+    return socket_send_batch(t, batch, count);
+}
+
+int transport_wait(Transport* t, long timeout_ms)
+{
+    int rc;
+
+    // parked, or cut out of a coalesced receive already
+    if (t->deferred_count > 0 || t->gro_next < t->gro_count) {
+        return 1;
+    }
+    if (t->backend.wait != NULL) {
+        return t->backend.wait(t->backend.context, timeout_ms);
+    }
+    rc = wait_readable(t->fd, timeout_ms);
+    if (rc < 0) {
+        perror("poll - transport_wait");
+    }
+    return rc;
+}
+
+void send_and_receive(Transport* t, const char* message, size_t len) {
+
+    if (transport_send(t, message, len) != TRUE) {
+        return;
+    }
+
+    // Bare datagrams are acknowledged one by one so the sender cannot run ahead of the receiver;
+    // a stream and reliable UDP already take care of that
+    if (t->type != TRANSPORT_UDP || t->reliable) {
+        return;
+    }
+
+    // waiting for response from client
+    char buffer[10];
+    long recv_len = recv_datagram(t, buffer, sizeof(buffer), NULL);
+    if (recv_len < 0) {
+        perror("recvfrom - send_and_receive");
         return;
     }
+}
 
-    // saving the message and len to parameters
-    memcpy(*message, buffer, recv_len);
-    (*message)[recv_len] = '\0';
-    *len = recv_len;
+void receive_and_send(Transport* t, char** message, size_t* len) {
 
-    char* response = "Ok";
-    size_t sent_len = sendto(fd, response, sizeof(response), 0, (const struct sockaddr*)&addr, sizeof(addr));
-    if (sent_len < 0) {
-        perror("sendto - receive_and_send");
+    // waiting for message from client
+    if (transport_recv(t, (unsigned char**)message, len) != TRUE) {
+        return;
     }
-    else if ((size_t)sent_len != sizeof(response)) {
-        fprintf(stderr, "Incomplete key sent: %zd/%zu bytes - receive_and_send\n", sent_len, sizeof(response));
+
+    if (t->type != TRANSPORT_UDP || t->reliable) {
+        return;
     }
+
+    const char* response = "Ok";
+    transport_send(t, response, strlen(response));
 }
 
-void print_header_and_free(int fd, struct sockaddr_in addr, char** message, size_t* len)
+void print_header_and_free(Transport* t, char** message, size_t* len)
 {
-    receive_and_send(fd, addr, message, len);
+    receive_and_send(t, message, len);
+    if (*message == NULL) {
+        return;
+    }
     printf("%s:\n", *message);
     free(*message);
     *message = NULL;
     *len = 0;
-}
\ No newline at end of file
+}
@@ -1,13 +1,366 @@
 #pragma once
 #include "params.h"
+#include "timer_wheel.h"
 
 #define BUFFER_SIZE  4096
 #define SERVER_PORT 8080
+// Behind a balancer (udp_balancer) on SERVER_PORT, the server shard with server ID n listens on BACKEND_BASE_PORT + n
+#define BACKEND_BASE_PORT 8100
 #define WPF_CLIENT_PORT 8081
 #define LOCALHOST "127.0.0.1"
 
-void send_and_receive(int server_fd, struct sockaddr_in client_addr, const char* message, size_t len);
+// Length prefix in front of every record on a stream transport (big endian)
+#define FRAME_HEADER_SIZE 4
+// Largest record accepted from a stream peer, longer prefixes are treated as corrupt
+#define MAX_FRAME_SIZE (1 << 20)
+// Largest UDP payload
+#define MAX_DATAGRAM_SIZE 65507
+// Most buffers transport_sendv gathers into one record
+#define MAX_SEGMENTS 8
+// Most datagrams moved by one transport_recv_batch / transport_send_batch call
+#define MAX_BATCH 32
 
-void receive_and_send(int server_fd, struct sockaddr_in client_addr, const char** message, size_t* len);
+// Reliable UDP (transport_set_reliable): every datagram starts with a record type and a 16-bit big endian number
+#define RECORD_HEADER_SIZE 3
+// handshake record, acknowledged by a RECORD_ACK with its number and retransmitted until it is
+#define RECORD_DATA 1
+#define RECORD_ACK 2
+// request after the handshake, answered by a RECORD_REPLY with the same number; the reply is the acknowledgement
+#define RECORD_REQUEST 3
+#define RECORD_REPLY 4
+// answer to a hello, record 0, without a valid cookie: the hello is to be sent again with the cookie it carries
+// appended. The server keeps nothing until then, so spoofed hellos cost it one HMAC each. After the cookie comes
+// the connection ID of the session to be (see connection_id_issue)
+#define RECORD_RETRY 5
+// the session's resumption ticket (see protocol_functions.h), sent by the server along with the first answers of a
+// session; not acknowledged, a lost one comes again with the next answer
+#define RECORD_TICKET 6
+// Every datagram from a client that got its connection ID starts with this byte and the ID, then the record:
+// a balancer routes the datagram on the ID, and the server finds the session by it whatever the address
+#define CONNECTION_ID_MARK 0x40
+#define ROUTE_PREFIX_SIZE (1 + CONNECTION_ID_SIZE)
 
-void print_header_and_free(int fd, struct sockaddr_in addr, const char** message, size_t* len);
\ No newline at end of file
+// A record that does not fit in max_datagram goes out as fragments: the record type with FRAGMENT_FLAG set,
+// the record number, then the 16-bit big endian id of this copy of the record, offset of the fragment and
+// total length of the record. The id keeps fragments of two different answers to the same request apart
+#define FRAGMENT_FLAG 0x80
+#define FRAGMENT_HEADER_SIZE 9
+// Largest record, so that offsets and lengths fit in 16 bits
+#define MAX_RECORD_SIZE 65535
+// Fragments carry a multiple of this many bytes, except the last one of a record
+#define FRAGMENT_UNIT 16
+// Default max_datagram: the IPv6 minimum MTU less the IP and UDP headers, so records cross WAN paths
+// without IP fragmentation
+#define DEFAULT_MAX_DATAGRAM 1200
+// Most datagrams one record is cut into
+#define MAX_FRAGMENTS 64
+
+// UDP segmentation offload (transport_use_offload): most datagrams sent as one UDP_SEGMENT send, the lowest
+// kernel limit; coalesced messages taken in by one receive, and the most datagrams they are cut back into
+#define GSO_MAX_SEGMENTS 64
+#define GRO_BUFFERS 8
+#define GRO_MAX_SEGMENTS (GRO_BUFFERS * 128)
+
+// Retransmission timeout: starts at RTO_INITIAL_MS, doubles on every retransmission up to RTO_MAX_MS,
+// and the record is given up after MAX_RETRANSMITS
+#define RTO_INITIAL_MS 200
+#define RTO_MAX_MS 3200
+#define MAX_RETRANSMITS 6
+// Longest wait for the next record from the peer, longer than the peer's whole retransmission schedule
+#define RECV_TIMEOUT_MS 15000
+// Most requests one transport has in flight at once, see transport_request_start
+#define MAX_OUTSTANDING_REQUESTS 16
+
+typedef enum TransportType {
+    TRANSPORT_UDP,
+    TRANSPORT_TCP,
+    // both ends in one process, see transport_pipe
+    TRANSPORT_MEMORY
+} TransportType;
+
+// One piece of a record, see transport_sendv
+typedef struct TransportSegment {
+    const void* data;
+    size_t len;
+} TransportSegment;
+
+typedef struct ReceivedDatagram {
+    // the payload: points into storage on the socket path, into the backend's receive buffers otherwise.
+    // Valid until the next transport_recv_batch on the same transport
+    unsigned char* data;
+    // 0 for a datagram that did not fit in its buffer, the caller drops it
+    size_t len;
+    struct sockaddr_in from;
+    unsigned char storage[BUFFER_SIZE];
+} ReceivedDatagram;
+
+typedef struct OutgoingDatagram {
+    TransportSegment segments[MAX_SEGMENTS];
+    size_t segment_count;
+    struct sockaddr_in to;
+} OutgoingDatagram;
+
+// One record coming in as fragments. Each fragment is copied straight to its offset in buffer, which is
+// allocated once per record with the length the first fragment announces
+typedef struct Reassembly {
+    BOOL active;
+    unsigned char type;
+    unsigned short seq;
+    unsigned short id;
+    struct sockaddr_in from;
+    size_t total;
+    // FRAGMENT_UNIT blocks of the record still missing
+    size_t missing;
+    // total + 1 bytes, NUL terminated once complete
+    unsigned char* buffer;
+    unsigned char have[MAX_RECORD_SIZE / FRAGMENT_UNIT / 8 + 1];
+} Reassembly;
+
+// One datagram cut out of a coalesced (UDP_GRO) receive
+typedef struct GroSegment {
+    unsigned char* data;
+    size_t len;
+    struct sockaddr_in from;
+} GroSegment;
+
+// The datagrams of the record in flight, pointing at the caller's buffers
+typedef struct Flight {
+    OutgoingDatagram datagrams[MAX_FRAGMENTS];
+    unsigned char headers[MAX_FRAGMENTS][FRAGMENT_HEADER_SIZE];
+    size_t count;
+} Flight;
+
+typedef struct Transport Transport;
+
+// A request started by transport_request_start: over reliable UDP its datagrams are sent again, on a timer of its
+// own, until its reply is in. Replies come in whatever order the server answers, each put together on its own
+typedef struct PendingRequest {
+    Transport* transport;
+    BOOL active;
+    // the request's record number, which its reply carries; the request ID handed to the caller
+    unsigned short seq;
+    Flight flight;
+    unsigned int rto_ms;
+    int retransmits;
+    Timer retransmit_timer;
+    Reassembly reassembly;
+    // the reply once in, NUL terminated; or given up after MAX_RETRANSMITS
+    unsigned char* reply;
+    size_t reply_len;
+    BOOL failed;
+} PendingRequest;
+
+// One direction of an in-memory link: the records queued by one end and not taken by the other yet, each behind a
+// FRAME_HEADER_SIZE length as on a stream, so the counters are the bytes a TCP connection would carry
+typedef struct MemoryPipe {
+    unsigned char* data;
+    size_t start;
+    size_t end;
+    size_t capacity;
+    // records and bytes queued since the last memory_pipe_reset_counters
+    size_t records;
+    size_t bytes;
+} MemoryPipe;
+
+// Replaces the socket calls behind transport_recv_batch / transport_send_batch / transport_wait, see io_uring_functions.h
+typedef struct TransportBackend {
+    int (*recv_batch)(void* context, ReceivedDatagram* batch, size_t max);
+    int (*send_batch)(void* context, const OutgoingDatagram* batch, size_t count);
+    int (*wait)(void* context, long timeout_ms);
+    void (*release)(void* context);
+    void* context;
+} TransportBackend;
+
+struct Transport {
+    TransportType type;
+    int fd;
+    // UDP: destination of sent datagrams, updated to the sender of every received one
+    struct sockaddr_in peer;
+    // UDP batches: plain socket calls when no backend is attached
+    TransportBackend backend;
+    // UDP on a socket shared by several peers: while set, receives only accept datagrams from peer and
+    // park the others in deferred (dropped once it is full); transport_recv_batch hands those out first
+    int filter_peer;
+    ReceivedDatagram* deferred;
+    size_t deferred_count;
+    size_t deferred_capacity;
+    // segmentation offload, see transport_use_offload
+    BOOL gso;
+    BOOL gro;
+    // GRO: GRO_BUFFERS buffers of MAX_RECORD_SIZE bytes, and the datagrams cut out of them not handed out yet
+    unsigned char* gro_buffers;
+    GroSegment* gro_segments;
+    size_t gro_next;
+    size_t gro_count;
+
+    // UDP between QSSL peers: numbered records, see transport_set_reliable
+    BOOL reliable;
+    TimerWheel* timers;
+    unsigned short send_seq;
+    unsigned short recv_seq;
+    // largest datagram sent, longer records are fragmented (DEFAULT_MAX_DATAGRAM)
+    size_t max_datagram;
+    // id of the next fragmented record
+    unsigned short fragment_id;
+    // the record in flight: its datagrams are sent again until it is acknowledged
+    Flight* flight;
+    unsigned char flight_type;
+    unsigned short flight_seq;
+    BOOL flight_pending;
+    BOOL flight_failed;
+    unsigned int rto_ms;
+    int retransmits;
+    Timer retransmit_timer;
+    Timer deadline_timer;
+    BOOL deadline_passed;
+    // set by the owner, from a timer of its own, to give up the exchange in progress
+    BOOL cancelled;
+    // cookie the server asked to see with our hello, once it sent a RECORD_RETRY
+    unsigned char cookie[COOKIE_SIZE];
+    BOOL cookie_held;
+    BOOL retry;
+    // CONNECTION_ID_MARK and the connection ID from the same RECORD_RETRY, in front of our datagrams once held
+    unsigned char route[ROUTE_PREFIX_SIZE];
+    BOOL route_held;
+    // ticket of the session, once the server sent one
+    unsigned char ticket[CONNECTION_ID_SIZE];
+    BOOL ticket_held;
+    // next record from the peer, taken in while waiting for something else
+    unsigned char* early;
+    size_t early_len;
+    // receive buffer of the reliable path
+    unsigned char* datagram;
+    // record from the peer arriving as fragments
+    Reassembly reassembly;
+    // pipelined requests: MAX_OUTSTANDING_REQUESTS slots once one is started, and how many are taken
+    PendingRequest* requests;
+    size_t requests_outstanding;
+    // TCP: ID of the request the next reply answers, a stream answers in order
+    unsigned short next_reply_seq;
+
+    // memory: records to the other end, records from it
+    MemoryPipe* pipe_out;
+    MemoryPipe* pipe_in;
+
+    // TCP: bytes read from the socket but not consumed yet
+    unsigned char read_buffer[BUFFER_SIZE];
+    size_t read_start;
+    size_t read_end;
+};
+
+void transport_init(Transport* t, TransportType type, int fd, struct sockaddr_in peer);
+
+// Detaches and frees the backend, if any, going back to plain socket calls
+void transport_detach_backend(Transport* t);
+
+// Frees the backend, the offload buffers and the reliable state, if any; the socket itself is left open
+void transport_release(Transport* t);
+
+// UDP between QSSL peers: transport_send / transport_recv exchange numbered records that are acknowledged,
+// retransmitted with exponential backoff on the timers of the wheel, and acknowledged again when they show up
+// twice, so a lost datagram costs a retransmission instead of a wedged handshake. Records longer than
+// max_datagram go out as fragments and are put back together by the receiver. Sends fail after
+// MAX_RETRANSMITS, receives after RECV_TIMEOUT_MS. Without it UDP carries bare payloads (the WPF link).
+int transport_set_reliable(Transport* t, TimerWheel* timers);
+
+// Linux: sends runs of equally sized datagrams to one address (the fragments of a record) as a single
+// UDP_SEGMENT (GSO) send, and turns on UDP_GRO so a run comes in with one receive and is cut back into datagrams
+// by transport_recv_batch and the reliable path. Each is probed and left off when the kernel lacks it, and GSO is
+// dropped for good if a send is refused. Not for the bare transport_recv path nor with an io_uring backend,
+// which do not cut coalesced receives. TRUE when at least one of them is on
+int transport_use_offload(Transport* t);
+
+// Connects a and b in memory (TRANSPORT_MEMORY, no socket): records sent by a are queued in a_to_b for b and the
+// other way round. Nothing blocks: a receive fails when nothing is queued, so one thread drives both ends in turn,
+// e.g. the sans-IO handshakes of protocol_functions.h; transport_request needs the reply queued already
+void transport_pipe(Transport* a, Transport* b, MemoryPipe* a_to_b, MemoryPipe* b_to_a);
+
+// TRUE when a record is waiting in p
+int memory_pipe_pending(const MemoryPipe* p);
+
+void memory_pipe_reset_counters(MemoryPipe* p);
+
+// Drops the queued records and frees the buffer
+void memory_pipe_release(MemoryPipe* p);
+
+// Restarts the record numbering for a new peer on the same socket
+void transport_reset_records(Transport* t, unsigned short send_seq, unsigned short recv_seq);
+
+// Reliable UDP: leaves the session on t, requests outstanding included, for the one resumed with ticket. The ticket is
+// the new connection ID in front of every datagram, and the first request sent under it opens the session
+void transport_resume(Transport* t, const unsigned char* ticket);
+
+// Request/reply exchange after the handshake: over reliable UDP a RECORD_REQUEST retransmitted until its
+// RECORD_REPLY comes back, otherwise a send followed by a receive. The reply is allocated as by transport_recv
+int transport_request(Transport* t, const TransportSegment* segments, size_t count, unsigned char** reply, size_t* reply_len);
+
+// Pipelined requests after the handshake: sends a request without waiting for its reply and hands back its ID in
+// *id. Up to MAX_OUTSTANDING_REQUESTS are in flight at once; over reliable UDP each is retransmitted on its own and
+// the server answers them in any order, a lost or slow one holds none of the others up. Over TCP they are answered
+// in order. The segments stay in use until transport_request_next hands out the request's reply. FALSE when every
+// slot is taken, or on a send error. Not to be mixed with transport_recv while requests are outstanding
+int transport_request_start(Transport* t, const TransportSegment* segments, size_t count, unsigned short* id);
+
+// Drives retransmissions and takes in replies for up to timeout_ms (-1: no limit, 0: what is there already) until
+// an outstanding request is done. 1 with its ID in *id and its reply allocated in *reply (a buffer already there is
+// freed), or *reply NULL when the request was given up; 0 when none is done in time, or none is outstanding; -1 on
+// a socket error
+int transport_request_next(Transport* t, long timeout_ms, unsigned short* id, unsigned char** reply, size_t* reply_len);
+
+void record_header(unsigned char* header, unsigned char type, unsigned short seq);
+
+// Splits a reliable UDP datagram; FALSE when it is too short to carry a header
+int record_parse(const unsigned char* data, size_t len, unsigned char* type, unsigned short* seq);
+
+// Moves *data and *len past the connection ID in front of a datagram, if any, and points *connection_id at it
+// (NULL without one); FALSE for a datagram cut short inside it
+int record_strip_route(const unsigned char** data, size_t* len, const unsigned char** connection_id);
+
+// Cuts a record into datagrams of at most max_datagram bytes for addr: a single datagram behind a record header when
+// it fits, fragments with the given id otherwise. The datagrams point into segments, headers receives their headers
+// (one per datagram). Returns the number of datagrams, 0 when the record is too large or takes more than capacity
+size_t record_fragment(unsigned char type, unsigned short seq, unsigned short id, const TransportSegment* segments, size_t count,
+                       size_t max_datagram, const struct sockaddr_in* addr,
+                       OutgoingDatagram* out, unsigned char (*headers)[FRAGMENT_HEADER_SIZE], size_t capacity);
+
+// Takes in one fragment (a datagram whose type has FRAGMENT_FLAG) of a record from addr. A fragment of another
+// record, or of another copy of it, than the one in progress starts over. TRUE once the record is complete in r->buffer
+int reassembly_add(Reassembly* r, const struct sockaddr_in* addr, const unsigned char* data, size_t len);
+
+// Forgets the record in progress; the buffer goes with it unless taken (set to NULL) by the caller
+void reassembly_reset(Reassembly* r);
+
+// Sends a bare RECORD_ACK for seq to addr
+int transport_send_ack(Transport* t, const struct sockaddr_in* addr, unsigned short seq);
+
+// "tcp" or "udp" as first argument, UDP when absent
+TransportType transport_type_from_args(int argc, char** argv);
+
+// "mtu=<bytes>" as an argument: the path MTU, datagrams are kept to it less the IPv4 and UDP headers.
+// DEFAULT_MAX_DATAGRAM when absent
+size_t max_datagram_from_args(int argc, char** argv);
+
+// Sends the segments as one record: one datagram for UDP, one length-prefixed frame written with a single vectored write for TCP
+int transport_sendv(Transport* t, const TransportSegment* segments, size_t count);
+
+int transport_send(Transport* t, const void* data, size_t len);
+
+// Receives one record into a newly allocated, NUL terminated buffer; a buffer already in *message is freed
+int transport_recv(Transport* t, unsigned char** message, size_t* len);
+
+// UDP only: blocks for one datagram, then takes whatever else is already queued, up to max (recvmmsg on Linux).
+// Returns the number of datagrams received or -1 on error
+int transport_recv_batch(Transport* t, ReceivedDatagram* batch, size_t max);
+
+// UDP only: sends every datagram, each to its own address (sendmmsg on Linux)
+int transport_send_batch(Transport* t, const OutgoingDatagram* batch, size_t count);
+
+// UDP only: waits up to timeout_ms (-1: no limit) until transport_recv_batch has a datagram to hand out, so that a
+// batch loop also keeps its timers. 1 when it has, 0 on timeout, -1 on error
+int transport_wait(Transport* t, long timeout_ms);
+
+void send_and_receive(Transport* t, const char* message, size_t len);
+
+void receive_and_send(Transport* t, char** message, size_t* len);
+
+void print_header_and_free(Transport* t, char** message, size_t* len);
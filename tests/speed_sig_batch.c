@@ -0,0 +1,160 @@
+/*
+ * speed_sig_batch.c
+ *
+ * Throughput of OQS_SIG_verify_batch against calling OQS_SIG_verify once per
+ * signature, for signatures spread over a number of public keys. Without an
+ * algorithm argument every enabled Dilithium security level is measured.
+ *
+ * Usage: speed_sig_batch [algorithm] [signatures] [keys] [threads]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <oqs/oqs.h>
+
+#define MESSAGE_LEN 256
+
+static double now_seconds(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int run(const char *alg, size_t count, size_t keys, size_t threads) {
+	int ret = EXIT_FAILURE;
+
+	OQS_SIG *sig = NULL;
+	uint8_t *public_keys = NULL;
+	uint8_t *secret_key = NULL;
+	uint8_t *messages = NULL;
+	uint8_t *signatures = NULL;
+	const uint8_t **message_ptrs = NULL;
+	const uint8_t **signature_ptrs = NULL;
+	const uint8_t **public_key_ptrs = NULL;
+	size_t *message_lens = NULL;
+	size_t *signature_lens = NULL;
+	OQS_STATUS *results = NULL;
+
+	sig = OQS_SIG_new(alg);
+	if (sig == NULL) {
+		fprintf(stderr, "ERROR: %s is not enabled in this build\n", alg);
+		return EXIT_FAILURE;
+	}
+
+	public_keys = malloc(keys * sig->length_public_key);
+	secret_key = malloc(sig->length_secret_key);
+	messages = malloc(count * MESSAGE_LEN);
+	signatures = malloc(count * sig->length_signature);
+	message_ptrs = malloc(count * sizeof(uint8_t *));
+	signature_ptrs = malloc(count * sizeof(uint8_t *));
+	public_key_ptrs = malloc(count * sizeof(uint8_t *));
+	message_lens = malloc(count * sizeof(size_t));
+	signature_lens = malloc(count * sizeof(size_t));
+	results = malloc(count * sizeof(OQS_STATUS));
+	if (public_keys == NULL || secret_key == NULL || messages == NULL || signatures == NULL || message_ptrs == NULL ||
+	        signature_ptrs == NULL || public_key_ptrs == NULL || message_lens == NULL || signature_lens == NULL || results == NULL) {
+		fprintf(stderr, "ERROR: malloc failed\n");
+		goto cleanup;
+	}
+
+	printf("%s: generating %zu keys and %zu signatures...\n", alg, keys, count);
+	OQS_randombytes(messages, count * MESSAGE_LEN);
+	for (size_t k = 0; k < keys; k++) {
+		if (OQS_SIG_keypair(sig, public_keys + k * sig->length_public_key, secret_key) != OQS_SUCCESS) {
+			fprintf(stderr, "ERROR: OQS_SIG_keypair failed\n");
+			goto cleanup;
+		}
+		/* Signatures are interleaved across keys, as they would be in a stored log. */
+		for (size_t i = k; i < count; i += keys) {
+			message_ptrs[i] = messages + i * MESSAGE_LEN;
+			message_lens[i] = MESSAGE_LEN;
+			signature_ptrs[i] = signatures + i * sig->length_signature;
+			public_key_ptrs[i] = public_keys + k * sig->length_public_key;
+			if (OQS_SIG_sign(sig, signatures + i * sig->length_signature, &signature_lens[i],
+			                 message_ptrs[i], MESSAGE_LEN, secret_key) != OQS_SUCCESS) {
+				fprintf(stderr, "ERROR: OQS_SIG_sign failed at signature %zu\n", i);
+				goto cleanup;
+			}
+		}
+	}
+
+	double start = now_seconds();
+	for (size_t i = 0; i < count; i++) {
+		if (OQS_SIG_verify(sig, message_ptrs[i], message_lens[i], signature_ptrs[i], signature_lens[i], public_key_ptrs[i]) != OQS_SUCCESS) {
+			fprintf(stderr, "ERROR: OQS_SIG_verify failed at signature %zu\n", i);
+			goto cleanup;
+		}
+	}
+	double single = now_seconds() - start;
+
+	start = now_seconds();
+	if (OQS_SIG_verify_batch(sig, count, message_ptrs, message_lens, signature_ptrs, signature_lens,
+	                         public_key_ptrs, results, threads) != OQS_SUCCESS) {
+		fprintf(stderr, "ERROR: OQS_SIG_verify_batch failed\n");
+		goto cleanup;
+	}
+	double batch = now_seconds() - start;
+
+	printf("%-24s %10.1f sigs/s\n", "OQS_SIG_verify", (double)count / single);
+	printf("%-24s %10.1f sigs/s (%.2fx)\n", "OQS_SIG_verify_batch", (double)count / batch, single / batch);
+
+	/* A corrupted signature must be reported on its own. */
+	signatures[(count - 1) * sig->length_signature + sig->length_signature / 2] ^= 1;
+	if (OQS_SIG_verify_batch(sig, count, message_ptrs, message_lens, signature_ptrs, signature_lens,
+	                         public_key_ptrs, results, threads) != OQS_ERROR || results[count - 1] != OQS_ERROR) {
+		fprintf(stderr, "ERROR: corrupted signature was not rejected\n");
+		goto cleanup;
+	}
+	for (size_t i = 0; i + 1 < count; i++) {
+		if (results[i] != OQS_SUCCESS) {
+			fprintf(stderr, "ERROR: valid signature %zu rejected next to a corrupted one\n", i);
+			goto cleanup;
+		}
+	}
+	ret = EXIT_SUCCESS;
+
+cleanup:
+	OQS_MEM_secure_free(secret_key, sig->length_secret_key);
+	OQS_SIG_free(sig);
+	free(public_keys);
+	free(messages);
+	free(signatures);
+	free(message_ptrs);
+	free(signature_ptrs);
+	free(public_key_ptrs);
+	free(message_lens);
+	free(signature_lens);
+	free(results);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	static const char *levels[] = { OQS_SIG_alg_dilithium_2, OQS_SIG_alg_dilithium_3, OQS_SIG_alg_dilithium_5 };
+	size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+	size_t keys = argc > 3 ? strtoul(argv[3], NULL, 10) : 16;
+	size_t threads = argc > 4 ? strtoul(argv[4], NULL, 10) : 0;
+	int ret = EXIT_SUCCESS;
+
+	if (count == 0 || keys == 0 || keys > count) {
+		fprintf(stderr, "ERROR: need at least one signature per key\n");
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 1) {
+		return run(argv[1], count, keys, threads);
+	}
+	for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+		if (!OQS_SIG_alg_is_enabled(levels[i])) {
+			continue;
+		}
+		if (run(levels[i], count, keys, threads) != EXIT_SUCCESS) {
+			ret = EXIT_FAILURE;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,173 @@
+/*
+ * speed_sig_latency.c
+ *
+ * Per-signature latency of Dilithium signing, p50 and p99, with the attempts
+ * run one after another and with speculative signing on its lanes. Each
+ * message is signed with the same randomness in both modes, so the two runs
+ * must also produce the same signatures. Without an algorithm argument every
+ * enabled Dilithium security level is measured; lanes 0 picks one per online
+ * core, which is the library default.
+ *
+ * Usage: speed_sig_latency [algorithm] [signatures] [lanes]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <oqs/oqs.h>
+
+#define MESSAGE_LEN 256
+
+static uint64_t rng_state;
+
+/* Signing draws its randomness from here, so a message can be signed twice alike */
+static void seeded_randombytes(uint8_t *out, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		rng_state ^= rng_state << 13;
+		rng_state ^= rng_state >> 7;
+		rng_state ^= rng_state << 17;
+		out[i] = (uint8_t)rng_state;
+	}
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : (x > y);
+}
+
+/* Signs every message once, keeping the signatures and the sorted latencies */
+static int sign_all(OQS_SIG *sig, const uint8_t *secret_key, const uint8_t *messages, size_t count,
+                    uint8_t *signatures, double *latencies) {
+	size_t signature_len;
+
+	for (size_t i = 0; i < count; i++) {
+		rng_state = 0x9e3779b97f4a7c15ULL + i;
+		double start = now_seconds();
+		if (OQS_SIG_sign(sig, signatures + i * sig->length_signature, &signature_len,
+		                 messages + i * MESSAGE_LEN, MESSAGE_LEN, secret_key) != OQS_SUCCESS) {
+			fprintf(stderr, "ERROR: OQS_SIG_sign failed at signature %zu\n", i);
+			return EXIT_FAILURE;
+		}
+		latencies[i] = now_seconds() - start;
+	}
+	qsort(latencies, count, sizeof(double), cmp_double);
+	return EXIT_SUCCESS;
+}
+
+static void report(const char *mode, const double *latencies, size_t count) {
+	printf("%-24s p50 %8.1f us   p99 %8.1f us   max %8.1f us\n", mode,
+	       latencies[count / 2] * 1e6, latencies[count * 99 / 100] * 1e6, latencies[count - 1] * 1e6);
+}
+
+static int run(const char *alg, size_t count, unsigned int lanes) {
+	int ret = EXIT_FAILURE;
+
+	OQS_SIG *sig = NULL;
+	uint8_t *public_key = NULL;
+	uint8_t *secret_key = NULL;
+	uint8_t *messages = NULL;
+	uint8_t *sequential = NULL;
+	uint8_t *speculative = NULL;
+	double *latencies = NULL;
+
+	sig = OQS_SIG_new(alg);
+	if (sig == NULL) {
+		fprintf(stderr, "ERROR: %s is not enabled in this build\n", alg);
+		return EXIT_FAILURE;
+	}
+
+	public_key = malloc(sig->length_public_key);
+	secret_key = malloc(sig->length_secret_key);
+	messages = malloc(count * MESSAGE_LEN);
+	sequential = malloc(count * sig->length_signature);
+	speculative = malloc(count * sig->length_signature);
+	latencies = malloc(count * sizeof(double));
+	if (public_key == NULL || secret_key == NULL || messages == NULL || sequential == NULL || speculative == NULL ||
+	        latencies == NULL) {
+		fprintf(stderr, "ERROR: malloc failed\n");
+		goto cleanup;
+	}
+
+	OQS_randombytes(messages, count * MESSAGE_LEN);
+	if (OQS_SIG_keypair(sig, public_key, secret_key) != OQS_SUCCESS) {
+		fprintf(stderr, "ERROR: OQS_SIG_keypair failed\n");
+		goto cleanup;
+	}
+
+	printf("%s: %zu signatures\n", alg, count);
+	OQS_randombytes_custom_algorithm(seeded_randombytes);
+#if defined(OQS_ENABLE_SIG_DILITHIUM_SPECULATIVE_SIGNING) && defined(OQS_USE_PTHREADS)
+	OQS_SIG_dilithium_set_sign_lanes(1);
+#endif
+	if (sign_all(sig, secret_key, messages, count, sequential, latencies) != EXIT_SUCCESS) {
+		goto cleanup;
+	}
+	report("sequential", latencies, count);
+
+#if defined(OQS_ENABLE_SIG_DILITHIUM_SPECULATIVE_SIGNING) && defined(OQS_USE_PTHREADS)
+	char mode[32];
+	OQS_SIG_dilithium_set_sign_lanes(lanes);
+	snprintf(mode, sizeof(mode), "speculative, %u lanes", OQS_SIG_dilithium_sign_lanes());
+	if (sign_all(sig, secret_key, messages, count, speculative, latencies) != EXIT_SUCCESS) {
+		goto cleanup;
+	}
+	report(mode, latencies, count);
+	OQS_SIG_dilithium_set_sign_lanes(0);
+
+	if (memcmp(sequential, speculative, count * sig->length_signature) != 0) {
+		fprintf(stderr, "ERROR: speculative signing produced a different signature\n");
+		goto cleanup;
+	}
+#else
+	(void)lanes;
+	printf("speculative signing is disabled in this build (OQS_ENABLE_SIG_DILITHIUM_SPECULATIVE_SIGNING)\n");
+#endif
+	ret = EXIT_SUCCESS;
+
+cleanup:
+	OQS_randombytes_switch_algorithm(OQS_RAND_alg_system);
+	OQS_MEM_secure_free(secret_key, sig->length_secret_key);
+	OQS_SIG_free(sig);
+	free(public_key);
+	free(messages);
+	free(sequential);
+	free(speculative);
+	free(latencies);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	static const char *levels[] = { OQS_SIG_alg_dilithium_2, OQS_SIG_alg_dilithium_3, OQS_SIG_alg_dilithium_5 };
+	size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000;
+	unsigned int lanes = argc > 3 ? (unsigned int)strtoul(argv[3], NULL, 10) : 0;
+	int ret = EXIT_SUCCESS;
+
+	if (count == 0) {
+		fprintf(stderr, "ERROR: need at least one signature\n");
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 1) {
+		return run(argv[1], count, lanes);
+	}
+	for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+		if (!OQS_SIG_alg_is_enabled(levels[i])) {
+			continue;
+		}
+		if (run(levels[i], count, lanes) != EXIT_SUCCESS) {
+			ret = EXIT_FAILURE;
+		}
+	}
+	return ret;
+}
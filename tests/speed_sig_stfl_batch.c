@@ -0,0 +1,143 @@
+/*
+ * speed_sig_stfl_batch.c
+ *
+ * Throughput of OQS_SIG_STFL_verify_batch against calling OQS_SIG_STFL_verify
+ * once per signature, for many signatures under one public key.
+ *
+ * Usage: speed_sig_stfl_batch [algorithm] [signatures] [threads]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <oqs/oqs.h>
+
+#define MESSAGE_LEN 256
+
+static double now_seconds(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static OQS_STATUS discard_secret_key(uint8_t *sk_buf, size_t buf_len, void *context) {
+	(void)sk_buf;
+	(void)buf_len;
+	(void)context;
+	return OQS_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+	const char *alg = argc > 1 ? argv[1] : OQS_SIG_STFL_alg_xmss_sha256_h10;
+	size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+	size_t threads = argc > 3 ? strtoul(argv[3], NULL, 10) : 0;
+	int ret = EXIT_FAILURE;
+
+	OQS_SIG_STFL *sig = NULL;
+	OQS_SIG_STFL_SECRET_KEY *secret_key = NULL;
+	uint8_t *public_key = NULL;
+	uint8_t *messages = NULL;
+	uint8_t *signatures = NULL;
+	const uint8_t **message_ptrs = NULL;
+	const uint8_t **signature_ptrs = NULL;
+	size_t *message_lens = NULL;
+	size_t *signature_lens = NULL;
+	OQS_STATUS *results = NULL;
+
+	if (count == 0) {
+		fprintf(stderr, "ERROR: need at least one signature\n");
+		return EXIT_FAILURE;
+	}
+
+	sig = OQS_SIG_STFL_new(alg);
+	secret_key = OQS_SIG_STFL_SECRET_KEY_new(alg);
+	if (sig == NULL || secret_key == NULL) {
+		fprintf(stderr, "ERROR: %s is not enabled in this build\n", alg);
+		goto cleanup;
+	}
+
+	public_key = malloc(sig->length_public_key);
+	messages = malloc(count * MESSAGE_LEN);
+	signatures = malloc(count * sig->length_signature);
+	message_ptrs = malloc(count * sizeof(uint8_t *));
+	signature_ptrs = malloc(count * sizeof(uint8_t *));
+	message_lens = malloc(count * sizeof(size_t));
+	signature_lens = malloc(count * sizeof(size_t));
+	results = malloc(count * sizeof(OQS_STATUS));
+	if (public_key == NULL || messages == NULL || signatures == NULL || message_ptrs == NULL ||
+	        signature_ptrs == NULL || message_lens == NULL || signature_lens == NULL || results == NULL) {
+		fprintf(stderr, "ERROR: malloc failed\n");
+		goto cleanup;
+	}
+
+	printf("%s: generating key and %zu signatures...\n", alg, count);
+	if (OQS_SIG_STFL_keypair(sig, public_key, secret_key) != OQS_SUCCESS) {
+		fprintf(stderr, "ERROR: OQS_SIG_STFL_keypair failed (key and signature generation may be disabled)\n");
+		goto cleanup;
+	}
+	OQS_SIG_STFL_SECRET_KEY_SET_store_cb(secret_key, discard_secret_key, secret_key);
+
+	OQS_randombytes(messages, count * MESSAGE_LEN);
+	for (size_t i = 0; i < count; i++) {
+		message_ptrs[i] = messages + i * MESSAGE_LEN;
+		message_lens[i] = MESSAGE_LEN;
+		signature_ptrs[i] = signatures + i * sig->length_signature;
+		if (OQS_SIG_STFL_sign(sig, signatures + i * sig->length_signature, &signature_lens[i],
+		                      message_ptrs[i], MESSAGE_LEN, secret_key) != OQS_SUCCESS) {
+			fprintf(stderr, "ERROR: OQS_SIG_STFL_sign failed at signature %zu\n", i);
+			goto cleanup;
+		}
+	}
+
+	double start = now_seconds();
+	for (size_t i = 0; i < count; i++) {
+		if (OQS_SIG_STFL_verify(sig, message_ptrs[i], message_lens[i], signature_ptrs[i], signature_lens[i], public_key) != OQS_SUCCESS) {
+			fprintf(stderr, "ERROR: OQS_SIG_STFL_verify failed at signature %zu\n", i);
+			goto cleanup;
+		}
+	}
+	double single = now_seconds() - start;
+
+	start = now_seconds();
+	if (OQS_SIG_STFL_verify_batch(sig, count, message_ptrs, message_lens, signature_ptrs, signature_lens,
+	                              public_key, results, threads) != OQS_SUCCESS) {
+		fprintf(stderr, "ERROR: OQS_SIG_STFL_verify_batch failed\n");
+		goto cleanup;
+	}
+	double batch = now_seconds() - start;
+
+	printf("%-24s %10.1f sigs/s\n", "OQS_SIG_STFL_verify", (double)count / single);
+	printf("%-24s %10.1f sigs/s (%.2fx)\n", "OQS_SIG_STFL_verify_batch", (double)count / batch, single / batch);
+
+	/* A corrupted signature must be reported on its own. */
+	signatures[(count - 1) * sig->length_signature + sig->length_signature / 2] ^= 1;
+	if (OQS_SIG_STFL_verify_batch(sig, count, message_ptrs, message_lens, signature_ptrs, signature_lens,
+	                              public_key, results, threads) != OQS_ERROR || results[count - 1] != OQS_ERROR) {
+		fprintf(stderr, "ERROR: corrupted signature was not rejected\n");
+		goto cleanup;
+	}
+	for (size_t i = 0; i + 1 < count; i++) {
+		if (results[i] != OQS_SUCCESS) {
+			fprintf(stderr, "ERROR: valid signature %zu rejected next to a corrupted one\n", i);
+			goto cleanup;
+		}
+	}
+	ret = EXIT_SUCCESS;
+
+cleanup:
+	OQS_SIG_STFL_SECRET_KEY_free(secret_key);
+	OQS_SIG_STFL_free(sig);
+	free(public_key);
+	free(messages);
+	free(signatures);
+	free(message_ptrs);
+	free(signature_ptrs);
+	free(message_lens);
+	free(signature_lens);
+	free(results);
+	return ret;
+}
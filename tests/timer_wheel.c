@@ -0,0 +1,166 @@
+#include "timer_wheel.h"
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+uint64_t monotonic_ms(void)
+{
+#if defined(_WIN32)
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
+}
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now_ms)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->current = now_ms / TIMER_WHEEL_TICK_MS;
+}
+
+void timer_init(Timer* timer, TimerCallback fire, void* context)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->fire = fire;
+    timer->context = context;
+}
+
+void timer_cancel(TimerWheel* wheel, Timer* timer)
+{
+    if (!timer->armed) {
+        return;
+    }
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    }
+    else {
+        wheel->slots[timer->bucket / TIMER_WHEEL_SLOTS][timer->bucket % TIMER_WHEEL_SLOTS] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = timer->prev = NULL;
+    timer->armed = FALSE;
+    wheel->armed--;
+}
+
+// Links the timer into the bucket of the lowest wheel its expiry fits in; one that is due already goes to the
+// bucket being processed
+static void place(TimerWheel* wheel, Timer* timer)
+{
+    uint64_t delta = timer->expires > wheel->current ? timer->expires - wheel->current : 0;
+    int level = 0;
+    size_t slot;
+    Timer** head;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1ULL << (TIMER_WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    if (delta >= 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) {
+        timer->expires = wheel->current + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+    slot = ((delta == 0 ? wheel->current : timer->expires) >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+
+    head = &wheel->slots[level][slot];
+    timer->bucket = (unsigned short)(level * TIMER_WHEEL_SLOTS + slot);
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = timer;
+    }
+    *head = timer;
+}
+
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t expires_ms)
+{
+    uint64_t expires = (expires_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+
+    timer_cancel(wheel, timer);
+    // a tick that was already processed would only be looked at again one revolution later
+    if (expires <= wheel->current) {
+        expires = wheel->current + 1;
+    }
+    timer->expires = expires;
+    place(wheel, timer);
+    timer->armed = TRUE;
+    wheel->armed++;
+}
+
+// Moves the timers of a bucket of an upper wheel down to the wheels below
+static void cascade(TimerWheel* wheel, int level, size_t slot)
+{
+    Timer* timer = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+    while (timer != NULL) {
+        Timer* next = timer->next;
+        place(wheel, timer);
+        timer = next;
+    }
+}
+
+// Fires the timers of one bucket of the first wheel that are due by tick
+static void fire_slot(TimerWheel* wheel, size_t slot, uint64_t tick)
+{
+    Timer* timer = wheel->slots[0][slot];
+    while (timer != NULL) {
+        Timer* next = timer->next;
+        if (timer->expires <= tick) {
+            timer_cancel(wheel, timer);
+            timer->fire(timer, timer->context);
+            // the callback may have changed the bucket, start over
+            next = wheel->slots[0][slot];
+        }
+        timer = next;
+    }
+}
+
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now_ms)
+{
+    uint64_t target = now_ms / TIMER_WHEEL_TICK_MS;
+
+    while (wheel->current < target) {
+        if (wheel->armed == 0) {
+            // nothing to fire on the way
+            wheel->current = target;
+            break;
+        }
+        wheel->current++;
+        // every wheel that came round brings the next bucket of the one above it down
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((wheel->current & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            cascade(wheel, level, (wheel->current >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+        }
+        fire_slot(wheel, wheel->current & SLOT_MASK, wheel->current);
+    }
+}
+
+long timer_wheel_next_timeout(const TimerWheel* wheel, uint64_t now_ms)
+{
+    uint64_t next = UINT64_MAX;
+
+    if (wheel->armed == 0) {
+        return -1;
+    }
+    // the first wheel holds the timers of its revolution, each bucket a single tick
+    for (uint64_t tick = wheel->current + 1; tick <= wheel->current + TIMER_WHEEL_SLOTS; tick++) {
+        if (wheel->slots[0][tick & SLOT_MASK] != NULL) {
+            next = tick;
+            break;
+        }
+    }
+    if (next == UINT64_MAX) {
+        // only timers on the upper wheels
+        next = (wheel->current | SLOT_MASK) + 1;
+    }
+
+    uint64_t next_ms = next * TIMER_WHEEL_TICK_MS;
+    return next_ms > now_ms ? (long)(next_ms - now_ms) : 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "params.h"
+
+// Hierarchical timer wheel: TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS buckets, the first one of
+// TIMER_WHEEL_TICK_MS per bucket, every next one a whole revolution of the one below per bucket (2.56 s, 11 min,
+// 48 h). A timer goes to the lowest wheel its expiry fits in and moves down a level each time the wheel below
+// comes round to it, so arming and cancelling stay O(1) whether the timer is a retransmission or the idle
+// timeout of one of a million sessions. Expiries past the top wheel are clamped to its end.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_TICK_MS 10
+
+typedef struct Timer Timer;
+typedef void (*TimerCallback)(Timer* timer, void* context);
+
+struct Timer {
+    Timer* next;
+    Timer* prev;
+    // expiry, in ticks
+    uint64_t expires;
+    TimerCallback fire;
+    void* context;
+    // bucket it is in: level * TIMER_WHEEL_SLOTS + slot
+    unsigned short bucket;
+    BOOL armed;
+};
+
+typedef struct TimerWheel {
+    Timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    // last tick that has been processed
+    uint64_t current;
+    size_t armed;
+} TimerWheel;
+
+// Milliseconds from a monotonic clock
+uint64_t monotonic_ms(void);
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now_ms);
+
+void timer_init(Timer* timer, TimerCallback fire, void* context);
+
+// (Re)arms the timer to fire once at expires_ms, rounded up to the next tick
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t expires_ms);
+
+void timer_cancel(TimerWheel* wheel, Timer* timer);
+
+// Fires every timer that expired by now_ms; callbacks may arm timers again
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now_ms);
+
+// Milliseconds until the next timer fires, -1 when none is armed. With only timers on the upper wheels, the time
+// until the first wheel comes round instead: advancing then brings them closer
+long timer_wheel_next_timeout(const TimerWheel* wheel, uint64_t now_ms);
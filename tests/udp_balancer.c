@@ -0,0 +1,276 @@
+/*
+ * udp_balancer.c
+ *
+ * Stand-in for the UDP load balancer in front of several QSSL server shards,
+ * on one machine. Clients send to SERVER_PORT as usual; each datagram goes on
+ * to the shard with the server ID in its connection ID, read with the routing
+ * key the servers share (ROUTING_KEY_FILE). The session's records are not
+ * decrypted, one AES block is. Datagrams without an ID (a first hello) go to the
+ * shard their client address hashes to. Shard n listens on BACKEND_BASE_PORT + n:
+ * start the servers with "server_id=<first>" so that together they cover
+ * backends=<n> IDs from 0.
+ *
+ * Every client address gets a socket of its own towards the shards, and the
+ * shards' answers on it go back to that client: the shards see one address per
+ * client, which changes when the client's does (NAT rebinding), and the
+ * connection ID keeps the datagrams going to the shard that holds the session.
+ * All clients come from this host as seen by the shards, so they share one
+ * handshake admission bucket there.
+ *
+ * Usage: udp_balancer [backends=<n>] [port=<n>]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "protocol_functions.h"
+#include "socket_functions.h"
+
+#if defined(_WIN32)
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+// Client addresses followed at a time; the one quiet the longest makes room for a new one
+#define MAX_FLOWS 1024
+// A client address quiet for this long is forgotten
+#define FLOW_IDLE_MS 60000
+#define BALANCER_STATS_INTERVAL_MS 10000
+
+typedef struct Flow {
+    struct sockaddr_in client;
+    // towards the shards, their answers come back on it
+    int fd;
+    uint64_t heard_ms;
+} Flow;
+
+typedef struct Balancer {
+    int fd;
+    size_t backends;
+    RoutingKey routing;
+    Flow flows[MAX_FLOWS];
+    size_t flow_count;
+    unsigned char datagram[MAX_DATAGRAM_SIZE];
+    // datagrams sent on by their connection ID, by the hash of their address, and answers relayed back
+    uint64_t routed;
+    uint64_t hashed;
+    uint64_t relayed;
+} Balancer;
+
+static struct sockaddr_in backend_address(size_t server_id)
+{
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(LOCALHOST);
+    addr.sin_port = htons((unsigned short)(BACKEND_BASE_PORT + server_id));
+    return addr;
+}
+
+// The shard for a datagram from client: the one in its connection ID, or one picked by the client's address
+static size_t pick_backend(Balancer* b, const struct sockaddr_in* client, const unsigned char* data, size_t len)
+{
+    const unsigned char* connection_id;
+    ConnectionId id;
+    uint8_t server_id;
+    uint64_t h;
+
+    if (record_strip_route(&data, &len, &connection_id) == TRUE && connection_id != NULL &&
+        connection_id_open(&b->routing, connection_id, &server_id, &id) == TRUE && server_id < b->backends) {
+        b->routed++;
+        return server_id;
+    }
+    b->hashed++;
+    h = ((uint64_t)ntohl(client->sin_addr.s_addr) << 16) | ntohs(client->sin_port);
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (size_t)((h >> 32) % b->backends);
+}
+
+static void close_flow(Balancer* b, size_t i)
+{
+    closesocket(b->flows[i].fd);
+    b->flows[i] = b->flows[--b->flow_count];
+}
+
+// The flow of client, opened when it is new; NULL when no socket can be opened
+static Flow* find_flow(Balancer* b, const struct sockaddr_in* client, uint64_t now_ms)
+{
+    struct sockaddr_in any;
+    size_t i, oldest = 0;
+
+    for (i = 0; i < b->flow_count; i++) {
+        Flow* f = &b->flows[i];
+        if (f->client.sin_addr.s_addr == client->sin_addr.s_addr && f->client.sin_port == client->sin_port) {
+            f->heard_ms = now_ms;
+            return f;
+        }
+        if (f->heard_ms < b->flows[oldest].heard_ms) {
+            oldest = i;
+        }
+    }
+    if (b->flow_count == MAX_FLOWS) {
+        close_flow(b, oldest);
+    }
+
+    Flow* f = &b->flows[b->flow_count];
+    f->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (f->fd == INVALID_SOCKET) {
+        perror("socket - find_flow");
+        return NULL;
+    }
+    memset(&any, 0, sizeof(any));
+    any.sin_family = AF_INET;
+    any.sin_addr.s_addr = inet_addr(LOCALHOST);
+    if (bind(f->fd, (const struct sockaddr*)&any, sizeof(any)) < 0) {
+        perror("bind - find_flow");
+        closesocket(f->fd);
+        return NULL;
+    }
+    f->client = *client;
+    f->heard_ms = now_ms;
+    b->flow_count++;
+    return f;
+}
+
+// A datagram from a client, on to its shard
+static void from_client(Balancer* b)
+{
+    struct sockaddr_in client;
+    socklen_t client_len = sizeof(client);
+    long n = recvfrom(b->fd, (char*)b->datagram, sizeof(b->datagram), 0, (struct sockaddr*)&client, &client_len);
+    Flow* f;
+
+    if (n <= 0) {
+        return;
+    }
+    f = find_flow(b, &client, monotonic_ms());
+    if (f == NULL) {
+        return;
+    }
+    struct sockaddr_in backend = backend_address(pick_backend(b, &client, b->datagram, (size_t)n));
+    if (sendto(f->fd, (const char*)b->datagram, n, 0, (const struct sockaddr*)&backend, sizeof(backend)) != n) {
+        perror("sendto - from_client");
+    }
+}
+
+// An answer from a shard, back to the client of the flow
+static void from_backend(Balancer* b, Flow* f)
+{
+    long n = recv(f->fd, (char*)b->datagram, sizeof(b->datagram), 0);
+
+    if (n <= 0) {
+        return;
+    }
+    if (sendto(b->fd, (const char*)b->datagram, n, 0, (const struct sockaddr*)&f->client, sizeof(f->client)) != n) {
+        perror("sendto - from_backend");
+        return;
+    }
+    b->relayed++;
+}
+
+static int balancer_config(int argc, char** argv, size_t* backends, unsigned short* port)
+{
+    *backends = 1;
+    *port = SERVER_PORT;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "backends=", 9) == 0) {
+            *backends = strtoul(argv[i] + 9, NULL, 10);
+        }
+        else if (strncmp(argv[i], "port=", 5) == 0) {
+            *port = (unsigned short)strtoul(argv[i] + 5, NULL, 10);
+        }
+        else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return FALSE;
+        }
+    }
+    if (*backends == 0 || *backends > MAX_SERVER_IDS) {
+        fprintf(stderr, "backends must be 1 to %d\n", MAX_SERVER_IDS);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int main(int argc, char** argv) {
+    WSADATA wsaData;
+    static Balancer b;
+    static struct pollfd fds[MAX_FLOWS + 1];
+    struct sockaddr_in addr;
+    unsigned short port;
+    uint64_t next_stats;
+    size_t i;
+
+    if (balancer_config(argc, argv, &b.backends, &port) != TRUE) {
+        return EXIT_FAILURE;
+    }
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("WSAStartup failed: %d\n", WSAGetLastError());
+        return EXIT_FAILURE;
+    }
+    if (routing_key_load(&b.routing, ROUTING_KEY_FILE) != TRUE) {
+        return EXIT_FAILURE;
+    }
+
+    b.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (b.fd == INVALID_SOCKET) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(b.fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+    printf("Balancer on port %d for %zu shards on ports %d to %zu\n", port, b.backends, BACKEND_BASE_PORT,
+           BACKEND_BASE_PORT + b.backends - 1);
+
+    next_stats = monotonic_ms() + BALANCER_STATS_INTERVAL_MS;
+    while (1) {
+        size_t count = b.flow_count;
+        uint64_t now_ms;
+
+        fds[0].fd = b.fd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < count; i++) {
+            fds[i + 1].fd = b.flows[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, (unsigned long)(count + 1), BALANCER_STATS_INTERVAL_MS) < 0) {
+            perror("poll");
+            break;
+        }
+        // answers first: taking in a client may close a flow and move the last one into its place
+        for (i = 0; i < count; i++) {
+            if (fds[i + 1].revents & POLLIN) {
+                from_backend(&b, &b.flows[i]);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            from_client(&b);
+        }
+
+        now_ms = monotonic_ms();
+        for (i = b.flow_count; i-- > 0;) {
+            if (now_ms - b.flows[i].heard_ms > FLOW_IDLE_MS) {
+                close_flow(&b, i);
+            }
+        }
+        if (now_ms >= next_stats) {
+            printf("balancer: %llu routed by connection ID, %llu by address, %llu answers, %zu clients\n",
+                   (unsigned long long)b.routed, (unsigned long long)b.hashed, (unsigned long long)b.relayed, b.flow_count);
+            next_stats = now_ms + BALANCER_STATS_INTERVAL_MS;
+        }
+    }
+
+    for (i = b.flow_count; i-- > 0;) {
+        close_flow(&b, i);
+    }
+    routing_key_clear(&b.routing);
+    closesocket(b.fd);
+    WSACleanup();
+    return EXIT_FAILURE;
+}
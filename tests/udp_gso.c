@@ -0,0 +1,207 @@
+/*
+ * udp_gso.c
+ *
+ * Bulk record throughput over loopback: records cut into MTU sized fragments
+ * (record_fragment) go through transport_send_batch and come back together
+ * through transport_recv_batch and reassembly_add, first with plain
+ * sendmmsg / recvmmsg, then with UDP_SEGMENT (GSO) sends, then with GSO sends
+ * and UDP_GRO receives (transport_use_offload). Reports throughput and the CPU
+ * time spent per byte by the whole process, sender and receiver together.
+ *
+ * Usage: udp_gso [records] [record bytes] [mtu=<bytes>]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+
+#include "socket_functions.h"
+
+#if !defined(_WIN32)
+#include <sys/select.h>
+#endif
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double cpu_seconds(void) {
+#if defined(_WIN32)
+    FILETIME created, exited, kernel, user;
+    ULARGE_INTEGER k, u;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) / 1e7;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static int open_loopback_socket(struct sockaddr_in* addr)
+{
+    socklen_t addr_len = sizeof(*addr);
+    int buffer_size = 4 << 20;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == INVALID_SOCKET) {
+        perror("socket");
+        return INVALID_SOCKET;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer_size, sizeof(buffer_size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char*)&buffer_size, sizeof(buffer_size));
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = inet_addr(LOCALHOST);
+    addr->sin_port = 0;
+    if (bind(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0 ||
+        getsockname(fd, (struct sockaddr*)addr, &addr_len) < 0) {
+        perror("bind");
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
+    return fd;
+}
+
+// A datagram lost on loopback would otherwise block the receive for good
+static int wait_for_data(int fd)
+{
+    fd_set set;
+    struct timeval tv = { 2, 0 };
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    return select(fd + 1, &set, NULL, NULL, &tv) > 0;
+}
+
+// Sends every record and takes it back in before the next one. Returns bytes per second, -1 on failure
+static double run(const char* name, int offload, size_t records, size_t record_len, size_t max_datagram)
+{
+    static OutgoingDatagram fragments[MAX_FRAGMENTS];
+    static unsigned char headers[MAX_FRAGMENTS][FRAGMENT_HEADER_SIZE];
+    static ReceivedDatagram received[MAX_BATCH];
+    static unsigned char record[MAX_RECORD_SIZE];
+    struct sockaddr_in sender_addr, receiver_addr;
+    Transport sender, receiver;
+    Reassembly reassembly;
+    TransportSegment segment = { record, record_len };
+    double rate = -1;
+    size_t i, count, done = 0;
+
+    int sender_fd = open_loopback_socket(&sender_addr);
+    int receiver_fd = open_loopback_socket(&receiver_addr);
+    transport_init(&sender, TRANSPORT_UDP, sender_fd, receiver_addr);
+    transport_init(&receiver, TRANSPORT_UDP, receiver_fd, sender_addr);
+    memset(&reassembly, 0, sizeof(reassembly));
+    if (sender_fd == INVALID_SOCKET || receiver_fd == INVALID_SOCKET) {
+        goto cleanup;
+    }
+    memset(record, 'x', record_len);
+
+    // GSO alone, then GSO and GRO
+    if (offload > 0 && (transport_use_offload(&sender) != TRUE || !sender.gso)) {
+        printf("%-24s not supported here\n", name);
+        rate = 0;
+        goto cleanup;
+    }
+    if (offload > 1 && (transport_use_offload(&receiver) != TRUE || !receiver.gro)) {
+        printf("%-24s not supported here\n", name);
+        rate = 0;
+        goto cleanup;
+    }
+
+    double start = now_seconds(), start_cpu = cpu_seconds();
+    for (i = 0; i < records; i++) {
+        count = record_fragment(RECORD_DATA, (unsigned short)i, (unsigned short)i, &segment, 1, max_datagram,
+                                &receiver_addr, fragments, headers, MAX_FRAGMENTS);
+        if (count == 0) {
+            fprintf(stderr, "ERROR: a %zu byte record does not fit in %d datagrams\n", record_len, MAX_FRAGMENTS);
+            goto cleanup;
+        }
+        if (transport_send_batch(&sender, fragments, count) != TRUE) {
+            goto cleanup;
+        }
+
+        // a single datagram is a whole record already, fragments are put back together
+        BOOL complete = FALSE;
+        while (!complete) {
+            // datagrams cut out of an earlier GRO receive are handed out without touching the socket
+            if (receiver.gro_next == receiver.gro_count && !wait_for_data(receiver_fd)) {
+                fprintf(stderr, "ERROR: record %zu lost on loopback\n", i);
+                goto cleanup;
+            }
+            int n = transport_recv_batch(&receiver, received, MAX_BATCH);
+            if (n < 0) {
+                goto cleanup;
+            }
+            for (int j = 0; j < n; j++) {
+                if (count == 1 || reassembly_add(&reassembly, &received[j].from, received[j].data, received[j].len) == TRUE) {
+                    complete = TRUE;
+                }
+            }
+        }
+        done += record_len;
+    }
+    double elapsed = now_seconds() - start, cpu = cpu_seconds() - start_cpu;
+
+    rate = (double)done / elapsed;
+    printf("%-24s %10.1f MB/s %8.2f ns CPU/byte\n", name, rate / 1e6, cpu * 1e9 / (double)done);
+
+cleanup:
+    reassembly_reset(&reassembly);
+    transport_release(&sender);
+    transport_release(&receiver);
+    if (sender_fd != INVALID_SOCKET) {
+        closesocket(sender_fd);
+    }
+    if (receiver_fd != INVALID_SOCKET) {
+        closesocket(receiver_fd);
+    }
+    return rate;
+}
+
+int main(int argc, char** argv) {
+    size_t records = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+    size_t record_len = argc > 2 ? strtoul(argv[2], NULL, 10) : 60000;
+    size_t max_datagram = max_datagram_from_args(argc, argv);
+    int ret = EXIT_FAILURE;
+
+    if (records == 0 || record_len == 0 || record_len > MAX_RECORD_SIZE) {
+        fprintf(stderr, "ERROR: need at least one record and a record of 1 to %d bytes\n", MAX_RECORD_SIZE);
+        return EXIT_FAILURE;
+    }
+
+#if defined(_WIN32)
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("WSAStartup failed: %d\n", WSAGetLastError());
+        return EXIT_FAILURE;
+    }
+#endif
+
+    printf("%zu records of %zu bytes in datagrams of up to %zu bytes, one core\n", records, record_len, max_datagram);
+    double plain = run("sendmmsg + recvmmsg", 0, records, record_len, max_datagram);
+    double gso = run("GSO", 1, records, record_len, max_datagram);
+    double gro = run("GSO + GRO", 2, records, record_len, max_datagram);
+    if (plain <= 0 || gso < 0 || gro < 0) {
+        goto cleanup;
+    }
+    if (gso > 0) {
+        printf("GSO speedup %.2fx\n", gso / plain);
+    }
+    if (gro > 0) {
+        printf("GSO + GRO speedup %.2fx\n", gro / plain);
+    }
+    ret = EXIT_SUCCESS;
+
+cleanup:
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+    return ret;
+}
@@ -0,0 +1,201 @@
+/*
+ * udp_load.c
+ *
+ * Load test for the UDP server path on one core: datagrams per second through
+ * one recvfrom + one sendto per datagram (the old server loop) against
+ * transport_recv_batch + transport_send_batch (recvmmsg / sendmmsg on Linux), and
+ * the same batches through the io_uring backend where it is available.
+ * A client socket in the same thread pushes bursts of MAX_BATCH requests over
+ * loopback and drains the echoed replies; only the server side is timed.
+ *
+ * Usage: udp_load [datagrams] [payload bytes]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <time.h>
+
+#include "io_uring_functions.h"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int open_loopback_socket(struct sockaddr_in* addr)
+{
+    socklen_t addr_len = sizeof(*addr);
+    int buffer_size = 1 << 20;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == INVALID_SOCKET) {
+        perror("socket");
+        return INVALID_SOCKET;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer_size, sizeof(buffer_size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char*)&buffer_size, sizeof(buffer_size));
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = inet_addr(LOCALHOST);
+    addr->sin_port = 0;
+    if (bind(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0 ||
+        getsockname(fd, (struct sockaddr*)addr, &addr_len) < 0) {
+        perror("bind");
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
+    return fd;
+}
+
+// The old server loop: one syscall per datagram in each direction
+static int serve_single(Transport* server, size_t burst)
+{
+    unsigned char buffer[BUFFER_SIZE];
+    struct sockaddr_in from;
+    socklen_t from_len;
+
+    for (size_t i = 0; i < burst; i++) {
+        from_len = sizeof(from);
+        long len = recvfrom(server->fd, (char*)buffer, BUFFER_SIZE, 0, (struct sockaddr*)&from, &from_len);
+        if (len < 0) {
+            perror("recvfrom");
+            return FALSE;
+        }
+        if (sendto(server->fd, (const char*)buffer, (int)len, 0, (const struct sockaddr*)&from, sizeof(from)) != len) {
+            perror("sendto");
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int serve_batch(Transport* server, size_t burst)
+{
+    static ReceivedDatagram requests[MAX_BATCH];
+    static OutgoingDatagram replies[MAX_BATCH];
+    size_t done = 0;
+
+    while (done < burst) {
+        int n = transport_recv_batch(server, requests, burst - done);
+        if (n < 0) {
+            return FALSE;
+        }
+        for (int i = 0; i < n; i++) {
+            replies[i].segments[0].data = requests[i].data;
+            replies[i].segments[0].len = requests[i].len;
+            replies[i].segment_count = 1;
+            replies[i].to = requests[i].from;
+        }
+        if (transport_send_batch(server, replies, (size_t)n) != TRUE) {
+            return FALSE;
+        }
+        done += (size_t)n;
+    }
+    return TRUE;
+}
+
+static double run(const char* name, int batched, Transport* client, Transport* server, size_t total, size_t payload_len)
+{
+    static ReceivedDatagram replies[MAX_BATCH];
+    static OutgoingDatagram requests[MAX_BATCH];
+    static unsigned char payload[BUFFER_SIZE];
+    double server_time = 0;
+    size_t sent = 0;
+
+    memset(payload, 'x', payload_len);
+    for (size_t i = 0; i < MAX_BATCH; i++) {
+        requests[i].segments[0].data = payload;
+        requests[i].segments[0].len = payload_len;
+        requests[i].segment_count = 1;
+        requests[i].to = client->peer;
+    }
+
+    while (sent < total) {
+        size_t burst = total - sent < MAX_BATCH ? total - sent : MAX_BATCH;
+        size_t received = 0;
+
+        if (transport_send_batch(client, requests, burst) != TRUE) {
+            return -1;
+        }
+
+        double start = now_seconds();
+        int rc = batched ? serve_batch(server, burst) : serve_single(server, burst);
+        server_time += now_seconds() - start;
+        if (rc != TRUE) {
+            return -1;
+        }
+
+        while (received < burst) {
+            int n = transport_recv_batch(client, replies, burst - received);
+            if (n < 0) {
+                return -1;
+            }
+            received += (size_t)n;
+        }
+        sent += burst;
+    }
+
+    double rate = (double)total / server_time;
+    printf("%-28s %12.0f datagrams/s\n", name, rate);
+    return rate;
+}
+
+int main(int argc, char** argv) {
+    size_t total = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    size_t payload_len = argc > 2 ? strtoul(argv[2], NULL, 10) : 256 + OQS_SIG_dilithium_2_length_signature;
+    struct sockaddr_in client_addr, server_addr;
+    Transport client, server;
+    int client_fd, server_fd, ret = EXIT_FAILURE;
+
+    if (total == 0 || payload_len == 0 || payload_len > BUFFER_SIZE) {
+        fprintf(stderr, "ERROR: need at least one datagram and a payload of 1 to %d bytes\n", BUFFER_SIZE);
+        return EXIT_FAILURE;
+    }
+
+#if defined(_WIN32)
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("WSAStartup failed: %d\n", WSAGetLastError());
+        return EXIT_FAILURE;
+    }
+#endif
+
+    client_fd = open_loopback_socket(&client_addr);
+    server_fd = open_loopback_socket(&server_addr);
+    if (client_fd == INVALID_SOCKET || server_fd == INVALID_SOCKET) {
+        goto cleanup;
+    }
+    transport_init(&client, TRANSPORT_UDP, client_fd, server_addr);
+    transport_init(&server, TRANSPORT_UDP, server_fd, client_addr);
+
+    printf("%zu datagrams of %zu bytes, bursts of %d, one core\n", total, payload_len, MAX_BATCH);
+    double single = run("recvfrom + sendto", 0, &client, &server, total, payload_len);
+    double batch = run("recv_batch + send_batch", 1, &client, &server, total, payload_len);
+    if (single <= 0 || batch <= 0) {
+        goto cleanup;
+    }
+    printf("speedup %.2fx\n", batch / single);
+
+    if (transport_use_io_uring(&server)) {
+        double uring = run("io_uring batches", 1, &client, &server, total, payload_len);
+        transport_release(&server);
+        if (uring <= 0) {
+            goto cleanup;
+        }
+        printf("speedup %.2fx\n", uring / single);
+    }
+    ret = EXIT_SUCCESS;
+
+cleanup:
+    if (client_fd != INVALID_SOCKET) {
+        closesocket(client_fd);
+    }
+    if (server_fd != INVALID_SOCKET) {
+        closesocket(server_fd);
+    }
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+    return ret;
+}